@@ -0,0 +1,72 @@
+#pragma once
+
+#include "math.hpp"
+
+#include <cstdint>
+
+// Layout shared with the Camera uniform block of the shaders (std140).
+struct CameraUniforms {
+  Mat4 view;
+  Mat4 projection;
+  Mat4 viewProjection;
+};
+
+// Input that moves the camera, accumulated by the window callbacks. The
+// motions are totals since startup and the camera only looks at the
+// difference between two snapshots, so none is lost when snapshots are skipped.
+struct CameraInput {
+  // Cursor pixels dragged with the left button (rotate) and the right or
+  // middle button (pan).
+  double rotateX{0.0};
+  double rotateY{0.0};
+  double panX{0.0};
+  double panY{0.0};
+  double scroll{0.0};
+  // Held movement keys along the camera's right, up and backward axes, -1 to 1.
+  Vec3 move;
+  bool fast{false};
+  uint32_t modeToggles{0};
+  uint32_t resets{0};
+};
+
+// Orbits around a target or flies freely. Both modes share the same state, a
+// target with the eye at some distance from it, so switching keeps the view:
+// orbiting rotates the eye around the target, flying rotates the target
+// around the eye. Until it is first moved (and after a reset) the camera
+// frames the whole scene, following it as meshes are added.
+class Camera {
+public:
+  enum class Mode {
+    Orbit,
+    Fly
+  };
+
+  void update(const CameraInput& input, const CameraInput& previous, float seconds, const Aabb& sceneBounds);
+
+  Mode mode() const { return currentMode; }
+  Vec3 eye() const;
+  Mat4 view() const;
+  // The depth range tightly encloses the scene.
+  Mat4 projection(float aspect) const;
+
+private:
+  static constexpr float FOV_Y{0.8f};
+  static constexpr float RADIANS_PER_PIXEL{0.005f};
+  static constexpr float MAX_PITCH{1.5f};
+  static constexpr float ZOOM_PER_STEP{0.9f};
+  // Scene radii per second, and how much faster with shift held.
+  static constexpr float FLY_SPEED{0.5f};
+  static constexpr float FAST_FACTOR{4.0f};
+
+  Mode currentMode{Mode::Orbit};
+  bool framing{true};
+  Aabb bounds;
+  Vec3 target;
+  float distance{1.0f};
+  float yaw{0.0f};
+  float pitch{0.0f};
+
+  // Unit vector from the target to the eye.
+  Vec3 backward() const;
+  void frame();
+};
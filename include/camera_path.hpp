@@ -0,0 +1,27 @@
+#pragma once
+
+#include "camera.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Camera input replayed from a file instead of taken from the window, for
+// rendering the same motion every run. Each line is a keyframe: the frame
+// number followed by the rotateX, rotateY, panX, panY and scroll totals of
+// CameraInput. Frames between keyframes are interpolated linearly and frames
+// after the last one hold it. Empty lines and lines starting with # are
+// skipped.
+class CameraPath {
+public:
+  explicit CameraPath(const std::string& path);
+
+  CameraInput at(uint64_t frame) const;
+
+private:
+  struct Keyframe {
+    uint64_t frame;
+    CameraInput input;
+  };
+  std::vector<Keyframe> keyframes;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Records the draws of a frame into secondary command buffers on a pool of
+// worker threads. Every worker owns one command pool per frame in flight, so
+// a frame's pools can be reset as a whole once its fence has signalled and no
+// pool is ever shared between threads.
+//
+// The calling thread records the first range itself and waits for the
+// workers, so `record()` returns with every secondary command buffer ready to
+// be executed by the primary.
+class CommandRecorder {
+public:
+  using RecordFunction = std::function<void(VkCommandBuffer commandBuffer, size_t first, size_t count)>;
+
+  CommandRecorder(VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t threadCount, uint32_t frameCount);
+  ~CommandRecorder();
+
+  const std::vector<VkCommandBuffer>& record(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritanceInfo, size_t itemCount, const RecordFunction& recordFunction);
+
+  uint32_t threadCount() const { return uint32_t(workers.size()); }
+
+private:
+  // Below this many items per thread waking up another worker costs more than it saves.
+  static constexpr size_t MIN_ITEMS_PER_THREAD{64};
+
+  struct Worker {
+    std::vector<VkCommandPool> commandPools;
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::thread thread;
+  };
+
+  VkDevice logicalDevice;
+  std::vector<Worker> workers;
+  std::vector<VkCommandBuffer> recorded;
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable workDone;
+  uint64_t generation{0};
+  uint32_t pendingWorkers{0};
+  bool stopping{false};
+  std::exception_ptr error;
+
+  uint32_t frame{0};
+  const VkCommandBufferInheritanceInfo* inheritanceInfo{nullptr};
+  const RecordFunction* recordFunction{nullptr};
+  size_t itemCount{0};
+  uint32_t activeWorkers{0};
+
+  void workerLoop(uint32_t index);
+  void recordRange(uint32_t index);
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// One descriptor set with large arrays of every texture (binding 0), storage
+// buffer (binding 1) and uniform buffer (binding 2) the shaders use, and the
+// one pipeline layout all pipelines share. Shaders pick their resources by array index, passed in push
+// constants or read from other buffers, so recording a draw never binds
+// descriptors: the set is bound once per command buffer, however many
+// materials the scene has.
+//
+// The arrays are partially bound, and the texture and storage buffer arrays
+// updated after bind, so adding one of those only writes its own slot, even
+// while frames in flight use the set. Freed slots are reused once those
+// frames have finished. Few devices update uniform buffers after bind, so the
+// (few, long lived) uniform buffers must be added before the first frame.
+class DescriptorHeap {
+public:
+  // Far below the 500000 update-after-bind descriptors per stage every device
+  // with descriptor indexing supports.
+  static constexpr uint32_t MAX_TEXTURES{16384};
+  static constexpr uint32_t MAX_BUFFERS{1024};
+  // A camera per view (up to 4 in each of up to 4 windows) and frame in
+  // flight (up to 4). Only as many as asked for are declared, since devices
+  // need only support 12 per stage.
+  static constexpr uint32_t MAX_UNIFORM_BUFFERS{4 * 4 * 4};
+  // One range shared by all stages, so any pipeline can take any push constants.
+  static constexpr uint32_t PUSH_CONSTANT_SIZE{128};
+
+  // With meshShaders, the buffers and push constants are visible to task and
+  // mesh shaders too; only valid if the device enabled them. Binding 2 has
+  // uniformBufferCount slots, at most MAX_UNIFORM_BUFFERS.
+  DescriptorHeap(VkDevice logicalDevice, uint32_t framesInFlight, uint32_t uniformBufferCount, bool meshShaders);
+  ~DescriptorHeap();
+
+  VkPipelineLayout pipelineLayout() const { return layout; }
+
+  uint32_t addTexture(VkImageView view, VkSampler sampler);
+  void removeTexture(uint32_t index);
+  uint32_t addBuffer(VkBuffer buffer);
+  // Points an existing slot at another buffer, e.g. after it has grown.
+  void updateBuffer(uint32_t index, VkBuffer buffer);
+  void removeBuffer(uint32_t index);
+  // Only before the first frame is recorded.
+  uint32_t addUniformBuffer(VkBuffer buffer);
+
+  void bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint) const;
+  template<typename T>
+  void pushConstants(VkCommandBuffer commandBuffer, const T& constants) const {
+    static_assert(sizeof(T) <= PUSH_CONSTANT_SIZE, "Push constants exceed the shared range");
+    vkCmdPushConstants(commandBuffer, layout, pushConstantStages, 0, sizeof(T), &constants);
+  }
+
+  // Once per frame, after the frame's fence has signalled.
+  void collect(uint64_t frameNumber);
+
+  // Throws if the device lacks the descriptor indexing features the heap needs.
+  static void requireFeatures(const VkPhysicalDeviceFeatures& supported, const VkPhysicalDeviceVulkan12Features& supportedVulkan12);
+  static void enableFeatures(VkPhysicalDeviceFeatures& features, VkPhysicalDeviceVulkan12Features& vulkan12Features);
+
+private:
+  struct FreedSlot {
+    uint32_t index;
+    uint64_t freedAtFrame;
+  };
+
+  struct SlotArray {
+    uint32_t capacity;
+    uint32_t next{0};
+    std::vector<uint32_t> free;
+    std::deque<FreedSlot> freed;
+  };
+
+  VkDevice logicalDevice;
+  uint32_t framesInFlight;
+  VkShaderStageFlags pushConstantStages{VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT};
+
+  VkDescriptorSetLayout setLayout;
+  VkDescriptorPool descriptorPool;
+  VkDescriptorSet descriptorSet;
+  VkPipelineLayout layout;
+
+  uint64_t frameNumber{0};
+  SlotArray textures{MAX_TEXTURES};
+  SlotArray buffers{MAX_BUFFERS};
+  SlotArray uniformBuffers;
+
+  uint32_t allocate(SlotArray& slots, const char* kind);
+  void release(SlotArray& slots, uint32_t index);
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+
+// Keeps frames on a steady cadence of one per display refresh and starts
+// each one as late as possible: it sleeps until just enough time is left to
+// sample input, record and submit before the frame's deadline. Input sampled
+// after the wait is then at most one frame's CPU time old when the frame is
+// presented, instead of the several refreshes a full FIFO queue adds.
+class FramePacer {
+public:
+  explicit FramePacer(double refreshRate);
+
+  // Sleeps until the latest point at which the next frame can still make its deadline.
+  void waitForNextFrame();
+  // Marks the end of the work following waitForNextFrame(), to refine the estimate.
+  void frameSubmitted();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr double SMOOTHING{0.1};
+  static constexpr double SAFETY_FACTOR{1.5};
+  static constexpr std::chrono::microseconds MARGIN{500};
+
+  Clock::duration period;
+  Clock::time_point deadline;
+  Clock::time_point frameStart;
+  double workEstimate{0.0};
+};
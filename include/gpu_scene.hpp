@@ -0,0 +1,279 @@
+#pragma once
+
+#include "descriptor_heap.hpp"
+#include "math.hpp"
+#include "memory_allocator.hpp"
+#include "mesh.hpp"
+#include "texture_streamer.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// Layout shared with indirect.vert and cull.comp (std430).
+struct GpuObject {
+  Mat4 model;
+  Vec3 boundsMin;
+  uint32_t mesh;
+  Vec3 boundsMax;
+  uint32_t visibleOffset;
+  // See DrawItem::viewMask.
+  uint32_t viewMask;
+  uint32_t padding[3];
+};
+
+// Per mesh LOD table for cull.comp; level 0 has no error. Clustered meshes
+// draw level 0 cluster by cluster.
+struct GpuMeshInfo {
+  float lodErrors[MAX_LOD_LEVELS];
+  uint32_t lodCount;
+  uint32_t objectCount;
+  uint32_t clustered;
+  uint32_t padding;
+};
+
+// Meshlets tested by one cluster workgroup; the local size of cluster_cull.comp and cluster.task.
+constexpr uint32_t MESHLETS_PER_WORKGROUP{32};
+
+// Per mesh workgroups of the cluster pass, read as VkDispatchIndirectCommand
+// or VkDrawMeshTasksIndirectCommandEXT: one workgroup per
+// MESHLETS_PER_WORKGROUP meshlets and visible level 0 object, counted by cull.comp.
+struct GpuClusterDispatch {
+  uint32_t groupCountX;
+  uint32_t objectCount;
+  uint32_t groupCountZ;
+  uint32_t padding;
+};
+
+// Which objects a cull.comp dispatch draws: all in the view frustum, or with
+// occlusion culling first those visible in the previous frame, then those
+// that became visible, tested against the depth pyramid.
+enum class CullPhase : uint32_t {
+  All,
+  LastVisible,
+  NewlyVisible
+};
+
+// Object counts of a frame, written by cull.comp and summed over all of its
+// views. Without occlusion culling every object drawn counts as
+// drawnLastVisible. Objects not shown in a view are not counted for it.
+struct GpuCullStats {
+  uint32_t drawnLastVisible;
+  uint32_t drawnNewlyVisible;
+  uint32_t frustumCulled;
+  uint32_t occlusionCulled;
+};
+
+struct CullPushConstants {
+  // Descriptor heap index of the frame's camera uniforms.
+  uint32_t camera;
+  uint32_t objectCount;
+  float viewportWidth;
+  float viewportHeight;
+  float maxPixelError;
+  // Descriptor heap indices of the scene buffers.
+  uint32_t objects;
+  uint32_t drawCommands;
+  uint32_t visibleObjects;
+  uint32_t meshInfos;
+  uint32_t clusterDispatches;
+  CullPhase phase;
+  uint32_t visibility;
+  uint32_t stats;
+  // The depth pyramid and the size of its first level.
+  uint32_t depthPyramid;
+  uint32_t pyramidWidth;
+  uint32_t pyramidHeight;
+  uint32_t pyramidLevels;
+  // The bit of the view being culled, see DrawItem::viewMask.
+  uint32_t viewBit;
+};
+
+// Layout shared with depth_pyramid.comp. Level 0 reduces the depth texture,
+// every further level the one before it, by 2x2 texels each. The view's
+// rectangle of the depth texture starts at depthX, depthY.
+struct DepthPyramidPushConstants {
+  uint32_t depth;
+  uint32_t depthX;
+  uint32_t depthY;
+  uint32_t sampleCount;
+  uint32_t depthPyramid;
+  uint32_t level;
+  uint32_t sourceOffset;
+  uint32_t sourceWidth;
+  uint32_t sourceHeight;
+  uint32_t targetOffset;
+  uint32_t targetWidth;
+  uint32_t targetHeight;
+};
+
+// The texture comes first, where basic.frag expects it.
+struct IndirectPushConstants {
+  uint32_t texture;
+  uint32_t camera;
+  uint32_t visibleOffset;
+  uint32_t objects;
+  uint32_t visibleObjects;
+};
+
+// Layout shared with cluster_cull.comp, cluster.vert, cluster.task and
+// cluster.mesh; each uses the part its path needs. The texture comes first,
+// where basic.frag expects it.
+struct ClusterPushConstants {
+  uint32_t texture;
+  uint32_t camera;
+  uint32_t objects;
+  uint32_t visibleObjects;
+  // The mesh's level 0 range of the visible objects.
+  uint32_t visibleOffset;
+  uint32_t meshlets;
+  uint32_t meshletCount;
+  // Compute pass: the mesh's range of the cluster commands and its count.
+  uint32_t clusterCommands;
+  uint32_t commandOffset;
+  uint32_t clusterCounts;
+  uint32_t mesh;
+  // Mesh shaders: the vertex buffer, and the sections of the meshlet buffer in words.
+  uint32_t vertices;
+  uint32_t vertexOffset;
+  uint32_t triangleOffset;
+};
+
+// Draw items in GPU buffers for GPU-driven rendering. A compute pass tests
+// every object against the view frustum, picks its level of detail and
+// appends it to that level's range of the visible object list, counting it in
+// the level's indexed indirect command. The render pass then issues one
+// indirect draw per mesh and level, so the number of draw calls no longer
+// grows with the object count.
+//
+// Meshes split into meshlets draw level 0 cluster by cluster: every visible
+// object of such a mesh gets a row of cluster workgroups that test each
+// meshlet against the frustum and its normal cone. With mesh shaders those are
+// task shader workgroups launching mesh shaders for the surviving clusters;
+// otherwise a compute pass appends one indexed indirect command per surviving
+// cluster, drawn with an indirect count.
+//
+// With occlusion culling a frame culls and draws twice. The objects visible
+// in the previous frame are drawn first; their depth is then reduced into a
+// pyramid of maximum depths, a storage buffer with one level per halving of
+// the viewport, and every other object in the frustum is drawn in a second
+// render pass if its box is not entirely behind the pyramid's depth. A
+// visibility flag per object carries the result over to the next frame.
+//
+// Several views cull and draw one after another in the same command buffer,
+// reusing the draw commands, visible object lists and depth pyramid; only the
+// visibility flags and the pyramid's level layout are kept per view. Each
+// object has a mask of the views that show it, tested by cull.comp.
+//
+// Objects and draw commands are written into a host visible upload buffer per
+// frame in flight and copied into device local buffers by the frame's command
+// buffer, the objects only when the scene has changed. The device local
+// buffers are reached through the descriptor heap, their indices passed in
+// push constants along with each mesh's texture.
+class GpuScene {
+public:
+  // Meshes are only drawn as clusters with clusters set, with mesh shaders if
+  // drawMeshTasksIndirect is given.
+  GpuScene(VkDevice logicalDevice, MemoryAllocator& memoryAllocator, DescriptorHeap& descriptorHeap, uint32_t frameCount, uint32_t viewCount,
+    bool clusters, PFN_vkCmdDrawMeshTasksIndirectEXT drawMeshTasksIndirect, bool occlusionCulling);
+  ~GpuScene();
+
+  // Must be called once the frame's fence has signalled, before recording it,
+  // with the viewport of every view.
+  void update(uint32_t frame, const std::vector<Mesh>& meshes, const std::vector<DrawItem>& drawItems, uint64_t version, const std::vector<VkExtent2D>& viewports);
+  // The counts of the frame's last recording, summed over its views, once its
+  // fence has signalled; false if there are none.
+  bool readStats(uint32_t frame, GpuCullStats& stats);
+
+  // Records the frame's uploads, once before the culling of the first view.
+  void recordUploads(VkCommandBuffer commandBuffer, uint32_t frame);
+  // Records outside of a render pass; clusterCullPipeline is only used without
+  // mesh shaders. With occlusion culling only the objects visible to the view
+  // in the previous frame are drawn afterwards.
+  void recordCulling(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t view, VkPipeline cullPipeline, VkPipeline clusterCullPipeline, const std::vector<Mesh>& meshes,
+    uint32_t camera, VkExtent2D viewport, float maxPixelError);
+  // Records between the two render passes of occlusion culling, once the
+  // first has left the depth texture (the descriptor heap index of the depth
+  // attachment) in the shader read only layout; the view covers the viewport
+  // of the depth texture.
+  void recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t view, VkPipeline cullPipeline, VkPipeline clusterCullPipeline, VkPipeline depthPyramidPipeline,
+    const std::vector<Mesh>& meshes, uint32_t camera, VkRect2D viewport, float maxPixelError, uint32_t depthTexture, uint32_t sampleCount);
+  // Records the copy readStats() reads, once after the culling of the last view.
+  void recordStatsReadback(VkCommandBuffer commandBuffer, uint32_t frame);
+  // Records inside the render pass, with the indirect graphics pipeline and
+  // the descriptor heap bound; binds clusterPipeline for the clustered meshes.
+  void recordDraws(VkCommandBuffer commandBuffer, uint32_t camera, const std::vector<Mesh>& meshes, const TextureStreamer& textureStreamer, VkPipeline clusterPipeline);
+
+private:
+  struct Buffer {
+    VkBuffer buffer{VK_NULL_HANDLE};
+    Allocation allocation;
+    VkDeviceSize size{0};
+    uint32_t index{0};
+  };
+
+  struct UploadSlot {
+    Buffer upload;
+    bool copyObjects{false};
+    Buffer statsReadback;
+    bool statsRecorded{false};
+    // Replaced while frames in flight could still read them; destroyed when
+    // the slot comes around again.
+    std::vector<Buffer> retiredBuffers;
+  };
+
+  struct PyramidLevel {
+    uint32_t offset;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  struct ViewState {
+    Buffer visibility;
+    VkExtent2D pyramidViewport{0, 0};
+    std::vector<PyramidLevel> pyramidLevels;
+  };
+
+  VkDevice logicalDevice;
+  MemoryAllocator& memoryAllocator;
+  DescriptorHeap& descriptorHeap;
+  bool clusters;
+  PFN_vkCmdDrawMeshTasksIndirectEXT drawMeshTasksIndirect;
+  bool occlusionCulling;
+  // Stages reading the scene buffers while drawing.
+  VkPipelineStageFlags drawStages{VK_PIPELINE_STAGE_VERTEX_SHADER_BIT};
+
+  Buffer objects;
+  Buffer drawCommands;
+  Buffer meshInfos;
+  Buffer visibleObjects;
+  Buffer clusterDispatches;
+  Buffer clusterCounts;
+  Buffer clusterCommands;
+  // Sized for the largest view.
+  Buffer depthPyramid;
+  Buffer stats;
+  std::vector<UploadSlot> uploadSlots;
+  std::vector<ViewState> views;
+
+  uint32_t objectCount{0};
+  uint32_t meshCount{0};
+  std::vector<uint32_t> meshObjectCounts;
+  std::vector<uint32_t> visibleOffsets;
+  std::vector<bool> clusteredMeshes;
+  std::vector<uint32_t> clusterCommandOffsets;
+  uint32_t clusteredMeshCount{0};
+  uint64_t version{~uint64_t{0}};
+
+  void ensureCapacity(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+  void updateDescriptors();
+  void updateDepthPyramid(UploadSlot& slot, ViewState& view, VkExtent2D viewport);
+  // Resets the draw commands and cluster dispatches from the frame's upload
+  // slot, for the cull pass that follows.
+  void recordResetDraws(VkCommandBuffer commandBuffer, const UploadSlot& slot);
+  // Culls into the reset draw commands and runs the cluster pass, leaving the
+  // results ready for the draws.
+  void recordCullPass(VkCommandBuffer commandBuffer, uint32_t view, CullPhase phase, VkPipeline cullPipeline, VkPipeline clusterCullPipeline,
+    const std::vector<Mesh>& meshes, uint32_t camera, VkExtent2D viewport, float maxPixelError);
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Encodes RGBA8 frames to PNG or PPM (picked by the file extension) on a
+// worker thread, so encoding and disk writes overlap with rendering. At most
+// `maxQueuedImages` frames are kept in memory; `write()` blocks beyond that.
+class ImageWriter {
+public:
+  explicit ImageWriter(size_t maxQueuedImages);
+  ~ImageWriter();
+
+  void write(const std::string& path, uint32_t width, uint32_t height, std::vector<uint8_t>&& rgba);
+
+  // Waits until every queued image has been written.
+  void finish();
+
+private:
+  struct Image {
+    std::string path;
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint8_t> rgba;
+  };
+
+  size_t maxQueuedImages;
+  std::thread worker;
+
+  std::mutex mutex;
+  std::condition_variable queueChanged;
+  std::deque<Image> images;
+  bool writing{false};
+  bool stopping{false};
+
+  void writeLoop();
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "descriptor_heap.hpp"
+#include "memory_allocator.hpp"
+#include "mesh.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// Instance data of the draws recorded on the CPU: per frame in flight, the
+// model matrices of all draw items and a list of instances, in host visible
+// storage buffers reached through the descriptor heap. Each recording thread
+// sorts the draw items of its range by mesh and level of detail into the same
+// range of the instance list, so every run of objects sharing a mesh and
+// level is one instanced draw; basic.vert looks up each instance's draw item
+// and, through it, its model matrix. Every view has an instance list of its
+// own, since each picks its own levels; the model matrices are shared.
+class InstanceBuffers {
+public:
+  InstanceBuffers(MemoryAllocator& memoryAllocator, DescriptorHeap& descriptorHeap, uint32_t frameCount, uint32_t viewCount);
+  ~InstanceBuffers();
+
+  // Must be called once the frame's fence has signalled, before recording it.
+  void update(uint32_t frame, const std::vector<DrawItem>& drawItems, uint64_t version);
+
+  // Descriptor heap indices of the frame's buffers.
+  uint32_t models(uint32_t frame) const { return frames[frame].models.index; }
+  uint32_t instances(uint32_t frame) const { return frames[frame].instances.index; }
+  // One entry per draw item and view, the lists of the views one after
+  // another; a recording thread only writes the entries of its own range.
+  uint32_t* instanceData(uint32_t frame) const { return static_cast<uint32_t*>(frames[frame].instances.allocation.mapped); }
+
+private:
+  struct Buffer {
+    VkBuffer buffer{VK_NULL_HANDLE};
+    Allocation allocation;
+    VkDeviceSize size{0};
+    uint32_t index{0};
+  };
+
+  struct Frame {
+    Buffer models;
+    Buffer instances;
+    uint64_t version{~uint64_t{0}};
+  };
+
+  MemoryAllocator& memoryAllocator;
+  DescriptorHeap& descriptorHeap;
+  uint32_t viewCount;
+  std::vector<Frame> frames;
+
+  void ensureCapacity(Buffer& buffer, VkDeviceSize size);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Jobs still to finish in one fork/join group. A counter may be reused once
+// it has been waited for.
+class JobCounter {
+public:
+  bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class JobSystem;
+  std::atomic<uint32_t> pending{0};
+};
+
+// Work-stealing scheduler for the CPU heavy parts of importing: every worker
+// has a deque of its own, takes its newest job first and, once it runs dry,
+// steals the oldest job of another worker. Jobs submitted from outside the
+// pool are spread over the workers round robin.
+class JobSystem {
+public:
+  // 0 threads means one per core.
+  explicit JobSystem(uint32_t threadCount = 0);
+  ~JobSystem();
+
+  uint32_t threadCount() const { return uint32_t(threads.size()); }
+
+  // Jobs report their own errors; one that throws anyway is printed and
+  // counts as done, so its counter is still waited for.
+  void run(JobCounter& counter, std::function<void()> job);
+  // On a worker, runs other jobs until the counter is done, so jobs can fork
+  // and join without tying up their thread; any other thread blocks.
+  void wait(JobCounter& counter);
+  // On a worker, runs one queued job that is not counted by `excluded`, so a
+  // job waiting for something else keeps its thread busy without starting
+  // more jobs like itself. False if there is none or not on a worker.
+  bool runOther(const JobCounter& excluded);
+
+private:
+  struct Job {
+    std::function<void()> function;
+    JobCounter* counter;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<uint32_t> nextQueue{0};
+
+  // Sleeping workers and blocked waiters wake on every new job and every
+  // finished counter.
+  std::mutex sleepMutex;
+  std::condition_variable changed;
+  std::atomic<size_t> queuedJobs{0};
+  bool stopRequested{false};
+
+  void work(uint32_t index);
+  bool runOne(uint32_t index, const JobCounter* excluded = nullptr);
+  bool pop(uint32_t index, Job& job, const JobCounter* excluded);
+  void notify();
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+#include <ostream>
+#include <string_view>
+
+// Writes text as a quoted JSON string. Quotes and backslashes are escaped,
+// control characters written as \u00XX; everything else, UTF-8 included, is
+// written as is.
+inline void writeJsonString(std::ostream& stream, std::string_view text) {
+  stream << '"';
+  for (auto c : text) {
+    if (c == '"' || c == '\\') {
+      stream << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[7];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+      stream << escaped;
+    } else {
+      stream << c;
+    }
+  }
+  stream << '"';
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct KtxLevel {
+  uint32_t width;
+  uint32_t height;
+  const char* data;
+  uint64_t size;
+};
+
+// Memory mapped KTX2 file with a block compressed (BC1 to BC7) 2D texture.
+// Levels are stored as written by the encoder, so a level is uploaded by
+// copying its range of the mapping. Throws on anything else: other formats,
+// arrays, cube maps, 3D textures and supercompressed (Basis, zstd) levels.
+class KtxTexture {
+public:
+  explicit KtxTexture(const std::string& path);
+
+  VkFormat format() const { return vkFormat; }
+  // Bytes per 4x4 block.
+  uint32_t blockBytes() const { return bytesPerBlock; }
+  uint32_t levelCount() const { return uint32_t(levels.size()); }
+  // Level 0 is the largest.
+  const KtxLevel& level(uint32_t index) const { return levels[index]; }
+
+private:
+  std::unique_ptr<const MappedFile> file;
+  VkFormat vkFormat;
+  uint32_t bytesPerBlock;
+  std::vector<KtxLevel> levels;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "job_system.hpp"
+#include "mesh.hpp"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct LodResult {
+  uint32_t mesh{0};
+  // All levels back to back, indexing the mesh's own vertices.
+  std::vector<uint32_t> indices;
+  std::vector<LodLevel> levels;
+};
+
+// Builds simplified index buffers for meshes, one job per mesh on the job
+// system, by collapsing the edges with the least quadric error, each level
+// targeting half the triangles of the previous one. The vertices are reused,
+// so a level costs only its indices. Levels are cached next to the source
+// file as <file>.lod and rebuilt only when the source changes.
+class LodBuilder {
+public:
+  // Without the cache, levels are always built and never written.
+  explicit LodBuilder(JobSystem& jobSystem, bool useCache = true);
+  ~LodBuilder();
+
+  // Meshes too small to benefit and meshes with a valid cache ignore addData().
+  // Results are only handed out for meshes that reached end().
+  void begin(uint32_t mesh, const std::string& path, uint32_t vertexCount, uint32_t indexCount);
+  void addData(uint32_t mesh, uint32_t firstVertex, const Vertex* vertices, size_t vertexCount, uint32_t firstIndex, const uint32_t* indices, size_t indexCount);
+  void end(uint32_t mesh);
+  void cancel(uint32_t mesh);
+
+  bool poll(LodResult& result);
+  // Blocks until every mesh passed to end() has been built or read from the cache.
+  void waitIdle();
+
+private:
+  static constexpr uint32_t MIN_TRIANGLES{4096};
+  // A level must remove at least this share of the previous level's triangles.
+  static constexpr float MIN_REDUCTION{0.2f};
+
+  struct Job {
+    uint32_t mesh;
+    std::string path;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    bool cached{false};
+    std::vector<Vec3> positions;
+    std::vector<std::array<uint16_t, 2>> texCoords;
+    std::vector<uint32_t> indices;
+  };
+
+  JobSystem& jobSystem;
+  bool useCache;
+  JobCounter builds;
+  std::atomic<bool> stopRequested{false};
+
+  std::mutex mutex;
+  std::deque<LodResult> results;
+
+  // Only touched by the thread feeding mesh data.
+  std::unordered_map<uint32_t, Job> collecting;
+
+  void run(Job& job);
+  LodResult build(Job& job);
+  bool readCache(const Job& job, LodResult& result);
+  void writeCache(const Job& job, const LodResult& result);
+};
+
+// Collapses edges until at most targetIndexCount indices remain or no edge can
+// be collapsed without flipping a triangle or moving an open border or texture
+// seam. Returns the simplified indices and sets error to the largest collapse
+// error.
+std::vector<uint32_t> simplify(const std::vector<Vec3>& positions, const std::vector<std::array<uint16_t, 2>>& texCoords, const std::vector<uint32_t>& indices, size_t targetIndexCount, float& error);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read only memory mapping of a whole file. Data handed to Vulkan straight
+// from the mapping skips the read into an intermediate buffer, and on a warm
+// page cache costs no I/O at all.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return static_cast<const char*>(mapping); }
+  size_t size() const { return length; }
+
+private:
+  void* mapping{nullptr};
+  size_t length{0};
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+struct Vec3 {
+  float x{0.0f};
+  float y{0.0f};
+  float z{0.0f};
+};
+
+inline Vec3 operator+(const Vec3& a, const Vec3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Vec3 operator-(const Vec3& a, const Vec3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Vec3 operator*(const Vec3& a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+
+inline float dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 cross(const Vec3& a, const Vec3& b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+inline float length(const Vec3& a) { return std::sqrt(dot(a, a)); }
+
+inline Vec3 normalize(const Vec3& a) {
+  auto l = length(a);
+  return l > 0.0f ? a * (1.0f / l) : a;
+}
+
+// Column-major, matching GLSL mat4 layout so it can be pushed/uploaded as is.
+struct Mat4 {
+  float m[16]{
+    1.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 1.0f, 0.0f,
+    0.0f, 0.0f, 0.0f, 1.0f
+  };
+
+  float& operator()(int row, int column) { return m[column * 4 + row]; }
+  float operator()(int row, int column) const { return m[column * 4 + row]; }
+};
+
+inline Mat4 operator*(const Mat4& a, const Mat4& b) {
+  Mat4 result;
+  for (auto column = 0; column < 4; column++) {
+    for (auto row = 0; row < 4; row++) {
+      auto sum = 0.0f;
+      for (auto k = 0; k < 4; k++) {
+        sum += a(row, k) * b(k, column);
+      }
+      result(row, column) = sum;
+    }
+  }
+  return result;
+}
+
+inline Vec3 transformPoint(const Mat4& a, const Vec3& p) {
+  return {
+    a(0, 0) * p.x + a(0, 1) * p.y + a(0, 2) * p.z + a(0, 3),
+    a(1, 0) * p.x + a(1, 1) * p.y + a(1, 2) * p.z + a(1, 3),
+    a(2, 0) * p.x + a(2, 1) * p.y + a(2, 2) * p.z + a(2, 3)
+  };
+}
+
+// Right handed view space, Vulkan clip space (depth in [0, 1], y pointing down).
+inline Mat4 perspective(float fovY, float aspect, float zNear, float zFar) {
+  auto f = 1.0f / std::tan(fovY * 0.5f);
+
+  Mat4 result;
+  result(0, 0) = f / aspect;
+  result(1, 1) = -f;
+  result(2, 2) = zFar / (zNear - zFar);
+  result(2, 3) = zNear * zFar / (zNear - zFar);
+  result(3, 2) = -1.0f;
+  result(3, 3) = 0.0f;
+  return result;
+}
+
+inline Mat4 lookAt(const Vec3& eye, const Vec3& center, const Vec3& up) {
+  auto forward = normalize(center - eye);
+  auto side = normalize(cross(forward, up));
+  auto newUp = cross(side, forward);
+
+  Mat4 result;
+  result(0, 0) = side.x;
+  result(0, 1) = side.y;
+  result(0, 2) = side.z;
+  result(1, 0) = newUp.x;
+  result(1, 1) = newUp.y;
+  result(1, 2) = newUp.z;
+  result(2, 0) = -forward.x;
+  result(2, 1) = -forward.y;
+  result(2, 2) = -forward.z;
+  result(0, 3) = -dot(side, eye);
+  result(1, 3) = -dot(newUp, eye);
+  result(2, 3) = dot(forward, eye);
+  return result;
+}
+
+inline Mat4 translation(const Vec3& t) {
+  Mat4 result;
+  result(0, 3) = t.x;
+  result(1, 3) = t.y;
+  result(2, 3) = t.z;
+  return result;
+}
+
+struct Aabb {
+  Vec3 min{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+  Vec3 max{std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+
+  bool valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+  Vec3 center() const { return (min + max) * 0.5f; }
+  Vec3 extent() const { return (max - min) * 0.5f; }
+  float radius() const { return length(extent()); }
+
+  void extend(const Vec3& p) {
+    min = {std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+    max = {std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+  }
+
+  void extend(const Aabb& other) {
+    if (other.valid()) {
+      extend(other.min);
+      extend(other.max);
+    }
+  }
+};
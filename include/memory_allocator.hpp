@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+struct MemoryBlock;
+
+struct Allocation {
+  VkDeviceMemory memory{VK_NULL_HANDLE};
+  VkDeviceSize offset{0};
+  VkDeviceSize size{0};
+  void* mapped{nullptr};
+  MemoryBlock* block{nullptr};
+};
+
+struct MemoryStats {
+  VkDeviceSize reservedBytes{0};
+  VkDeviceSize usedBytes{0};
+  VkDeviceSize largestFreeRange{0};
+  uint32_t blockCount{0};
+  uint32_t allocationCount{0};
+  // High-water marks since the allocator was created.
+  VkDeviceSize peakReservedBytes{0};
+  VkDeviceSize peakUsedBytes{0};
+
+  // 0 when all free space is one contiguous range, towards 1 the more it is split.
+  float fragmentation{0.0f};
+};
+
+struct DefragmentableBuffer {
+  VkBuffer* buffer;
+  Allocation* allocation;
+  VkDeviceSize size;
+  VkBufferUsageFlags usage;
+};
+
+struct RetiredBuffer {
+  VkBuffer buffer;
+  Allocation allocation;
+};
+
+// Carves buffers and images out of large per memory type blocks instead of
+// calling vkAllocateMemory per resource. Each block keeps its free ranges in
+// an offset ordered map (for coalescing) and a size ordered map (for best fit
+// lookups). Buffers/linear images and optimal images live in separate blocks,
+// so bufferImageGranularity never has to be considered between neighbours.
+//
+// Buffers are shared concurrently between the given queue families, so uploads
+// on a transfer queue need no ownership transfer before rendering reads them.
+class MemoryAllocator {
+public:
+  MemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::vector<uint32_t>& queueFamilyIndices);
+  ~MemoryAllocator();
+
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& allocation);
+  void destroyBuffer(VkBuffer& buffer, Allocation& allocation);
+
+  void createImage(const VkImageCreateInfo& imageCreateInfo, VkMemoryPropertyFlags properties, VkImage& image, Allocation& allocation);
+  void destroyImage(VkImage& image, Allocation& allocation);
+
+  // Moves buffers out of sparsely used blocks into fuller ones. The copies are
+  // recorded into `commandBuffer`; the returned buffers must be released with
+  // `release()` once it has finished executing.
+  std::vector<RetiredBuffer> defragment(VkCommandBuffer commandBuffer, const std::vector<DefragmentableBuffer>& buffers);
+  void release(std::vector<RetiredBuffer>& retiredBuffers);
+  void releaseEmptyBlocks();
+
+  MemoryStats stats() const;
+  void logStats(std::ostream& stream) const;
+
+private:
+  static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE{64 << 20};
+
+  enum class ResourceKind { Linear, Optimal };
+
+  VkDevice logicalDevice;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  uint32_t maxAllocationCount;
+  std::vector<uint32_t> queueFamilyIndices;
+
+  mutable std::mutex mutex;
+  std::array<std::vector<std::unique_ptr<MemoryBlock>>, VK_MAX_MEMORY_TYPES * 2> pools;
+  uint32_t deviceAllocationCount{0};
+  VkDeviceSize reservedBytes{0};
+  VkDeviceSize usedBytes{0};
+  VkDeviceSize peakReservedBytes{0};
+  VkDeviceSize peakUsedBytes{0};
+
+  Allocation allocate(const VkMemoryRequirements& memoryRequirements, VkMemoryPropertyFlags properties, ResourceKind kind);
+  Allocation allocateFromPool(uint32_t memoryType, ResourceKind kind, const VkMemoryRequirements& memoryRequirements, const MemoryBlock* limit);
+  void free(Allocation& allocation);
+
+  void setSharingMode(VkBufferCreateInfo& bufferCreateInfo) const;
+  uint32_t findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const;
+  VkDeviceSize blockSizeFor(uint32_t memoryType) const;
+  MemoryBlock* createBlock(uint32_t memoryType, ResourceKind kind, VkDeviceSize size, bool dedicated);
+  void destroyBlock(MemoryBlock* block);
+};
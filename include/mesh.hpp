@@ -0,0 +1,151 @@
+#pragma once
+
+#include "math.hpp"
+#include "memory_allocator.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Detail levels per mesh, including the full resolution one.
+constexpr uint32_t MAX_LOD_LEVELS{4};
+
+// Normal of vertices from meshes without normals; those are shaded flat.
+constexpr int16_t NO_NORMAL{-32768};
+
+constexpr uint32_t NO_MESH{~uint32_t{0}};
+constexpr uint64_t CONTENT_HASH_SEED{14695981039346656037ull};
+
+// 20 bytes: full precision positions, since CAD models need them, octahedral
+// normals, which lose nothing visible at 16 bits per component, and half
+// float texture coordinates.
+struct Vertex {
+  Vec3 position;
+  std::array<int16_t, 2> normal{NO_NORMAL, NO_NORMAL};
+  std::array<uint16_t, 2> texCoord{0, 0};
+
+  static VkVertexInputBindingDescription bindingDescription();
+  static std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions();
+};
+
+// Cluster size limits, within what every VK_EXT_mesh_shader device can output
+// from one mesh shader workgroup.
+constexpr uint32_t MESHLET_MAX_VERTICES{64};
+constexpr uint32_t MESHLET_MAX_TRIANGLES{124};
+
+// A cluster of neighbouring triangles, culled as a whole: against the view
+// frustum with its bounding sphere, and as back facing with the cone that
+// bounds its triangle normals. Layout shared with the cluster shaders (std430).
+struct Meshlet {
+  Vec3 center;
+  float radius;
+  Vec3 coneAxis;
+  // Sine of the cone's half angle; 1, with a zero axis, if the normals spread
+  // over more than a hemisphere and the cluster can face the camera from anywhere.
+  float coneCutoff;
+  uint32_t firstVertex;
+  uint32_t vertexCount;
+  uint32_t firstTriangle;
+  uint32_t triangleCount;
+};
+
+// Where the sections of a mesh's meshlet buffer start: the meshlets come
+// first, followed by their triangles as indices into the mesh's vertices (for
+// indexed draws) and, for mesh shaders, their vertex lists and the triangles
+// as 8 bit indices into those, one triangle per 32 bit word.
+struct MeshletLayout {
+  uint32_t meshletCount{0};
+  VkDeviceSize indexOffset{0};
+  // In 32 bit words.
+  uint32_t vertexOffset{0};
+  uint32_t triangleOffset{0};
+};
+
+// A simplified version of a mesh: a range of its LOD index buffer that reuses
+// its vertices. error bounds how far the surface moved, in mesh units.
+struct LodLevel {
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  float error;
+};
+
+struct Mesh {
+  std::string path;
+
+  VkBuffer vertexBuffer{VK_NULL_HANDLE};
+  Allocation vertexAllocation;
+  VkBuffer indexBuffer{VK_NULL_HANDLE};
+  Allocation indexAllocation;
+
+  uint32_t vertexCount{0};
+  uint32_t indexCount{0};
+  Aabb bounds;
+
+  // Levels 1 and up, coarsest last; level 0 is indexBuffer itself.
+  VkBuffer lodIndexBuffer{VK_NULL_HANDLE};
+  Allocation lodIndexAllocation;
+  uint32_t lodIndexCount{0};
+  std::vector<LodLevel> lods;
+
+  // Clusters of level 0 for cluster culling, and the descriptor heap indices
+  // of the meshlet buffer and (for mesh shaders) of the vertex buffer.
+  VkBuffer meshletBuffer{VK_NULL_HANDLE};
+  Allocation meshletAllocation;
+  VkDeviceSize meshletBufferSize{0};
+  MeshletLayout meshletLayout;
+  uint32_t meshletBufferIndex{0};
+  uint32_t vertexBufferIndex{0};
+
+  bool ready{false};
+  bool cached{false};
+
+  // KTX2 base color texture, empty for untextured meshes.
+  std::string texturePath;
+  uint32_t texture{0};
+
+  // Set while copies into the buffers are in flight on the transfer queue;
+  // the mesh and its pending LODs and meshlets are used once uploadValue has completed.
+  bool uploading{false};
+  uint64_t uploadValue{0};
+  std::vector<LodLevel> pendingLods;
+  MeshletLayout pendingMeshletLayout;
+
+  // Hash of the vertices, indices and texture path. A mesh with the same
+  // content as an earlier one, confirmed byte for byte, is a duplicate of it:
+  // it keeps no buffers and its draw items use the original mesh.
+  uint64_t contentHash{0};
+  uint32_t duplicateOf{NO_MESH};
+  // Grid cell of its first copy, see Viewer::addDrawItems().
+  uint32_t firstCell{0};
+  // Views showing the part, see DrawItem::viewMask.
+  uint32_t viewMask{~uint32_t{0}};
+};
+
+// One object in the scene: a mesh placed with its own model matrix.
+struct DrawItem {
+  uint32_t mesh;
+  Mat4 model;
+  Aabb bounds;
+  // Bit i set if view i shows the object.
+  uint32_t viewMask{~uint32_t{0}};
+  // Node of the viewer's SceneCore that model and bounds are copied from.
+  uint32_t node{0};
+};
+
+// FNV-1a over 32 bit words rather than bytes. Data split into several calls
+// at word boundaries hashes the same as in one.
+uint64_t hashWords(uint64_t hash, const void* data, size_t size);
+
+std::array<int16_t, 2> encodeNormal(const Vec3& normal);
+std::array<uint16_t, 2> encodeTexCoord(float u, float v);
+
+// Screen space size of the box's projection in pixels, the larger of width and
+// height. 0 if it lies beside the viewport, unbounded if it crosses the camera plane.
+float projectedPixels(const Aabb& bounds, const Mat4& viewProjection, VkExtent2D viewport);
+
+// Picks the coarsest level whose error, projected with the object's screen
+// space size, stays within maxPixelError. Mirrors selectLod() in cull.comp.
+uint32_t selectLod(const Mesh& mesh, const Aabb& bounds, const Mat4& viewProjection, VkExtent2D viewport, float maxPixelError);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Binary copy of an imported mesh, written while its source file is parsed
+// for the first time and memory mapped on later launches. Vertices and
+// indices are stored exactly as they are uploaded, each section page aligned,
+// so loading a cached mesh is a copy from the mapped pages into the staging
+// buffer. Entries live in <cache dir>/meshes, named by a hash of the source
+// path, and are ignored once the source's size or modification time changes.
+// The path of the mesh's texture, if any, follows the header. The content
+// hash is stored so that cached duplicates are recognized before any upload.
+struct MeshCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  Aabb bounds;
+  uint64_t contentHash;
+  uint32_t texturePathLength;
+};
+
+std::string meshCachePath(const std::string& cacheDirectory, const std::string& sourcePath);
+
+// Returns nullptr if there is no valid cache entry for the source, including
+// one whose indices reach past its vertices.
+std::shared_ptr<const MappedFile> openMeshCache(const std::string& cachePath, const std::string& sourcePath, MeshCacheHeader& header, std::string& texturePath);
+
+// Compares the vertices, indices and texture of two sources' cache entries
+// byte for byte. False if either has no valid entry.
+bool sameMeshCacheContent(const std::string& cacheDirectory, const std::string& sourcePath, const std::string& otherSourcePath);
+
+// Streams a mesh into a temporary file next to the cache entry and moves it
+// into place on commit(); dropping the writer before that discards it. Write
+// errors only disable caching for this mesh.
+class MeshCacheWriter {
+public:
+  MeshCacheWriter(const std::string& cachePath, const std::string& sourcePath, uint32_t vertexCount, uint32_t indexCount);
+  ~MeshCacheWriter();
+
+  void write(uint32_t firstVertex, const std::vector<Vertex>& vertices, uint32_t firstIndex, const std::vector<uint32_t>& indices);
+  void commit(const Aabb& bounds, uint64_t contentHash, const std::string& texturePath);
+
+private:
+  std::string path;
+  std::string temporaryPath;
+  std::ofstream file;
+  MeshCacheHeader header;
+  bool failed{false};
+  bool committed{false};
+};
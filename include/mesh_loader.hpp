@@ -0,0 +1,182 @@
+#pragma once
+
+#include "job_system.hpp"
+#include "mesh.hpp"
+#include "mesh_cache.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct MeshLoadEvent {
+  enum class Type { Begin, Data, End, Failed };
+
+  Type type;
+  uint32_t mesh{0};
+
+  // Begin
+  uint32_t vertexCount{0};
+  uint32_t indexCount{0};
+  bool cached{false};
+
+  // Begin of cached and repeated meshes and End, see Mesh::contentHash.
+  uint64_t contentHash{0};
+  // Begin of repeated meshes: the mesh the same file was first loaded as,
+  // whose events all came before.
+  uint32_t repeatOf{NO_MESH};
+  // Begin of cached meshes and End: an earlier mesh whose vertices, indices
+  // and texture are byte for byte the same, in the numbering of
+  // MeshLoader::firstMesh. Its End came before.
+  uint32_t duplicateOf{NO_MESH};
+
+  // Data, either owned by the vectors or pointing into a memory mapped mesh
+  // cache entry that mapping keeps alive.
+  uint32_t firstVertex{0};
+  std::vector<Vertex> vertices;
+  uint32_t firstIndex{0};
+  std::vector<uint32_t> indices;
+  std::shared_ptr<const MappedFile> mapping;
+  const Vertex* mappedVertices{nullptr};
+  size_t mappedVertexCount{0};
+  const uint32_t* mappedIndices{nullptr};
+  size_t mappedIndexCount{0};
+
+  const Vertex* vertexData() const { return mapping ? mappedVertices : vertices.data(); }
+  size_t vertexDataCount() const { return mapping ? mappedVertexCount : vertices.size(); }
+  const uint32_t* indexData() const { return mapping ? mappedIndices : indices.data(); }
+  size_t indexDataCount() const { return mapping ? mappedIndexCount : indices.size(); }
+
+  // End
+  Aabb bounds;
+  std::string texturePath;
+
+  // Failed
+  std::string error;
+};
+
+class MeshLoader;
+
+// A mesh with buffers of its own that later meshes with the same content may
+// share.
+struct OriginalMesh {
+  uint32_t mesh;
+  std::string path;
+};
+
+// What a file's repeats are announced with, taken from its first load.
+struct MeshSummary {
+  uint32_t vertexCount{0};
+  uint32_t indexCount{0};
+  bool cached{false};
+  uint64_t contentHash{0};
+  Aabb bounds;
+  std::string texturePath;
+};
+
+// Receives one mesh from its parser and hands it out as bounded batches of
+// vertices/indices, hashing them and writing them to the mesh cache on the way.
+class MeshImport {
+public:
+  MeshImport(MeshLoader& loader, uint32_t mesh, const std::string& path);
+
+  void begin(uint32_t vertexCount, uint32_t indexCount);
+  void addVertex(const Vertex& vertex);
+  void addIndex(uint32_t index);
+  // Relative paths are resolved against the mesh file's directory.
+  void setTexture(const std::string& texturePath);
+  void end();
+
+  // Valid after end().
+  const MeshSummary& summary() const { return loaded; }
+
+private:
+  static constexpr size_t VERTICES_PER_EVENT{1 << 16};
+  static constexpr size_t INDICES_PER_EVENT{3 << 16};
+
+  MeshLoader& loader;
+  uint32_t mesh;
+  const std::string& path;
+  std::unique_ptr<MeshCacheWriter> cacheWriter;
+
+  MeshLoadEvent pending;
+  uint64_t vertexHash{CONTENT_HASH_SEED};
+  uint64_t indexHash{CONTENT_HASH_SEED};
+  MeshSummary loaded;
+
+  void flushPending();
+};
+
+// Parses OBJ, PLY and .vmesh files, along with texture coordinates and the
+// path of the base color texture (map_Kd of the OBJ's first material, or a
+// PLY TextureFile comment), one file per job on the job system so an
+// assembly of many files is parsed on every core. The files are read in
+// fixed size blocks and handed out as bounded batches, so the host never
+// holds more than a few batches of any mesh at once. Events of one mesh come
+// in order; those of different meshes interleave.
+//
+// A file given several times is parsed once; its repeats follow the first
+// load without Data events, their Begin carrying its content hash and mesh
+// (repeatOf), so they are duplicates of it from the start.
+//
+// With a cache directory, every parsed mesh is also written to the mesh
+// cache, and later loads of an unchanged file hand out ranges of the mapped
+// cache entry instead of parsing it. With dedup on top, the import job
+// compares each mesh whose content hash matches an original's with that
+// original's cache entry, and announces it as a duplicate if the bytes are
+// the same; cached duplicates then come without Data events.
+//
+// Meshes are numbered from 0 in events, but from firstMesh in duplicateOf
+// and originals, so duplicates can refer to meshes of earlier loaders.
+class MeshLoader {
+public:
+  MeshLoader(JobSystem& jobSystem, const std::vector<std::string>& paths, const std::string& cacheDirectory, bool dedup, uint32_t firstMesh, std::unordered_map<uint64_t, OriginalMesh> originals);
+  ~MeshLoader();
+
+  bool poll(MeshLoadEvent& event);
+  bool finished() const;
+
+  // Blocks until an event can be polled or loading has finished.
+  void wait();
+
+  // Most vertex and index bytes a Data event carries.
+  static constexpr size_t MAX_EVENT_BYTES{4 << 20};
+
+private:
+  friend class MeshImport;
+
+  static constexpr size_t MAX_QUEUED_EVENTS{8};
+  // Mapped batches cost no memory, so they only need to be small enough to spread uploads over frames.
+  static constexpr size_t MAPPED_BYTES_PER_EVENT{MAX_EVENT_BYTES};
+
+  JobSystem& jobSystem;
+  std::vector<std::string> paths;
+  std::string cacheDirectory;
+  bool dedup;
+  uint32_t firstMesh;
+  JobCounter imports;
+  std::atomic<size_t> filesLeft{0};
+
+  mutable std::mutex mutex;
+  std::condition_variable queueChanged;
+  std::deque<MeshLoadEvent> events;
+  std::atomic<bool> stopRequested{false};
+  bool importsDone{false};
+
+  std::mutex originalsMutex;
+  // By content hash.
+  std::unordered_map<uint64_t, OriginalMesh> originals;
+
+  // Loads the first mesh of the file and announces the others as its repeats.
+  void importFile(const std::vector<uint32_t>& meshes);
+  void load(uint32_t mesh, MeshSummary& summary);
+  bool loadCached(uint32_t mesh, MeshSummary& summary);
+  // Compares the cache entries, so mesh's must have been committed.
+  uint32_t originalOf(uint32_t mesh, uint64_t contentHash);
+  void addOriginal(uint32_t mesh, uint64_t contentHash);
+  void push(MeshLoadEvent&& event);
+};
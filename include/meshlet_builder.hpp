@@ -0,0 +1,71 @@
+#pragma once
+
+#include "job_system.hpp"
+#include "mesh.hpp"
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct MeshletResult {
+  uint32_t mesh{0};
+  std::vector<Meshlet> meshlets;
+  // Three per triangle, indexing the mesh's vertices.
+  std::vector<uint32_t> indices;
+  // Per meshlet, the mesh vertices it uses and its triangles as three 8 bit
+  // indices into those, packed into one word.
+  std::vector<uint32_t> vertices;
+  std::vector<uint32_t> triangles;
+};
+
+// Splits dense meshes into meshlets, one job per mesh on the job system, for
+// culling them cluster by cluster on the GPU. A single pass over the
+// triangles, so it is cheap enough to run on every load instead of being cached.
+class MeshletBuilder {
+public:
+  explicit MeshletBuilder(JobSystem& jobSystem);
+  ~MeshletBuilder();
+
+  // Meshes too small to benefit ignore addData(). Results are only handed
+  // out for meshes that reached end().
+  void begin(uint32_t mesh, const std::string& path, uint32_t vertexCount, uint32_t indexCount);
+  void addData(uint32_t mesh, uint32_t firstVertex, const Vertex* vertices, size_t vertexCount, uint32_t firstIndex, const uint32_t* indices, size_t indexCount);
+  void end(uint32_t mesh);
+  void cancel(uint32_t mesh);
+
+  bool poll(MeshletResult& result);
+  // Blocks until every mesh passed to end() has been built.
+  void waitIdle();
+
+private:
+  // Below this, culling whole objects is enough.
+  static constexpr uint32_t MIN_TRIANGLES{4096};
+
+  struct Job {
+    uint32_t mesh;
+    std::string path;
+    std::vector<Vec3> positions;
+    std::vector<uint32_t> indices;
+  };
+
+  JobSystem& jobSystem;
+  JobCounter builds;
+  std::atomic<bool> stopRequested{false};
+
+  std::mutex mutex;
+  std::deque<MeshletResult> results;
+
+  // Only touched by the thread feeding mesh data.
+  std::unordered_map<uint32_t, Job> collecting;
+
+  void build(const Job& job);
+};
+
+// Groups the triangles, in index order, into meshlets of at most
+// MESHLET_MAX_VERTICES vertices and MESHLET_MAX_TRIANGLES triangles. Meshes
+// are exported with neighbouring triangles mostly next to each other, so the
+// clusters stay compact.
+MeshletResult buildMeshlets(const std::vector<Vec3>& positions, const std::vector<uint32_t>& indices);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Limits of --windows, of the views side by side in each window (--views)
+// and of --frames-in-flight. Every view has a camera uniform buffer per frame
+// in flight, see DescriptorHeap::MAX_UNIFORM_BUFFERS.
+constexpr uint32_t MAX_WINDOWS{4};
+constexpr uint32_t MAX_VIEWS_PER_WINDOW{4};
+constexpr uint32_t MAX_FRAMES_IN_FLIGHT{4};
+
+struct Options {
+  std::vector<std::string> meshFiles;
+  uint32_t resizeBenchmarkIterations{0};
+  std::string cacheDirectory;
+  std::string shaderDirectory;
+  bool shaderHotReload{true};
+  bool asyncPipelineCompilation{true};
+  bool startupTiming{false};
+  bool meshCache{true};
+  uint32_t recordThreads{0};
+  uint32_t importThreads{0};
+  uint32_t copies{1};
+  uint32_t repeat{1};
+  bool dedup{true};
+  uint32_t recordBenchmarkFrames{0};
+  bool gpuDriven{true};
+  bool clusters{true};
+  bool meshShaders{true};
+  bool occlusionCulling{true};
+  bool lod{true};
+  float lodPixelError{1.0f};
+  bool frameStats{false};
+  std::string statsFile;
+  uint32_t samples{1};
+  uint32_t textureBudget{256};
+
+  uint32_t windows{1};
+  uint32_t views{1};
+  bool viewFiles{false};
+  std::string presentMode{"fifo"};
+  uint32_t framesInFlight{2};
+  uint32_t swapChainImageCount{0};
+  bool framePacing{false};
+  bool renderThread{true};
+  std::string traceFile;
+
+  bool headless{false};
+  uint32_t width{1024};
+  uint32_t height{1024};
+  uint32_t frameCount{1};
+  std::string outputDirectory{"."};
+  std::string imageFormat{"png"};
+  std::string cameraPath;
+};
+
+Options parseOptions(int argc, char** argv);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+#include <vector>
+
+// VkPipelineCache persisted to disk. The file carries its own header with the
+// device identity, so a cache written by another GPU or driver version is
+// discarded instead of being handed to the driver.
+class PipelineCache {
+public:
+  PipelineCache(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& path);
+  ~PipelineCache();
+
+  VkPipelineCache handle() const { return pipelineCache; }
+  size_t loadedBytes() const { return initialDataSize; }
+
+  void save();
+
+private:
+  static constexpr uint32_t FILE_VERSION{1};
+
+  struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t checksum;
+  };
+
+  VkDevice logicalDevice;
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  std::string path;
+  VkPipelineCache pipelineCache{VK_NULL_HANDLE};
+  size_t initialDataSize{0};
+
+  bool load(std::vector<char>& data);
+  FileHeader expectedHeader(const std::vector<char>& data) const;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps the last `capacity` samples of a measurement for percentiles.
+class RollingStats {
+public:
+  explicit RollingStats(size_t capacity = 1024);
+
+  void add(double sample);
+  double percentile(double p) const;
+  size_t count() const { return samples.size(); }
+  uint64_t total() const { return totalCount; }
+
+private:
+  size_t capacity;
+  std::vector<double> samples;
+  size_t next{0};
+  uint64_t totalCount{0};
+};
+
+// CPU scoped timers and GPU timestamp queries with rolling percentiles and
+// Chrome trace (chrome://tracing, Perfetto) export.
+//
+// GPU timestamps are written into one query pool per frame in flight and read
+// back right after that frame's fence has been waited on, so the results are
+// already available and reading them never stalls. Without calibrated
+// timestamps the GPU timeline is placed in the trace by aligning each
+// frame's first timestamp with the CPU time it was submitted at.
+class Profiler {
+public:
+  class Scope {
+  public:
+    Scope(Profiler* profiler, const char* name);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    Profiler* profiler;
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  Profiler(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t frameCount, bool enabled, bool tracing);
+  ~Profiler();
+
+  Scope scope(const char* name) { return Scope{enabled ? this : nullptr, name}; }
+
+  // Call after waiting on `frame`'s fence and before recording it again.
+  void collect(uint32_t frame);
+  void resetQueries(VkCommandBuffer commandBuffer, uint32_t frame);
+  uint32_t beginGpuScope(VkCommandBuffer commandBuffer, uint32_t frame, const char* name);
+  void endGpuScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope);
+  void submitted(uint32_t frame);
+
+  void endFrame();
+  // Per frame counts, such as culled objects, reported next to the timings.
+  void addCount(const char* name, uint64_t count);
+
+  void report(std::ostream& stream) const;
+  // The timings of report() as a JSON object.
+  void writeJson(std::ostream& stream) const;
+  void writeChromeTrace(const std::string& path) const;
+
+private:
+  // Enough for the culling scopes of every view.
+  static constexpr uint32_t MAX_GPU_SCOPES{64};
+  static constexpr size_t MAX_TRACE_EVENTS{1 << 20};
+  static constexpr uint32_t GPU_THREAD{~0u};
+
+  struct TraceEvent {
+    const char* name;
+    uint32_t thread;
+    double start;
+    double duration;
+  };
+
+  struct GpuFrame {
+    VkQueryPool queryPool{VK_NULL_HANDLE};
+    std::vector<const char*> scopes;
+    std::chrono::steady_clock::time_point submitTime;
+  };
+
+  VkDevice logicalDevice;
+  bool enabled;
+  bool tracing;
+  double timestampPeriod{0.0};
+  uint64_t timestampMask{0};
+  std::vector<GpuFrame> gpuFrames;
+
+  std::chrono::steady_clock::time_point origin;
+  std::chrono::steady_clock::time_point lastFrameEnd;
+
+  mutable std::mutex mutex;
+  RollingStats frameTimes;
+  std::map<std::string, RollingStats> cpuStats;
+  std::map<std::string, RollingStats> gpuStats;
+  std::map<std::string, RollingStats> counts;
+  std::map<std::thread::id, uint32_t> threads;
+  std::vector<TraceEvent> traceEvents;
+
+  void addCpuSample(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end);
+  double microseconds(std::chrono::steady_clock::time_point time) const;
+};
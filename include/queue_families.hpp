@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+struct QueueFamilies {
+  uint32_t graphics{0};
+  uint32_t present{0};
+  // A transfer only family where the device has one (its copy engines), else
+  // an async compute family, else a second queue of the graphics family. On
+  // devices with a single queue this is the graphics queue itself.
+  uint32_t transfer{0};
+  uint32_t transferQueueIndex{0};
+};
+
+// The graphics family also has to support compute, for culling. Without a
+// surface, present is left equal to graphics. Throws if the device lacks a
+// graphics or a presenting queue.
+QueueFamilies findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface);
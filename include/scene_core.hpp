@@ -0,0 +1,101 @@
+#pragma once
+
+#include "math.hpp"
+#include "mesh.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Instruction sets the scene kernels have paths for, picked once at runtime.
+enum class SimdLevel {
+  Scalar,
+  Sse,
+  Avx2
+};
+
+// The best level the CPU supports: AVX2 needs FMA and F16C as well, SSE is
+// every x86-64 CPU, anything else runs the scalar code.
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// Affine transforms as the twelve coefficients of the upper 3x4 part of a
+// column-major Mat4, each coefficient in an array of its own, so that a
+// kernel loads the same coefficient of 4 or 8 transforms at once.
+struct TransformArrays {
+  std::array<std::vector<float>, 12> m;
+
+  void resize(size_t size);
+  size_t size() const { return m[0].size(); }
+  void set(size_t index, const Mat4& transform);
+  Mat4 get(size_t index) const;
+};
+
+struct BoundsArrays {
+  std::vector<float> minX, minY, minZ;
+  std::vector<float> maxX, maxY, maxZ;
+
+  void resize(size_t size);
+  size_t size() const { return minX.size(); }
+  void set(size_t index, const Aabb& bounds);
+  Aabb get(size_t index) const;
+};
+
+// world[i] = world[parents[i]] * local[i] for i in [begin, end). Every parent
+// must lie before begin, so the range has no dependencies within itself.
+void propagateTransforms(SimdLevel level, const TransformArrays& local, TransformArrays& world, const uint32_t* parents, size_t begin, size_t end);
+// The boxes around the local boxes transformed by the world transforms.
+void transformBounds(SimdLevel level, const TransformArrays& world, const BoundsArrays& local, BoundsArrays& worldBounds, size_t begin, size_t end);
+Aabb mergeBounds(SimdLevel level, const BoundsArrays& bounds, size_t begin, size_t end);
+// Packs imported attributes into vertices: positions as they are, normals
+// with encodeNormal() and texture coordinates (u, v pairs, may be null) with
+// encodeTexCoord(), bit for bit.
+void quantizeVertices(SimdLevel level, const Vec3* positions, const Vec3* normals, const float* texCoords, size_t count, Vertex* vertices);
+
+// Transform hierarchy of a scene, with each node's world transform and the
+// world space box of its local bounds. Nodes are stored sorted by depth, so
+// all nodes of one depth are a contiguous range whose parents are already
+// up to date, and the kernels run over each depth in turn. Moving a node
+// only sets its local transform; update() recomputes the whole scene, which
+// for a hundred thousand parts takes about a tenth of a frame with AVX2.
+class SceneCore {
+public:
+  static constexpr uint32_t NO_PARENT{~uint32_t{0}};
+
+  explicit SceneCore(SimdLevel level = detectSimdLevel());
+
+  // Returns the node's id, which stays valid as nodes are added. The bounds
+  // must be valid; give nodes without geometry a point box at their origin.
+  uint32_t addNode(uint32_t parent, const Mat4& local, const Aabb& localBounds);
+  void setLocal(uint32_t node, const Mat4& local);
+  void update();
+
+  size_t size() const { return parents.size(); }
+  SimdLevel simdLevel() const { return level; }
+  // Valid after update().
+  Mat4 world(uint32_t node) const { return worldTransforms.get(slots[node]); }
+  Aabb worldBounds(uint32_t node) const { return worldBoxes.get(slots[node]); }
+  const Aabb& bounds() const { return sceneBounds; }
+
+private:
+  SimdLevel level;
+
+  // Indexed by slot, the storage order.
+  std::vector<uint32_t> parents;
+  std::vector<uint32_t> depths;
+  TransformArrays localTransforms;
+  TransformArrays worldTransforms;
+  BoundsArrays localBoxes;
+  BoundsArrays worldBoxes;
+  // First slot of every depth, and one past the last slot.
+  std::vector<size_t> depthStarts;
+  bool sorted{true};
+
+  // Slot of every node id, and the node id of every slot.
+  std::vector<uint32_t> slots;
+  std::vector<uint32_t> nodes;
+  Aabb sceneBounds;
+
+  void sortByDepth();
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ReloadedPipeline {
+  uint32_t id;
+  VkPipeline pipeline;
+};
+
+// Compiles GLSL from the shader directory at runtime with shaderc. Compiled
+// SPIR-V is cached on disk keyed by a hash of the source, so unchanged shaders
+// are never recompiled across launches.
+//
+// Pipelines register the shaders they are built from. When `watch()` is
+// active, a background thread waits for inotify events on the shader
+// directory, recompiles the changed shaders, rebuilds the affected pipelines
+// and queues them for the render loop to pick up with `poll()`.
+class ShaderManager {
+public:
+  using PipelineBuilder = std::function<VkPipeline()>;
+
+  ShaderManager(VkDevice logicalDevice, const std::string& shaderDirectory, const std::string& cacheDirectory);
+  ~ShaderManager();
+
+  VkShaderModule createShaderModule(const std::string& name);
+  // Returns the path of the cached SPIR-V for the shader's current source, compiling it first if needed.
+  std::string compile(const std::string& name);
+
+  uint32_t addPipeline(const std::vector<std::string>& shaderNames, PipelineBuilder builder);
+  void watch();
+  bool poll(ReloadedPipeline& reloaded);
+
+private:
+  struct RegisteredPipeline {
+    std::vector<std::string> shaderNames;
+    PipelineBuilder builder;
+  };
+
+  VkDevice logicalDevice;
+  std::string shaderDirectory;
+  std::string cacheDirectory;
+
+  std::mutex mutex;
+  std::vector<RegisteredPipeline> pipelines;
+  std::deque<ReloadedPipeline> reloadedPipelines;
+
+  int inotifyDescriptor{-1};
+  int stopDescriptor{-1};
+  std::thread watcher;
+
+  void watchLoop();
+  void rebuildPipelinesUsing(const std::string& shaderName);
+};
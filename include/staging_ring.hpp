@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+// One mip level of an image, as rows of blockSize x blockSize texel blocks
+// packed without padding.
+struct ImageLevel {
+  uint32_t width;
+  uint32_t height;
+  const void* data;
+};
+
+// Host visible upload buffer split into a few slots that are recycled in
+// order. Each slot owns a command buffer, so new data can be written into one
+// slot while the copies of the previous ones are still executing.
+//
+// The copies run on their own (ideally transfer only) queue, so they overlap
+// rendering instead of queueing up behind it. Every submission signals the
+// next value of a timeline semaphore; a frame may use uploaded data once
+// completedValue() has reached the value flush() returned for it, and waits on
+// that value in its submission so the copies are visible to it.
+class StagingRing {
+public:
+  StagingRing(VkDevice logicalDevice, VkQueue queue, uint32_t queueFamilyIndex, VkBuffer buffer, void* mapped, VkDeviceSize size, uint32_t slotCount);
+  ~StagingRing();
+
+  void upload(VkBuffer destination, VkDeviceSize destinationOffset, const void* data, VkDeviceSize size);
+  // Fills mip levels 0..levels.size()-1 of a freshly created image and leaves
+  // them in SHADER_READ_ONLY_OPTIMAL. Levels are split at block rows to fit
+  // the slots.
+  void uploadImage(VkImage destination, uint32_t blockSize, uint32_t blockBytes, const std::vector<ImageLevel>& levels);
+  // Returns the semaphore value at which everything uploaded so far is complete.
+  uint64_t flush();
+  void waitIdle();
+
+  VkSemaphore semaphore() const { return timeline; }
+  uint64_t completedValue() const;
+
+  VkDeviceSize size() const { return slotSize * slots.size(); }
+  // Bytes that can be uploaded before a slot whose copies are still running
+  // comes up again, i.e. without waiting.
+  VkDeviceSize freeBytes() const;
+  // Blocks until freeBytes() reaches bytes, which must fit the slots other
+  // than the one being recorded.
+  void waitForFreeBytes(VkDeviceSize bytes);
+
+private:
+  struct Slot {
+    VkCommandBuffer commandBuffer;
+    uint64_t value{0};
+    VkDeviceSize used{0};
+    bool recording{false};
+  };
+
+  VkDevice logicalDevice;
+  VkQueue queue;
+  VkCommandPool commandPool;
+  VkSemaphore timeline;
+  uint64_t submittedValue{0};
+
+  VkBuffer buffer;
+  char* mapped;
+  VkDeviceSize slotSize;
+
+  std::vector<Slot> slots;
+  size_t currentSlot{0};
+
+  void waitForValue(uint64_t value);
+  Slot& recordingSlot();
+  void nextSlot();
+  void beginSlot(Slot& slot);
+  void submitSlot(Slot& slot);
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Records named milestones relative to construction, for measuring the time
+// from process start to the first presented frame.
+class StartupTimer {
+public:
+  StartupTimer();
+
+  void mark(const std::string& milestone);
+  void print(std::ostream& stream) const;
+  // Milliseconds to each milestone as a JSON object.
+  void writeJson(std::ostream& stream) const;
+
+private:
+  std::chrono::steady_clock::time_point start;
+  std::vector<std::pair<std::string, double>> milestones;
+};
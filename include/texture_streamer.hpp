@@ -0,0 +1,130 @@
+#pragma once
+
+#include "descriptor_heap.hpp"
+#include "ktx_texture.hpp"
+#include "memory_allocator.hpp"
+#include "staging_ring.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Block compressed textures whose mip levels are streamed in as objects
+// using them grow on screen, within a fixed budget of GPU memory.
+//
+// The tail of a texture (its levels of at most TAIL_SIZE texels) is uploaded
+// once it fits the budget, before any finer level, and stays resident; until
+// then the texture is drawn white. Finer levels are streamed into a second image
+// holding the contiguous range from the finest level needed down to the
+// smallest: making more levels resident creates a new image for the new
+// range, fills it from the mapped file through the staging ring and switches
+// to it once the copies have completed; the old image is destroyed once no
+// frame in flight uses it anymore. When a texture does not fit, the streamed
+// images of the least recently used textures are dropped, leaving those
+// textures with their tail. Images are charged what the device reports they
+// need, and images being filled or waiting for destruction count towards the
+// budget, so it is never exceeded.
+//
+// Handle 0 is a white texture for meshes without one.
+class TextureStreamer {
+public:
+  TextureStreamer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, MemoryAllocator& memoryAllocator, StagingRing& stagingRing,
+    DescriptorHeap& descriptorHeap, const std::vector<uint32_t>& queueFamilyIndices, VkDeviceSize budget, uint32_t framesInFlight);
+  ~TextureStreamer();
+
+  // Index in the descriptor heap of the texture's resident levels.
+  uint32_t textureIndex(uint32_t texture) const;
+
+  // Returns the handle of the texture in the file, 0 if it can not be used.
+  // Files already loaded return their existing handle.
+  uint32_t load(const std::string& path);
+
+  // Asks for levels sharp enough to cover `pixels` screen pixels across in the
+  // next update(); called for every visible object using the texture.
+  void request(uint32_t texture, float pixels);
+
+  // Once per frame, after the frame's fence has signalled. Switches to images
+  // whose copies completed by `visibleUploadValue` (what the frame's
+  // submission waits for) and starts filling new ones for this frame's requests.
+  void update(uint64_t frameNumber, uint64_t visibleUploadValue);
+
+  // True when no image is being filled and the last update started none.
+  bool idle() const;
+
+  void logStats(std::ostream& stream) const;
+
+private:
+  static constexpr uint32_t TAIL_SIZE{64};
+  // Spreads large residency changes over frames, like the mesh uploads.
+  static constexpr VkDeviceSize UPLOAD_BUDGET_PER_FRAME{32 << 20};
+
+  // An image holding levels baseLevel..levelCount-1 of a texture.
+  struct Version {
+    VkImage image{VK_NULL_HANDLE};
+    Allocation allocation;
+    VkImageView view{VK_NULL_HANDLE};
+    uint32_t index{0};
+    uint32_t baseLevel{0};
+    VkDeviceSize bytes{0};
+    uint64_t uploadValue{0};
+  };
+
+  struct Texture {
+    std::string path;
+    std::unique_ptr<KtxTexture> file;
+    uint32_t tailLevel{0};
+    // Memory of an image of levels baseLevel.., by base level up to the tail.
+    std::vector<VkDeviceSize> versionBytes;
+    Version tail;
+    Version streamed;
+    Version pending;
+    // Finest level requested since the last update, levelCount if none.
+    uint32_t requestedLevel{0};
+    uint64_t lastUsed{0};
+  };
+
+  struct RetiredVersion {
+    Version version;
+    uint64_t retiredAtFrame;
+  };
+
+  VkPhysicalDevice physicalDevice;
+  VkDevice logicalDevice;
+  MemoryAllocator& memoryAllocator;
+  StagingRing& stagingRing;
+  DescriptorHeap& descriptorHeap;
+  std::vector<uint32_t> queueFamilyIndices;
+  VkDeviceSize budget;
+  uint32_t framesInFlight;
+
+  VkSampler sampler;
+
+  std::vector<Texture> textures;
+  std::unordered_map<std::string, uint32_t> handles;
+  std::deque<RetiredVersion> retiredVersions;
+  VkDeviceSize usedBytes{0};
+  VkDeviceSize retiringBytes{0};
+  uint64_t frameNumber{0};
+  uint64_t visibleUploadValue{0};
+  bool started{false};
+  uint64_t levelsStreamed{0};
+  uint64_t evictions{0};
+
+  void createDefaultTexture();
+  bool createTails();
+  VkImageCreateInfo versionCreateInfo(const Texture& texture, uint32_t baseLevel) const;
+  VkDeviceSize queryVersionBytes(const Texture& texture, uint32_t baseLevel) const;
+  bool createVersion(Texture& texture, uint32_t baseLevel, Version& version);
+  void createView(VkFormat format, uint32_t levelCount, Version& version);
+  void destroyVersion(Version& version);
+  void retire(Version& version);
+  bool evictFor(VkDeviceSize bytes, const Texture& keep, bool evictDrawn = false);
+  uint32_t residentLevel(const Texture& texture) const;
+  VkDeviceSize levelBytes(const Texture& texture, uint32_t baseLevel) const;
+};
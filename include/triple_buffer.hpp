@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands the latest value from one writer thread to one reader thread without
+// locks: the writer fills the back slot and swaps it with the middle one, the
+// reader swaps the middle slot with its front one if it holds a newer value.
+// Neither side ever waits, and the reader skips values it was too slow for.
+template<typename T>
+class TripleBuffer {
+public:
+  // Writer side: fill back(), then publish() it.
+  T& back() { return slots[backIndex]; }
+
+  void publish() {
+    backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+  }
+
+  // Reader side: the latest published value, or the previous one again if
+  // nothing was published since.
+  const T& latest() {
+    if (middle.load(std::memory_order_relaxed) & FRESH) {
+      frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+    return slots[frontIndex];
+  }
+
+private:
+  static constexpr uint8_t INDEX_MASK{3};
+  static constexpr uint8_t FRESH{4};
+
+  std::array<T, 3> slots{};
+  uint8_t backIndex{0};
+  std::atomic<uint8_t> middle{1};
+  uint8_t frontIndex{2};
+};
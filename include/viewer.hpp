@@ -1,11 +1,82 @@
 #define GLFW_INCLUDE_VULKAN
 #include "GLFW/glfw3.h"
 
+#include "camera.hpp"
+#include "camera_path.hpp"
+#include "command_recorder.hpp"
+#include "descriptor_heap.hpp"
+#include "frame_pacer.hpp"
+#include "gpu_scene.hpp"
+#include "image_writer.hpp"
+#include "instance_buffers.hpp"
+#include "job_system.hpp"
+#include "lod_builder.hpp"
+#include "memory_allocator.hpp"
+#include "mesh.hpp"
+#include "mesh_loader.hpp"
+#include "meshlet_builder.hpp"
+#include "options.hpp"
+#include "pipeline_cache.hpp"
+#include "profiler.hpp"
+#include "queue_families.hpp"
+#include "scene_core.hpp"
+#include "shader_manager.hpp"
+#include "staging_ring.hpp"
+#include "startup_timer.hpp"
+#include "texture_streamer.hpp"
+#include "triple_buffer.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <string>
 
+// Layout shared with basic.vert and basic.frag; the texture is at the same
+// offset as in IndirectPushConstants, so both pipelines use basic.frag. The
+// others are descriptor heap indices, see InstanceBuffers.
+struct DrawPushConstants {
+  uint32_t texture;
+  uint32_t camera;
+  uint32_t models;
+  uint32_t instances;
+};
+
+constexpr uint32_t MAX_VIEWS{MAX_WINDOWS * MAX_VIEWS_PER_WINDOW};
+
+struct WindowInput {
+  VkExtent2D framebufferExtent{0, 0};
+  uint64_t resizes{0};
+};
+
+// Window state the main thread hands to the render thread. Fixed size, so
+// publishing it never allocates.
+struct InputState {
+  // Every view has a camera of its own.
+  std::array<CameraInput, MAX_VIEWS> cameras;
+  std::array<WindowInput, MAX_WINDOWS> windows;
+};
+
+// With a window, the main thread only handles input: it sleeps in
+// glfwWaitEvents() and publishes the input state through a triple buffer
+// after every batch of events. The render thread loads meshes and textures,
+// moves the camera by the latest input and records and submits the frames,
+// so a slow frame never delays input handling.
+//
+// Every window is split into views side by side, each with a camera of its
+// own, and all views share the device, the uploaded meshes and textures and
+// the pipelines. A frame records every view of every window into one command
+// buffer, one render pass (or two with occlusion culling) per view limited to
+// its rectangle, and submits and presents all windows at once.
 class Viewer {
 public:
+  explicit Viewer(const Options& options);
   ~Viewer();
 
   void run();
@@ -13,46 +84,291 @@ private:
   uint32_t width{640};
   uint32_t height{480};
 
-  const size_t MAX_FRAMES_IN_FLIGHT{2};
+  const VkDeviceSize STAGING_BUFFER_SIZE{64 << 20};
+  const uint32_t STAGING_SLOT_COUNT{8};
+  // Half the ring, so the meshes of one frame leave room for its textures.
+  // Uploads also stop early once the slots still free would not hold another
+  // batch, see processMeshEvents().
+  const VkDeviceSize UPLOAD_BUDGET_PER_FRAME{STAGING_BUFFER_SIZE / 2};
+  const VkBufferUsageFlags MESH_BUFFER_USAGE{VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+  // Mesh shaders read the vertices from a storage buffer.
+  const VkBufferUsageFlags VERTEX_BUFFER_USAGE{MESH_BUFFER_USAGE | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+  const VkBufferUsageFlags MESHLET_BUFFER_USAGE{MESH_BUFFER_USAGE | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT};
+  const float MAX_FRAGMENTATION{0.5f};
+  const size_t MAX_QUEUED_IMAGES{4};
+  const float MAX_CAMERA_STEP{0.1f};
 
-  GLFWwindow* window;
+  Options options;
+  size_t framesInFlight;
+  StartupTimer startupTimer;
 
   VkInstance vkInstance;
   VkPhysicalDevice physicalDevice;
   VkDevice logicalDevice;
+  std::unique_ptr<MemoryAllocator> memoryAllocator;
+  QueueFamilies queueFamilies;
   VkQueue graphicsQueue;
-  VkSurfaceKHR surface;
   VkQueue presentationQueue;
+  VkQueue transferQueue;
+  // Dense meshes are culled cluster by cluster, by task and mesh shaders if
+  // the device has them and by a compute pass feeding indirect draws otherwise.
+  bool clusters{false};
+  bool meshShaders{false};
+  PFN_vkCmdDrawMeshTasksIndirectEXT drawMeshTasksIndirect{nullptr};
+  // The GPU-driven path draws in two render passes, testing the objects not
+  // drawn in the first against the first pass's depth.
+  bool occlusionCulling{false};
 
-  VkSwapchainKHR swapChain;
-  std::vector<VkImage> swapChainImages;
-  std::vector<VkImageView> swapChainImageViews;
-  std::vector<VkFramebuffer> swapChainFramebuffers;
+  VkSurfaceFormatKHR surfaceFormat{VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+  VkPresentModeKHR presentMode{VK_PRESENT_MODE_FIFO_KHR};
 
+  // Multisampled color and depth only live for the duration of the render
+  // pass, so they are transient and never stored; the color samples are
+  // resolved into the swap chain (or offscreen) image at the end of the pass.
+  // Occlusion culling keeps both between its two render passes and samples
+  // the depth, which is then in the descriptor heap.
+  static constexpr uint32_t NO_TEXTURE{~uint32_t{0}};
+  struct TransientAttachment {
+    VkImage image{VK_NULL_HANDLE};
+    Allocation allocation;
+    VkImageView view{VK_NULL_HANDLE};
+    uint32_t texture{NO_TEXTURE};
+  };
+  VkSampleCountFlagBits sampleCount{VK_SAMPLE_COUNT_1_BIT};
+  VkFormat depthFormat{VK_FORMAT_D32_SFLOAT};
+  VkSampler depthSampler{VK_NULL_HANDLE};
+
+  // Headless mode has a single window without a surface, rendering into the
+  // offscreen targets instead of a swap chain.
+  struct Window {
+    GLFWwindow* handle{nullptr};
+    VkSurfaceKHR surface{VK_NULL_HANDLE};
+    VkSwapchainKHR swapChain{VK_NULL_HANDLE};
+    VkExtent2D extent{0, 0};
+    std::vector<VkImage> images;
+    std::vector<VkImageView> imageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    // Shared by the window's views, which draw one after another.
+    TransientAttachment colorAttachment;
+    TransientAttachment depthAttachment;
+    // One per frame in flight.
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    uint64_t handledResizes{0};
+    // The image acquired for the frame being drawn, if acquired is set.
+    uint32_t imageIndex{0};
+    bool acquired{false};
+  };
+  std::vector<Window> windows;
+
+  // One per frame in flight, written when the frame is recorded.
+  struct CameraBuffer {
+    VkBuffer buffer{VK_NULL_HANDLE};
+    Allocation allocation;
+    uint32_t index{0};
+  };
+
+  // Views are ordered by window, options.views per window from left to right.
+  struct View {
+    uint32_t window{0};
+    VkRect2D rectangle{};
+    Camera camera;
+    std::vector<CameraBuffer> cameraBuffers;
+  };
+  std::vector<View> views;
+
+  std::unique_ptr<PipelineCache> pipelineCache;
+  std::unique_ptr<ShaderManager> shaderManager;
+  // With occlusion culling renderPass draws the first phase and
+  // occlusionRenderPass continues it; both are compatible, so pipelines and
+  // framebuffers work with either.
   VkRenderPass renderPass;
-  VkPipelineLayout pipelineLayout;
+  VkRenderPass occlusionRenderPass{VK_NULL_HANDLE};
+  // Views after the first in a window keep what the views before them drew.
+  VkRenderPass nextViewRenderPass{VK_NULL_HANDLE};
+  VkRenderPass nextViewOcclusionRenderPass{VK_NULL_HANDLE};
   VkPipeline graphicsPipeline;
+  VkPipeline indirectPipeline{VK_NULL_HANDLE};
+  VkPipeline cullPipeline{VK_NULL_HANDLE};
+  VkPipeline clusterCullPipeline{VK_NULL_HANDLE};
+  VkPipeline clusterPipeline{VK_NULL_HANDLE};
+  VkPipeline depthPyramidPipeline{VK_NULL_HANDLE};
+  // Indexed by the shader manager's pipeline id, so reloads know which handle to replace.
+  std::vector<VkPipeline*> reloadablePipelines;
+
+  struct RetiredPipeline {
+    VkPipeline pipeline;
+    uint64_t retiredAtFrame;
+  };
+  std::deque<RetiredPipeline> retiredPipelines;
 
   VkCommandPool commandPool;
   std::vector<VkCommandBuffer> commandBuffers;
+  std::unique_ptr<CommandRecorder> commandRecorder;
+  std::unique_ptr<Profiler> profiler;
+  std::unique_ptr<FramePacer> framePacer;
+
+  struct RetiredSwapChain {
+    VkSwapchainKHR swapChain;
+    std::vector<VkImageView> imageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    TransientAttachment colorAttachment;
+    TransientAttachment depthAttachment;
+    uint64_t retiredAtFrame;
+  };
+  std::deque<RetiredSwapChain> retiredSwapChains;
+
+  // Mesh buffers moved by defragmentation, along with the command buffer
+  // copying them.
+  struct RetiredMeshBuffers {
+    VkCommandBuffer commandBuffer;
+    std::vector<RetiredBuffer> buffers;
+    uint64_t retiredAtFrame;
+  };
+  std::deque<RetiredMeshBuffers> retiredMeshBuffers;
+  std::vector<double> resizeTimings;
+
+  // Headless mode renders into these instead of the swap chain, one per frame in flight.
+  struct OffscreenTarget {
+    VkImage image{VK_NULL_HANDLE};
+    Allocation imageAllocation;
+    VkImageView imageView{VK_NULL_HANDLE};
+    VkFramebuffer framebuffer{VK_NULL_HANDLE};
+    VkBuffer readbackBuffer{VK_NULL_HANDLE};
+    Allocation readbackAllocation;
+    int64_t pendingFrame{-1};
+  };
+  std::vector<OffscreenTarget> offscreenTargets;
+  std::unique_ptr<ImageWriter> imageWriter;
+
+  VkBuffer stagingBuffer{VK_NULL_HANDLE};
+  Allocation stagingAllocation;
+  std::unique_ptr<StagingRing> stagingRing;
+  // Staging ring value whose uploads the next submitted frame may read.
+  uint64_t visibleUploadValue{0};
+  // Runs the mesh imports and the LOD and meshlet builds.
+  std::unique_ptr<JobSystem> jobSystem;
+  std::unique_ptr<MeshLoader> meshLoader;
+  // Index of the loader's first mesh in meshes; files dropped on the window are loaded after the current batch.
+  uint32_t meshBase{0};
+  std::vector<std::string> droppedFiles;
+  std::mutex droppedFilesMutex;
+  std::unique_ptr<LodBuilder> lodBuilder;
+  std::unique_ptr<MeshletBuilder> meshletBuilder;
+  std::vector<Mesh> meshes;
+  // Meshes with buffers of their own, by content hash, handed to the next
+  // loader as originals.
+  std::unordered_map<uint64_t, uint32_t> meshesByContent;
+  // Sorted by mesh.
+  std::vector<DrawItem> drawItems;
+  uint64_t sceneVersion{0};
+  std::unique_ptr<DescriptorHeap> descriptorHeap;
+  std::unique_ptr<GpuScene> gpuScene;
+  std::unique_ptr<InstanceBuffers> instanceBuffers;
+  std::unique_ptr<TextureStreamer> textureStreamer;
+  std::chrono::steady_clock::time_point loadStart;
+
+  // Written by the callbacks on the main thread. Keys and drags go to the
+  // view under the cursor of their window, found when no button is held.
+  InputState input;
+  struct Cursor {
+    double x{0.0};
+    double y{0.0};
+    uint32_t view{0};
+  };
+  std::vector<Cursor> cursors;
+  TripleBuffer<InputState> inputSnapshots;
+  // Read by whichever thread draws the frames.
+  InputState lastInput;
+  // Replaces the input of every camera, if given.
+  std::unique_ptr<CameraPath> cameraPath;
+  std::chrono::steady_clock::time_point lastCameraUpdate;
+  // Transforms and world bounds of the draw items, see DrawItem::node.
+  SceneCore sceneCore;
+  bool sceneCoreChanged{false};
+  Aabb sceneBounds;
+
+  bool renderThreadRunning{false};
+  std::atomic<bool> closeRequested{false};
+  std::exception_ptr renderError;
 
   std::vector<const char*> logicalDeviceExtensions{
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
   };
 
-  std::vector<VkSemaphore> imageAvailableSemaphores;
-  std::vector<VkSemaphore> renderFinishedSemaphores;
   std::vector<VkFence> inFlightFences;
   size_t currentFrame{0};
-
-  bool resizeHappended{false};
+  uint64_t frameNumber{0};
+  bool startupComplete{false};
 
   void drawFrame();
-  void createSwapChain();
-  void recreateSwapChain();
-  void cleanupSwapChain();
-  void createShaderModuleFromBinary(const std::string& filename, VkShaderModule& shaderModule);
+  void chooseSampleCount();
+  void chooseDepthFormat();
+  void createRenderPass();
+  // The first of two render passes clears, the last one leaves the target ready to present or read back.
+  // With keepTarget the target holds other views, which only the render area may overwrite.
+  VkRenderPass buildRenderPass(bool first, bool last, bool keepTarget);
+  void createPipelines();
+  void registerPipeline(VkPipeline& pipeline, const std::vector<std::string>& shaderNames, std::function<VkPipeline()> build);
+  VkPipeline buildGraphicsPipeline(const std::vector<std::string>& shaderNames);
+  VkPipeline buildComputePipeline(const std::string& shaderName);
+  void swapReloadedPipelines();
+  void destroyRetiredPipelines(bool all);
+  void createCommandBuffers();
+  void chooseSurfaceFormat();
+  void choosePresentMode();
+  void createWindow(uint32_t index);
+  uint32_t windowIndex(GLFWwindow* handle) const;
+  bool windowClosed() const;
+  void createSwapChain(uint32_t index, VkExtent2D swapExtent);
+  void recreateSwapChain(uint32_t index);
+  void destroyRetiredSwapChains(bool all);
+  void cleanupSwapChains();
+  void createViews();
+  void layoutViews(uint32_t window);
+  void createTransientAttachments(Window& window);
+  TransientAttachment createTransientAttachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkExtent2D extent);
+  void destroyTransientAttachment(TransientAttachment& attachment);
+  std::vector<VkImageView> framebufferAttachments(const Window& window, VkImageView target) const;
+  void beginCommandBuffer(VkCommandBuffer commandBuffer);
+  void endCommandBuffer(VkCommandBuffer commandBuffer);
+  // Draws every view of the windows with a framebuffer, by window index.
+  void recordViews(VkCommandBuffer commandBuffer, const std::vector<VkFramebuffer>& framebuffers);
+  void recordView(VkCommandBuffer commandBuffer, uint32_t view, VkFramebuffer framebuffer, bool firstInWindow);
+  void setViewportAndScissor(VkCommandBuffer commandBuffer, const VkRect2D& rectangle);
+  void recordDrawItems(VkCommandBuffer commandBuffer, const Mat4& viewProjection, uint32_t camera, uint32_t frame, uint32_t view, size_t first, size_t count);
+  void runResizeBenchmark();
+  void runRecordBenchmark();
+  void waitForMeshes();
+  void createOffscreenTargets();
+  void destroyOffscreenTargets();
+  void renderOffscreen();
+  void drawOffscreenFrame();
+  void writeReadback(OffscreenTarget& target);
+  void writeStats(const std::string& path) const;
+  void addDrawItems(uint32_t part);
+  void updateSceneCore();
+  uint32_t originalOf(uint32_t original) const;
+  void processMeshEvents();
+  void processLodResults();
+  void processMeshletResults();
+  void completeUploads();
+  VkPipelineStageFlags uploadWaitStages() const;
+  void updateTextures();
+  void loadMeshes(const std::vector<std::string>& paths);
+  void destroyMesh(Mesh& mesh);
+  void defragmentMeshMemory();
+  void destroyRetiredMeshBuffers(bool all);
+  Mat4 sceneTransform(const View& view) const;
+  void pollInput();
+  void publishInput();
+  void requestClose();
+  void renderLoop();
+  void updateCamera();
 
   static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+  static void cursorPositionCallback(GLFWwindow* window, double x, double y);
+  static void scrollCallback(GLFWwindow* window, double x, double y);
   static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+  static void dropCallback(GLFWwindow* window, int count, const char** paths);
 };
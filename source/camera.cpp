@@ -0,0 +1,100 @@
+#include "camera.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const Vec3 WORLD_UP{0.0f, 1.0f, 0.0f};
+
+// Near plane distance relative to the far plane when the eye is inside the scene.
+constexpr float MIN_NEAR_RATIO{1e-3f};
+// Of the distance to the target, per dragged pixel.
+constexpr float PAN_PER_PIXEL{0.001f};
+// Of the scene radius, per scroll step in fly mode.
+constexpr float FLY_SCROLL_STEP{0.1f};
+
+}
+
+void Camera::update(const CameraInput& input, const CameraInput& previous, float seconds, const Aabb& sceneBounds) {
+  bounds = sceneBounds;
+  if (input.resets != previous.resets) {
+    framing = true;
+  }
+  if ((input.modeToggles - previous.modeToggles) % 2 == 1) {
+    currentMode = currentMode == Mode::Orbit ? Mode::Fly : Mode::Orbit;
+  }
+
+  auto rotateX = float(input.rotateX - previous.rotateX);
+  auto rotateY = float(input.rotateY - previous.rotateY);
+  auto panX = float(input.panX - previous.panX);
+  auto panY = float(input.panY - previous.panY);
+  auto scroll = float(input.scroll - previous.scroll);
+  auto moving = input.move.x != 0.0f || input.move.y != 0.0f || input.move.z != 0.0f;
+  if (rotateX == 0.0f && rotateY == 0.0f && panX == 0.0f && panY == 0.0f && scroll == 0.0f && !moving) {
+    if (framing) {
+      frame();
+    }
+    return;
+  }
+  framing = false;
+
+  auto radius = bounds.valid() ? std::max(bounds.radius(), 1e-3f) : 1.0f;
+
+  if (rotateX != 0.0f || rotateY != 0.0f) {
+    auto eyeBefore = eye();
+    yaw -= rotateX * RADIANS_PER_PIXEL;
+    pitch = std::clamp(pitch + rotateY * RADIANS_PER_PIXEL, -MAX_PITCH, MAX_PITCH);
+    if (currentMode == Mode::Fly) {
+      target = eyeBefore - backward() * distance;
+    }
+  }
+
+  auto back = backward();
+  auto right = normalize(cross(WORLD_UP, back));
+  auto up = cross(back, right);
+
+  // Dragging moves the scene along with the cursor.
+  target = target - right * (panX * PAN_PER_PIXEL * distance) + up * (panY * PAN_PER_PIXEL * distance);
+
+  if (currentMode == Mode::Orbit) {
+    distance *= std::pow(ZOOM_PER_STEP, scroll);
+  } else {
+    target = target - back * (scroll * FLY_SCROLL_STEP * radius);
+  }
+
+  auto speed = radius * FLY_SPEED * (input.fast ? FAST_FACTOR : 1.0f);
+  target = target + (right * input.move.x + up * input.move.y + back * input.move.z) * (speed * seconds);
+}
+
+Vec3 Camera::eye() const {
+  return target + backward() * distance;
+}
+
+Mat4 Camera::view() const {
+  return lookAt(eye(), target, WORLD_UP);
+}
+
+Mat4 Camera::projection(float aspect) const {
+  auto radius = bounds.valid() ? std::max(bounds.radius(), 1e-3f) : 1.0f;
+  auto centerDistance = bounds.valid() ? length(eye() - bounds.center()) : distance;
+  auto zFar = centerDistance + radius;
+  auto zNear = std::max(centerDistance - radius, zFar * MIN_NEAR_RATIO);
+  return perspective(FOV_Y, aspect, zNear, zFar);
+}
+
+Vec3 Camera::backward() const {
+  return {std::sin(yaw) * std::cos(pitch), std::sin(pitch), std::cos(yaw) * std::cos(pitch)};
+}
+
+// Looks at the scene from the front, just far enough away to see all of it.
+void Camera::frame() {
+  if (!bounds.valid()) {
+    return;
+  }
+
+  target = bounds.center();
+  distance = std::max(bounds.radius(), 1e-3f) / std::sin(FOV_Y * 0.5f);
+  yaw = 0.0f;
+  pitch = 0.0f;
+}
@@ -0,0 +1,60 @@
+#include "camera_path.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+CameraPath::CameraPath(const std::string& path) {
+  std::ifstream file{path};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open camera path " + path);
+  }
+
+  std::string line;
+  auto lineNumber = 0;
+  while (std::getline(file, line)) {
+    lineNumber++;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+
+    Keyframe keyframe{};
+    std::istringstream values{line};
+    if (!(values >> keyframe.frame >> keyframe.input.rotateX >> keyframe.input.rotateY >> keyframe.input.panX >> keyframe.input.panY >> keyframe.input.scroll)) {
+      throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected frame rotateX rotateY panX panY scroll");
+    }
+    if (!keyframes.empty() && keyframe.frame <= keyframes.back().frame) {
+      throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": keyframes must be in increasing frame order");
+    }
+    keyframes.push_back(keyframe);
+  }
+
+  if (keyframes.empty()) {
+    throw std::runtime_error("Camera path " + path + " has no keyframes");
+  }
+}
+
+CameraInput CameraPath::at(uint64_t frame) const {
+  if (frame <= keyframes.front().frame) {
+    return keyframes.front().input;
+  }
+
+  for (auto i = size_t{1}; i < keyframes.size(); i++) {
+    const auto& next = keyframes[i];
+    if (frame > next.frame) {
+      continue;
+    }
+
+    const auto& previous = keyframes[i - 1];
+    auto t = double(frame - previous.frame) / double(next.frame - previous.frame);
+    auto lerp = [t](double a, double b) { return a + (b - a) * t; };
+    CameraInput input;
+    input.rotateX = lerp(previous.input.rotateX, next.input.rotateX);
+    input.rotateY = lerp(previous.input.rotateY, next.input.rotateY);
+    input.panX = lerp(previous.input.panX, next.input.panX);
+    input.panY = lerp(previous.input.panY, next.input.panY);
+    input.scroll = lerp(previous.input.scroll, next.input.scroll);
+    return input;
+  }
+  return keyframes.back().input;
+}
@@ -0,0 +1,155 @@
+#include "command_recorder.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+CommandRecorder::CommandRecorder(VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t threadCount, uint32_t frameCount)
+  : logicalDevice{logicalDevice}, workers(std::max(threadCount, 1u)) {
+  for (auto& worker : workers) {
+    worker.commandPools.resize(frameCount);
+    worker.commandBuffers.resize(frameCount);
+
+    for (auto i = uint32_t{0}; i < frameCount; i++) {
+      VkCommandPoolCreateInfo commandPoolCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queueFamilyIndex
+      };
+
+      if (vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr, &worker.commandPools[i]) != VK_SUCCESS) {
+        throw std::runtime_error("Could not create recording command pool");
+      }
+
+      VkCommandBufferAllocateInfo commandBufferAllocateInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = worker.commandPools[i],
+        .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        .commandBufferCount = 1
+      };
+
+      if (vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, &worker.commandBuffers[i]) != VK_SUCCESS) {
+        throw std::runtime_error("Could not allocate secondary command buffer");
+      }
+    }
+  }
+
+  // Worker 0 is the thread calling record().
+  for (auto i = uint32_t{1}; i < workers.size(); i++) {
+    workers[i].thread = std::thread{&CommandRecorder::workerLoop, this, i};
+  }
+}
+
+CommandRecorder::~CommandRecorder() {
+  {
+    std::lock_guard lock{mutex};
+    stopping = true;
+  }
+  workAvailable.notify_all();
+
+  for (auto& worker : workers) {
+    if (worker.thread.joinable()) {
+      worker.thread.join();
+    }
+    for (auto commandPool : worker.commandPools) {
+      vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+    }
+  }
+}
+
+const std::vector<VkCommandBuffer>& CommandRecorder::record(uint32_t frame, const VkCommandBufferInheritanceInfo& inheritanceInfo, size_t itemCount, const RecordFunction& recordFunction) {
+  auto active = uint32_t(std::clamp<size_t>(itemCount / MIN_ITEMS_PER_THREAD, 1, workers.size()));
+
+  {
+    std::lock_guard lock{mutex};
+    this->frame = frame;
+    this->inheritanceInfo = &inheritanceInfo;
+    this->recordFunction = &recordFunction;
+    this->itemCount = itemCount;
+    activeWorkers = active;
+    pendingWorkers = active - 1;
+    error = nullptr;
+    generation++;
+  }
+  if (active > 1) {
+    workAvailable.notify_all();
+  }
+
+  try {
+    recordRange(0);
+  } catch (...) {
+    std::lock_guard lock{mutex};
+    error = std::current_exception();
+  }
+
+  std::unique_lock lock{mutex};
+  workDone.wait(lock, [this] { return pendingWorkers == 0; });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  recorded.clear();
+  for (auto i = uint32_t{0}; i < active; i++) {
+    recorded.push_back(workers[i].commandBuffers[frame]);
+  }
+  return recorded;
+}
+
+void CommandRecorder::workerLoop(uint32_t index) {
+  auto seenGeneration = uint64_t{0};
+
+  while (true) {
+    {
+      std::unique_lock lock{mutex};
+      workAvailable.wait(lock, [&] { return stopping || generation != seenGeneration; });
+      if (stopping) {
+        return;
+      }
+      seenGeneration = generation;
+      if (index >= activeWorkers) {
+        continue;
+      }
+    }
+
+    std::exception_ptr recordError;
+    try {
+      recordRange(index);
+    } catch (...) {
+      recordError = std::current_exception();
+    }
+
+    {
+      std::lock_guard lock{mutex};
+      if (recordError) {
+        error = recordError;
+      }
+      pendingWorkers--;
+    }
+    workDone.notify_one();
+  }
+}
+
+void CommandRecorder::recordRange(uint32_t index) {
+  auto commandPool = workers[index].commandPools[frame];
+  auto commandBuffer = workers[index].commandBuffers[frame];
+
+  // Resetting the whole pool is cheaper than resetting its command buffers individually.
+  vkResetCommandPool(logicalDevice, commandPool, 0);
+
+  VkCommandBufferBeginInfo commandBufferBeginInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+    .pInheritanceInfo = inheritanceInfo
+  };
+
+  if (vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) != VK_SUCCESS) {
+    throw std::runtime_error("Could not begin secondary command buffer");
+  }
+
+  auto first = itemCount * index / activeWorkers;
+  auto last = itemCount * (index + 1) / activeWorkers;
+  (*recordFunction)(commandBuffer, first, last - first);
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("Could not record secondary command buffer");
+  }
+}
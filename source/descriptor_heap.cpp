@@ -0,0 +1,215 @@
+#include "descriptor_heap.hpp"
+
+#include <array>
+#include <stdexcept>
+#include <string>
+
+DescriptorHeap::DescriptorHeap(VkDevice logicalDevice, uint32_t framesInFlight, uint32_t uniformBufferCount, bool meshShaders)
+  : logicalDevice{logicalDevice}, framesInFlight{framesInFlight}, uniformBuffers{uniformBufferCount} {
+  if (uniformBufferCount == 0 || uniformBufferCount > MAX_UNIFORM_BUFFERS) {
+    throw std::runtime_error("Unsupported number of uniform buffers " + std::to_string(uniformBufferCount));
+  }
+
+  VkShaderStageFlags bufferStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+  if (meshShaders) {
+    bufferStages |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+    pushConstantStages |= VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+  }
+
+  // Compute reads the depth attachment for occlusion culling.
+  std::array<VkDescriptorSetLayoutBinding, 3> bindings{{
+    {0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_TEXTURES, VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT, nullptr},
+    {1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_BUFFERS, bufferStages, nullptr},
+    {2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uniformBufferCount, bufferStages, nullptr}
+  }};
+
+  VkDescriptorBindingFlags bindingFlag = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+    | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+  std::array<VkDescriptorBindingFlags, 3> bindingFlags{bindingFlag, bindingFlag, VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT};
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+    .bindingCount = uint32_t(bindingFlags.size()),
+    .pBindingFlags = bindingFlags.data()
+  };
+
+  VkDescriptorSetLayoutCreateInfo setLayoutCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .pNext = &bindingFlagsCreateInfo,
+    .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+    .bindingCount = uint32_t(bindings.size()),
+    .pBindings = bindings.data()
+  };
+
+  if (vkCreateDescriptorSetLayout(logicalDevice, &setLayoutCreateInfo, nullptr, &setLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create descriptor heap layout");
+  }
+
+  std::array<VkDescriptorPoolSize, 3> poolSizes{{
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, MAX_TEXTURES},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, MAX_BUFFERS},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, uniformBufferCount}
+  }};
+
+  VkDescriptorPoolCreateInfo descriptorPoolCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+    .maxSets = 1,
+    .poolSizeCount = uint32_t(poolSizes.size()),
+    .pPoolSizes = poolSizes.data()
+  };
+
+  if (vkCreateDescriptorPool(logicalDevice, &descriptorPoolCreateInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create descriptor heap pool");
+  }
+
+  VkDescriptorSetAllocateInfo descriptorSetAllocateInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    .descriptorPool = descriptorPool,
+    .descriptorSetCount = 1,
+    .pSetLayouts = &setLayout
+  };
+
+  if (vkAllocateDescriptorSets(logicalDevice, &descriptorSetAllocateInfo, &descriptorSet) != VK_SUCCESS) {
+    throw std::runtime_error("Could not allocate descriptor heap");
+  }
+
+  VkPushConstantRange pushConstantRange{
+    .stageFlags = pushConstantStages,
+    .offset = 0,
+    .size = PUSH_CONSTANT_SIZE
+  };
+
+  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &setLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &pushConstantRange
+  };
+
+  if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCreateInfo, nullptr, &layout) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create pipeline layout");
+  }
+}
+
+DescriptorHeap::~DescriptorHeap() {
+  vkDestroyPipelineLayout(logicalDevice, layout, nullptr);
+  vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
+  vkDestroyDescriptorSetLayout(logicalDevice, setLayout, nullptr);
+}
+
+uint32_t DescriptorHeap::addTexture(VkImageView view, VkSampler sampler) {
+  auto index = allocate(textures, "texture");
+
+  VkDescriptorImageInfo imageInfo{sampler, view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+  VkWriteDescriptorSet write{
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = descriptorSet,
+    .dstBinding = 0,
+    .dstArrayElement = index,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+    .pImageInfo = &imageInfo
+  };
+  vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+  return index;
+}
+
+void DescriptorHeap::removeTexture(uint32_t index) {
+  release(textures, index);
+}
+
+uint32_t DescriptorHeap::addBuffer(VkBuffer buffer) {
+  auto index = allocate(buffers, "buffer");
+  updateBuffer(index, buffer);
+  return index;
+}
+
+void DescriptorHeap::updateBuffer(uint32_t index, VkBuffer buffer) {
+  VkDescriptorBufferInfo bufferInfo{buffer, 0, VK_WHOLE_SIZE};
+  VkWriteDescriptorSet write{
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = descriptorSet,
+    .dstBinding = 1,
+    .dstArrayElement = index,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    .pBufferInfo = &bufferInfo
+  };
+  vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+}
+
+void DescriptorHeap::removeBuffer(uint32_t index) {
+  release(buffers, index);
+}
+
+uint32_t DescriptorHeap::addUniformBuffer(VkBuffer buffer) {
+  auto index = allocate(uniformBuffers, "uniform buffer");
+
+  VkDescriptorBufferInfo bufferInfo{buffer, 0, VK_WHOLE_SIZE};
+  VkWriteDescriptorSet write{
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = descriptorSet,
+    .dstBinding = 2,
+    .dstArrayElement = index,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+    .pBufferInfo = &bufferInfo
+  };
+  vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+  return index;
+}
+
+void DescriptorHeap::bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint) const {
+  vkCmdBindDescriptorSets(commandBuffer, bindPoint, layout, 0, 1, &descriptorSet, 0, nullptr);
+}
+
+void DescriptorHeap::collect(uint64_t frameNumber) {
+  this->frameNumber = frameNumber;
+  for (auto slots : {&textures, &buffers}) {
+    while (!slots->freed.empty() && slots->freed.front().freedAtFrame + framesInFlight <= frameNumber) {
+      slots->free.push_back(slots->freed.front().index);
+      slots->freed.pop_front();
+    }
+  }
+}
+
+// The shaders index the arrays with push constants, which are dynamically
+// uniform, so non-uniform indexing is not needed.
+void DescriptorHeap::requireFeatures(const VkPhysicalDeviceFeatures& supported, const VkPhysicalDeviceVulkan12Features& supportedVulkan12) {
+  if (!supported.shaderUniformBufferArrayDynamicIndexing || !supported.shaderSampledImageArrayDynamicIndexing || !supported.shaderStorageBufferArrayDynamicIndexing
+      || !supportedVulkan12.descriptorIndexing || !supportedVulkan12.runtimeDescriptorArray || !supportedVulkan12.descriptorBindingPartiallyBound
+      || !supportedVulkan12.descriptorBindingSampledImageUpdateAfterBind || !supportedVulkan12.descriptorBindingStorageBufferUpdateAfterBind
+      || !supportedVulkan12.descriptorBindingUpdateUnusedWhilePending) {
+    throw std::runtime_error("Descriptor indexing is not supported");
+  }
+}
+
+void DescriptorHeap::enableFeatures(VkPhysicalDeviceFeatures& features, VkPhysicalDeviceVulkan12Features& vulkan12Features) {
+  features.shaderUniformBufferArrayDynamicIndexing = VK_TRUE;
+  features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+  features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+  vulkan12Features.descriptorIndexing = VK_TRUE;
+  vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+  vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+  vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+  vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+}
+
+uint32_t DescriptorHeap::allocate(SlotArray& slots, const char* kind) {
+  if (!slots.free.empty()) {
+    auto index = slots.free.back();
+    slots.free.pop_back();
+    return index;
+  }
+  if (slots.next == slots.capacity) {
+    throw std::runtime_error(std::string{"Descriptor heap is out of "} + kind + " slots");
+  }
+  return slots.next++;
+}
+
+void DescriptorHeap::release(SlotArray& slots, uint32_t index) {
+  slots.freed.push_back({index, frameNumber});
+}
@@ -0,0 +1,28 @@
+#include "frame_pacer.hpp"
+
+#include <thread>
+
+FramePacer::FramePacer(double refreshRate)
+  : period{std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / (refreshRate > 0.0 ? refreshRate : 60.0)))},
+    deadline{Clock::now()}, frameStart{deadline} {
+}
+
+void FramePacer::waitForNextFrame() {
+  auto work = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(workEstimate * SAFETY_FACTOR)) + MARGIN;
+  auto now = Clock::now();
+
+  deadline += period;
+  if (deadline - work < now) {
+    // Running late (or the first frame): start now and lock the cadence to this frame.
+    deadline = now + work;
+  } else {
+    std::this_thread::sleep_until(deadline - work);
+  }
+
+  frameStart = Clock::now();
+}
+
+void FramePacer::frameSubmitted() {
+  auto work = std::chrono::duration<double>(Clock::now() - frameStart).count();
+  workEstimate = workEstimate == 0.0 ? work : workEstimate + SMOOTHING * (work - workEstimate);
+}
@@ -0,0 +1,522 @@
+#include "gpu_scene.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+static_assert(sizeof(GpuObject) == 112, "GpuObject must match the std430 layout of Object in the shaders");
+static_assert(sizeof(GpuMeshInfo) == 32, "GpuMeshInfo must match the std430 layout of MeshInfo in cull.comp");
+static_assert(sizeof(GpuClusterDispatch) == 16, "GpuClusterDispatch must match the std430 layout of ClusterDispatch in cull.comp");
+static_assert(sizeof(ClusterPushConstants) <= DescriptorHeap::PUSH_CONSTANT_SIZE, "Cluster push constants exceed the shared range");
+static_assert(sizeof(GpuCullStats) == 16, "GpuCullStats must match the std430 layout of CullStats in cull.comp");
+
+namespace {
+
+constexpr uint32_t CULL_WORKGROUP_SIZE{64};
+// The local size of depth_pyramid.comp in both dimensions.
+constexpr uint32_t PYRAMID_WORKGROUP_SIZE{8};
+constexpr VkDeviceSize INITIAL_OBJECT_CAPACITY{1024};
+constexpr VkDeviceSize INITIAL_MESH_CAPACITY{64};
+// The objects of a mesh are the second dimension of its cluster workgroups,
+// and every device supports 65535 workgroups per dimension.
+constexpr uint32_t MAX_CLUSTER_OBJECTS{65535};
+// Bounds the cluster commands of the compute path (80 MiB) and the task
+// workgroups of one mesh shader draw, the smallest maxTaskWorkGroupTotalCount.
+constexpr VkDeviceSize MAX_CLUSTER_DRAWS{1 << 22};
+
+const VkMemoryPropertyFlags UPLOAD_MEMORY{VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+VkDeviceSize commandBytes(VkDeviceSize meshCount) {
+  return alignUp(std::max<VkDeviceSize>(meshCount, 1) * MAX_LOD_LEVELS * sizeof(VkDrawIndexedIndirectCommand), 16);
+}
+
+VkDeviceSize meshInfoBytes(VkDeviceSize meshCount) {
+  return std::max<VkDeviceSize>(meshCount, 1) * sizeof(GpuMeshInfo);
+}
+
+VkDeviceSize dispatchBytes(VkDeviceSize meshCount) {
+  return std::max<VkDeviceSize>(meshCount, 1) * sizeof(GpuClusterDispatch);
+}
+
+VkDeviceSize countBytes(VkDeviceSize meshCount) {
+  return std::max<VkDeviceSize>(meshCount, 1) * sizeof(uint32_t);
+}
+
+// Upload slot layout: commands, mesh infos, cluster dispatches, then the objects.
+VkDeviceSize meshBytes(VkDeviceSize meshCount) {
+  return commandBytes(meshCount) + meshInfoBytes(meshCount) + dispatchBytes(meshCount);
+}
+
+uint32_t workgroupCount(uint32_t meshletCount) {
+  return (meshletCount + MESHLETS_PER_WORKGROUP - 1) / MESHLETS_PER_WORKGROUP;
+}
+
+const VkBufferUsageFlags CLUSTER_BUFFER_USAGE{VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+const VkBufferUsageFlags VISIBILITY_BUFFER_USAGE{VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+const VkBufferUsageFlags STATS_BUFFER_USAGE{VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT};
+
+}
+
+GpuScene::GpuScene(VkDevice logicalDevice, MemoryAllocator& memoryAllocator, DescriptorHeap& descriptorHeap, uint32_t frameCount, uint32_t viewCount,
+    bool clusters, PFN_vkCmdDrawMeshTasksIndirectEXT drawMeshTasksIndirect, bool occlusionCulling)
+  : logicalDevice{logicalDevice}, memoryAllocator{memoryAllocator}, descriptorHeap{descriptorHeap}, clusters{clusters},
+    drawMeshTasksIndirect{drawMeshTasksIndirect}, occlusionCulling{occlusionCulling}, uploadSlots(frameCount), views(viewCount) {
+  if (drawMeshTasksIndirect != nullptr) {
+    drawStages |= VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT;
+  }
+
+  ensureCapacity(objects, INITIAL_OBJECT_CAPACITY * sizeof(GpuObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(visibleObjects, INITIAL_OBJECT_CAPACITY * MAX_LOD_LEVELS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(drawCommands, commandBytes(INITIAL_MESH_CAPACITY), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(meshInfos, meshInfoBytes(INITIAL_MESH_CAPACITY), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(clusterDispatches, dispatchBytes(INITIAL_MESH_CAPACITY), CLUSTER_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(clusterCounts, countBytes(INITIAL_MESH_CAPACITY), CLUSTER_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(clusterCommands, sizeof(VkDrawIndexedIndirectCommand), CLUSTER_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(depthPyramid, sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ensureCapacity(stats, sizeof(GpuCullStats), STATS_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  for (auto buffer : {&objects, &drawCommands, &visibleObjects, &meshInfos, &clusterDispatches, &clusterCounts, &clusterCommands, &depthPyramid, &stats}) {
+    buffer->index = descriptorHeap.addBuffer(buffer->buffer);
+  }
+  for (auto& view : views) {
+    ensureCapacity(view.visibility, INITIAL_OBJECT_CAPACITY * sizeof(uint32_t), VISIBILITY_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    view.visibility.index = descriptorHeap.addBuffer(view.visibility.buffer);
+  }
+  for (auto& slot : uploadSlots) {
+    ensureCapacity(slot.statsReadback, sizeof(GpuCullStats), VK_BUFFER_USAGE_TRANSFER_DST_BIT, UPLOAD_MEMORY);
+  }
+}
+
+GpuScene::~GpuScene() {
+  for (auto& slot : uploadSlots) {
+    memoryAllocator.destroyBuffer(slot.upload.buffer, slot.upload.allocation);
+    memoryAllocator.destroyBuffer(slot.statsReadback.buffer, slot.statsReadback.allocation);
+    for (auto& buffer : slot.retiredBuffers) {
+      memoryAllocator.destroyBuffer(buffer.buffer, buffer.allocation);
+    }
+  }
+  memoryAllocator.destroyBuffer(drawCommands.buffer, drawCommands.allocation);
+  memoryAllocator.destroyBuffer(meshInfos.buffer, meshInfos.allocation);
+  memoryAllocator.destroyBuffer(visibleObjects.buffer, visibleObjects.allocation);
+  memoryAllocator.destroyBuffer(objects.buffer, objects.allocation);
+  memoryAllocator.destroyBuffer(clusterDispatches.buffer, clusterDispatches.allocation);
+  memoryAllocator.destroyBuffer(clusterCounts.buffer, clusterCounts.allocation);
+  memoryAllocator.destroyBuffer(clusterCommands.buffer, clusterCommands.allocation);
+  memoryAllocator.destroyBuffer(depthPyramid.buffer, depthPyramid.allocation);
+  memoryAllocator.destroyBuffer(stats.buffer, stats.allocation);
+
+  for (auto buffer : {&objects, &drawCommands, &visibleObjects, &meshInfos, &clusterDispatches, &clusterCounts, &clusterCommands, &depthPyramid, &stats}) {
+    descriptorHeap.removeBuffer(buffer->index);
+  }
+  for (auto& view : views) {
+    memoryAllocator.destroyBuffer(view.visibility.buffer, view.visibility.allocation);
+    descriptorHeap.removeBuffer(view.visibility.index);
+  }
+}
+
+void GpuScene::update(uint32_t frame, const std::vector<Mesh>& meshes, const std::vector<DrawItem>& drawItems, uint64_t version, const std::vector<VkExtent2D>& viewports) {
+  auto& slot = uploadSlots[frame];
+  for (auto& buffer : slot.retiredBuffers) {
+    memoryAllocator.destroyBuffer(buffer.buffer, buffer.allocation);
+  }
+  slot.retiredBuffers.clear();
+
+  for (auto i = size_t{0}; occlusionCulling && i < views.size(); i++) {
+    auto& view = views[i];
+    if (viewports[i].width != view.pyramidViewport.width || viewports[i].height != view.pyramidViewport.height) {
+      updateDepthPyramid(slot, view, viewports[i]);
+    }
+  }
+
+  auto objectBytes = std::max<VkDeviceSize>(drawItems.size(), 1) * sizeof(GpuObject);
+
+  if (version != this->version) {
+    // Every level of a mesh gets room for all of its objects.
+    meshObjectCounts.assign(meshes.size(), 0);
+    for (const auto& drawItem : drawItems) {
+      meshObjectCounts[drawItem.mesh]++;
+    }
+    visibleOffsets.assign(meshes.size(), 0);
+    for (auto i = size_t{1}; i < meshes.size(); i++) {
+      visibleOffsets[i] = visibleOffsets[i - 1] + meshObjectCounts[i - 1] * MAX_LOD_LEVELS;
+    }
+
+    // Without mesh shaders, every object of a clustered mesh gets room for a
+    // command per meshlet. Meshes beyond the limits are culled as whole objects.
+    clusteredMeshes.assign(meshes.size(), false);
+    clusterCommandOffsets.assign(meshes.size(), 0);
+    clusteredMeshCount = 0;
+    auto clusterCommandCount = VkDeviceSize{0};
+    for (auto i = uint32_t{0}; clusters && i < meshes.size(); i++) {
+      const auto& layout = meshes[i].meshletLayout;
+      auto objectCount = meshObjectCounts[i];
+      if (!meshes[i].ready || layout.meshletCount == 0 || objectCount == 0 || objectCount > MAX_CLUSTER_OBJECTS) {
+        continue;
+      }
+      auto draws = drawMeshTasksIndirect != nullptr ? VkDeviceSize{workgroupCount(layout.meshletCount)} * objectCount : clusterCommandCount + VkDeviceSize{layout.meshletCount} * objectCount;
+      if (draws > MAX_CLUSTER_DRAWS) {
+        continue;
+      }
+      clusteredMeshes[i] = true;
+      clusteredMeshCount++;
+      if (drawMeshTasksIndirect == nullptr) {
+        clusterCommandOffsets[i] = uint32_t(clusterCommandCount);
+        clusterCommandCount = draws;
+      }
+    }
+    auto clusterCommandBytes = std::max<VkDeviceSize>(clusterCommandCount, 1) * sizeof(VkDrawIndexedIndirectCommand);
+
+    // Growing the shared device buffers is rare (they double), so it is fine to
+    // wait for the frames still reading them instead of deferring destruction.
+    if (objects.size < objectBytes || drawCommands.size < commandBytes(meshes.size()) || clusterCommands.size < clusterCommandBytes) {
+      vkDeviceWaitIdle(logicalDevice);
+      ensureCapacity(objects, std::max(objectBytes, objects.size * 2), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      ensureCapacity(visibleObjects, objects.size / sizeof(GpuObject) * MAX_LOD_LEVELS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      for (auto& view : views) {
+        ensureCapacity(view.visibility, objects.size / sizeof(GpuObject) * sizeof(uint32_t), VISIBILITY_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      }
+      ensureCapacity(drawCommands, commandBytes(meshes.size()), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      ensureCapacity(meshInfos, meshInfoBytes(meshes.size()), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      ensureCapacity(clusterDispatches, dispatchBytes(meshes.size()), CLUSTER_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      ensureCapacity(clusterCounts, countBytes(meshes.size()), CLUSTER_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      if (clusterCommands.size < clusterCommandBytes) {
+        ensureCapacity(clusterCommands, std::max(clusterCommandBytes, clusterCommands.size * 2), CLUSTER_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      }
+      updateDescriptors();
+    }
+
+    ensureCapacity(slot.upload, meshBytes(meshes.size()) + objectBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, UPLOAD_MEMORY);
+
+    auto gpuObjects = reinterpret_cast<GpuObject*>(static_cast<char*>(slot.upload.allocation.mapped) + meshBytes(meshes.size()));
+    for (auto i = size_t{0}; i < drawItems.size(); i++) {
+      const auto& drawItem = drawItems[i];
+      gpuObjects[i] = {drawItem.model, drawItem.bounds.min, drawItem.mesh, drawItem.bounds.max, visibleOffsets[drawItem.mesh], drawItem.viewMask, {}};
+    }
+
+    slot.copyObjects = true;
+    objectCount = uint32_t(drawItems.size());
+    meshCount = uint32_t(meshes.size());
+    this->version = version;
+  }
+
+  // Meshes finish loading and gain levels without changing the objects, so
+  // the commands, LOD tables and cluster dispatches are written every frame.
+  ensureCapacity(slot.upload, meshBytes(meshCount), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, UPLOAD_MEMORY);
+  auto commands = static_cast<VkDrawIndexedIndirectCommand*>(slot.upload.allocation.mapped);
+  auto infos = reinterpret_cast<GpuMeshInfo*>(static_cast<char*>(slot.upload.allocation.mapped) + commandBytes(meshCount));
+  auto dispatches = reinterpret_cast<GpuClusterDispatch*>(static_cast<char*>(slot.upload.allocation.mapped) + commandBytes(meshCount) + meshInfoBytes(meshCount));
+  for (auto i = uint32_t{0}; i < meshCount; i++) {
+    const auto& mesh = meshes[i];
+    auto levelCount = mesh.ready ? uint32_t(mesh.lods.size()) + 1 : 1;
+
+    GpuMeshInfo info{};
+    info.lodCount = levelCount;
+    info.objectCount = meshObjectCounts[i];
+    info.clustered = clusteredMeshes[i];
+    dispatches[i] = {clusteredMeshes[i] ? workgroupCount(mesh.meshletLayout.meshletCount) : 0, 0, 1, 0};
+    commands[i * MAX_LOD_LEVELS] = {mesh.ready ? mesh.indexCount : 0, 0, 0, 0, 0};
+    for (auto level = uint32_t{1}; level < MAX_LOD_LEVELS; level++) {
+      if (level < levelCount) {
+        const auto& lod = mesh.lods[level - 1];
+        commands[i * MAX_LOD_LEVELS + level] = {lod.indexCount, 0, lod.firstIndex, 0, 0};
+        info.lodErrors[level] = lod.error;
+      } else {
+        commands[i * MAX_LOD_LEVELS + level] = {0, 0, 0, 0, 0};
+      }
+    }
+    infos[i] = info;
+  }
+}
+
+bool GpuScene::readStats(uint32_t frame, GpuCullStats& stats) {
+  auto& slot = uploadSlots[frame];
+  if (!slot.statsRecorded) {
+    return false;
+  }
+
+  std::memcpy(&stats, slot.statsReadback.allocation.mapped, sizeof(stats));
+  slot.statsRecorded = false;
+  return true;
+}
+
+void GpuScene::recordUploads(VkCommandBuffer commandBuffer, uint32_t frame) {
+  auto& slot = uploadSlots[frame];
+  if (objectCount == 0) {
+    return;
+  }
+
+  // The previous frame may still be reading the buffers about to be
+  // overwritten, and its visibility flags are read by this frame's culling.
+  VkMemoryBarrier writeAfterReadBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | drawStages | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &writeAfterReadBarrier, 0, nullptr, 0, nullptr);
+
+  VkBufferCopy meshInfoCopy{commandBytes(meshCount), 0, meshCount * sizeof(GpuMeshInfo)};
+  vkCmdCopyBuffer(commandBuffer, slot.upload.buffer, meshInfos.buffer, 1, &meshInfoCopy);
+  if (slot.copyObjects) {
+    VkBufferCopy objectCopy{meshBytes(meshCount), 0, objectCount * sizeof(GpuObject)};
+    vkCmdCopyBuffer(commandBuffer, slot.upload.buffer, objects.buffer, 1, &objectCopy);
+    // A changed scene starts over with nothing visible.
+    for (const auto& view : views) {
+      vkCmdFillBuffer(commandBuffer, view.visibility.buffer, 0, objectCount * sizeof(uint32_t), 0);
+    }
+    slot.copyObjects = false;
+  }
+  vkCmdFillBuffer(commandBuffer, stats.buffer, 0, sizeof(GpuCullStats), 0);
+}
+
+void GpuScene::recordCulling(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t view, VkPipeline cullPipeline, VkPipeline clusterCullPipeline, const std::vector<Mesh>& meshes,
+    uint32_t camera, VkExtent2D viewport, float maxPixelError) {
+  if (objectCount == 0) {
+    return;
+  }
+
+  recordResetDraws(commandBuffer, uploadSlots[frame]);
+  recordCullPass(commandBuffer, view, occlusionCulling ? CullPhase::LastVisible : CullPhase::All, cullPipeline, clusterCullPipeline, meshes, camera, viewport, maxPixelError);
+}
+
+void GpuScene::recordOcclusionCulling(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t view, VkPipeline cullPipeline, VkPipeline clusterCullPipeline, VkPipeline depthPyramidPipeline,
+    const std::vector<Mesh>& meshes, uint32_t camera, VkRect2D viewport, float maxPixelError, uint32_t depthTexture, uint32_t sampleCount) {
+  if (objectCount == 0) {
+    return;
+  }
+
+  recordResetDraws(commandBuffer, uploadSlots[frame]);
+
+  // The render pass dependency makes the depth writes visible to compute.
+  VkMemoryBarrier levelBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
+  descriptorHeap.bind(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE);
+  const auto& pyramidLevels = views[view].pyramidLevels;
+  for (auto level = uint32_t{0}; level < pyramidLevels.size(); level++) {
+    const auto& target = pyramidLevels[level];
+    DepthPyramidPushConstants pushConstants{depthTexture, uint32_t(viewport.offset.x), uint32_t(viewport.offset.y), sampleCount, depthPyramid.index, level,
+      0, viewport.extent.width, viewport.extent.height, target.offset, target.width, target.height};
+    if (level > 0) {
+      const auto& source = pyramidLevels[level - 1];
+      pushConstants.sourceOffset = source.offset;
+      pushConstants.sourceWidth = source.width;
+      pushConstants.sourceHeight = source.height;
+    }
+    descriptorHeap.pushConstants(commandBuffer, pushConstants);
+    vkCmdDispatch(commandBuffer, (target.width + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE, (target.height + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE, 1);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+  }
+
+  recordCullPass(commandBuffer, view, CullPhase::NewlyVisible, cullPipeline, clusterCullPipeline, meshes, camera, viewport.extent, maxPixelError);
+}
+
+void GpuScene::recordResetDraws(VkCommandBuffer commandBuffer, const UploadSlot& slot) {
+  // The render pass before (of this view or the one before it) has drawn
+  // from the commands about to be reset, and the culling before has added
+  // to the stats the next culling adds to.
+  VkMemoryBarrier writeAfterReadBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | drawStages | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &writeAfterReadBarrier, 0, nullptr, 0, nullptr);
+
+  VkBufferCopy commandCopy{0, 0, meshCount * MAX_LOD_LEVELS * sizeof(VkDrawIndexedIndirectCommand)};
+  vkCmdCopyBuffer(commandBuffer, slot.upload.buffer, drawCommands.buffer, 1, &commandCopy);
+  VkBufferCopy dispatchCopy{commandBytes(meshCount) + meshInfoBytes(meshCount), 0, meshCount * sizeof(GpuClusterDispatch)};
+  vkCmdCopyBuffer(commandBuffer, slot.upload.buffer, clusterDispatches.buffer, 1, &dispatchCopy);
+  if (clusteredMeshCount > 0 && drawMeshTasksIndirect == nullptr) {
+    vkCmdFillBuffer(commandBuffer, clusterCounts.buffer, 0, countBytes(meshCount), 0);
+  }
+
+  VkMemoryBarrier uploadBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &uploadBarrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuScene::recordCullPass(VkCommandBuffer commandBuffer, uint32_t view, CullPhase phase, VkPipeline cullPipeline, VkPipeline clusterCullPipeline,
+    const std::vector<Mesh>& meshes, uint32_t camera, VkExtent2D viewport, float maxPixelError) {
+  const auto& pyramidLevels = views[view].pyramidLevels;
+  auto pyramidWidth = pyramidLevels.empty() ? 0 : pyramidLevels.front().width;
+  auto pyramidHeight = pyramidLevels.empty() ? 0 : pyramidLevels.front().height;
+  CullPushConstants pushConstants{camera, objectCount, float(viewport.width), float(viewport.height), maxPixelError,
+    objects.index, drawCommands.index, visibleObjects.index, meshInfos.index, clusterDispatches.index,
+    phase, views[view].visibility.index, stats.index, depthPyramid.index, pyramidWidth, pyramidHeight, uint32_t(pyramidLevels.size()), 1u << view};
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+  descriptorHeap.bind(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE);
+  descriptorHeap.pushConstants(commandBuffer, pushConstants);
+  vkCmdDispatch(commandBuffer, (objectCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+  auto clusterPass = clusteredMeshCount > 0 && drawMeshTasksIndirect == nullptr;
+  VkMemoryBarrier cullBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | drawStages | (clusterPass ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : 0),
+    0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+  if (!clusterPass) {
+    return;
+  }
+
+  // One indirect dispatch per clustered mesh, sized by its visible objects.
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, clusterCullPipeline);
+  for (auto i = uint32_t{0}; i < meshCount; i++) {
+    if (!clusteredMeshes[i]) {
+      continue;
+    }
+
+    const auto& mesh = meshes[i];
+    ClusterPushConstants clusterPushConstants{0, camera, objects.index, visibleObjects.index, visibleOffsets[i], mesh.meshletBufferIndex, mesh.meshletLayout.meshletCount,
+      clusterCommands.index, clusterCommandOffsets[i], clusterCounts.index, i, 0, 0, 0};
+    descriptorHeap.pushConstants(commandBuffer, clusterPushConstants);
+    vkCmdDispatchIndirect(commandBuffer, clusterDispatches.buffer, i * sizeof(GpuClusterDispatch));
+  }
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | drawStages,
+    0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuScene::recordStatsReadback(VkCommandBuffer commandBuffer, uint32_t frame) {
+  auto& slot = uploadSlots[frame];
+  if (objectCount == 0) {
+    return;
+  }
+
+  VkMemoryBarrier statsBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &statsBarrier, 0, nullptr, 0, nullptr);
+
+  VkBufferCopy statsCopy{0, 0, sizeof(GpuCullStats)};
+  vkCmdCopyBuffer(commandBuffer, stats.buffer, slot.statsReadback.buffer, 1, &statsCopy);
+
+  VkMemoryBarrier hostBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_HOST_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+  slot.statsRecorded = true;
+}
+
+void GpuScene::recordDraws(VkCommandBuffer commandBuffer, uint32_t camera, const std::vector<Mesh>& meshes, const TextureStreamer& textureStreamer, VkPipeline clusterPipeline) {
+  if (objectCount == 0) {
+    return;
+  }
+
+  for (auto i = uint32_t{0}; i < meshCount; i++) {
+    const auto& mesh = meshes[i];
+    if (!mesh.ready || meshObjectCounts[i] == 0) {
+      continue;
+    }
+
+    auto texture = textureStreamer.textureIndex(mesh.texture);
+    auto offset = VkDeviceSize{0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mesh.vertexBuffer, &offset);
+    for (auto level = uint32_t{0}; level <= mesh.lods.size(); level++) {
+      if (level == 0 && clusteredMeshes[i]) {
+        continue;
+      }
+      if (level <= 1) {
+        vkCmdBindIndexBuffer(commandBuffer, level == 0 ? mesh.indexBuffer : mesh.lodIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+      }
+
+      IndirectPushConstants pushConstants{texture, camera, visibleOffsets[i] + level * meshObjectCounts[i], objects.index, visibleObjects.index};
+      descriptorHeap.pushConstants(commandBuffer, pushConstants);
+      vkCmdDrawIndexedIndirect(commandBuffer, drawCommands.buffer, (i * MAX_LOD_LEVELS + level) * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+    }
+  }
+
+  if (clusteredMeshCount == 0) {
+    return;
+  }
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, clusterPipeline);
+  for (auto i = uint32_t{0}; i < meshCount; i++) {
+    if (!clusteredMeshes[i]) {
+      continue;
+    }
+
+    const auto& mesh = meshes[i];
+    const auto& layout = mesh.meshletLayout;
+    ClusterPushConstants pushConstants{textureStreamer.textureIndex(mesh.texture), camera, objects.index, visibleObjects.index, visibleOffsets[i], mesh.meshletBufferIndex,
+      layout.meshletCount, 0, 0, 0, i, mesh.vertexBufferIndex, layout.vertexOffset, layout.triangleOffset};
+    descriptorHeap.pushConstants(commandBuffer, pushConstants);
+
+    if (drawMeshTasksIndirect != nullptr) {
+      drawMeshTasksIndirect(commandBuffer, clusterDispatches.buffer, i * sizeof(GpuClusterDispatch), 1, sizeof(GpuClusterDispatch));
+      continue;
+    }
+
+    // The meshlets' triangles index the mesh's vertex buffer.
+    auto offset = VkDeviceSize{0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mesh.vertexBuffer, &offset);
+    vkCmdBindIndexBuffer(commandBuffer, mesh.meshletBuffer, layout.indexOffset, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexedIndirectCount(commandBuffer, clusterCommands.buffer, clusterCommandOffsets[i] * sizeof(VkDrawIndexedIndirectCommand), clusterCounts.buffer,
+      i * sizeof(uint32_t), meshObjectCounts[i] * layout.meshletCount, sizeof(VkDrawIndexedIndirectCommand));
+  }
+}
+
+void GpuScene::ensureCapacity(Buffer& buffer, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
+  if (buffer.size >= size) {
+    return;
+  }
+
+  memoryAllocator.destroyBuffer(buffer.buffer, buffer.allocation);
+  memoryAllocator.createBuffer(size, usage, properties, buffer.buffer, buffer.allocation);
+  buffer.size = size;
+}
+
+void GpuScene::updateDescriptors() {
+  for (auto buffer : {&objects, &drawCommands, &visibleObjects, &meshInfos, &clusterDispatches, &clusterCounts, &clusterCommands}) {
+    descriptorHeap.updateBuffer(buffer->index, buffer->buffer);
+  }
+  for (auto& view : views) {
+    descriptorHeap.updateBuffer(view.visibility.index, view.visibility.buffer);
+  }
+}
+
+// Level 0 halves the viewport, rounding up so that every depth texel is
+// covered; the last level is a single texel. A larger pyramid gets a new
+// buffer and heap slot, as the frames in flight may still read the old ones;
+// resizing a window never waits for the device.
+void GpuScene::updateDepthPyramid(UploadSlot& slot, ViewState& view, VkExtent2D viewport) {
+  auto& pyramidLevels = view.pyramidLevels;
+  pyramidLevels.clear();
+  auto width = std::max((viewport.width + 1) / 2, 1u);
+  auto height = std::max((viewport.height + 1) / 2, 1u);
+  auto texelCount = uint32_t{0};
+  while (true) {
+    pyramidLevels.push_back({texelCount, width, height});
+    texelCount += width * height;
+    if (width == 1 && height == 1) {
+      break;
+    }
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+  }
+  view.pyramidViewport = viewport;
+
+  if (depthPyramid.size < texelCount * sizeof(float)) {
+    slot.retiredBuffers.push_back(depthPyramid);
+    descriptorHeap.removeBuffer(depthPyramid.index);
+    depthPyramid = {};
+    ensureCapacity(depthPyramid, texelCount * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    depthPyramid.index = descriptorHeap.addBuffer(depthPyramid.buffer);
+  }
+}
@@ -0,0 +1,179 @@
+#include "image_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+std::vector<uint8_t> toRgb(const std::vector<uint8_t>& rgba) {
+  std::vector<uint8_t> rgb(rgba.size() / 4 * 3);
+  for (size_t i = 0, j = 0; i < rgba.size(); i += 4, j += 3) {
+    rgb[j] = rgba[i];
+    rgb[j + 1] = rgba[i + 1];
+    rgb[j + 2] = rgba[i + 2];
+  }
+  return rgb;
+}
+
+void writePpm(std::ofstream& file, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb) {
+  file << "P6\n" << width << " " << height << "\n255\n";
+  file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+}
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> table;
+    for (auto i = uint32_t{0}; i < 256; i++) {
+      auto c = i;
+      for (auto k = 0; k < 8; k++) {
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[i] = c;
+    }
+    return table;
+  }();
+
+  crc = ~crc;
+  for (auto i = size_t{0}; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void appendBigEndian(std::vector<uint8_t>& data, uint32_t value) {
+  data.push_back(uint8_t(value >> 24));
+  data.push_back(uint8_t(value >> 16));
+  data.push_back(uint8_t(value >> 8));
+  data.push_back(uint8_t(value));
+}
+
+void writeChunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data) {
+  std::vector<uint8_t> chunk;
+  chunk.reserve(data.size() + 12);
+  appendBigEndian(chunk, uint32_t(data.size()));
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  appendBigEndian(chunk, crc32(chunk.data() + 4, data.size() + 4));
+  file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+// The image data is stored in uncompressed deflate blocks: no zlib dependency,
+// and encoding stays far cheaper than rendering. Files are roughly as large as
+// the equivalent PPM.
+void writePng(std::ofstream& file, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb) {
+  constexpr size_t MAX_STORED_BLOCK{65535};
+
+  auto rowSize = size_t{width} * 3;
+  std::vector<uint8_t> scanlines;
+  scanlines.reserve((rowSize + 1) * height);
+  for (auto y = uint32_t{0}; y < height; y++) {
+    scanlines.push_back(0);
+    scanlines.insert(scanlines.end(), rgb.begin() + y * rowSize, rgb.begin() + (y + 1) * rowSize);
+  }
+
+  std::vector<uint8_t> zlib{0x78, 0x01};
+  zlib.reserve(scanlines.size() + scanlines.size() / MAX_STORED_BLOCK * 5 + 16);
+  for (auto offset = size_t{0}; offset < scanlines.size() || offset == 0; offset += MAX_STORED_BLOCK) {
+    auto size = std::min(MAX_STORED_BLOCK, scanlines.size() - offset);
+    auto last = offset + size == scanlines.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(uint8_t(size));
+    zlib.push_back(uint8_t(size >> 8));
+    zlib.push_back(uint8_t(~size));
+    zlib.push_back(uint8_t(~size >> 8));
+    zlib.insert(zlib.end(), scanlines.begin() + offset, scanlines.begin() + offset + size);
+    if (last) {
+      break;
+    }
+  }
+
+  auto a = uint32_t{1};
+  auto b = uint32_t{0};
+  for (auto byte : scanlines) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  appendBigEndian(zlib, (b << 16) | a);
+
+  std::vector<uint8_t> header;
+  appendBigEndian(header, width);
+  appendBigEndian(header, height);
+  header.insert(header.end(), {8, 2, 0, 0, 0});
+
+  const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+  writeChunk(file, "IHDR", header);
+  writeChunk(file, "IDAT", zlib);
+  writeChunk(file, "IEND", {});
+}
+
+}
+
+ImageWriter::ImageWriter(size_t maxQueuedImages)
+  : maxQueuedImages{maxQueuedImages} {
+  worker = std::thread{&ImageWriter::writeLoop, this};
+}
+
+ImageWriter::~ImageWriter() {
+  finish();
+  {
+    std::lock_guard lock{mutex};
+    stopping = true;
+  }
+  queueChanged.notify_all();
+  worker.join();
+}
+
+void ImageWriter::write(const std::string& path, uint32_t width, uint32_t height, std::vector<uint8_t>&& rgba) {
+  std::unique_lock lock{mutex};
+  queueChanged.wait(lock, [this] { return images.size() < maxQueuedImages; });
+  images.push_back({path, width, height, std::move(rgba)});
+  queueChanged.notify_all();
+}
+
+void ImageWriter::finish() {
+  std::unique_lock lock{mutex};
+  queueChanged.wait(lock, [this] { return images.empty() && !writing; });
+}
+
+void ImageWriter::writeLoop() {
+  while (true) {
+    Image image;
+    {
+      std::unique_lock lock{mutex};
+      queueChanged.wait(lock, [this] { return stopping || !images.empty(); });
+      if (images.empty()) {
+        return;
+      }
+      image = std::move(images.front());
+      images.pop_front();
+      writing = true;
+    }
+    queueChanged.notify_all();
+
+    try {
+      std::ofstream file{image.path, std::ios::binary | std::ios::trunc};
+      if (!file.is_open()) {
+        throw std::runtime_error("Could not open " + image.path);
+      }
+
+      auto rgb = toRgb(image.rgba);
+      if (image.path.size() >= 4 && image.path.compare(image.path.size() - 4, 4, ".ppm") == 0) {
+        writePpm(file, image.width, image.height, rgb);
+      } else {
+        writePng(file, image.width, image.height, rgb);
+      }
+    } catch (const std::exception& exception) {
+      std::cerr << exception.what() << std::endl;
+    }
+
+    {
+      std::lock_guard lock{mutex};
+      writing = false;
+    }
+    queueChanged.notify_all();
+  }
+}
@@ -0,0 +1,148 @@
+#include "job_system.hpp"
+#include "lod_builder.hpp"
+#include "mesh_loader.hpp"
+#include "meshlet_builder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Imports the given files the way the viewer does, parsing, deduplicating
+// and building meshlets and LODs, without uploading anything, with 1, 2,
+// 4, ... job threads, and prints the time and speedup of each. Neither the
+// mesh cache nor the LOD cache is used, so every run does all the work.
+namespace {
+
+struct Options {
+  std::vector<std::string> paths;
+  uint32_t maxThreads{0};
+};
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  options.maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (auto i = 1; i < argc; i++) {
+    auto arg = std::string{argv[i]};
+    if (arg == "--max-threads" && i + 1 < argc) {
+      options.maxThreads = std::max(uint32_t(std::stoul(argv[++i])), 1u);
+    } else if (arg.rfind("--", 0) == 0) {
+      throw std::runtime_error("Usage: import_benchmark [--max-threads N] mesh files...");
+    } else {
+      options.paths.push_back(arg);
+    }
+  }
+  if (options.paths.empty()) {
+    throw std::runtime_error("Usage: import_benchmark [--max-threads N] mesh files...");
+  }
+  return options;
+}
+
+struct ImportStats {
+  uint32_t meshes{0};
+  uint32_t duplicates{0};
+  uint64_t triangles{0};
+};
+
+// Feeds the builders like Viewer::processMeshEvents(): duplicates are
+// recognized by content hash and never built.
+ImportStats import(JobSystem& jobSystem, const std::vector<std::string>& paths) {
+  LodBuilder lodBuilder{jobSystem, false};
+  MeshletBuilder meshletBuilder{jobSystem};
+  MeshLoader loader{jobSystem, paths, "", false, 0, {}};
+
+  ImportStats stats;
+  std::unordered_set<uint64_t> contents;
+  std::vector<bool> duplicate(paths.size());
+  MeshLoadEvent event;
+  while (!loader.finished()) {
+    if (!loader.poll(event)) {
+      loader.wait();
+      continue;
+    }
+
+    switch (event.type) {
+      case MeshLoadEvent::Type::Begin:
+        duplicate[event.mesh] = event.contentHash != 0 && contents.count(event.contentHash) > 0;
+        if (!duplicate[event.mesh]) {
+          lodBuilder.begin(event.mesh, paths[event.mesh], event.vertexCount, event.indexCount);
+          meshletBuilder.begin(event.mesh, paths[event.mesh], event.vertexCount, event.indexCount);
+        }
+        stats.triangles += event.indexCount / 3;
+        break;
+
+      case MeshLoadEvent::Type::Data:
+        lodBuilder.addData(event.mesh, event.firstVertex, event.vertexData(), event.vertexDataCount(), event.firstIndex, event.indexData(), event.indexDataCount());
+        meshletBuilder.addData(event.mesh, event.firstVertex, event.vertexData(), event.vertexDataCount(), event.firstIndex, event.indexData(), event.indexDataCount());
+        break;
+
+      case MeshLoadEvent::Type::End:
+        stats.meshes++;
+        if (duplicate[event.mesh] || !contents.insert(event.contentHash).second) {
+          stats.duplicates++;
+          lodBuilder.cancel(event.mesh);
+          meshletBuilder.cancel(event.mesh);
+        } else {
+          lodBuilder.end(event.mesh);
+          meshletBuilder.end(event.mesh);
+        }
+        break;
+
+      case MeshLoadEvent::Type::Failed:
+        lodBuilder.cancel(event.mesh);
+        meshletBuilder.cancel(event.mesh);
+        throw std::runtime_error("Could not load " + paths[event.mesh] + ": " + event.error);
+    }
+  }
+
+  lodBuilder.waitIdle();
+  meshletBuilder.waitIdle();
+  return stats;
+}
+
+}
+
+int main(int argc, char** argv) {
+  try {
+    auto options = parseOptions(argc, argv);
+
+    std::vector<uint32_t> threadCounts;
+    for (auto threadCount = uint32_t{1}; threadCount < options.maxThreads; threadCount *= 2) {
+      threadCounts.push_back(threadCount);
+    }
+    threadCounts.push_back(options.maxThreads);
+
+    auto baseline = 0.0;
+    for (auto threadCount : threadCounts) {
+      JobSystem jobSystem{threadCount};
+      // The builders report every mesh; only the totals are of interest here.
+      auto output = std::cout.rdbuf(nullptr);
+      auto start = std::chrono::steady_clock::now();
+      ImportStats stats;
+      try {
+        stats = import(jobSystem, options.paths);
+      } catch (...) {
+        std::cout.rdbuf(output);
+        throw;
+      }
+      auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      std::cout.rdbuf(output);
+
+      if (threadCount == threadCounts.front()) {
+        baseline = milliseconds;
+        std::cout << "Imported " << stats.meshes << " meshes (" << stats.duplicates << " duplicates), " << stats.triangles << " triangles" << std::endl;
+      }
+      std::cout << threadCount << " threads: " << milliseconds << " ms, speedup " << baseline / milliseconds << std::endl;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#include "instance_buffers.hpp"
+
+#include <algorithm>
+
+namespace {
+
+constexpr VkDeviceSize INITIAL_CAPACITY{1024};
+
+}
+
+InstanceBuffers::InstanceBuffers(MemoryAllocator& memoryAllocator, DescriptorHeap& descriptorHeap, uint32_t frameCount, uint32_t viewCount)
+  : memoryAllocator{memoryAllocator}, descriptorHeap{descriptorHeap}, viewCount{viewCount}, frames(frameCount) {
+  for (auto& frame : frames) {
+    ensureCapacity(frame.models, INITIAL_CAPACITY * sizeof(Mat4));
+    ensureCapacity(frame.instances, INITIAL_CAPACITY * viewCount * sizeof(uint32_t));
+    frame.models.index = descriptorHeap.addBuffer(frame.models.buffer);
+    frame.instances.index = descriptorHeap.addBuffer(frame.instances.buffer);
+  }
+}
+
+InstanceBuffers::~InstanceBuffers() {
+  for (auto& frame : frames) {
+    for (auto buffer : {&frame.models, &frame.instances}) {
+      descriptorHeap.removeBuffer(buffer->index);
+      memoryAllocator.destroyBuffer(buffer->buffer, buffer->allocation);
+    }
+  }
+}
+
+void InstanceBuffers::update(uint32_t frame, const std::vector<DrawItem>& drawItems, uint64_t version) {
+  auto& slot = frames[frame];
+  if (version == slot.version) {
+    return;
+  }
+
+  // Only this frame reads its buffers and it has finished, so they are
+  // replaced right away; the heap slots are updated after bind.
+  auto count = std::max<VkDeviceSize>(drawItems.size(), 1);
+  if (slot.models.size < count * sizeof(Mat4)) {
+    ensureCapacity(slot.models, std::max(count * sizeof(Mat4), slot.models.size * 2));
+    ensureCapacity(slot.instances, slot.models.size / sizeof(Mat4) * viewCount * sizeof(uint32_t));
+    descriptorHeap.updateBuffer(slot.models.index, slot.models.buffer);
+    descriptorHeap.updateBuffer(slot.instances.index, slot.instances.buffer);
+  }
+
+  auto models = static_cast<Mat4*>(slot.models.allocation.mapped);
+  for (auto i = size_t{0}; i < drawItems.size(); i++) {
+    models[i] = drawItems[i].model;
+  }
+  slot.version = version;
+}
+
+void InstanceBuffers::ensureCapacity(Buffer& buffer, VkDeviceSize size) {
+  if (buffer.size >= size) {
+    return;
+  }
+
+  memoryAllocator.destroyBuffer(buffer.buffer, buffer.allocation);
+  memoryAllocator.createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    buffer.buffer, buffer.allocation);
+  buffer.size = size;
+}
@@ -0,0 +1,143 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+// The pool and queue of the worker running on this thread, if any.
+thread_local const JobSystem* currentSystem{nullptr};
+thread_local uint32_t currentQueue{0};
+
+}
+
+JobSystem::JobSystem(uint32_t threadCount) {
+  if (threadCount == 0) {
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  for (auto i = uint32_t{0}; i < threadCount; i++) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (auto i = uint32_t{0}; i < threadCount; i++) {
+    threads.emplace_back(&JobSystem::work, this, i);
+  }
+}
+
+// Owners wait for their counters before the pool goes away, so the queues
+// are empty by now.
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard lock{sleepMutex};
+    stopRequested = true;
+  }
+  changed.notify_all();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void JobSystem::run(JobCounter& counter, std::function<void()> job) {
+  counter.pending.fetch_add(1, std::memory_order_relaxed);
+  // Counted before it is queued, so a worker never sees a job it cannot account for.
+  queuedJobs.fetch_add(1, std::memory_order_relaxed);
+
+  auto index = currentSystem == this ? currentQueue : nextQueue.fetch_add(1, std::memory_order_relaxed) % uint32_t(queues.size());
+  {
+    std::lock_guard lock{queues[index]->mutex};
+    queues[index]->jobs.push_back({std::move(job), &counter});
+  }
+  notify();
+}
+
+void JobSystem::wait(JobCounter& counter) {
+  if (currentSystem != this) {
+    std::unique_lock lock{sleepMutex};
+    changed.wait(lock, [&] { return counter.done(); });
+    return;
+  }
+
+  while (!counter.done()) {
+    if (!runOne(currentQueue)) {
+      std::unique_lock lock{sleepMutex};
+      changed.wait(lock, [&] { return counter.done() || queuedJobs.load(std::memory_order_relaxed) > 0; });
+    }
+  }
+}
+
+bool JobSystem::runOther(const JobCounter& excluded) {
+  return currentSystem == this && runOne(currentQueue, &excluded);
+}
+
+void JobSystem::work(uint32_t index) {
+  currentSystem = this;
+  currentQueue = index;
+
+  while (true) {
+    if (runOne(index)) {
+      continue;
+    }
+
+    std::unique_lock lock{sleepMutex};
+    changed.wait(lock, [this] { return stopRequested || queuedJobs.load(std::memory_order_relaxed) > 0; });
+    if (stopRequested && queuedJobs.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+  }
+}
+
+bool JobSystem::runOne(uint32_t index, const JobCounter* excluded) {
+  Job job;
+  if (!pop(index, job, excluded)) {
+    return false;
+  }
+
+  try {
+    job.function();
+  } catch (const std::exception& exception) {
+    std::cerr << "Job failed: " << exception.what() << std::endl;
+  }
+  if (job.counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    notify();
+  }
+  return true;
+}
+
+// The newest job of the worker's own queue, which is likely still in its
+// caches, or else the oldest job of the next queue that has one, which is
+// likely the largest piece of its work left. Jobs of the excluded counter
+// are skipped.
+bool JobSystem::pop(uint32_t index, Job& job, const JobCounter* excluded) {
+  for (auto i = size_t{0}; i < queues.size(); i++) {
+    auto& queue = *queues[(index + i) % queues.size()];
+    std::lock_guard lock{queue.mutex};
+    auto eligible = [&](const Job& queued) { return queued.counter != excluded; };
+    auto found = queue.jobs.end();
+    if (i == 0) {
+      auto newest = std::find_if(queue.jobs.rbegin(), queue.jobs.rend(), eligible);
+      if (newest != queue.jobs.rend()) {
+        found = std::prev(newest.base());
+      }
+    } else {
+      found = std::find_if(queue.jobs.begin(), queue.jobs.end(), eligible);
+    }
+    if (found == queue.jobs.end()) {
+      continue;
+    }
+
+    job = std::move(*found);
+    queue.jobs.erase(found);
+    queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void JobSystem::notify() {
+  {
+    std::lock_guard lock{sleepMutex};
+  }
+  changed.notify_all();
+}
@@ -0,0 +1,107 @@
+#include "ktx_texture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint8_t KTX2_IDENTIFIER[12]{0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+
+struct Ktx2Header {
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex {
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header must match the KTX2 file layout");
+
+uint32_t blockBytesOf(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+    case VK_FORMAT_BC4_SNORM_BLOCK:
+      return 8;
+    case VK_FORMAT_BC2_UNORM_BLOCK:
+    case VK_FORMAT_BC2_SRGB_BLOCK:
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+    case VK_FORMAT_BC5_SNORM_BLOCK:
+    case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+    case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+    case VK_FORMAT_BC7_UNORM_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+      return 16;
+    default:
+      return 0;
+  }
+}
+
+}
+
+KtxTexture::KtxTexture(const std::string& path)
+  : file{std::make_unique<const MappedFile>(path)} {
+  Ktx2Header header;
+  if (file->size() < sizeof(header)) {
+    throw std::runtime_error("Not a KTX2 file: " + path);
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+    throw std::runtime_error("Not a KTX2 file: " + path);
+  }
+
+  vkFormat = VkFormat(header.vkFormat);
+  bytesPerBlock = blockBytesOf(vkFormat);
+  if (bytesPerBlock == 0) {
+    throw std::runtime_error("KTX2 file is not BC1 to BC7 compressed: " + path);
+  }
+  if (header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1) {
+    throw std::runtime_error("KTX2 file is not a 2D texture: " + path);
+  }
+  if (header.supercompressionScheme != 0) {
+    throw std::runtime_error("Supercompressed KTX2 files are not supported: " + path);
+  }
+
+  // A level count of 0 asks the loader to generate the mip chain; it is used as the single level it has.
+  auto levelCount = std::max(header.levelCount, 1u);
+  if (file->size() < sizeof(header) + levelCount * sizeof(Ktx2LevelIndex)) {
+    throw std::runtime_error("Truncated KTX2 file: " + path);
+  }
+
+  levels.resize(levelCount);
+  for (auto i = uint32_t{0}; i < levelCount; i++) {
+    Ktx2LevelIndex index;
+    std::memcpy(&index, file->data() + sizeof(header) + i * sizeof(index), sizeof(index));
+
+    auto width = std::max(header.pixelWidth >> i, 1u);
+    auto height = std::max(header.pixelHeight >> i, 1u);
+    auto expectedSize = uint64_t{(width + 3) / 4} * ((height + 3) / 4) * bytesPerBlock;
+    if (index.byteLength != expectedSize || index.byteOffset + index.byteLength > file->size()) {
+      throw std::runtime_error("Invalid level " + std::to_string(i) + " in KTX2 file " + path);
+    }
+    levels[i] = {width, height, file->data() + index.byteOffset, index.byteLength};
+  }
+}
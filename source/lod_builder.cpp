@@ -0,0 +1,490 @@
+#include "lod_builder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+constexpr uint32_t CACHE_VERSION{2};
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t levelCount;
+  uint32_t lodIndexCount;
+};
+
+// Everything but the level counts, which only the cache itself knows.
+bool expectedHeader(const std::string& path, uint32_t vertexCount, uint32_t indexCount, CacheHeader& header) {
+  std::error_code error;
+  auto sourceSize = std::filesystem::file_size(path, error);
+  if (error) {
+    return false;
+  }
+  auto sourceTime = std::filesystem::last_write_time(path, error);
+  if (error) {
+    return false;
+  }
+
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "VLOD", 4);
+  header.version = CACHE_VERSION;
+  header.sourceSize = sourceSize;
+  header.sourceTime = sourceTime.time_since_epoch().count();
+  header.vertexCount = vertexCount;
+  header.indexCount = indexCount;
+  return true;
+}
+
+bool readHeader(std::ifstream& file, const std::string& path, uint32_t vertexCount, uint32_t indexCount, CacheHeader& header) {
+  CacheHeader expected;
+  if (!expectedHeader(path, vertexCount, indexCount, expected) || !file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    return false;
+  }
+  return std::memcmp(&header, &expected, offsetof(CacheHeader, levelCount)) == 0;
+}
+
+// Symmetric 4x4 matrix summing the squared distances to a set of planes,
+// weighted by the area of the triangles they came from.
+struct Quadric {
+  double a00{0.0}, a01{0.0}, a02{0.0}, a03{0.0};
+  double a11{0.0}, a12{0.0}, a13{0.0};
+  double a22{0.0}, a23{0.0};
+  double a33{0.0};
+  double weight{0.0};
+
+  void addPlane(const Vec3& n, double d, double w) {
+    a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+    a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+    a22 += w * n.z * n.z; a23 += w * n.z * d;
+    a33 += w * d * d;
+    weight += w;
+  }
+
+  Quadric& operator+=(const Quadric& o) {
+    a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+    a11 += o.a11; a12 += o.a12; a13 += o.a13;
+    a22 += o.a22; a23 += o.a23;
+    a33 += o.a33;
+    weight += o.weight;
+    return *this;
+  }
+
+  // Mean squared distance of p to the planes.
+  double error(const Vec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    auto e = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z + 2.0 * a03 * x
+      + a11 * y * y + 2.0 * a12 * y * z + 2.0 * a13 * y
+      + a22 * z * z + 2.0 * a23 * z
+      + a33;
+    return weight > 0.0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+struct PositionHash {
+  size_t operator()(const Vec3& p) const {
+    uint32_t bits[3];
+    std::memcpy(bits, &p, sizeof(bits));
+    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+  }
+};
+
+struct PositionEqual {
+  bool operator()(const Vec3& a, const Vec3& b) const {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+  }
+};
+
+struct SurfacePoint {
+  Vec3 position;
+  std::array<uint16_t, 2> texCoord;
+};
+
+struct SurfacePointHash {
+  size_t operator()(const SurfacePoint& p) const {
+    return PositionHash{}(p.position) ^ ((uint32_t{p.texCoord[0]} << 16 | p.texCoord[1]) * 2654435761u);
+  }
+};
+
+struct SurfacePointEqual {
+  bool operator()(const SurfacePoint& a, const SurfacePoint& b) const {
+    return PositionEqual{}(a.position, b.position) && a.texCoord == b.texCoord;
+  }
+};
+
+}
+
+LodBuilder::LodBuilder(JobSystem& jobSystem, bool useCache)
+  : jobSystem{jobSystem}, useCache{useCache} {
+}
+
+LodBuilder::~LodBuilder() {
+  stopRequested = true;
+  jobSystem.wait(builds);
+}
+
+void LodBuilder::begin(uint32_t mesh, const std::string& path, uint32_t vertexCount, uint32_t indexCount) {
+  if (indexCount / 3 < MIN_TRIANGLES) {
+    return;
+  }
+
+  Job job{mesh, path, vertexCount, indexCount};
+
+  if (useCache) {
+    std::ifstream file{path + ".lod", std::ios::binary};
+    CacheHeader header;
+    job.cached = file.is_open() && readHeader(file, path, vertexCount, indexCount, header);
+  }
+  if (!job.cached) {
+    job.positions.resize(vertexCount);
+    job.texCoords.resize(vertexCount);
+    job.indices.resize(indexCount);
+  }
+  collecting[mesh] = std::move(job);
+}
+
+void LodBuilder::addData(uint32_t mesh, uint32_t firstVertex, const Vertex* vertices, size_t vertexCount, uint32_t firstIndex, const uint32_t* indices, size_t indexCount) {
+  auto it = collecting.find(mesh);
+  if (it == collecting.end() || it->second.cached) {
+    return;
+  }
+
+  auto& job = it->second;
+  for (auto i = size_t{0}; i < vertexCount && firstVertex + i < job.positions.size(); i++) {
+    job.positions[firstVertex + i] = vertices[i].position;
+    job.texCoords[firstVertex + i] = vertices[i].texCoord;
+  }
+  auto count = std::min(indexCount, job.indices.size() - std::min<size_t>(firstIndex, job.indices.size()));
+  std::copy_n(indices, count, job.indices.begin() + std::min<size_t>(firstIndex, job.indices.size()));
+}
+
+void LodBuilder::end(uint32_t mesh) {
+  auto it = collecting.find(mesh);
+  if (it == collecting.end()) {
+    return;
+  }
+
+  jobSystem.run(builds, [this, job = std::move(it->second)]() mutable { run(job); });
+  collecting.erase(it);
+}
+
+void LodBuilder::cancel(uint32_t mesh) {
+  collecting.erase(mesh);
+}
+
+void LodBuilder::waitIdle() {
+  jobSystem.wait(builds);
+}
+
+bool LodBuilder::poll(LodResult& result) {
+  std::lock_guard lock{mutex};
+  if (results.empty()) {
+    return false;
+  }
+
+  result = std::move(results.front());
+  results.pop_front();
+  return true;
+}
+
+// Jobs still queued when the builder is dropped finish right away.
+void LodBuilder::run(Job& job) {
+  if (stopRequested) {
+    return;
+  }
+
+  LodResult result;
+  if (job.cached) {
+    if (!readCache(job, result)) {
+      std::cerr << "Discarding unreadable LOD cache " << job.path << ".lod" << std::endl;
+      result.levels.clear();
+    }
+  } else {
+    auto buildStart = std::chrono::steady_clock::now();
+    result = build(job);
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+    std::cout << "Built " << result.levels.size() << " LODs for " << job.path << " in " << elapsed << " ms" << std::endl;
+    if (useCache) {
+      writeCache(job, result);
+    }
+  }
+
+  if (!result.levels.empty()) {
+    std::lock_guard lock{mutex};
+    results.push_back(std::move(result));
+  }
+}
+
+LodResult LodBuilder::build(Job& job) {
+  LodResult result;
+  result.mesh = job.mesh;
+
+  auto current = std::move(job.indices);
+  auto error = 0.0f;
+  while (result.levels.size() + 1 < MAX_LOD_LEVELS) {
+    auto levelError = 0.0f;
+    auto simplified = simplify(job.positions, job.texCoords, current, current.size() / 6 * 3, levelError);
+    if (float(simplified.size()) > float(current.size()) * (1.0f - MIN_REDUCTION)) {
+      break;
+    }
+
+    // Each level is simplified from the previous one, so their errors add up.
+    error += levelError;
+    result.levels.push_back({uint32_t(result.indices.size()), uint32_t(simplified.size()), error});
+    result.indices.insert(result.indices.end(), simplified.begin(), simplified.end());
+    current = std::move(simplified);
+  }
+
+  return result;
+}
+
+bool LodBuilder::readCache(const Job& job, LodResult& result) {
+  auto path = job.path + ".lod";
+  std::ifstream file{path, std::ios::binary};
+  CacheHeader header;
+  if (!file.is_open() || !readHeader(file, job.path, job.vertexCount, job.indexCount, header) || header.levelCount >= MAX_LOD_LEVELS) {
+    return false;
+  }
+
+  // Nothing is allocated for more than the file holds, and no level is larger than the mesh.
+  std::error_code error;
+  auto fileSize = std::filesystem::file_size(path, error);
+  auto expectedSize = sizeof(header) + uint64_t{header.levelCount} * sizeof(LodLevel) + uint64_t{header.lodIndexCount} * sizeof(uint32_t);
+  if (error || fileSize < expectedSize || header.lodIndexCount > uint64_t{job.indexCount} * header.levelCount) {
+    return false;
+  }
+
+  result.mesh = job.mesh;
+  result.levels.resize(header.levelCount);
+  result.indices.resize(header.lodIndexCount);
+  if (!file.read(reinterpret_cast<char*>(result.levels.data()), result.levels.size() * sizeof(LodLevel))
+      || !file.read(reinterpret_cast<char*>(result.indices.data()), result.indices.size() * sizeof(uint32_t))) {
+    return false;
+  }
+
+  // The indices go straight to the GPU, so a corrupt file must not reach past the mesh.
+  for (const auto& level : result.levels) {
+    if (uint64_t{level.firstIndex} + level.indexCount > result.indices.size()) {
+      return false;
+    }
+  }
+  return std::all_of(result.indices.begin(), result.indices.end(), [&](uint32_t index) { return index < job.vertexCount; });
+}
+
+void LodBuilder::writeCache(const Job& job, const LodResult& result) {
+  CacheHeader header;
+  if (!expectedHeader(job.path, job.vertexCount, job.indexCount, header)) {
+    return;
+  }
+  header.levelCount = uint32_t(result.levels.size());
+  header.lodIndexCount = uint32_t(result.indices.size());
+
+  // The source directory may well be read only; the levels are just rebuilt next time then.
+  auto path = job.path + ".lod";
+  auto temporaryPath = path + ".tmp";
+  {
+    std::ofstream file{temporaryPath, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(result.levels.data()), result.levels.size() * sizeof(LodLevel));
+    file.write(reinterpret_cast<const char*>(result.indices.data()), result.indices.size() * sizeof(uint32_t));
+    if (!file) {
+      std::cerr << "Could not write LOD cache " << path << std::endl;
+      file.close();
+      std::error_code error;
+      std::filesystem::remove(temporaryPath, error);
+      return;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error) {
+    std::cerr << "Could not write LOD cache " << path << ": " << error.message() << std::endl;
+  }
+}
+
+std::vector<uint32_t> simplify(const std::vector<Vec3>& positions, const std::vector<std::array<uint16_t, 2>>& texCoords, const std::vector<uint32_t>& source, size_t targetIndexCount, float& error) {
+  auto vertexCount = positions.size();
+
+  // Vertices that differ only in their normal collapse as one, so hard edges
+  // do not tear open. Texture seams split the surface instead: their edges
+  // become open borders and stay in place below, so both sides keep their
+  // texture coordinates.
+  std::vector<uint32_t> canonical(vertexCount);
+  {
+    std::unordered_map<SurfacePoint, uint32_t, SurfacePointHash, SurfacePointEqual> firstVertex;
+    firstVertex.reserve(vertexCount);
+    for (auto i = uint32_t{0}; i < vertexCount; i++) {
+      canonical[i] = firstVertex.emplace(SurfacePoint{positions[i], texCoords[i]}, i).first->second;
+    }
+  }
+
+  // Collapses work on the canonical vertices; corners keeps the vertex each
+  // triangle corner had in the source until a collapse moves it, so normals
+  // survive wherever the surface is unchanged.
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> corners;
+  indices.reserve(source.size());
+  corners.reserve(source.size());
+  for (auto t = size_t{0}; t + 2 < source.size(); t += 3) {
+    auto a = canonical[source[t]], b = canonical[source[t + 1]], c = canonical[source[t + 2]];
+    if (a != b && b != c && a != c) {
+      indices.insert(indices.end(), {a, b, c});
+      corners.insert(corners.end(), {source[t], source[t + 1], source[t + 2]});
+    }
+  }
+
+  std::vector<Quadric> quadrics(vertexCount);
+  for (auto t = size_t{0}; t < indices.size(); t += 3) {
+    const auto& p0 = positions[indices[t]];
+    auto normal = cross(positions[indices[t + 1]] - p0, positions[indices[t + 2]] - p0);
+    auto area = length(normal);
+    if (area > 0.0f) {
+      auto n = normal * (1.0f / area);
+      for (auto k = 0; k < 3; k++) {
+        quadrics[indices[t + k]].addPlane(n, -dot(n, p0), area * 0.5);
+      }
+    }
+  }
+
+  // Open borders and non-manifold edges stay in place, or holes would grow.
+  std::vector<bool> locked(vertexCount, false);
+  {
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    edgeUses.reserve(indices.size());
+    for (auto t = size_t{0}; t < indices.size(); t += 3) {
+      for (auto e = 0; e < 3; e++) {
+        auto a = indices[t + e], b = indices[t + (e + 1) % 3];
+        edgeUses[uint64_t{std::min(a, b)} << 32 | std::max(a, b)]++;
+      }
+    }
+    for (const auto& [edge, uses] : edgeUses) {
+      if (uses != 2) {
+        locked[edge >> 32] = true;
+        locked[edge & 0xffffffff] = true;
+      }
+    }
+  }
+
+  struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+  };
+
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<uint32_t> remap(vertexCount);
+  std::vector<bool> touched(vertexCount);
+  std::vector<Collapse> collapses;
+  auto maxCost = 0.0;
+
+  // Moving a vertex onto its neighbour must not turn any of its remaining triangles over.
+  auto flips = [&](uint32_t from, uint32_t to) {
+    for (auto k = adjacencyOffsets[from]; k < adjacencyOffsets[from + 1]; k++) {
+      auto t = adjacency[k] * 3;
+      uint32_t corners[3] = {remap[indices[t]], remap[indices[t + 1]], remap[indices[t + 2]]};
+      if (corners[0] == to || corners[1] == to || corners[2] == to) {
+        continue;
+      }
+
+      auto before = cross(positions[corners[1]] - positions[corners[0]], positions[corners[2]] - positions[corners[0]]);
+      for (auto& corner : corners) {
+        corner = corner == from ? to : corner;
+      }
+      auto after = cross(positions[corners[1]] - positions[corners[0]], positions[corners[2]] - positions[corners[0]]);
+      if (dot(before, after) < 0.25f * length(before) * length(after)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Every pass collapses a batch of independent edges, cheapest first, and
+  // rebuilds the adjacency once instead of after every collapse.
+  while (indices.size() > targetIndexCount) {
+    std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+    for (auto index : indices) {
+      adjacencyOffsets[index + 1]++;
+    }
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+    adjacency.resize(indices.size());
+    auto fill = adjacencyOffsets;
+    for (auto i = size_t{0}; i < indices.size(); i++) {
+      adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+    }
+
+    collapses.clear();
+    for (auto t = size_t{0}; t < indices.size(); t += 3) {
+      for (auto e = 0; e < 3; e++) {
+        auto a = indices[t + e], b = indices[t + (e + 1) % 3];
+        // Interior edges are seen from both triangles; take them once.
+        if (a > b || (locked[a] && locked[b])) {
+          continue;
+        }
+
+        auto merged = quadrics[a];
+        merged += quadrics[b];
+        auto costToB = locked[a] ? std::numeric_limits<double>::max() : merged.error(positions[b]);
+        auto costToA = locked[b] ? std::numeric_limits<double>::max() : merged.error(positions[a]);
+        collapses.push_back(costToB <= costToA ? Collapse{a, b, costToB} : Collapse{b, a, costToA});
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+    // Each collapse removes the two triangles sharing the edge.
+    auto collapseLimit = ((indices.size() - targetIndexCount) / 3 + 1) / 2;
+    std::iota(remap.begin(), remap.end(), 0);
+    std::fill(touched.begin(), touched.end(), false);
+
+    auto applied = size_t{0};
+    for (const auto& collapse : collapses) {
+      if (applied == collapseLimit) {
+        break;
+      }
+      if (touched[collapse.from] || touched[collapse.to] || flips(collapse.from, collapse.to)) {
+        continue;
+      }
+
+      remap[collapse.from] = collapse.to;
+      quadrics[collapse.to] += quadrics[collapse.from];
+      touched[collapse.from] = true;
+      touched[collapse.to] = true;
+      maxCost = std::max(maxCost, collapse.cost);
+      applied++;
+    }
+
+    if (applied == 0) {
+      break;
+    }
+
+    auto kept = size_t{0};
+    for (auto t = size_t{0}; t < indices.size(); t += 3) {
+      auto a = remap[indices[t]], b = remap[indices[t + 1]], c = remap[indices[t + 2]];
+      if (a != b && b != c && a != c) {
+        for (auto k = 0; k < 3; k++) {
+          auto index = remap[indices[t + k]];
+          corners[kept] = index == indices[t + k] ? corners[t + k] : index;
+          indices[kept++] = index;
+        }
+      }
+    }
+    indices.resize(kept);
+    corners.resize(kept);
+  }
+
+  error = float(std::sqrt(maxCost));
+  return corners;
+}
@@ -1,7 +1,8 @@
 #include "viewer.hpp"
+#include "options.hpp"
 
-int main() {
-  Viewer viewer;
+int main(int argc, char** argv) {
+  Viewer viewer{parseOptions(argc, argv)};
   viewer.run();
   
   return 0;
@@ -0,0 +1,45 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path) {
+  auto descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (descriptor < 0) {
+    throw std::runtime_error("Could not open " + path);
+  }
+
+  struct stat status;
+  if (fstat(descriptor, &status) != 0) {
+    close(descriptor);
+    throw std::runtime_error("Could not stat " + path);
+  }
+  length = size_t(status.st_size);
+
+  // mmap rejects empty ranges; an empty file simply has no data.
+  if (length > 0) {
+    mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  }
+  close(descriptor);
+
+  if (mapping == MAP_FAILED) {
+    mapping = nullptr;
+    throw std::runtime_error("Could not map " + path);
+  }
+
+  // Uploads walk the file front to back; start reading ahead right away.
+  if (mapping != nullptr) {
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    madvise(mapping, length, MADV_WILLNEED);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (mapping != nullptr) {
+    munmap(mapping, length);
+  }
+}
@@ -0,0 +1,432 @@
+#include "memory_allocator.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <stdexcept>
+
+struct MemoryBlock {
+  VkDeviceMemory memory{VK_NULL_HANDLE};
+  VkDeviceSize size{0};
+  void* mapped{nullptr};
+  uint32_t pool{0};
+  bool dedicated{false};
+
+  VkDeviceSize usedBytes{0};
+  uint32_t allocationCount{0};
+
+  std::map<VkDeviceSize, VkDeviceSize> freeByOffset;
+  std::multimap<VkDeviceSize, VkDeviceSize> freeBySize;
+
+  void initialize(VkDeviceSize blockSize) {
+    size = blockSize;
+    insertFreeRange(0, blockSize);
+  }
+
+  bool allocate(VkDeviceSize allocationSize, VkDeviceSize alignment, VkDeviceSize& offset) {
+    for (auto range = freeBySize.lower_bound(allocationSize); range != freeBySize.end(); ++range) {
+      auto rangeSize = range->first;
+      auto rangeOffset = range->second;
+      auto alignedOffset = (rangeOffset + alignment - 1) & ~(alignment - 1);
+      if (alignedOffset + allocationSize > rangeOffset + rangeSize) {
+        continue;
+      }
+
+      freeBySize.erase(range);
+      freeByOffset.erase(rangeOffset);
+
+      if (alignedOffset > rangeOffset) {
+        insertFreeRange(rangeOffset, alignedOffset - rangeOffset);
+      }
+      auto allocationEnd = alignedOffset + allocationSize;
+      if (rangeOffset + rangeSize > allocationEnd) {
+        insertFreeRange(allocationEnd, rangeOffset + rangeSize - allocationEnd);
+      }
+
+      offset = alignedOffset;
+      usedBytes += allocationSize;
+      allocationCount++;
+      return true;
+    }
+
+    return false;
+  }
+
+  void free(VkDeviceSize offset, VkDeviceSize allocationSize) {
+    usedBytes -= allocationSize;
+    allocationCount--;
+
+    auto next = freeByOffset.lower_bound(offset);
+    if (next != freeByOffset.end() && offset + allocationSize == next->first) {
+      allocationSize += next->second;
+      eraseFreeRange(next->first, next->second);
+    }
+
+    next = freeByOffset.lower_bound(offset);
+    if (next != freeByOffset.begin()) {
+      auto previous = std::prev(next);
+      if (previous->first + previous->second == offset) {
+        offset = previous->first;
+        allocationSize += previous->second;
+        eraseFreeRange(previous->first, previous->second);
+      }
+    }
+
+    insertFreeRange(offset, allocationSize);
+  }
+
+  VkDeviceSize largestFreeRange() const {
+    return freeBySize.empty() ? 0 : freeBySize.rbegin()->first;
+  }
+
+private:
+  void insertFreeRange(VkDeviceSize offset, VkDeviceSize rangeSize) {
+    freeByOffset.emplace(offset, rangeSize);
+    freeBySize.emplace(rangeSize, offset);
+  }
+
+  void eraseFreeRange(VkDeviceSize offset, VkDeviceSize rangeSize) {
+    freeByOffset.erase(offset);
+    auto candidates = freeBySize.equal_range(rangeSize);
+    for (auto candidate = candidates.first; candidate != candidates.second; ++candidate) {
+      if (candidate->second == offset) {
+        freeBySize.erase(candidate);
+        return;
+      }
+    }
+  }
+};
+
+MemoryAllocator::MemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::vector<uint32_t>& queueFamilyIndices)
+  : logicalDevice{logicalDevice}, queueFamilyIndices{queueFamilyIndices} {
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+  maxAllocationCount = physicalDeviceProperties.limits.maxMemoryAllocationCount;
+}
+
+MemoryAllocator::~MemoryAllocator() {
+  for (auto& pool : pools) {
+    for (auto& block : pool) {
+      if (block->mapped != nullptr) {
+        vkUnmapMemory(logicalDevice, block->memory);
+      }
+      vkFreeMemory(logicalDevice, block->memory, nullptr);
+    }
+  }
+}
+
+void MemoryAllocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& allocation) {
+  VkBufferCreateInfo bufferCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  setSharingMode(bufferCreateInfo);
+
+  if (vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create buffer");
+  }
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetBufferMemoryRequirements(logicalDevice, buffer, &memoryRequirements);
+
+  // Callers retry with other properties when no memory type fits, so the buffer must not leak.
+  std::lock_guard lock{mutex};
+  try {
+    allocation = allocate(memoryRequirements, properties, ResourceKind::Linear);
+  } catch (...) {
+    vkDestroyBuffer(logicalDevice, buffer, nullptr);
+    buffer = VK_NULL_HANDLE;
+    throw;
+  }
+  vkBindBufferMemory(logicalDevice, buffer, allocation.memory, allocation.offset);
+}
+
+void MemoryAllocator::destroyBuffer(VkBuffer& buffer, Allocation& allocation) {
+  vkDestroyBuffer(logicalDevice, buffer, nullptr);
+  buffer = VK_NULL_HANDLE;
+
+  std::lock_guard lock{mutex};
+  free(allocation);
+}
+
+void MemoryAllocator::createImage(const VkImageCreateInfo& imageCreateInfo, VkMemoryPropertyFlags properties, VkImage& image, Allocation& allocation) {
+  if (vkCreateImage(logicalDevice, &imageCreateInfo, nullptr, &image) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create image");
+  }
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetImageMemoryRequirements(logicalDevice, image, &memoryRequirements);
+
+  auto kind = imageCreateInfo.tiling == VK_IMAGE_TILING_LINEAR ? ResourceKind::Linear : ResourceKind::Optimal;
+
+  std::lock_guard lock{mutex};
+  try {
+    allocation = allocate(memoryRequirements, properties, kind);
+  } catch (...) {
+    vkDestroyImage(logicalDevice, image, nullptr);
+    image = VK_NULL_HANDLE;
+    throw;
+  }
+  vkBindImageMemory(logicalDevice, image, allocation.memory, allocation.offset);
+}
+
+void MemoryAllocator::destroyImage(VkImage& image, Allocation& allocation) {
+  vkDestroyImage(logicalDevice, image, nullptr);
+  image = VK_NULL_HANDLE;
+
+  std::lock_guard lock{mutex};
+  free(allocation);
+}
+
+std::vector<RetiredBuffer> MemoryAllocator::defragment(VkCommandBuffer commandBuffer, const std::vector<DefragmentableBuffer>& buffers) {
+  std::lock_guard lock{mutex};
+  std::vector<RetiredBuffer> retiredBuffers;
+
+  VkMemoryBarrier memoryBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+  for (const auto& candidate : buffers) {
+    auto block = candidate.allocation->block;
+    if (block == nullptr || block->dedicated || block->usedBytes * 2 > block->size) {
+      continue;
+    }
+
+    VkBufferCreateInfo bufferCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = candidate.size,
+      .usage = candidate.usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    setSharingMode(bufferCreateInfo);
+
+    VkBuffer buffer;
+    if (vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer) != VK_SUCCESS) {
+      throw std::runtime_error("Could not create buffer");
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(logicalDevice, buffer, &memoryRequirements);
+
+    auto allocation = allocateFromPool(block->pool / 2, ResourceKind(block->pool % 2), memoryRequirements, block);
+    if (allocation.block == nullptr) {
+      vkDestroyBuffer(logicalDevice, buffer, nullptr);
+      continue;
+    }
+    vkBindBufferMemory(logicalDevice, buffer, allocation.memory, allocation.offset);
+
+    VkBufferCopy bufferCopy{
+      .srcOffset = 0,
+      .dstOffset = 0,
+      .size = candidate.size
+    };
+    vkCmdCopyBuffer(commandBuffer, *candidate.buffer, buffer, 1, &bufferCopy);
+
+    retiredBuffers.push_back({*candidate.buffer, *candidate.allocation});
+    *candidate.buffer = buffer;
+    *candidate.allocation = allocation;
+  }
+
+  memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+  return retiredBuffers;
+}
+
+void MemoryAllocator::release(std::vector<RetiredBuffer>& retiredBuffers) {
+  for (auto& retiredBuffer : retiredBuffers) {
+    destroyBuffer(retiredBuffer.buffer, retiredBuffer.allocation);
+  }
+  retiredBuffers.clear();
+
+  releaseEmptyBlocks();
+}
+
+void MemoryAllocator::releaseEmptyBlocks() {
+  std::lock_guard lock{mutex};
+
+  for (auto& pool : pools) {
+    std::vector<MemoryBlock*> emptyBlocks;
+    for (auto& block : pool) {
+      if (block->allocationCount == 0) {
+        emptyBlocks.push_back(block.get());
+      }
+    }
+
+    // Keep one empty block around so the next allocation does not hit the driver.
+    for (auto i = size_t{1}; i < emptyBlocks.size(); i++) {
+      destroyBlock(emptyBlocks[i]);
+    }
+  }
+}
+
+MemoryStats MemoryAllocator::stats() const {
+  std::lock_guard lock{mutex};
+  MemoryStats stats;
+
+  auto freeBytes = VkDeviceSize{0};
+  auto splitFreeBytes = VkDeviceSize{0};
+  for (const auto& pool : pools) {
+    for (const auto& block : pool) {
+      auto blockFreeBytes = block->size - block->usedBytes;
+      stats.reservedBytes += block->size;
+      stats.usedBytes += block->usedBytes;
+      stats.largestFreeRange = std::max(stats.largestFreeRange, block->largestFreeRange());
+      stats.blockCount++;
+      stats.allocationCount += block->allocationCount;
+      freeBytes += blockFreeBytes;
+      splitFreeBytes += blockFreeBytes - block->largestFreeRange();
+    }
+  }
+
+  stats.fragmentation = freeBytes > 0 ? float(splitFreeBytes) / float(freeBytes) : 0.0f;
+  stats.peakReservedBytes = peakReservedBytes;
+  stats.peakUsedBytes = peakUsedBytes;
+  return stats;
+}
+
+void MemoryAllocator::logStats(std::ostream& stream) const {
+  auto memoryStats = stats();
+  stream << "Device memory: " << memoryStats.usedBytes / (1 << 20) << " MiB used of " << memoryStats.reservedBytes / (1 << 20)
+    << " MiB reserved in " << memoryStats.blockCount << " blocks (" << memoryStats.allocationCount << " allocations, "
+    << std::fixed << std::setprecision(1) << memoryStats.fragmentation * 100.0f << "% fragmented)" << std::defaultfloat << std::endl;
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& memoryRequirements, VkMemoryPropertyFlags properties, ResourceKind kind) {
+  auto memoryType = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+  auto blockSize = blockSizeFor(memoryType);
+
+  if (memoryRequirements.size > blockSize / 2) {
+    auto block = createBlock(memoryType, kind, memoryRequirements.size, true);
+    auto offset = VkDeviceSize{0};
+    block->allocate(memoryRequirements.size, memoryRequirements.alignment, offset);
+    usedBytes += memoryRequirements.size;
+    peakUsedBytes = std::max(peakUsedBytes, usedBytes);
+    return {block->memory, offset, memoryRequirements.size, block->mapped, block};
+  }
+
+  auto allocation = allocateFromPool(memoryType, kind, memoryRequirements, nullptr);
+  if (allocation.block != nullptr) {
+    return allocation;
+  }
+
+  createBlock(memoryType, kind, blockSize, false);
+  return allocateFromPool(memoryType, kind, memoryRequirements, nullptr);
+}
+
+Allocation MemoryAllocator::allocateFromPool(uint32_t memoryType, ResourceKind kind, const VkMemoryRequirements& memoryRequirements, const MemoryBlock* limit) {
+  auto& pool = pools[memoryType * 2 + uint32_t(kind)];
+
+  // Prefer the fullest blocks so sparsely used ones can drain and be released.
+  std::vector<MemoryBlock*> candidates;
+  for (auto& block : pool) {
+    if (!block->dedicated && block.get() != limit && (limit == nullptr || block->usedBytes > limit->usedBytes)) {
+      candidates.push_back(block.get());
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](auto a, auto b) { return a->usedBytes > b->usedBytes; });
+
+  for (auto block : candidates) {
+    auto offset = VkDeviceSize{0};
+    if (block->allocate(memoryRequirements.size, memoryRequirements.alignment, offset)) {
+      usedBytes += memoryRequirements.size;
+      peakUsedBytes = std::max(peakUsedBytes, usedBytes);
+      auto mapped = block->mapped != nullptr ? static_cast<char*>(block->mapped) + offset : nullptr;
+      return {block->memory, offset, memoryRequirements.size, mapped, block};
+    }
+  }
+
+  return {};
+}
+
+void MemoryAllocator::free(Allocation& allocation) {
+  auto block = allocation.block;
+  if (block == nullptr) {
+    return;
+  }
+
+  block->free(allocation.offset, allocation.size);
+  usedBytes -= allocation.size;
+  allocation = {};
+
+  if (block->dedicated) {
+    destroyBlock(block);
+  }
+}
+
+void MemoryAllocator::setSharingMode(VkBufferCreateInfo& bufferCreateInfo) const {
+  if (queueFamilyIndices.size() > 1) {
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferCreateInfo.queueFamilyIndexCount = uint32_t(queueFamilyIndices.size());
+    bufferCreateInfo.pQueueFamilyIndices = queueFamilyIndices.data();
+  }
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t memoryTypeBits, VkMemoryPropertyFlags properties) const {
+  for (auto i = uint32_t{0}; i < memoryProperties.memoryTypeCount; i++) {
+    if ((memoryTypeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("Could not find a suitable memory type");
+}
+
+VkDeviceSize MemoryAllocator::blockSizeFor(uint32_t memoryType) const {
+  auto heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+  return heapSize <= (VkDeviceSize{1} << 30) ? heapSize / 8 : DEFAULT_BLOCK_SIZE;
+}
+
+MemoryBlock* MemoryAllocator::createBlock(uint32_t memoryType, ResourceKind kind, VkDeviceSize size, bool dedicated) {
+  if (deviceAllocationCount >= maxAllocationCount) {
+    throw std::runtime_error("Exceeded maxMemoryAllocationCount");
+  }
+
+  VkMemoryAllocateInfo memoryAllocateInfo{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = size,
+    .memoryTypeIndex = memoryType
+  };
+
+  auto block = std::make_unique<MemoryBlock>();
+  if (vkAllocateMemory(logicalDevice, &memoryAllocateInfo, nullptr, &block->memory) != VK_SUCCESS) {
+    throw std::runtime_error("Could not allocate device memory");
+  }
+  deviceAllocationCount++;
+  reservedBytes += size;
+  peakReservedBytes = std::max(peakReservedBytes, reservedBytes);
+
+  if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    vkMapMemory(logicalDevice, block->memory, 0, size, 0, &block->mapped);
+  }
+
+  block->initialize(size);
+  block->pool = memoryType * 2 + uint32_t(kind);
+  block->dedicated = dedicated;
+
+  auto& pool = pools[block->pool];
+  pool.push_back(std::move(block));
+  return pool.back().get();
+}
+
+void MemoryAllocator::destroyBlock(MemoryBlock* block) {
+  auto& pool = pools[block->pool];
+  auto owner = std::find_if(pool.begin(), pool.end(), [block](const auto& candidate) { return candidate.get() == block; });
+
+  if (block->mapped != nullptr) {
+    vkUnmapMemory(logicalDevice, block->memory);
+  }
+  vkFreeMemory(logicalDevice, block->memory, nullptr);
+  deviceAllocationCount--;
+  reservedBytes -= block->size;
+
+  pool.erase(owner);
+}
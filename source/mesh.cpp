@@ -0,0 +1,157 @@
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+static_assert(sizeof(Vertex) == 20, "Vertex layout is shared with the mesh cache and the vertex shaders");
+
+VkVertexInputBindingDescription Vertex::bindingDescription() {
+  return {
+    .binding = 0,
+    .stride = sizeof(Vertex),
+    .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+  };
+}
+
+std::array<VkVertexInputAttributeDescription, 3> Vertex::attributeDescriptions() {
+  return {{
+    {
+      .location = 0,
+      .binding = 0,
+      .format = VK_FORMAT_R32G32B32_SFLOAT,
+      .offset = offsetof(Vertex, position)
+    },
+    {
+      .location = 1,
+      .binding = 0,
+      .format = VK_FORMAT_R16G16_SINT,
+      .offset = offsetof(Vertex, normal)
+    },
+    {
+      .location = 2,
+      .binding = 0,
+      .format = VK_FORMAT_R16G16_SFLOAT,
+      .offset = offsetof(Vertex, texCoord)
+    }
+  }};
+}
+
+uint64_t hashWords(uint64_t hash, const void* data, size_t size) {
+  auto bytes = static_cast<const uint8_t*>(data);
+  for (auto i = size_t{0}; i < size; i += sizeof(uint32_t)) {
+    auto word = uint32_t{0};
+    std::memcpy(&word, bytes + i, std::min(size - i, sizeof(uint32_t)));
+    hash ^= word;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Projects onto the octahedron |x| + |y| + |z| = 1 and folds the lower half
+// over the upper one. decodeNormal() in the vertex shaders reverses this.
+std::array<int16_t, 2> encodeNormal(const Vec3& normal) {
+  auto sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+  if (!(sum > 0.0f)) {
+    return {NO_NORMAL, NO_NORMAL};
+  }
+
+  auto x = normal.x / sum;
+  auto y = normal.y / sum;
+  if (normal.z < 0.0f) {
+    auto foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    auto foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = foldedX;
+    y = foldedY;
+  }
+
+  auto quantize = [](float value) { return int16_t(std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f)); };
+  return {quantize(x), quantize(y)};
+}
+
+namespace {
+
+// Rounds to nearest even; magnitudes beyond the half range become infinity.
+uint16_t toHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  auto sign = uint16_t((bits >> 16) & 0x8000);
+  auto exponent = int((bits >> 23) & 0xff) - 127 + 15;
+  auto mantissa = bits & 0x7fffff;
+
+  if (exponent >= 31) {
+    return uint16_t(sign | 0x7c00 | (((bits >> 23) & 0xff) == 0xff && mantissa != 0 ? 0x200 : 0));
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    auto shift = uint32_t(14 - exponent);
+    auto half = mantissa >> shift;
+    auto remainder = mantissa & ((1u << shift) - 1);
+    auto midpoint = 1u << (shift - 1);
+    if (remainder > midpoint || (remainder == midpoint && (half & 1))) {
+      half++;
+    }
+    return uint16_t(sign | half);
+  }
+
+  auto half = uint32_t(exponent << 10) | (mantissa >> 13);
+  auto remainder = mantissa & 0x1fff;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+    half++;
+  }
+  return uint16_t(sign | half);
+}
+
+}
+
+std::array<uint16_t, 2> encodeTexCoord(float u, float v) {
+  return {toHalf(u), toHalf(v)};
+}
+
+float projectedPixels(const Aabb& bounds, const Mat4& viewProjection, VkExtent2D viewport) {
+  auto lowest = std::numeric_limits<float>::lowest();
+  auto highest = std::numeric_limits<float>::max();
+  auto ndcMin = Vec3{highest, highest, 0.0f};
+  auto ndcMax = Vec3{lowest, lowest, 0.0f};
+
+  for (auto i = 0; i < 8; i++) {
+    auto p = Vec3{i & 1 ? bounds.max.x : bounds.min.x, i & 2 ? bounds.max.y : bounds.min.y, i & 4 ? bounds.max.z : bounds.min.z};
+    auto w = viewProjection(3, 0) * p.x + viewProjection(3, 1) * p.y + viewProjection(3, 2) * p.z + viewProjection(3, 3);
+    if (w <= 0.0f) {
+      return std::numeric_limits<float>::max();
+    }
+    auto ndc = transformPoint(viewProjection, p) * (1.0f / w);
+    ndcMin = {std::min(ndcMin.x, ndc.x), std::min(ndcMin.y, ndc.y), 0.0f};
+    ndcMax = {std::max(ndcMax.x, ndc.x), std::max(ndcMax.y, ndc.y), 0.0f};
+  }
+
+  if (ndcMin.x > 1.0f || ndcMax.x < -1.0f || ndcMin.y > 1.0f || ndcMax.y < -1.0f) {
+    return 0.0f;
+  }
+  return std::max((ndcMax.x - ndcMin.x) * 0.5f * float(viewport.width), (ndcMax.y - ndcMin.y) * 0.5f * float(viewport.height));
+}
+
+uint32_t selectLod(const Mesh& mesh, const Aabb& bounds, const Mat4& viewProjection, VkExtent2D viewport, float maxPixelError) {
+  if (mesh.lods.empty()) {
+    return 0;
+  }
+
+  auto pixels = projectedPixels(bounds, viewProjection, viewport);
+  // Crossing the camera plane: the projected size is unbounded.
+  if (pixels == std::numeric_limits<float>::max()) {
+    return 0;
+  }
+  auto pixelsPerUnit = pixels / std::max(length(bounds.max - bounds.min), 1e-6f);
+
+  for (auto level = uint32_t(mesh.lods.size()); level > 0; level--) {
+    if (mesh.lods[level - 1].error * pixelsPerUnit <= maxPixelError) {
+      return level;
+    }
+  }
+  return 0;
+}
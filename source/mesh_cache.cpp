@@ -0,0 +1,176 @@
+#include "mesh_cache.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+constexpr uint32_t CACHE_VERSION{3};
+constexpr uint64_t SECTION_ALIGNMENT{4096};
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+uint64_t fnv1a(const std::string& data) {
+  auto hash = uint64_t{14695981039346656037ull};
+  for (auto c : data) {
+    hash ^= uint8_t(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Everything but the bounds, content hash and texture, which are only known once the mesh is imported.
+bool expectedHeader(const std::string& sourcePath, uint32_t vertexCount, uint32_t indexCount, MeshCacheHeader& header) {
+  std::error_code error;
+  auto sourceSize = std::filesystem::file_size(sourcePath, error);
+  if (error) {
+    return false;
+  }
+  auto sourceTime = std::filesystem::last_write_time(sourcePath, error);
+  if (error) {
+    return false;
+  }
+
+  header = MeshCacheHeader{};
+  std::memcpy(header.magic, "VMSC", 4);
+  header.version = CACHE_VERSION;
+  header.sourceSize = sourceSize;
+  header.sourceTime = sourceTime.time_since_epoch().count();
+  header.vertexCount = vertexCount;
+  header.indexCount = indexCount;
+  header.vertexOffset = SECTION_ALIGNMENT;
+  header.indexOffset = alignUp(header.vertexOffset + uint64_t{vertexCount} * sizeof(Vertex), SECTION_ALIGNMENT);
+  header.bounds = {};
+  header.contentHash = 0;
+  header.texturePathLength = 0;
+  return true;
+}
+
+}
+
+std::string meshCachePath(const std::string& cacheDirectory, const std::string& sourcePath) {
+  std::error_code error;
+  auto absolutePath = std::filesystem::absolute(sourcePath, error).lexically_normal().string();
+
+  std::stringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << fnv1a(error ? sourcePath : absolutePath) << ".vcache";
+  return cacheDirectory + "/meshes/" + name.str();
+}
+
+std::shared_ptr<const MappedFile> openMeshCache(const std::string& cachePath, const std::string& sourcePath, MeshCacheHeader& header, std::string& texturePath) {
+  std::error_code error;
+  if (!std::filesystem::exists(cachePath, error)) {
+    return nullptr;
+  }
+
+  std::shared_ptr<const MappedFile> file;
+  try {
+    file = std::make_shared<const MappedFile>(cachePath);
+  } catch (const std::exception& exception) {
+    std::cerr << exception.what() << std::endl;
+    return nullptr;
+  }
+
+  if (file->size() < sizeof(header)) {
+    return nullptr;
+  }
+  std::memcpy(&header, file->data(), sizeof(header));
+
+  MeshCacheHeader expected;
+  if (!expectedHeader(sourcePath, header.vertexCount, header.indexCount, expected)
+      || std::memcmp(&header, &expected, offsetof(MeshCacheHeader, bounds)) != 0
+      || file->size() < header.indexOffset + uint64_t{header.indexCount} * sizeof(uint32_t)
+      || sizeof(header) + header.texturePathLength > header.vertexOffset) {
+    return nullptr;
+  }
+
+  // The indices go to the GPU as they are, so a corrupt entry must not reach
+  // past its vertices; the source is parsed again instead.
+  auto indices = reinterpret_cast<const uint32_t*>(file->data() + header.indexOffset);
+  if (!std::all_of(indices, indices + header.indexCount, [&](uint32_t index) { return index < header.vertexCount; })) {
+    std::cerr << "Discarding corrupt mesh cache entry " << cachePath << std::endl;
+    return nullptr;
+  }
+
+  texturePath.assign(file->data() + sizeof(header), header.texturePathLength);
+  return file;
+}
+
+bool sameMeshCacheContent(const std::string& cacheDirectory, const std::string& sourcePath, const std::string& otherSourcePath) {
+  MeshCacheHeader header, otherHeader;
+  std::string texturePath, otherTexturePath;
+  auto file = openMeshCache(meshCachePath(cacheDirectory, sourcePath), sourcePath, header, texturePath);
+  auto otherFile = openMeshCache(meshCachePath(cacheDirectory, otherSourcePath), otherSourcePath, otherHeader, otherTexturePath);
+  if (!file || !otherFile || header.vertexCount != otherHeader.vertexCount || header.indexCount != otherHeader.indexCount || texturePath != otherTexturePath) {
+    return false;
+  }
+  return std::memcmp(file->data() + header.vertexOffset, otherFile->data() + otherHeader.vertexOffset, size_t{header.vertexCount} * sizeof(Vertex)) == 0
+    && std::memcmp(file->data() + header.indexOffset, otherFile->data() + otherHeader.indexOffset, size_t{header.indexCount} * sizeof(uint32_t)) == 0;
+}
+
+MeshCacheWriter::MeshCacheWriter(const std::string& cachePath, const std::string& sourcePath, uint32_t vertexCount, uint32_t indexCount)
+  : path{cachePath}, temporaryPath{cachePath + ".tmp"} {
+  std::error_code error;
+  std::filesystem::create_directories(std::filesystem::path{path}.parent_path(), error);
+  failed = error || !expectedHeader(sourcePath, vertexCount, indexCount, header);
+  if (!failed) {
+    file.open(temporaryPath, std::ios::binary | std::ios::trunc);
+    failed = !file.is_open();
+  }
+}
+
+MeshCacheWriter::~MeshCacheWriter() {
+  if (!committed) {
+    file.close();
+    std::error_code error;
+    std::filesystem::remove(temporaryPath, error);
+  }
+}
+
+void MeshCacheWriter::write(uint32_t firstVertex, const std::vector<Vertex>& vertices, uint32_t firstIndex, const std::vector<uint32_t>& indices) {
+  if (failed) {
+    return;
+  }
+
+  if (!vertices.empty()) {
+    file.seekp(header.vertexOffset + uint64_t{firstVertex} * sizeof(Vertex));
+    file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(Vertex));
+  }
+  if (!indices.empty()) {
+    file.seekp(header.indexOffset + uint64_t{firstIndex} * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+  }
+  failed = !file;
+}
+
+void MeshCacheWriter::commit(const Aabb& bounds, uint64_t contentHash, const std::string& texturePath) {
+  // The path has to fit in front of the vertices.
+  if (failed || sizeof(header) + texturePath.size() > header.vertexOffset) {
+    std::cerr << "Could not write mesh cache " << temporaryPath << std::endl;
+    return;
+  }
+
+  // The bounds and hash are only known now that every vertex has been seen.
+  header.bounds = bounds;
+  header.contentHash = contentHash;
+  header.texturePathLength = uint32_t(texturePath.size());
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(texturePath.data(), texturePath.size());
+  file.close();
+  if (!file) {
+    std::cerr << "Could not write mesh cache " << temporaryPath << std::endl;
+    return;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  committed = !error;
+}
@@ -0,0 +1,1086 @@
+#include "mesh_loader.hpp"
+
+#include "scene_core.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+constexpr size_t READ_BLOCK_SIZE{4 << 20};
+
+struct LoadCancelled {};
+
+class ChunkedReader {
+public:
+  explicit ChunkedReader(const std::string& path)
+    : file{path, std::ios::binary}, buffer(READ_BLOCK_SIZE) {
+    if (!file.is_open()) {
+      throw std::runtime_error("Could not open mesh file " + path);
+    }
+  }
+
+  bool readLine(std::string_view& line) {
+    while (true) {
+      auto newline = static_cast<char*>(std::memchr(buffer.data() + begin, '\n', end - begin));
+      if (newline != nullptr) {
+        auto length = size_t(newline - (buffer.data() + begin));
+        line = std::string_view{buffer.data() + begin, length};
+        begin += length + 1;
+        if (!line.empty() && line.back() == '\r') {
+          line.remove_suffix(1);
+        }
+        return true;
+      }
+
+      if (eof) {
+        if (begin == end) {
+          return false;
+        }
+        line = std::string_view{buffer.data() + begin, end - begin};
+        begin = end;
+        return true;
+      }
+
+      if (begin == 0 && end == buffer.size()) {
+        throw std::runtime_error("Line exceeds read block size");
+      }
+      refill();
+    }
+  }
+
+  void read(void* data, size_t size) {
+    auto destination = static_cast<char*>(data);
+    while (size > 0) {
+      if (begin == end) {
+        if (eof) {
+          throw std::runtime_error("Unexpected end of mesh file");
+        }
+        refill();
+        continue;
+      }
+      auto count = std::min(size, end - begin);
+      std::memcpy(destination, buffer.data() + begin, count);
+      begin += count;
+      destination += count;
+      size -= count;
+    }
+  }
+
+  void skip(uint64_t size) {
+    if (size <= end - begin) {
+      begin += size;
+    } else {
+      seek(position() + size);
+    }
+  }
+
+  void seek(uint64_t offset) {
+    file.clear();
+    file.seekg(offset);
+    bufferOffset = offset;
+    begin = 0;
+    end = 0;
+    eof = false;
+  }
+
+  uint64_t position() const {
+    return bufferOffset + begin;
+  }
+
+private:
+  std::ifstream file;
+  std::vector<char> buffer;
+  size_t begin{0};
+  size_t end{0};
+  uint64_t bufferOffset{0};
+  bool eof{false};
+
+  void refill() {
+    std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+    bufferOffset += begin;
+    end -= begin;
+    begin = 0;
+
+    file.read(buffer.data() + end, buffer.size() - end);
+    auto count = size_t(file.gcount());
+    end += count;
+    eof = count == 0;
+  }
+};
+
+std::string_view nextToken(std::string_view& text) {
+  auto start = text.find_first_not_of(" \t");
+  if (start == std::string_view::npos) {
+    text = {};
+    return {};
+  }
+  text.remove_prefix(start);
+  auto stop = std::min(text.find_first_of(" \t"), text.size());
+  auto token = text.substr(0, stop);
+  text.remove_prefix(stop);
+  return token;
+}
+
+template<typename T>
+T parseNumber(std::string_view token) {
+  auto value = T{};
+  if (std::from_chars(token.data(), token.data() + token.size(), value).ec != std::errc{}) {
+    throw std::runtime_error("Could not parse number '" + std::string{token} + "'");
+  }
+  return value;
+}
+
+// The rest of the line, for names that may contain spaces.
+std::string_view remainder(std::string_view line) {
+  auto start = line.find_first_not_of(" \t");
+  return start == std::string_view::npos ? std::string_view{} : line.substr(start);
+}
+
+// The map_Kd of `material`, relative to the directory of the material library.
+std::string findDiffuseMap(const std::string& libraryPath, const std::string& material) {
+  std::ifstream library{libraryPath};
+  std::string text;
+  auto inMaterial = false;
+  while (std::getline(library, text)) {
+    std::string_view line{text};
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    auto keyword = nextToken(line);
+    if (keyword == "newmtl") {
+      inMaterial = remainder(line) == material;
+    } else if (inMaterial && keyword == "map_Kd") {
+      // Options like -bm 1 come first; the file name is last.
+      auto name = remainder(line);
+      auto lastSpace = name.find_last_of(" \t");
+      return std::string{lastSpace == std::string_view::npos ? name : name.substr(lastSpace + 1)};
+    }
+  }
+  return {};
+}
+
+// Zero based indices of a face corner ("p", "p/t", "p//n" or "p/t/n"), given
+// how many positions and texture coordinates came before it. texCoord is
+// UINT32_MAX without one.
+struct ObjCorner {
+  uint32_t position;
+  uint32_t texCoord;
+};
+
+ObjCorner parseObjCorner(std::string_view token, uint64_t positionCount, uint64_t texCoordCount) {
+  auto slash = token.find('/');
+  auto position = parseNumber<int64_t>(token.substr(0, slash));
+  auto resolvedPosition = uint64_t(position < 0 ? int64_t(positionCount) + position : position - 1);
+  if (resolvedPosition >= positionCount) {
+    throw std::runtime_error("OBJ face index out of range");
+  }
+
+  ObjCorner corner{uint32_t(resolvedPosition), UINT32_MAX};
+  if (texCoordCount > 0 && slash != std::string_view::npos && slash + 1 < token.size() && token[slash + 1] != '/') {
+    auto texCoord = parseNumber<int64_t>(token.substr(slash + 1, token.find('/', slash + 1) - slash - 1));
+    auto resolvedTexCoord = uint64_t(texCoord < 0 ? int64_t(texCoordCount) + texCoord : texCoord - 1);
+    if (resolvedTexCoord >= texCoordCount) {
+      throw std::runtime_error("OBJ face index out of range");
+    }
+    corner.texCoord = uint32_t(resolvedTexCoord);
+  }
+  return corner;
+}
+
+// Collects parsed vertex attributes and packs them a batch at a time with the
+// scene core kernels, at the best SIMD level the CPU has.
+class VertexBatch {
+public:
+  explicit VertexBatch(MeshImport& sink)
+    : sink{sink}, level{detectSimdLevel()}, vertices(SIZE) {
+    positions.reserve(SIZE);
+    normals.reserve(SIZE);
+    texCoords.reserve(2 * SIZE);
+  }
+
+  // A zero normal stands for none; texture coordinates have their origin top left.
+  void add(const Vec3& position, const Vec3& normal, float u, float v) {
+    positions.push_back(position);
+    normals.push_back(normal);
+    texCoords.insert(texCoords.end(), {u, v});
+    if (positions.size() == SIZE) {
+      flush();
+    }
+  }
+
+  void flush() {
+    quantizeVertices(level, positions.data(), normals.data(), texCoords.data(), positions.size(), vertices.data());
+    for (auto i = size_t{0}; i < positions.size(); i++) {
+      sink.addVertex(vertices[i]);
+    }
+    positions.clear();
+    normals.clear();
+    texCoords.clear();
+  }
+
+private:
+  static constexpr size_t SIZE{4096};
+
+  MeshImport& sink;
+  SimdLevel level;
+  std::vector<Vec3> positions;
+  std::vector<Vec3> normals;
+  std::vector<float> texCoords;
+  std::vector<Vertex> vertices;
+};
+
+void loadObj(const std::string& path, MeshImport& sink) {
+  ChunkedReader reader{path};
+  std::string_view line;
+
+  // Vertices are streamed out before the faces that reference them are read,
+  // so the first pass remembers which texture coordinate each position gets:
+  // the one of the first face corner using it. Corners pairing a position
+  // with another texture coordinate (seams) get a vertex of their own, one
+  // per distinct pair, appended after the positions.
+  std::vector<std::array<float, 2>> texCoords;
+  std::vector<uint32_t> positionTexCoords;
+  std::unordered_map<uint64_t, uint32_t> seamVertices;
+  std::vector<ObjCorner> seams;
+  std::string materialLibrary;
+  std::string material;
+
+  auto vertexCount = uint64_t{0};
+  auto indexCount = uint64_t{0};
+  while (reader.readLine(line)) {
+    auto keyword = nextToken(line);
+    if (keyword == "v") {
+      vertexCount++;
+    } else if (keyword == "vt") {
+      auto u = parseNumber<float>(nextToken(line));
+      auto v = parseNumber<float>(nextToken(line));
+      // OBJ puts the origin bottom left, Vulkan and KTX top left.
+      texCoords.push_back({u, 1.0f - v});
+    } else if (keyword == "f") {
+      auto corners = uint64_t{0};
+      for (auto token = nextToken(line); !token.empty(); token = nextToken(line)) {
+        corners++;
+        auto corner = parseObjCorner(token, vertexCount, texCoords.size());
+        if (corner.texCoord == UINT32_MAX) {
+          continue;
+        }
+
+        if (positionTexCoords.size() < vertexCount) {
+          positionTexCoords.resize(vertexCount, UINT32_MAX);
+        }
+        auto& texCoord = positionTexCoords[corner.position];
+        if (texCoord == UINT32_MAX) {
+          texCoord = corner.texCoord;
+        } else if (texCoord != corner.texCoord && seamVertices.emplace(uint64_t{corner.position} << 32 | corner.texCoord, uint32_t(seams.size())).second) {
+          seams.push_back(corner);
+        }
+      }
+      if (corners >= 3) {
+        indexCount += 3 * (corners - 2);
+      }
+    } else if (keyword == "mtllib" && materialLibrary.empty()) {
+      materialLibrary = std::string{remainder(line)};
+    } else if (keyword == "usemtl" && material.empty()) {
+      material = std::string{remainder(line)};
+    }
+  }
+
+  auto positionCount = vertexCount;
+  vertexCount += seams.size();
+  if (vertexCount > UINT32_MAX || indexCount > UINT32_MAX) {
+    throw std::runtime_error("Mesh exceeds 32 bit index range");
+  }
+  sink.begin(uint32_t(vertexCount), uint32_t(indexCount));
+
+  // Positions of the seam vertices, filled in as their position is read.
+  std::unordered_map<uint32_t, Vec3> seamPositions;
+  for (const auto& seam : seams) {
+    seamPositions.emplace(seam.position, Vec3{});
+  }
+
+  reader.seek(0);
+  VertexBatch vertices{sink};
+  auto verticesSeen = uint64_t{0};
+  auto texCoordsSeen = uint64_t{0};
+  while (reader.readLine(line)) {
+    auto keyword = nextToken(line);
+    if (keyword == "v") {
+      Vec3 position;
+      position.x = parseNumber<float>(nextToken(line));
+      position.y = parseNumber<float>(nextToken(line));
+      position.z = parseNumber<float>(nextToken(line));
+      auto texCoord = std::array<float, 2>{0.0f, 0.0f};
+      if (verticesSeen < positionTexCoords.size() && positionTexCoords[verticesSeen] != UINT32_MAX) {
+        texCoord = texCoords[positionTexCoords[verticesSeen]];
+      }
+      auto seamPosition = seamPositions.find(uint32_t(verticesSeen));
+      if (seamPosition != seamPositions.end()) {
+        seamPosition->second = position;
+      }
+      vertices.add(position, {}, texCoord[0], texCoord[1]);
+      verticesSeen++;
+    } else if (keyword == "vt") {
+      texCoordsSeen++;
+    } else if (keyword == "f") {
+      auto cornerIndex = 0;
+      auto first = uint32_t{0};
+      auto previous = uint32_t{0};
+      for (auto token = nextToken(line); !token.empty(); token = nextToken(line)) {
+        auto corner = parseObjCorner(token, verticesSeen, texCoordsSeen);
+        auto resolved = corner.position;
+        if (corner.texCoord != UINT32_MAX && positionTexCoords[corner.position] != corner.texCoord) {
+          resolved = uint32_t(positionCount) + seamVertices.at(uint64_t{corner.position} << 32 | corner.texCoord);
+        }
+        if (cornerIndex >= 2) {
+          sink.addIndex(first);
+          sink.addIndex(previous);
+          sink.addIndex(resolved);
+        }
+        if (cornerIndex == 0) {
+          first = resolved;
+        }
+        previous = resolved;
+        cornerIndex++;
+      }
+    }
+  }
+
+  for (const auto& seam : seams) {
+    const auto& texCoord = texCoords[seam.texCoord];
+    vertices.add(seamPositions.at(seam.position), {}, texCoord[0], texCoord[1]);
+  }
+  vertices.flush();
+
+  if (!materialLibrary.empty() && !material.empty()) {
+    auto libraryPath = std::filesystem::path{path}.parent_path() / materialLibrary;
+    auto diffuseMap = findDiffuseMap(libraryPath.string(), material);
+    if (!diffuseMap.empty()) {
+      sink.setTexture((std::filesystem::path{materialLibrary}.parent_path() / diffuseMap).string());
+    }
+  }
+
+  sink.end();
+}
+
+enum class PlyFormat { Ascii, BinaryLittleEndian, BinaryBigEndian };
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  bool isList{false};
+  PlyType countType{PlyType::UInt8};
+};
+
+struct PlyElement {
+  std::string name;
+  uint64_t count{0};
+  std::vector<PlyProperty> properties;
+};
+
+PlyType parsePlyType(std::string_view name) {
+  if (name == "char" || name == "int8") return PlyType::Int8;
+  if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+  if (name == "short" || name == "int16") return PlyType::Int16;
+  if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+  if (name == "int" || name == "int32") return PlyType::Int32;
+  if (name == "uint" || name == "uint32") return PlyType::UInt32;
+  if (name == "float" || name == "float32") return PlyType::Float32;
+  if (name == "double" || name == "float64") return PlyType::Float64;
+  throw std::runtime_error("Unknown PLY property type " + std::string{name});
+}
+
+size_t plyTypeSize(PlyType type) {
+  switch (type) {
+    case PlyType::Int8:
+    case PlyType::UInt8:
+      return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16:
+      return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::Float32:
+      return 4;
+    case PlyType::Float64:
+      return 8;
+  }
+  return 0;
+}
+
+double decodePlyValue(const char* data, PlyType type, bool bigEndian) {
+  char bytes[8];
+  auto size = plyTypeSize(type);
+  std::memcpy(bytes, data, size);
+  if (bigEndian) {
+    std::reverse(bytes, bytes + size);
+  }
+
+  switch (type) {
+    case PlyType::Int8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+    case PlyType::UInt8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+    case PlyType::Int16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyType::UInt16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+    case PlyType::Int32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::UInt32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::Float32: { float v; std::memcpy(&v, bytes, 4); return v; }
+    case PlyType::Float64: { double v; std::memcpy(&v, bytes, 8); return v; }
+  }
+  return 0.0;
+}
+
+// Reads one element instance into `values` (list properties are expanded in
+// place, prefixed by their count).
+class PlyRecordReader {
+public:
+  PlyRecordReader(ChunkedReader& reader, PlyFormat format)
+    : reader{reader}, format{format} {}
+
+  void read(const PlyElement& element, std::vector<double>& values) {
+    values.clear();
+
+    if (format == PlyFormat::Ascii) {
+      std::string_view line;
+      if (!reader.readLine(line)) {
+        throw std::runtime_error("Unexpected end of PLY file");
+      }
+      for (auto token = nextToken(line); !token.empty(); token = nextToken(line)) {
+        values.push_back(parseNumber<double>(token));
+      }
+      return;
+    }
+
+    auto bigEndian = format == PlyFormat::BinaryBigEndian;
+    for (const auto& property : element.properties) {
+      if (!property.isList) {
+        values.push_back(readValue(property.type, bigEndian));
+        continue;
+      }
+      auto count = readValue(property.countType, bigEndian);
+      values.push_back(count);
+      for (auto i = 0; i < int(count); i++) {
+        values.push_back(readValue(property.type, bigEndian));
+      }
+    }
+  }
+
+  void skip(const PlyElement& element) {
+    auto hasList = std::any_of(element.properties.begin(), element.properties.end(), [](const auto& p) { return p.isList; });
+    if (format == PlyFormat::Ascii || hasList) {
+      std::vector<double> values;
+      for (auto i = uint64_t{0}; i < element.count; i++) {
+        read(element, values);
+      }
+      return;
+    }
+
+    auto stride = uint64_t{0};
+    for (const auto& property : element.properties) {
+      stride += plyTypeSize(property.type);
+    }
+    reader.skip(stride * element.count);
+  }
+
+private:
+  ChunkedReader& reader;
+  PlyFormat format;
+
+  double readValue(PlyType type, bool bigEndian) {
+    char bytes[8];
+    reader.read(bytes, plyTypeSize(type));
+    return decodePlyValue(bytes, type, bigEndian);
+  }
+};
+
+int findPlyProperty(const PlyElement& element, std::string_view name) {
+  for (auto i = size_t{0}; i < element.properties.size(); i++) {
+    if (element.properties[i].name == name) {
+      return int(i);
+    }
+  }
+  return -1;
+}
+
+// The corner count of a face record, checked against the indices it has
+// before it is converted.
+size_t plyFaceCorners(const std::vector<double>& values) {
+  if (values.empty() || !(values[0] >= 0.0) || values[0] != std::floor(values[0])) {
+    throw std::runtime_error("PLY face record without index list");
+  }
+  if (values[0] > double(values.size() - 1)) {
+    throw std::runtime_error("PLY face record with too few indices");
+  }
+  return size_t(values[0]);
+}
+
+// Values come from the file as doubles; only whole numbers that name a vertex
+// may be converted.
+uint32_t plyFaceIndex(double value, uint64_t vertexCount) {
+  if (!(value >= 0.0 && value < double(vertexCount)) || value != std::floor(value)) {
+    throw std::runtime_error("Mesh index out of range");
+  }
+  return uint32_t(value);
+}
+
+void loadPly(const std::string& path, MeshImport& sink) {
+  ChunkedReader reader{path};
+  std::string_view line;
+
+  if (!reader.readLine(line) || line != "ply") {
+    throw std::runtime_error("Not a PLY file: " + path);
+  }
+
+  auto format = PlyFormat::Ascii;
+  std::vector<PlyElement> elements;
+  std::string textureFile;
+  while (true) {
+    if (!reader.readLine(line)) {
+      throw std::runtime_error("Unterminated PLY header");
+    }
+    auto keyword = nextToken(line);
+    if (keyword == "end_header") {
+      break;
+    } else if (keyword == "format") {
+      auto name = nextToken(line);
+      if (name == "ascii") {
+        format = PlyFormat::Ascii;
+      } else if (name == "binary_little_endian") {
+        format = PlyFormat::BinaryLittleEndian;
+      } else if (name == "binary_big_endian") {
+        format = PlyFormat::BinaryBigEndian;
+      } else {
+        throw std::runtime_error("Unknown PLY format " + std::string{name});
+      }
+    } else if (keyword == "comment") {
+      // Written by MeshLab and others for the texture the u/v properties index.
+      if (nextToken(line) == "TextureFile") {
+        textureFile = std::string{remainder(line)};
+      }
+    } else if (keyword == "element") {
+      auto name = nextToken(line);
+      elements.push_back({std::string{name}, parseNumber<uint64_t>(nextToken(line)), {}});
+    } else if (keyword == "property") {
+      if (elements.empty()) {
+        throw std::runtime_error("PLY property outside of element");
+      }
+      PlyProperty property;
+      auto type = nextToken(line);
+      if (type == "list") {
+        property.isList = true;
+        property.countType = parsePlyType(nextToken(line));
+        type = nextToken(line);
+      }
+      property.type = parsePlyType(type);
+      property.name = std::string{nextToken(line)};
+      elements.back().properties.push_back(property);
+    }
+  }
+
+  auto dataStart = reader.position();
+  PlyRecordReader records{reader, format};
+  std::vector<double> values;
+
+  auto vertexCount = uint64_t{0};
+  auto indexCount = uint64_t{0};
+  for (const auto& element : elements) {
+    if (element.name == "vertex") {
+      vertexCount = element.count;
+      records.skip(element);
+    } else if (element.name == "face") {
+      for (auto i = uint64_t{0}; i < element.count; i++) {
+        records.read(element, values);
+        auto corners = plyFaceCorners(values);
+        if (corners >= 3) {
+          indexCount += 3 * (corners - 2);
+        }
+      }
+    } else {
+      records.skip(element);
+    }
+  }
+
+  if (vertexCount > UINT32_MAX || indexCount > UINT32_MAX) {
+    throw std::runtime_error("Mesh exceeds 32 bit index range");
+  }
+  sink.begin(uint32_t(vertexCount), uint32_t(indexCount));
+
+  reader.seek(dataStart);
+  for (const auto& element : elements) {
+    if (element.name == "vertex") {
+      auto x = findPlyProperty(element, "x");
+      auto y = findPlyProperty(element, "y");
+      auto z = findPlyProperty(element, "z");
+      auto nx = findPlyProperty(element, "nx");
+      auto ny = findPlyProperty(element, "ny");
+      auto nz = findPlyProperty(element, "nz");
+      if (x < 0 || y < 0 || z < 0) {
+        throw std::runtime_error("PLY vertex element without x/y/z");
+      }
+      auto hasNormals = nx >= 0 && ny >= 0 && nz >= 0;
+
+      auto u = -1;
+      auto v = -1;
+      for (auto [uName, vName] : {std::pair{"u", "v"}, std::pair{"s", "t"}, std::pair{"texture_u", "texture_v"}}) {
+        if (u < 0 || v < 0) {
+          u = findPlyProperty(element, uName);
+          v = findPlyProperty(element, vName);
+        }
+      }
+      auto hasTexCoords = u >= 0 && v >= 0;
+
+      VertexBatch vertices{sink};
+      for (auto i = uint64_t{0}; i < element.count; i++) {
+        records.read(element, values);
+        // Binary records always have every property; ASCII lines may be short.
+        if (values.size() < element.properties.size()) {
+          throw std::runtime_error("PLY vertex record with too few values");
+        }
+        Vec3 normal{};
+        if (hasNormals) {
+          normal = {float(values[nx]), float(values[ny]), float(values[nz])};
+        }
+        // Bottom left origin, like OBJ.
+        vertices.add({float(values[x]), float(values[y]), float(values[z])}, normal,
+          hasTexCoords ? float(values[u]) : 0.0f, hasTexCoords ? 1.0f - float(values[v]) : 0.0f);
+      }
+      vertices.flush();
+    } else if (element.name == "face") {
+      if (element.properties.empty() || !element.properties[0].isList) {
+        throw std::runtime_error("PLY face element must start with the index list");
+      }
+      for (auto i = uint64_t{0}; i < element.count; i++) {
+        records.read(element, values);
+        auto corners = plyFaceCorners(values);
+        for (auto corner = size_t{2}; corner < corners; corner++) {
+          sink.addIndex(plyFaceIndex(values[1], vertexCount));
+          sink.addIndex(plyFaceIndex(values[corner], vertexCount));
+          sink.addIndex(plyFaceIndex(values[corner + 1], vertexCount));
+        }
+      }
+    } else {
+      records.skip(element);
+    }
+  }
+
+  if (!textureFile.empty()) {
+    sink.setTexture(textureFile);
+  }
+  sink.end();
+}
+
+struct VmeshHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+};
+
+// Vertex layout of version 1 files, from before normals were packed.
+struct VmeshVertex {
+  Vec3 position;
+  Vec3 normal;
+};
+
+void loadVmesh(const std::string& path, MeshImport& sink) {
+  ChunkedReader reader{path};
+
+  VmeshHeader header;
+  reader.read(&header, sizeof(header));
+  if (std::memcmp(header.magic, "VMSH", 4) != 0 || header.version != 1) {
+    throw std::runtime_error("Not a version 1 vmesh file: " + path);
+  }
+  auto expectedSize = sizeof(header) + uint64_t{header.vertexCount} * sizeof(VmeshVertex) + uint64_t{header.indexCount} * sizeof(uint32_t);
+  if (std::filesystem::file_size(path) < expectedSize) {
+    throw std::runtime_error("Truncated vmesh file: " + path);
+  }
+
+  sink.begin(header.vertexCount, header.indexCount);
+
+  VmeshVertex vmeshVertex;
+  VertexBatch vertices{sink};
+  for (auto i = uint32_t{0}; i < header.vertexCount; i++) {
+    reader.read(&vmeshVertex, sizeof(vmeshVertex));
+    vertices.add(vmeshVertex.position, vmeshVertex.normal, 0.0f, 0.0f);
+  }
+  vertices.flush();
+
+  auto index = uint32_t{0};
+  for (auto i = uint32_t{0}; i < header.indexCount; i++) {
+    reader.read(&index, sizeof(index));
+    sink.addIndex(index);
+  }
+
+  sink.end();
+}
+
+std::string extensionOf(const std::string& path) {
+  auto dot = path.find_last_of('.');
+  auto extension = dot == std::string::npos ? std::string{} : path.substr(dot);
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+  return extension;
+}
+
+// The same for every spelling of a file's path, so repeats are recognized however they are given.
+std::string fileKey(const std::string& path) {
+  std::error_code error;
+  auto absolutePath = std::filesystem::absolute(path, error).lexically_normal().string();
+  return error ? path : absolutePath;
+}
+
+}
+
+MeshImport::MeshImport(MeshLoader& loader, uint32_t mesh, const std::string& path)
+  : loader{loader}, mesh{mesh}, path{path} {
+}
+
+void MeshImport::begin(uint32_t vertexCount, uint32_t indexCount) {
+  static_assert(VERTICES_PER_EVENT * sizeof(Vertex) + INDICES_PER_EVENT * sizeof(uint32_t) <= MeshLoader::MAX_EVENT_BYTES, "Batches must fit the event size the viewer reserves staging space for");
+  loaded.vertexCount = vertexCount;
+  loaded.indexCount = indexCount;
+
+  MeshLoadEvent event{.type = MeshLoadEvent::Type::Begin, .mesh = mesh};
+  event.vertexCount = vertexCount;
+  event.indexCount = indexCount;
+  loader.push(std::move(event));
+
+  pending = MeshLoadEvent{.type = MeshLoadEvent::Type::Data, .mesh = mesh};
+  pending.vertices.reserve(VERTICES_PER_EVENT);
+  pending.indices.reserve(INDICES_PER_EVENT);
+
+  if (!loader.cacheDirectory.empty()) {
+    cacheWriter = std::make_unique<MeshCacheWriter>(meshCachePath(loader.cacheDirectory, path), path, vertexCount, indexCount);
+  }
+}
+
+void MeshImport::addVertex(const Vertex& vertex) {
+  if (pending.firstVertex + pending.vertices.size() >= loaded.vertexCount) {
+    throw std::runtime_error("Mesh has more vertices than announced");
+  }
+
+  loaded.bounds.extend(vertex.position);
+  pending.vertices.push_back(vertex);
+  if (pending.vertices.size() == VERTICES_PER_EVENT) {
+    flushPending();
+  }
+}
+
+void MeshImport::addIndex(uint32_t index) {
+  if (index >= loaded.vertexCount) {
+    throw std::runtime_error("Mesh index out of range");
+  }
+  if (pending.firstIndex + pending.indices.size() >= loaded.indexCount) {
+    throw std::runtime_error("Mesh has more indices than announced");
+  }
+
+  pending.indices.push_back(index);
+  if (pending.indices.size() == INDICES_PER_EVENT) {
+    flushPending();
+  }
+}
+
+void MeshImport::setTexture(const std::string& texturePath) {
+  loaded.texturePath = (std::filesystem::path{path}.parent_path() / texturePath).lexically_normal().string();
+}
+
+void MeshImport::end() {
+  flushPending();
+  // A file that changed between the parser's passes would leave part of the
+  // buffers and the cache entry unwritten.
+  if (pending.firstVertex != loaded.vertexCount) {
+    throw std::runtime_error("Mesh has fewer vertices than announced");
+  }
+  if (pending.firstIndex != loaded.indexCount) {
+    throw std::runtime_error("Mesh has fewer indices than announced");
+  }
+  loaded.contentHash = hashWords(hashWords(vertexHash, &indexHash, sizeof(indexHash)), loaded.texturePath.data(), loaded.texturePath.size());
+  if (cacheWriter) {
+    cacheWriter->commit(loaded.bounds, loaded.contentHash, loaded.texturePath);
+    cacheWriter.reset();
+  }
+
+  MeshLoadEvent event{.type = MeshLoadEvent::Type::End, .mesh = mesh};
+  event.contentHash = loaded.contentHash;
+  event.bounds = loaded.bounds;
+  event.texturePath = loaded.texturePath;
+  event.duplicateOf = loader.originalOf(mesh, loaded.contentHash);
+  auto original = event.duplicateOf == NO_MESH;
+  loader.push(std::move(event));
+  if (original) {
+    loader.addOriginal(mesh, loaded.contentHash);
+  }
+}
+
+void MeshImport::flushPending() {
+  if (pending.vertices.empty() && pending.indices.empty()) {
+    return;
+  }
+
+  if (cacheWriter) {
+    cacheWriter->write(pending.firstVertex, pending.vertices, pending.firstIndex, pending.indices);
+  }
+  // Batches are handed out in order, so the hashes do not depend on the batch size.
+  vertexHash = hashWords(vertexHash, pending.vertices.data(), pending.vertices.size() * sizeof(Vertex));
+  indexHash = hashWords(indexHash, pending.indices.data(), pending.indices.size() * sizeof(uint32_t));
+
+  auto nextVertex = uint32_t(pending.firstVertex + pending.vertices.size());
+  auto nextIndex = uint32_t(pending.firstIndex + pending.indices.size());
+  loader.push(std::move(pending));
+
+  pending = MeshLoadEvent{.type = MeshLoadEvent::Type::Data, .mesh = mesh};
+  pending.firstVertex = nextVertex;
+  pending.firstIndex = nextIndex;
+  pending.vertices.reserve(VERTICES_PER_EVENT);
+  pending.indices.reserve(INDICES_PER_EVENT);
+}
+
+MeshLoader::MeshLoader(JobSystem& jobSystem, const std::vector<std::string>& paths, const std::string& cacheDirectory, bool dedup, uint32_t firstMesh, std::unordered_map<uint64_t, OriginalMesh> originals)
+  : jobSystem{jobSystem}, paths{paths}, cacheDirectory{cacheDirectory}, dedup{dedup && !cacheDirectory.empty()}, firstMesh{firstMesh}, originals{std::move(originals)} {
+  std::vector<std::vector<uint32_t>> files;
+  std::unordered_map<std::string, size_t> fileIndices;
+  for (auto i = size_t{0}; i < paths.size(); i++) {
+    auto [it, inserted] = fileIndices.emplace(fileKey(paths[i]), files.size());
+    if (inserted) {
+      files.emplace_back();
+    }
+    files[it->second].push_back(uint32_t(i));
+  }
+
+  filesLeft = files.size();
+  importsDone = files.empty();
+  for (auto& meshes : files) {
+    jobSystem.run(imports, [this, meshes = std::move(meshes)] { importFile(meshes); });
+  }
+}
+
+MeshLoader::~MeshLoader() {
+  stopRequested = true;
+  queueChanged.notify_all();
+  jobSystem.wait(imports);
+}
+
+bool MeshLoader::poll(MeshLoadEvent& event) {
+  std::lock_guard lock{mutex};
+  if (events.empty()) {
+    return false;
+  }
+
+  event = std::move(events.front());
+  events.pop_front();
+  queueChanged.notify_all();
+  return true;
+}
+
+bool MeshLoader::finished() const {
+  std::lock_guard lock{mutex};
+  return importsDone && events.empty();
+}
+
+void MeshLoader::wait() {
+  std::unique_lock lock{mutex};
+  queueChanged.wait(lock, [this] { return !events.empty() || importsDone; });
+}
+
+// While the queue is full, the worker builds LODs and meshlets of meshes
+// already loaded instead of sleeping, but starts no other import, which
+// would only block on the same queue. Jobs queued while it sleeps are picked
+// up after a short timeout.
+void MeshLoader::push(MeshLoadEvent&& event) {
+  std::unique_lock lock{mutex};
+  while (events.size() >= MAX_QUEUED_EVENTS && !stopRequested) {
+    lock.unlock();
+    auto helped = jobSystem.runOther(imports);
+    lock.lock();
+    if (!helped) {
+      queueChanged.wait_for(lock, std::chrono::milliseconds{1}, [this] { return events.size() < MAX_QUEUED_EVENTS || stopRequested; });
+    }
+  }
+  if (stopRequested) {
+    throw LoadCancelled{};
+  }
+
+  events.push_back(std::move(event));
+  queueChanged.notify_all();
+}
+
+bool MeshLoader::loadCached(uint32_t mesh, MeshSummary& summary) {
+  MeshCacheHeader header;
+  std::string cachedTexturePath;
+  auto file = openMeshCache(meshCachePath(cacheDirectory, paths[mesh]), paths[mesh], header, cachedTexturePath);
+  if (!file) {
+    return false;
+  }
+
+  MeshLoadEvent begin{.type = MeshLoadEvent::Type::Begin, .mesh = mesh};
+  begin.vertexCount = header.vertexCount;
+  begin.indexCount = header.indexCount;
+  begin.cached = true;
+  begin.contentHash = header.contentHash;
+  begin.duplicateOf = originalOf(mesh, header.contentHash);
+  auto duplicateOf = begin.duplicateOf;
+  push(std::move(begin));
+  summary = {header.vertexCount, header.indexCount, true, header.contentHash, header.bounds, cachedTexturePath};
+
+  if (duplicateOf != NO_MESH) {
+    MeshLoadEvent end{.type = MeshLoadEvent::Type::End, .mesh = mesh};
+    end.contentHash = header.contentHash;
+    end.bounds = header.bounds;
+    end.texturePath = cachedTexturePath;
+    end.duplicateOf = duplicateOf;
+    push(std::move(end));
+    return true;
+  }
+
+  // openMeshCache() has checked every index against the vertex count.
+  auto vertices = reinterpret_cast<const Vertex*>(file->data() + header.vertexOffset);
+  for (auto first = size_t{0}; first < header.vertexCount; first += MAPPED_BYTES_PER_EVENT / sizeof(Vertex)) {
+    MeshLoadEvent event{.type = MeshLoadEvent::Type::Data, .mesh = mesh};
+    event.mapping = file;
+    event.firstVertex = uint32_t(first);
+    event.mappedVertices = vertices + first;
+    event.mappedVertexCount = std::min(header.vertexCount - first, MAPPED_BYTES_PER_EVENT / sizeof(Vertex));
+    push(std::move(event));
+  }
+
+  auto indices = reinterpret_cast<const uint32_t*>(file->data() + header.indexOffset);
+  for (auto first = size_t{0}; first < header.indexCount; first += MAPPED_BYTES_PER_EVENT / sizeof(uint32_t)) {
+    MeshLoadEvent event{.type = MeshLoadEvent::Type::Data, .mesh = mesh};
+    event.mapping = file;
+    event.firstIndex = uint32_t(first);
+    event.mappedIndices = indices + first;
+    event.mappedIndexCount = std::min(header.indexCount - first, MAPPED_BYTES_PER_EVENT / sizeof(uint32_t));
+    push(std::move(event));
+  }
+
+  MeshLoadEvent end{.type = MeshLoadEvent::Type::End, .mesh = mesh};
+  end.contentHash = header.contentHash;
+  end.bounds = header.bounds;
+  end.texturePath = cachedTexturePath;
+  // Another mesh with this content may have finished in the meantime.
+  end.duplicateOf = originalOf(mesh, header.contentHash);
+  auto original = end.duplicateOf == NO_MESH;
+  push(std::move(end));
+  if (original) {
+    addOriginal(mesh, header.contentHash);
+  }
+  return true;
+}
+
+uint32_t MeshLoader::originalOf(uint32_t mesh, uint64_t contentHash) {
+  if (!dedup || contentHash == 0) {
+    return NO_MESH;
+  }
+
+  OriginalMesh original;
+  {
+    std::lock_guard lock{originalsMutex};
+    auto found = originals.find(contentHash);
+    if (found == originals.end()) {
+      return NO_MESH;
+    }
+    original = found->second;
+  }
+  return sameMeshCacheContent(cacheDirectory, paths[mesh], original.path) ? original.mesh : NO_MESH;
+}
+
+// Called once the mesh's End is queued, so meshes announced as its
+// duplicates always come after it.
+void MeshLoader::addOriginal(uint32_t mesh, uint64_t contentHash) {
+  if (!dedup || contentHash == 0) {
+    return;
+  }
+
+  std::lock_guard lock{originalsMutex};
+  originals.emplace(contentHash, OriginalMesh{firstMesh + mesh, paths[mesh]});
+}
+
+void MeshLoader::load(uint32_t mesh, MeshSummary& summary) {
+  // Jobs still queued when the loader is dropped finish right away.
+  if (stopRequested) {
+    throw LoadCancelled{};
+  }
+
+  const auto& path = paths[mesh];
+  if (!cacheDirectory.empty() && loadCached(mesh, summary)) {
+    return;
+  }
+
+  // Dropping the import on an error discards its cache entry.
+  MeshImport import{*this, mesh, path};
+  auto extension = extensionOf(path);
+  if (extension == ".obj") {
+    loadObj(path, import);
+  } else if (extension == ".ply") {
+    loadPly(path, import);
+  } else if (extension == ".vmesh") {
+    loadVmesh(path, import);
+  } else {
+    throw std::runtime_error("Unsupported mesh format " + path);
+  }
+  summary = import.summary();
+}
+
+void MeshLoader::importFile(const std::vector<uint32_t>& meshes) {
+  // Meshes of the file that have had their End or Failed event.
+  auto finishedMeshes = size_t{0};
+  auto fail = [&](const std::string& error) {
+    for (; finishedMeshes < meshes.size(); finishedMeshes++) {
+      MeshLoadEvent event{.type = MeshLoadEvent::Type::Failed, .mesh = meshes[finishedMeshes]};
+      event.error = error;
+      push(std::move(event));
+    }
+  };
+
+  try {
+    MeshSummary summary;
+    try {
+      load(meshes.front(), summary);
+    } catch (const LoadCancelled&) {
+      throw;
+    } catch (const std::exception& exception) {
+      fail(exception.what());
+    }
+
+    for (finishedMeshes = std::max(finishedMeshes, size_t{1}); finishedMeshes < meshes.size(); finishedMeshes++) {
+      auto mesh = meshes[finishedMeshes];
+      MeshLoadEvent begin{.type = MeshLoadEvent::Type::Begin, .mesh = mesh};
+      begin.vertexCount = summary.vertexCount;
+      begin.indexCount = summary.indexCount;
+      begin.cached = summary.cached;
+      begin.contentHash = summary.contentHash;
+      begin.repeatOf = meshes.front();
+      push(std::move(begin));
+
+      MeshLoadEvent end{.type = MeshLoadEvent::Type::End, .mesh = mesh};
+      end.contentHash = summary.contentHash;
+      end.bounds = summary.bounds;
+      end.texturePath = summary.texturePath;
+      push(std::move(end));
+    }
+  } catch (const LoadCancelled&) {
+  } catch (const std::exception& exception) {
+    // Anything failing past the parser, e.g. memory for the repeats' events,
+    // fails the meshes still waiting for their End. The file still counts as
+    // done below even if that fails too.
+    try {
+      fail(exception.what());
+    } catch (const LoadCancelled&) {
+    } catch (const std::exception&) {
+    }
+  }
+
+  if (filesLeft.fetch_sub(1) == 1) {
+    std::lock_guard lock{mutex};
+    importsDone = true;
+    queueChanged.notify_all();
+  }
+}
@@ -0,0 +1,191 @@
+#include "meshlet_builder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+static_assert(sizeof(Meshlet) == 48, "Meshlet must match the std430 layout of Meshlet in the cluster shaders");
+
+namespace {
+
+constexpr uint32_t NO_LOCAL_INDEX{~uint32_t{0}};
+
+// Sphere around the box of the meshlet's vertices, and the cone of its
+// triangle normals. The cone axis is the mean normal; the cutoff is the sine
+// of the largest angle between the axis and a normal, the form the
+// conservative backface test in the shaders needs.
+void computeBounds(Meshlet& meshlet, const MeshletResult& result, const std::vector<Vec3>& positions) {
+  Aabb box;
+  for (auto i = uint32_t{0}; i < meshlet.vertexCount; i++) {
+    box.extend(positions[result.vertices[meshlet.firstVertex + i]]);
+  }
+  meshlet.center = box.center();
+  meshlet.radius = 0.0f;
+  for (auto i = uint32_t{0}; i < meshlet.vertexCount; i++) {
+    meshlet.radius = std::max(meshlet.radius, length(positions[result.vertices[meshlet.firstVertex + i]] - meshlet.center));
+  }
+
+  std::vector<Vec3> normals;
+  normals.reserve(meshlet.triangleCount);
+  auto axis = Vec3{};
+  for (auto i = uint32_t{0}; i < meshlet.triangleCount; i++) {
+    const auto* triangle = &result.indices[(meshlet.firstTriangle + i) * 3];
+    auto normal = cross(positions[triangle[1]] - positions[triangle[0]], positions[triangle[2]] - positions[triangle[0]]);
+    // Degenerate triangles are never rasterized, so they do not constrain the cone.
+    if (length(normal) > 0.0f) {
+      normals.push_back(normalize(normal));
+      axis = axis + normals.back();
+    }
+  }
+
+  meshlet.coneAxis = {};
+  meshlet.coneCutoff = 1.0f;
+  if (normals.empty() || length(axis) == 0.0f) {
+    return;
+  }
+
+  axis = normalize(axis);
+  auto minDot = 1.0f;
+  for (const auto& normal : normals) {
+    minDot = std::min(minDot, dot(axis, normal));
+  }
+  if (minDot > 0.0f) {
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+  }
+}
+
+}
+
+MeshletBuilder::MeshletBuilder(JobSystem& jobSystem)
+  : jobSystem{jobSystem} {
+}
+
+MeshletBuilder::~MeshletBuilder() {
+  stopRequested = true;
+  jobSystem.wait(builds);
+}
+
+void MeshletBuilder::begin(uint32_t mesh, const std::string& path, uint32_t vertexCount, uint32_t indexCount) {
+  if (indexCount / 3 < MIN_TRIANGLES) {
+    return;
+  }
+
+  Job job{mesh, path};
+  job.positions.resize(vertexCount);
+  job.indices.resize(indexCount);
+  collecting[mesh] = std::move(job);
+}
+
+void MeshletBuilder::addData(uint32_t mesh, uint32_t firstVertex, const Vertex* vertices, size_t vertexCount, uint32_t firstIndex, const uint32_t* indices, size_t indexCount) {
+  auto it = collecting.find(mesh);
+  if (it == collecting.end()) {
+    return;
+  }
+
+  auto& job = it->second;
+  for (auto i = size_t{0}; i < vertexCount && firstVertex + i < job.positions.size(); i++) {
+    job.positions[firstVertex + i] = vertices[i].position;
+  }
+  auto count = std::min(indexCount, job.indices.size() - std::min<size_t>(firstIndex, job.indices.size()));
+  std::copy_n(indices, count, job.indices.begin() + std::min<size_t>(firstIndex, job.indices.size()));
+}
+
+void MeshletBuilder::end(uint32_t mesh) {
+  auto it = collecting.find(mesh);
+  if (it == collecting.end()) {
+    return;
+  }
+
+  jobSystem.run(builds, [this, job = std::move(it->second)] { build(job); });
+  collecting.erase(it);
+}
+
+void MeshletBuilder::cancel(uint32_t mesh) {
+  collecting.erase(mesh);
+}
+
+void MeshletBuilder::waitIdle() {
+  jobSystem.wait(builds);
+}
+
+bool MeshletBuilder::poll(MeshletResult& result) {
+  std::lock_guard lock{mutex};
+  if (results.empty()) {
+    return false;
+  }
+
+  result = std::move(results.front());
+  results.pop_front();
+  return true;
+}
+
+// Jobs still queued when the builder is dropped finish right away.
+void MeshletBuilder::build(const Job& job) {
+  if (stopRequested) {
+    return;
+  }
+
+  auto buildStart = std::chrono::steady_clock::now();
+  auto result = buildMeshlets(job.positions, job.indices);
+  result.mesh = job.mesh;
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+  std::cout << "Built " << result.meshlets.size() << " meshlets for " << job.path << " in " << elapsed << " ms" << std::endl;
+
+  std::lock_guard lock{mutex};
+  results.push_back(std::move(result));
+}
+
+MeshletResult buildMeshlets(const std::vector<Vec3>& positions, const std::vector<uint32_t>& indices) {
+  MeshletResult result;
+  result.indices.reserve(indices.size());
+  result.triangles.reserve(indices.size() / 3);
+
+  // Local index of every mesh vertex in the current meshlet; reset for the
+  // meshlet's own vertices when it is finished, so a pass stays linear.
+  std::vector<uint32_t> localIndices(positions.size(), NO_LOCAL_INDEX);
+  Meshlet meshlet{};
+
+  auto finish = [&] {
+    if (meshlet.triangleCount == 0) {
+      return;
+    }
+    computeBounds(meshlet, result, positions);
+    for (auto i = uint32_t{0}; i < meshlet.vertexCount; i++) {
+      localIndices[result.vertices[meshlet.firstVertex + i]] = NO_LOCAL_INDEX;
+    }
+    result.meshlets.push_back(meshlet);
+    meshlet = Meshlet{};
+    meshlet.firstVertex = uint32_t(result.vertices.size());
+    meshlet.firstTriangle = uint32_t(result.triangles.size());
+  };
+
+  for (auto i = size_t{0}; i + 2 < indices.size(); i += 3) {
+    auto a = indices[i];
+    auto b = indices[i + 1];
+    auto c = indices[i + 2];
+    auto newVertices = uint32_t(localIndices[a] == NO_LOCAL_INDEX)
+      + uint32_t(b != a && localIndices[b] == NO_LOCAL_INDEX)
+      + uint32_t(c != a && c != b && localIndices[c] == NO_LOCAL_INDEX);
+    if (meshlet.vertexCount + newVertices > MESHLET_MAX_VERTICES || meshlet.triangleCount == MESHLET_MAX_TRIANGLES) {
+      finish();
+    }
+
+    auto packed = uint32_t{0};
+    for (auto corner = 0; corner < 3; corner++) {
+      auto vertex = indices[i + corner];
+      if (localIndices[vertex] == NO_LOCAL_INDEX) {
+        localIndices[vertex] = meshlet.vertexCount++;
+        result.vertices.push_back(vertex);
+      }
+      packed |= localIndices[vertex] << (corner * 8);
+      result.indices.push_back(vertex);
+    }
+    result.triangles.push_back(packed);
+    meshlet.triangleCount++;
+  }
+  finish();
+
+  return result;
+}
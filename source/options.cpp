@@ -0,0 +1,158 @@
+#include "options.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+
+std::string nextValue(int argc, char** argv, int& i) {
+  if (i + 1 >= argc) {
+    throw std::runtime_error(std::string{"Missing value for "} + argv[i]);
+  }
+  return argv[++i];
+}
+
+uint32_t rangedValue(int argc, char** argv, int& i, uint32_t min, uint32_t max) {
+  auto name = std::string{argv[i]};
+  auto value = std::stoul(nextValue(argc, argv, i));
+  if (value < min || value > max) {
+    throw std::runtime_error(name + " must be between " + std::to_string(min) + " and " + std::to_string(max));
+  }
+  return uint32_t(value);
+}
+
+std::string defaultCacheDirectory() {
+  if (auto xdgCacheHome = std::getenv("XDG_CACHE_HOME")) {
+    return std::string{xdgCacheHome} + "/viewer";
+  }
+  if (auto home = std::getenv("HOME")) {
+    return std::string{home} + "/.cache/viewer";
+  }
+  return ".viewer-cache";
+}
+
+}
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  options.cacheDirectory = defaultCacheDirectory();
+  options.shaderDirectory = VIEWER_SHADER_DIR;
+  options.recordThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  options.importThreads = options.recordThreads;
+
+  for (auto i = 1; i < argc; i++) {
+    auto argument = std::string{argv[i]};
+
+    if (argument == "--resize-benchmark") {
+      options.resizeBenchmarkIterations = uint32_t(std::stoul(nextValue(argc, argv, i)));
+    } else if (argument == "--cache-dir") {
+      options.cacheDirectory = nextValue(argc, argv, i);
+    } else if (argument == "--shader-dir") {
+      options.shaderDirectory = nextValue(argc, argv, i);
+    } else if (argument == "--no-hot-reload") {
+      options.shaderHotReload = false;
+    } else if (argument == "--no-async-pipelines") {
+      options.asyncPipelineCompilation = false;
+    } else if (argument == "--startup-timing") {
+      options.startupTiming = true;
+    } else if (argument == "--no-mesh-cache") {
+      options.meshCache = false;
+    } else if (argument == "--record-threads") {
+      options.recordThreads = std::max(uint32_t(std::stoul(nextValue(argc, argv, i))), 1u);
+    } else if (argument == "--import-threads") {
+      options.importThreads = std::max(uint32_t(std::stoul(nextValue(argc, argv, i))), 1u);
+    } else if (argument == "--copies") {
+      options.copies = std::max(uint32_t(std::stoul(nextValue(argc, argv, i))), 1u);
+    } else if (argument == "--repeat") {
+      options.repeat = std::max(uint32_t(std::stoul(nextValue(argc, argv, i))), 1u);
+    } else if (argument == "--no-dedup") {
+      options.dedup = false;
+    } else if (argument == "--record-benchmark") {
+      options.recordBenchmarkFrames = uint32_t(std::stoul(nextValue(argc, argv, i)));
+    } else if (argument == "--no-lod") {
+      options.lod = false;
+    } else if (argument == "--lod-error") {
+      options.lodPixelError = std::stof(nextValue(argc, argv, i));
+    } else if (argument == "--cpu-draws") {
+      options.gpuDriven = false;
+    } else if (argument == "--no-clusters") {
+      options.clusters = false;
+    } else if (argument == "--no-mesh-shaders") {
+      options.meshShaders = false;
+    } else if (argument == "--no-occlusion") {
+      options.occlusionCulling = false;
+    } else if (argument == "--windows") {
+      options.windows = rangedValue(argc, argv, i, 1, MAX_WINDOWS);
+    } else if (argument == "--views") {
+      options.views = rangedValue(argc, argv, i, 1, MAX_VIEWS_PER_WINDOW);
+    } else if (argument == "--view-files") {
+      options.viewFiles = true;
+    } else if (argument == "--present-mode") {
+      options.presentMode = nextValue(argc, argv, i);
+      if (options.presentMode != "fifo" && options.presentMode != "fifo-relaxed" && options.presentMode != "mailbox" && options.presentMode != "immediate") {
+        throw std::runtime_error("Unknown present mode " + options.presentMode);
+      }
+    } else if (argument == "--frames-in-flight") {
+      options.framesInFlight = rangedValue(argc, argv, i, 1, MAX_FRAMES_IN_FLIGHT);
+    } else if (argument == "--swapchain-images") {
+      options.swapChainImageCount = uint32_t(std::stoul(nextValue(argc, argv, i)));
+    } else if (argument == "--frame-pacing") {
+      options.framePacing = true;
+    } else if (argument == "--no-render-thread") {
+      options.renderThread = false;
+    } else if (argument == "--low-latency") {
+      options.presentMode = "mailbox";
+      options.framesInFlight = 1;
+      options.framePacing = true;
+    } else if (argument == "--msaa") {
+      options.samples = uint32_t(std::stoul(nextValue(argc, argv, i)));
+      if (options.samples != 1 && options.samples != 2 && options.samples != 4 && options.samples != 8) {
+        throw std::runtime_error("MSAA sample count must be 1, 2, 4 or 8");
+      }
+    } else if (argument == "--texture-budget") {
+      options.textureBudget = std::max(uint32_t(std::stoul(nextValue(argc, argv, i))), 1u);
+    } else if (argument == "--frame-stats") {
+      options.frameStats = true;
+    } else if (argument == "--stats-json") {
+      options.statsFile = nextValue(argc, argv, i);
+    } else if (argument == "--trace") {
+      options.traceFile = nextValue(argc, argv, i);
+    } else if (argument == "--headless") {
+      options.headless = true;
+    } else if (argument == "--size") {
+      auto size = nextValue(argc, argv, i);
+      auto separator = size.find('x');
+      if (separator == std::string::npos) {
+        throw std::runtime_error("Expected --size WIDTHxHEIGHT");
+      }
+      auto width = std::stoul(size.substr(0, separator));
+      auto height = std::stoul(size.substr(separator + 1));
+      // Offscreen targets are created at this size, which Vulkan requires to be non-zero.
+      if (width < 1 || height < 1 || width > UINT32_MAX || height > UINT32_MAX) {
+        throw std::runtime_error("--size width and height must be between 1 and " + std::to_string(UINT32_MAX));
+      }
+      options.width = uint32_t(width);
+      options.height = uint32_t(height);
+    } else if (argument == "--frames") {
+      options.frameCount = rangedValue(argc, argv, i, 1, UINT32_MAX);
+    } else if (argument == "--output") {
+      options.outputDirectory = nextValue(argc, argv, i);
+    } else if (argument == "--image-format") {
+      options.imageFormat = nextValue(argc, argv, i);
+      if (options.imageFormat != "png" && options.imageFormat != "ppm" && options.imageFormat != "none") {
+        throw std::runtime_error("Unsupported image format " + options.imageFormat);
+      }
+    } else if (argument == "--camera-path") {
+      options.cameraPath = nextValue(argc, argv, i);
+    } else if (argument.rfind("--", 0) == 0) {
+      throw std::runtime_error("Unknown option " + argument);
+    } else {
+      options.meshFiles.push_back(argument);
+    }
+  }
+
+  return options;
+}
@@ -0,0 +1,151 @@
+#include "pipeline_cache.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+uint64_t fnv1a(const char* data, size_t size) {
+  auto hash = uint64_t{14695981039346656037ull};
+  for (auto i = size_t{0}; i < size; i++) {
+    hash ^= uint8_t(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE at the start of the driver blob.
+struct DriverCacheHeader {
+  uint32_t headerSize;
+  uint32_t headerVersion;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+}
+
+PipelineCache::PipelineCache(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, const std::string& path)
+  : logicalDevice{logicalDevice}, path{path} {
+  vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+  std::vector<char> data;
+  if (load(data)) {
+    initialDataSize = data.size();
+  } else {
+    data.clear();
+  }
+
+  VkPipelineCacheCreateInfo pipelineCacheCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    .initialDataSize = data.size(),
+    .pInitialData = data.data()
+  };
+
+  if (vkCreatePipelineCache(logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create pipeline cache");
+  }
+}
+
+PipelineCache::~PipelineCache() {
+  try {
+    save();
+  } catch (const std::exception& exception) {
+    std::cerr << "Could not save pipeline cache: " << exception.what() << std::endl;
+  }
+
+  vkDestroyPipelineCache(logicalDevice, pipelineCache, nullptr);
+}
+
+void PipelineCache::save() {
+  auto dataSize = size_t{0};
+  vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, nullptr);
+  std::vector<char> data(dataSize);
+  if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Could not read pipeline cache data");
+  }
+  data.resize(dataSize);
+
+  auto header = expectedHeader(data);
+
+  // Write to a temporary file first so a crash never leaves a torn cache behind.
+  std::filesystem::create_directories(std::filesystem::path{path}.parent_path());
+  auto temporaryPath = path + ".tmp";
+  {
+    std::ofstream file{temporaryPath, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(data.data(), data.size());
+    if (!file) {
+      throw std::runtime_error("Could not write " + temporaryPath);
+    }
+  }
+  std::filesystem::rename(temporaryPath, path);
+}
+
+bool PipelineCache::load(std::vector<char>& data) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file.is_open()) {
+    return false;
+  }
+
+  FileHeader header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+    return false;
+  }
+
+  // Everything before the data size only depends on the device, so foreign
+  // or garbage files are rejected before anything is allocated for them.
+  auto expected = expectedHeader({});
+  if (std::memcmp(&header, &expected, offsetof(FileHeader, dataSize)) != 0) {
+    std::cerr << "Discarding pipeline cache " << path << " written by another device, driver or viewer version" << std::endl;
+    return false;
+  }
+
+  std::error_code error;
+  auto fileSize = std::filesystem::file_size(path, error);
+  if (error || header.dataSize > fileSize - sizeof(header)) {
+    std::cerr << "Discarding truncated pipeline cache " << path << std::endl;
+    return false;
+  }
+
+  data.resize(header.dataSize);
+  if (!file.read(data.data(), data.size())) {
+    std::cerr << "Discarding truncated pipeline cache " << path << std::endl;
+    return false;
+  }
+
+  expected = expectedHeader(data);
+  if (std::memcmp(&header, &expected, sizeof(header)) != 0) {
+    std::cerr << "Discarding corrupt pipeline cache " << path << std::endl;
+    return false;
+  }
+
+  DriverCacheHeader driverHeader;
+  if (data.size() < sizeof(driverHeader)) {
+    return false;
+  }
+  std::memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+  return driverHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+    && driverHeader.vendorID == physicalDeviceProperties.vendorID
+    && driverHeader.deviceID == physicalDeviceProperties.deviceID
+    && std::memcmp(driverHeader.pipelineCacheUUID, physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+PipelineCache::FileHeader PipelineCache::expectedHeader(const std::vector<char>& data) const {
+  FileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "VPCF", 4);
+  header.version = FILE_VERSION;
+  header.vendorID = physicalDeviceProperties.vendorID;
+  header.deviceID = physicalDeviceProperties.deviceID;
+  header.driverVersion = physicalDeviceProperties.driverVersion;
+  std::memcpy(header.pipelineCacheUUID, physicalDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+  header.dataSize = data.size();
+  header.checksum = fnv1a(data.data(), data.size());
+  return header;
+}
@@ -0,0 +1,258 @@
+#include "profiler.hpp"
+
+#include "json.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+RollingStats::RollingStats(size_t capacity)
+  : capacity{capacity} {
+}
+
+void RollingStats::add(double sample) {
+  if (samples.size() < capacity) {
+    samples.push_back(sample);
+  } else {
+    samples[next] = sample;
+  }
+  next = (next + 1) % capacity;
+  totalCount++;
+}
+
+double RollingStats::percentile(double p) const {
+  if (samples.empty()) {
+    return 0.0;
+  }
+
+  auto sorted = samples;
+  auto index = std::min(size_t(p * sorted.size()), sorted.size() - 1);
+  std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+  return sorted[index];
+}
+
+Profiler::Scope::Scope(Profiler* profiler, const char* name)
+  : profiler{profiler}, name{name} {
+  if (profiler != nullptr) {
+    start = std::chrono::steady_clock::now();
+  }
+}
+
+Profiler::Scope::~Scope() {
+  if (profiler != nullptr) {
+    profiler->addCpuSample(name, start, std::chrono::steady_clock::now());
+  }
+}
+
+Profiler::Profiler(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t queueFamilyIndex, uint32_t frameCount, bool enabled, bool tracing)
+  : logicalDevice{logicalDevice}, enabled{enabled || tracing}, tracing{tracing}, gpuFrames(frameCount),
+    origin{std::chrono::steady_clock::now()}, lastFrameEnd{origin} {
+  if (!this->enabled) {
+    return;
+  }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  auto queueFamilyCount = uint32_t{0};
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+  // Without valid bits the queue does not support timestamps; only CPU scopes are measured then.
+  auto validBits = queueFamilyIndex < queueFamilyCount ? queueFamilies[queueFamilyIndex].timestampValidBits : 0;
+  if (validBits == 0) {
+    return;
+  }
+  timestampPeriod = properties.limits.timestampPeriod;
+  timestampMask = validBits >= 64 ? ~uint64_t{0} : (uint64_t{1} << validBits) - 1;
+
+  for (auto& gpuFrame : gpuFrames) {
+    VkQueryPoolCreateInfo queryPoolCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = MAX_GPU_SCOPES * 2
+    };
+
+    if (vkCreateQueryPool(logicalDevice, &queryPoolCreateInfo, nullptr, &gpuFrame.queryPool) != VK_SUCCESS) {
+      throw std::runtime_error("Could not create timestamp query pool");
+    }
+  }
+}
+
+Profiler::~Profiler() {
+  for (auto& gpuFrame : gpuFrames) {
+    vkDestroyQueryPool(logicalDevice, gpuFrame.queryPool, nullptr);
+  }
+}
+
+void Profiler::collect(uint32_t frame) {
+  auto& gpuFrame = gpuFrames[frame];
+  if (gpuFrame.queryPool == VK_NULL_HANDLE || gpuFrame.scopes.empty()) {
+    return;
+  }
+
+  std::vector<uint64_t> timestamps(gpuFrame.scopes.size() * 2);
+  auto result = vkGetQueryPoolResults(logicalDevice, gpuFrame.queryPool, 0, uint32_t(timestamps.size()), timestamps.size() * sizeof(uint64_t),
+    timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  auto scopes = std::move(gpuFrame.scopes);
+  gpuFrame.scopes.clear();
+
+  // The frame's fence has signalled, so anything else means the frame was never submitted.
+  if (result != VK_SUCCESS) {
+    return;
+  }
+
+  std::lock_guard lock{mutex};
+  auto frameStart = timestamps[0] & timestampMask;
+  for (auto i = size_t{0}; i < scopes.size(); i++) {
+    auto begin = timestamps[i * 2] & timestampMask;
+    auto end = timestamps[i * 2 + 1] & timestampMask;
+    auto durationNs = double((end - begin) & timestampMask) * timestampPeriod;
+    gpuStats[scopes[i]].add(durationNs / 1e6);
+
+    if (tracing && traceEvents.size() < MAX_TRACE_EVENTS) {
+      auto offsetNs = double((begin - frameStart) & timestampMask) * timestampPeriod;
+      traceEvents.push_back({scopes[i], GPU_THREAD, microseconds(gpuFrame.submitTime) + offsetNs / 1e3, durationNs / 1e3});
+    }
+  }
+}
+
+void Profiler::resetQueries(VkCommandBuffer commandBuffer, uint32_t frame) {
+  auto& gpuFrame = gpuFrames[frame];
+  if (gpuFrame.queryPool != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(commandBuffer, gpuFrame.queryPool, 0, MAX_GPU_SCOPES * 2);
+    gpuFrame.scopes.clear();
+  }
+}
+
+uint32_t Profiler::beginGpuScope(VkCommandBuffer commandBuffer, uint32_t frame, const char* name) {
+  auto& gpuFrame = gpuFrames[frame];
+  if (gpuFrame.queryPool == VK_NULL_HANDLE || gpuFrame.scopes.size() == MAX_GPU_SCOPES) {
+    return MAX_GPU_SCOPES;
+  }
+
+  auto scope = uint32_t(gpuFrame.scopes.size());
+  gpuFrame.scopes.push_back(name);
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, gpuFrame.queryPool, scope * 2);
+  return scope;
+}
+
+void Profiler::endGpuScope(VkCommandBuffer commandBuffer, uint32_t frame, uint32_t scope) {
+  if (scope < MAX_GPU_SCOPES) {
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, gpuFrames[frame].queryPool, scope * 2 + 1);
+  }
+}
+
+void Profiler::submitted(uint32_t frame) {
+  gpuFrames[frame].submitTime = std::chrono::steady_clock::now();
+}
+
+void Profiler::endFrame() {
+  if (!enabled) {
+    return;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard lock{mutex};
+  frameTimes.add(std::chrono::duration<double, std::milli>(now - lastFrameEnd).count());
+  lastFrameEnd = now;
+}
+
+void Profiler::addCount(const char* name, uint64_t count) {
+  if (!enabled) {
+    return;
+  }
+
+  std::lock_guard lock{mutex};
+  counts[name].add(double(count));
+}
+
+void Profiler::report(std::ostream& stream) const {
+  std::lock_guard lock{mutex};
+  if (frameTimes.count() == 0) {
+    return;
+  }
+
+  auto print = [&](const std::string& name, const RollingStats& stats) {
+    stream << "  " << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(3)
+      << " p50 " << std::setw(8) << stats.percentile(0.5) << " ms  p99 " << std::setw(8) << stats.percentile(0.99) << " ms" << std::endl;
+  };
+
+  stream << "Frame timings over the last " << frameTimes.count() << " of " << frameTimes.total() << " frames:" << std::endl;
+  print("frame", frameTimes);
+  for (const auto& [name, stats] : cpuStats) {
+    print("cpu " + name, stats);
+  }
+  for (const auto& [name, stats] : gpuStats) {
+    print("gpu " + name, stats);
+  }
+  for (const auto& [name, stats] : counts) {
+    stream << "  " << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(0)
+      << " p50 " << std::setw(8) << stats.percentile(0.5) << "     p99 " << std::setw(8) << stats.percentile(0.99) << std::endl;
+  }
+  stream << std::defaultfloat;
+}
+
+void Profiler::writeJson(std::ostream& stream) const {
+  std::lock_guard lock{mutex};
+  auto write = [&](const RollingStats& stats) {
+    stream << "{\"p50\": " << stats.percentile(0.5) << ", \"p90\": " << stats.percentile(0.9) << ", \"p99\": " << stats.percentile(0.99) << "}";
+  };
+  auto writeGroup = [&](const char* group, const std::map<std::string, RollingStats>& stats) {
+    stream << ",\n    \"" << group << "\": {";
+    auto first = true;
+    for (const auto& [name, samples] : stats) {
+      stream << (first ? "" : ", ");
+      writeJsonString(stream, name);
+      stream << ": ";
+      write(samples);
+      first = false;
+    }
+    stream << "}";
+  };
+
+  stream << std::fixed << std::setprecision(3);
+  stream << "{\n    \"frames\": " << frameTimes.total() << ",\n    \"frame\": ";
+  write(frameTimes);
+  writeGroup("cpu", cpuStats);
+  writeGroup("gpu", gpuStats);
+  writeGroup("counts", counts);
+  stream << "\n  }" << std::defaultfloat;
+}
+
+void Profiler::writeChromeTrace(const std::string& path) const {
+  std::ofstream file{path, std::ios::trunc};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open " + path);
+  }
+
+  std::lock_guard lock{mutex};
+  file << "{\"traceEvents\":[\n";
+  file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+  file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"GPU\"}}";
+  file << std::fixed << std::setprecision(3);
+  for (const auto& event : traceEvents) {
+    auto gpu = event.thread == GPU_THREAD;
+    file << ",\n{\"name\":";
+    writeJsonString(file, event.name);
+    file << ",\"ph\":\"X\",\"pid\":" << (gpu ? 2 : 1) << ",\"tid\":" << (gpu ? 0 : event.thread)
+      << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+  }
+  file << "\n]}\n";
+}
+
+void Profiler::addCpuSample(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+  std::lock_guard lock{mutex};
+  cpuStats[name].add(std::chrono::duration<double, std::milli>(end - start).count());
+
+  if (tracing && traceEvents.size() < MAX_TRACE_EVENTS) {
+    auto thread = threads.emplace(std::this_thread::get_id(), uint32_t(threads.size())).first->second;
+    traceEvents.push_back({name, thread, microseconds(start), std::chrono::duration<double, std::micro>(end - start).count()});
+  }
+}
+
+double Profiler::microseconds(std::chrono::steady_clock::time_point time) const {
+  return std::chrono::duration<double, std::micro>(time - origin).count();
+}
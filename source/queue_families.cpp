@@ -0,0 +1,79 @@
+#include "queue_families.hpp"
+
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t NONE{std::numeric_limits<uint32_t>::max()};
+
+bool canPresent(VkPhysicalDevice physicalDevice, uint32_t family, VkSurfaceKHR surface) {
+  if (surface == VK_NULL_HANDLE) {
+    return true;
+  }
+  auto supported = VkBool32{VK_FALSE};
+  vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, family, surface, &supported);
+  return supported == VK_TRUE;
+}
+
+}
+
+QueueFamilies findQueueFamilies(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
+  auto familyCount = uint32_t{0};
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+  auto graphicsAndCompute = VkQueueFlags{VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT};
+
+  // A family that can both draw and present saves a queue ownership hand over per frame.
+  auto graphics = NONE;
+  auto present = NONE;
+  for (auto i = uint32_t{0}; i < familyCount; i++) {
+    if ((families[i].queueFlags & graphicsAndCompute) == graphicsAndCompute && canPresent(physicalDevice, i, surface)) {
+      graphics = i;
+      present = i;
+      break;
+    }
+  }
+  for (auto i = uint32_t{0}; i < familyCount && graphics == NONE; i++) {
+    if ((families[i].queueFlags & graphicsAndCompute) == graphicsAndCompute) {
+      graphics = i;
+    }
+  }
+  for (auto i = uint32_t{0}; i < familyCount && present == NONE; i++) {
+    if (canPresent(physicalDevice, i, surface)) {
+      present = i;
+    }
+  }
+
+  if (graphics == NONE) {
+    throw std::runtime_error("Device has no graphics queue");
+  }
+  if (present == NONE) {
+    throw std::runtime_error("Device has no queue that can present to the window");
+  }
+
+  QueueFamilies queueFamilies{.graphics = graphics, .present = present, .transfer = graphics};
+
+  // Graphics and compute families support transfers without saying so.
+  auto transfer = NONE;
+  for (auto i = uint32_t{0}; i < familyCount && transfer == NONE; i++) {
+    if ((families[i].queueFlags & VK_QUEUE_TRANSFER_BIT) && !(families[i].queueFlags & graphicsAndCompute)) {
+      transfer = i;
+    }
+  }
+  for (auto i = uint32_t{0}; i < familyCount && transfer == NONE; i++) {
+    if ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      transfer = i;
+    }
+  }
+
+  if (transfer != NONE) {
+    queueFamilies.transfer = transfer;
+  } else if (families[graphics].queueCount > 1) {
+    queueFamilies.transferQueueIndex = 1;
+  }
+  return queueFamilies;
+}
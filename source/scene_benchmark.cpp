@@ -0,0 +1,190 @@
+#include "scene_core.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+// Times SceneCore::update() and quantizeVertices() at every SIMD level the
+// CPU supports, on an assembly of nested subassemblies, and checks that each
+// level computes what the scalar code does.
+namespace {
+
+constexpr double FRAME_MILLISECONDS{1000.0 / 60.0};
+
+struct Options {
+  size_t parts{100000};
+  size_t vertices{1000000};
+  int iterations{50};
+};
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  for (auto i = 1; i < argc; i++) {
+    auto arg = std::string{argv[i]};
+    auto value = [&] {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing value for " + arg);
+      }
+      return std::stoul(argv[++i]);
+    };
+    if (arg == "--parts") {
+      options.parts = value();
+    } else if (arg == "--vertices") {
+      options.vertices = value();
+    } else if (arg == "--iterations") {
+      options.iterations = int(value());
+    } else {
+      throw std::runtime_error("Usage: scene_benchmark [--parts N] [--vertices N] [--iterations N]");
+    }
+  }
+  return options;
+}
+
+Mat4 randomTransform(std::mt19937& random) {
+  std::uniform_real_distribution<float> angle{0.0f, 6.2831853f};
+  std::uniform_real_distribution<float> offset{-10.0f, 10.0f};
+  auto a = angle(random);
+  auto b = angle(random);
+  Mat4 transform;
+  transform(0, 0) = std::cos(a);
+  transform(0, 1) = -std::sin(a) * std::cos(b);
+  transform(0, 2) = std::sin(a) * std::sin(b);
+  transform(1, 0) = std::sin(a);
+  transform(1, 1) = std::cos(a) * std::cos(b);
+  transform(1, 2) = -std::cos(a) * std::sin(b);
+  transform(2, 1) = std::sin(b);
+  transform(2, 2) = std::cos(b);
+  transform(0, 3) = offset(random);
+  transform(1, 3) = offset(random);
+  transform(2, 3) = offset(random);
+  return transform;
+}
+
+// Subassemblies of 8 to 16 children, 5 levels deep, the rest parts.
+SceneCore buildAssembly(SimdLevel level, size_t parts) {
+  std::mt19937 random{1};
+  std::uniform_int_distribution<size_t> fanOut{8, 16};
+  SceneCore scene{level};
+  auto box = Aabb{{-1.0f, -1.0f, -1.0f}, {1.0f, 1.0f, 1.0f}};
+
+  std::vector<uint32_t> assemblies{scene.addNode(SceneCore::NO_PARENT, Mat4{}, box)};
+  for (auto depth = 0; depth < 5 && scene.size() < parts; depth++) {
+    std::vector<uint32_t> children;
+    for (auto parent : assemblies) {
+      for (auto i = fanOut(random); i > 0 && scene.size() < parts; i--) {
+        children.push_back(scene.addNode(parent, randomTransform(random), box));
+      }
+    }
+    assemblies = std::move(children);
+  }
+  while (scene.size() < parts) {
+    scene.addNode(assemblies[random() % assemblies.size()], randomTransform(random), box);
+  }
+  return scene;
+}
+
+double relativeError(float a, float b) {
+  return std::abs(a - b) / std::max(1.0f, std::abs(b));
+}
+
+void benchmarkScene(const Options& options, SimdLevel level, const SceneCore& reference) {
+  auto scene = buildAssembly(level, options.parts);
+  std::mt19937 random{2};
+
+  // Every iteration moves the root, so the whole assembly is recomputed.
+  scene.update();
+  auto start = std::chrono::steady_clock::now();
+  for (auto i = 0; i < options.iterations; i++) {
+    scene.setLocal(0, randomTransform(random));
+    scene.update();
+  }
+  auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / options.iterations;
+
+  scene.setLocal(0, Mat4{});
+  scene.update();
+  auto maxError = 0.0;
+  for (auto node = uint32_t{0}; node < scene.size(); node++) {
+    auto world = scene.world(node);
+    auto expected = reference.world(node);
+    for (auto k = 0; k < 16; k++) {
+      maxError = std::max(maxError, relativeError(world.m[k], expected.m[k]));
+    }
+    auto bounds = scene.worldBounds(node);
+    auto expectedBounds = reference.worldBounds(node);
+    maxError = std::max({maxError, relativeError(bounds.min.x, expectedBounds.min.x), relativeError(bounds.max.z, expectedBounds.max.z)});
+  }
+
+  std::cout << "  " << simdLevelName(level) << ": " << milliseconds << " ms, "
+            << milliseconds / FRAME_MILLISECONDS * 100.0 << "% of a 60 Hz frame, "
+            << "max relative error " << maxError << std::endl;
+  if (maxError > 1e-4) {
+    throw std::runtime_error(std::string{simdLevelName(level)} + " transforms differ from the scalar ones");
+  }
+}
+
+void benchmarkQuantization(const Options& options, const std::vector<SimdLevel>& levels) {
+  std::mt19937 random{3};
+  std::normal_distribution<float> direction;
+  std::uniform_real_distribution<float> texCoord{-4.0f, 4.0f};
+  std::vector<Vec3> positions(options.vertices);
+  std::vector<Vec3> normals(options.vertices);
+  std::vector<float> texCoords(options.vertices * 2);
+  for (auto i = size_t{0}; i < options.vertices; i++) {
+    positions[i] = {direction(random), direction(random), direction(random)};
+    // Every 64th normal is zero, like the missing normals of a broken file.
+    normals[i] = i % 64 == 0 ? Vec3{} : Vec3{direction(random), direction(random), direction(random)};
+    texCoords[i * 2] = texCoord(random);
+    texCoords[i * 2 + 1] = texCoord(random);
+  }
+
+  std::vector<Vertex> expected(options.vertices);
+  quantizeVertices(SimdLevel::Scalar, positions.data(), normals.data(), texCoords.data(), options.vertices, expected.data());
+
+  std::cout << "Quantizing " << options.vertices << " vertices" << std::endl;
+  for (auto level : levels) {
+    std::vector<Vertex> vertices(options.vertices);
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < options.iterations; i++) {
+      quantizeVertices(level, positions.data(), normals.data(), texCoords.data(), options.vertices, vertices.data());
+    }
+    auto milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / options.iterations;
+    std::cout << "  " << simdLevelName(level) << ": " << milliseconds << " ms" << std::endl;
+
+    if (std::memcmp(vertices.data(), expected.data(), vertices.size() * sizeof(Vertex)) != 0) {
+      throw std::runtime_error(std::string{simdLevelName(level)} + " vertices differ from the scalar ones");
+    }
+  }
+}
+
+}
+
+int main(int argc, char** argv) {
+  try {
+    auto options = parseOptions(argc, argv);
+    std::vector<SimdLevel> levels{SimdLevel::Scalar};
+    if (detectSimdLevel() != SimdLevel::Scalar) {
+      levels.push_back(SimdLevel::Sse);
+    }
+    if (detectSimdLevel() == SimdLevel::Avx2) {
+      levels.push_back(SimdLevel::Avx2);
+    }
+
+    auto reference = buildAssembly(SimdLevel::Scalar, options.parts);
+    reference.update();
+    std::cout << "Updating " << reference.size() << " nodes" << std::endl;
+    for (auto level : levels) {
+      benchmarkScene(options, level, reference);
+    }
+    benchmarkQuantization(options, levels);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
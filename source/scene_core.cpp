@@ -0,0 +1,579 @@
+#include "scene_core.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCENE_CORE_X86 1
+#endif
+
+namespace {
+
+// Coefficient index of row and column in TransformArrays.
+constexpr size_t coefficient(size_t row, size_t column) {
+  return column * 3 + row;
+}
+
+void propagateScalar(const TransformArrays& local, TransformArrays& world, const uint32_t* parents, size_t begin, size_t end) {
+  for (auto i = begin; i < end; i++) {
+    auto parent = parents[i];
+    for (auto column = size_t{0}; column < 4; column++) {
+      for (auto row = size_t{0}; row < 3; row++) {
+        auto value = column == 3 ? world.m[coefficient(row, 3)][parent] : 0.0f;
+        for (auto k = size_t{0}; k < 3; k++) {
+          value += world.m[coefficient(row, k)][parent] * local.m[coefficient(k, column)][i];
+        }
+        world.m[coefficient(row, column)][i] = value;
+      }
+    }
+  }
+}
+
+// Center and half extent: the transformed center, and the extent along each
+// world axis that the rotated and scaled box reaches.
+void transformBoundsScalar(const TransformArrays& world, const BoundsArrays& local, BoundsArrays& worldBounds, size_t begin, size_t end) {
+  for (auto i = begin; i < end; i++) {
+    float center[3]{(local.minX[i] + local.maxX[i]) * 0.5f, (local.minY[i] + local.maxY[i]) * 0.5f, (local.minZ[i] + local.maxZ[i]) * 0.5f};
+    float extent[3]{(local.maxX[i] - local.minX[i]) * 0.5f, (local.maxY[i] - local.minY[i]) * 0.5f, (local.maxZ[i] - local.minZ[i]) * 0.5f};
+    float worldCenter[3];
+    float worldExtent[3];
+    for (auto row = size_t{0}; row < 3; row++) {
+      worldCenter[row] = world.m[coefficient(row, 3)][i];
+      worldExtent[row] = 0.0f;
+      for (auto k = size_t{0}; k < 3; k++) {
+        worldCenter[row] += world.m[coefficient(row, k)][i] * center[k];
+        worldExtent[row] += std::abs(world.m[coefficient(row, k)][i]) * extent[k];
+      }
+    }
+    worldBounds.minX[i] = worldCenter[0] - worldExtent[0];
+    worldBounds.minY[i] = worldCenter[1] - worldExtent[1];
+    worldBounds.minZ[i] = worldCenter[2] - worldExtent[2];
+    worldBounds.maxX[i] = worldCenter[0] + worldExtent[0];
+    worldBounds.maxY[i] = worldCenter[1] + worldExtent[1];
+    worldBounds.maxZ[i] = worldCenter[2] + worldExtent[2];
+  }
+}
+
+Aabb mergeScalar(const BoundsArrays& bounds, size_t begin, size_t end) {
+  Aabb merged;
+  for (auto i = begin; i < end; i++) {
+    merged.min = {std::min(merged.min.x, bounds.minX[i]), std::min(merged.min.y, bounds.minY[i]), std::min(merged.min.z, bounds.minZ[i])};
+    merged.max = {std::max(merged.max.x, bounds.maxX[i]), std::max(merged.max.y, bounds.maxY[i]), std::max(merged.max.z, bounds.maxZ[i])};
+  }
+  return merged;
+}
+
+void quantizeScalar(const Vec3* positions, const Vec3* normals, const float* texCoords, size_t begin, size_t end, Vertex* vertices) {
+  for (auto i = begin; i < end; i++) {
+    vertices[i].position = positions[i];
+    vertices[i].normal = encodeNormal(normals[i]);
+    vertices[i].texCoord = texCoords != nullptr ? encodeTexCoord(texCoords[i * 2], texCoords[i * 2 + 1]) : std::array<uint16_t, 2>{0, 0};
+  }
+}
+
+#if SCENE_CORE_X86
+
+// SSE2 only, which every x86-64 CPU has: no gathers, rounding or blends.
+
+__m128 absSse(__m128 value) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), value);
+}
+
+__m128 selectSse(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+__m128 gatherSse(const float* values, const uint32_t* indices) {
+  return _mm_set_ps(values[indices[3]], values[indices[2]], values[indices[1]], values[indices[0]]);
+}
+
+void propagateSse(const TransformArrays& local, TransformArrays& world, const uint32_t* parents, size_t begin, size_t end) {
+  auto i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 parent[12];
+    __m128 child[12];
+    for (auto k = size_t{0}; k < 12; k++) {
+      parent[k] = gatherSse(world.m[k].data(), parents + i);
+      child[k] = _mm_loadu_ps(local.m[k].data() + i);
+    }
+    for (auto column = size_t{0}; column < 4; column++) {
+      for (auto row = size_t{0}; row < 3; row++) {
+        auto value = column == 3 ? parent[coefficient(row, 3)] : _mm_setzero_ps();
+        for (auto k = size_t{0}; k < 3; k++) {
+          value = _mm_add_ps(value, _mm_mul_ps(parent[coefficient(row, k)], child[coefficient(k, column)]));
+        }
+        _mm_storeu_ps(world.m[coefficient(row, column)].data() + i, value);
+      }
+    }
+  }
+  propagateScalar(local, world, parents, i, end);
+}
+
+void transformBoundsSse(const TransformArrays& world, const BoundsArrays& local, BoundsArrays& worldBounds, size_t begin, size_t end) {
+  auto half = _mm_set1_ps(0.5f);
+  auto i = begin;
+  for (; i + 4 <= end; i += 4) {
+    const std::vector<float>* mins[3]{&local.minX, &local.minY, &local.minZ};
+    const std::vector<float>* maxs[3]{&local.maxX, &local.maxY, &local.maxZ};
+    __m128 center[3];
+    __m128 extent[3];
+    for (auto axis = 0; axis < 3; axis++) {
+      auto low = _mm_loadu_ps(mins[axis]->data() + i);
+      auto high = _mm_loadu_ps(maxs[axis]->data() + i);
+      center[axis] = _mm_mul_ps(_mm_add_ps(low, high), half);
+      extent[axis] = _mm_mul_ps(_mm_sub_ps(high, low), half);
+    }
+
+    std::vector<float>* worldMins[3]{&worldBounds.minX, &worldBounds.minY, &worldBounds.minZ};
+    std::vector<float>* worldMaxs[3]{&worldBounds.maxX, &worldBounds.maxY, &worldBounds.maxZ};
+    for (auto row = size_t{0}; row < 3; row++) {
+      auto worldCenter = _mm_loadu_ps(world.m[coefficient(row, 3)].data() + i);
+      auto worldExtent = _mm_setzero_ps();
+      for (auto k = size_t{0}; k < 3; k++) {
+        auto m = _mm_loadu_ps(world.m[coefficient(row, k)].data() + i);
+        worldCenter = _mm_add_ps(worldCenter, _mm_mul_ps(m, center[k]));
+        worldExtent = _mm_add_ps(worldExtent, _mm_mul_ps(absSse(m), extent[k]));
+      }
+      _mm_storeu_ps(worldMins[row]->data() + i, _mm_sub_ps(worldCenter, worldExtent));
+      _mm_storeu_ps(worldMaxs[row]->data() + i, _mm_add_ps(worldCenter, worldExtent));
+    }
+  }
+  transformBoundsScalar(world, local, worldBounds, i, end);
+}
+
+Aabb mergeSse(const BoundsArrays& bounds, size_t begin, size_t end) {
+  auto merged = mergeScalar(bounds, begin, std::min(end, begin + (end - begin) % 4));
+  const std::vector<float>* arrays[6]{&bounds.minX, &bounds.minY, &bounds.minZ, &bounds.maxX, &bounds.maxY, &bounds.maxZ};
+  __m128 lanes[6];
+  for (auto axis = 0; axis < 3; axis++) {
+    lanes[axis] = _mm_set1_ps(std::numeric_limits<float>::max());
+    lanes[axis + 3] = _mm_set1_ps(std::numeric_limits<float>::lowest());
+  }
+  for (auto i = begin + (end - begin) % 4; i < end; i += 4) {
+    for (auto axis = 0; axis < 3; axis++) {
+      lanes[axis] = _mm_min_ps(lanes[axis], _mm_loadu_ps(arrays[axis]->data() + i));
+      lanes[axis + 3] = _mm_max_ps(lanes[axis + 3], _mm_loadu_ps(arrays[axis + 3]->data() + i));
+    }
+  }
+
+  float values[6][4];
+  for (auto axis = 0; axis < 6; axis++) {
+    _mm_storeu_ps(values[axis], lanes[axis]);
+  }
+  for (auto lane = 0; lane < 4; lane++) {
+    merged.extend(Aabb{{values[0][lane], values[1][lane], values[2][lane]}, {values[3][lane], values[4][lane], values[5][lane]}});
+  }
+  return merged;
+}
+
+// encodeNormal() four at a time; lround() rounds halfway cases away from
+// zero, so the fraction left after truncating decides.
+__m128 roundAwaySse(__m128 value) {
+  auto truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(value));
+  auto fraction = _mm_sub_ps(value, truncated);
+  auto sign = _mm_or_ps(_mm_and_ps(value, _mm_set1_ps(-0.0f)), _mm_set1_ps(1.0f));
+  auto roundUp = _mm_cmpge_ps(absSse(fraction), _mm_set1_ps(0.5f));
+  return _mm_add_ps(truncated, _mm_and_ps(roundUp, sign));
+}
+
+void quantizeSse(const Vec3* positions, const Vec3* normals, const float* texCoords, size_t begin, size_t end, Vertex* vertices) {
+  auto one = _mm_set1_ps(1.0f);
+  auto i = begin;
+  for (; i + 4 <= end; i += 4) {
+    auto nx = _mm_set_ps(normals[i + 3].x, normals[i + 2].x, normals[i + 1].x, normals[i].x);
+    auto ny = _mm_set_ps(normals[i + 3].y, normals[i + 2].y, normals[i + 1].y, normals[i].y);
+    auto nz = _mm_set_ps(normals[i + 3].z, normals[i + 2].z, normals[i + 1].z, normals[i].z);
+    auto sum = _mm_add_ps(_mm_add_ps(absSse(nx), absSse(ny)), absSse(nz));
+    auto valid = _mm_cmpgt_ps(sum, _mm_setzero_ps());
+
+    auto x = _mm_div_ps(nx, sum);
+    auto y = _mm_div_ps(ny, sum);
+    auto signX = selectSse(_mm_cmpge_ps(x, _mm_setzero_ps()), one, _mm_set1_ps(-1.0f));
+    auto signY = selectSse(_mm_cmpge_ps(y, _mm_setzero_ps()), one, _mm_set1_ps(-1.0f));
+    auto lower = _mm_cmplt_ps(nz, _mm_setzero_ps());
+    auto foldedX = _mm_mul_ps(_mm_sub_ps(one, absSse(y)), signX);
+    auto foldedY = _mm_mul_ps(_mm_sub_ps(one, absSse(x)), signY);
+    x = selectSse(lower, foldedX, x);
+    y = selectSse(lower, foldedY, y);
+
+    auto scale = _mm_set1_ps(32767.0f);
+    int32_t encodedX[4];
+    int32_t encodedY[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(encodedX), _mm_cvttps_epi32(roundAwaySse(_mm_mul_ps(_mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1.0f)), one), scale))));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(encodedY), _mm_cvttps_epi32(roundAwaySse(_mm_mul_ps(_mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-1.0f)), one), scale))));
+    auto validLanes = _mm_movemask_ps(valid);
+
+    for (auto lane = size_t{0}; lane < 4; lane++) {
+      auto& vertex = vertices[i + lane];
+      vertex.position = positions[i + lane];
+      vertex.normal = validLanes & (1 << lane) ? std::array<int16_t, 2>{int16_t(encodedX[lane]), int16_t(encodedY[lane])} : std::array<int16_t, 2>{NO_NORMAL, NO_NORMAL};
+      vertex.texCoord = texCoords != nullptr ? encodeTexCoord(texCoords[(i + lane) * 2], texCoords[(i + lane) * 2 + 1]) : std::array<uint16_t, 2>{0, 0};
+    }
+  }
+  quantizeScalar(positions, normals, texCoords, i, end, vertices);
+}
+
+// AVX2 paths, compiled for AVX2, FMA and F16C whatever the rest of the build
+// targets, and only called once detectSimdLevel() has found them.
+#define SCENE_CORE_AVX2 __attribute__((target("avx2,fma,f16c")))
+
+SCENE_CORE_AVX2 __m256 absAvx2(__m256 value) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), value);
+}
+
+SCENE_CORE_AVX2 void propagateAvx2(const TransformArrays& local, TransformArrays& world, const uint32_t* parents, size_t begin, size_t end) {
+  auto i = begin;
+  for (; i + 8 <= end; i += 8) {
+    auto parentIndices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(parents + i));
+    __m256 parent[12];
+    __m256 child[12];
+    for (auto k = size_t{0}; k < 12; k++) {
+      parent[k] = _mm256_i32gather_ps(world.m[k].data(), parentIndices, 4);
+      child[k] = _mm256_loadu_ps(local.m[k].data() + i);
+    }
+    for (auto column = size_t{0}; column < 4; column++) {
+      for (auto row = size_t{0}; row < 3; row++) {
+        auto value = column == 3 ? parent[coefficient(row, 3)] : _mm256_setzero_ps();
+        for (auto k = size_t{0}; k < 3; k++) {
+          value = _mm256_fmadd_ps(parent[coefficient(row, k)], child[coefficient(k, column)], value);
+        }
+        _mm256_storeu_ps(world.m[coefficient(row, column)].data() + i, value);
+      }
+    }
+  }
+  propagateScalar(local, world, parents, i, end);
+}
+
+SCENE_CORE_AVX2 void transformBoundsAvx2(const TransformArrays& world, const BoundsArrays& local, BoundsArrays& worldBounds, size_t begin, size_t end) {
+  auto half = _mm256_set1_ps(0.5f);
+  const std::vector<float>* mins[3]{&local.minX, &local.minY, &local.minZ};
+  const std::vector<float>* maxs[3]{&local.maxX, &local.maxY, &local.maxZ};
+  std::vector<float>* worldMins[3]{&worldBounds.minX, &worldBounds.minY, &worldBounds.minZ};
+  std::vector<float>* worldMaxs[3]{&worldBounds.maxX, &worldBounds.maxY, &worldBounds.maxZ};
+  auto i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 center[3];
+    __m256 extent[3];
+    for (auto axis = 0; axis < 3; axis++) {
+      auto low = _mm256_loadu_ps(mins[axis]->data() + i);
+      auto high = _mm256_loadu_ps(maxs[axis]->data() + i);
+      center[axis] = _mm256_mul_ps(_mm256_add_ps(low, high), half);
+      extent[axis] = _mm256_mul_ps(_mm256_sub_ps(high, low), half);
+    }
+
+    for (auto row = size_t{0}; row < 3; row++) {
+      auto worldCenter = _mm256_loadu_ps(world.m[coefficient(row, 3)].data() + i);
+      auto worldExtent = _mm256_setzero_ps();
+      for (auto k = size_t{0}; k < 3; k++) {
+        auto m = _mm256_loadu_ps(world.m[coefficient(row, k)].data() + i);
+        worldCenter = _mm256_fmadd_ps(m, center[k], worldCenter);
+        worldExtent = _mm256_fmadd_ps(absAvx2(m), extent[k], worldExtent);
+      }
+      _mm256_storeu_ps(worldMins[row]->data() + i, _mm256_sub_ps(worldCenter, worldExtent));
+      _mm256_storeu_ps(worldMaxs[row]->data() + i, _mm256_add_ps(worldCenter, worldExtent));
+    }
+  }
+  transformBoundsScalar(world, local, worldBounds, i, end);
+}
+
+SCENE_CORE_AVX2 Aabb mergeAvx2(const BoundsArrays& bounds, size_t begin, size_t end) {
+  auto merged = mergeScalar(bounds, begin, std::min(end, begin + (end - begin) % 8));
+  const std::vector<float>* arrays[6]{&bounds.minX, &bounds.minY, &bounds.minZ, &bounds.maxX, &bounds.maxY, &bounds.maxZ};
+  __m256 lanes[6];
+  for (auto axis = 0; axis < 3; axis++) {
+    lanes[axis] = _mm256_set1_ps(std::numeric_limits<float>::max());
+    lanes[axis + 3] = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+  }
+  for (auto i = begin + (end - begin) % 8; i < end; i += 8) {
+    for (auto axis = 0; axis < 3; axis++) {
+      lanes[axis] = _mm256_min_ps(lanes[axis], _mm256_loadu_ps(arrays[axis]->data() + i));
+      lanes[axis + 3] = _mm256_max_ps(lanes[axis + 3], _mm256_loadu_ps(arrays[axis + 3]->data() + i));
+    }
+  }
+
+  float values[6][8];
+  for (auto axis = 0; axis < 6; axis++) {
+    _mm256_storeu_ps(values[axis], lanes[axis]);
+  }
+  for (auto lane = 0; lane < 8; lane++) {
+    merged.extend(Aabb{{values[0][lane], values[1][lane], values[2][lane]}, {values[3][lane], values[4][lane], values[5][lane]}});
+  }
+  return merged;
+}
+
+SCENE_CORE_AVX2 __m256 roundAwayAvx2(__m256 value) {
+  auto truncated = _mm256_round_ps(value, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+  auto fraction = _mm256_sub_ps(value, truncated);
+  auto sign = _mm256_or_ps(_mm256_and_ps(value, _mm256_set1_ps(-0.0f)), _mm256_set1_ps(1.0f));
+  auto roundUp = _mm256_cmp_ps(absAvx2(fraction), _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+  return _mm256_add_ps(truncated, _mm256_and_ps(roundUp, sign));
+}
+
+// Vec3 and texture coordinate pairs are gathered with strides of 3 and 2
+// floats; F16C converts to half floats with the same rounding as encodeTexCoord().
+SCENE_CORE_AVX2 void quantizeAvx2(const Vec3* positions, const Vec3* normals, const float* texCoords, size_t begin, size_t end, Vertex* vertices) {
+  static_assert(sizeof(Vec3) == 3 * sizeof(float), "Vec3 must be three packed floats");
+  auto one = _mm256_set1_ps(1.0f);
+  auto minusOne = _mm256_set1_ps(-1.0f);
+  auto zero = _mm256_setzero_ps();
+  auto scale = _mm256_set1_ps(32767.0f);
+  auto normalOffsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  auto texCoordOffsets = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+  auto i = begin;
+  for (; i + 8 <= end; i += 8) {
+    const auto* normal = reinterpret_cast<const float*>(normals + i);
+    auto nx = _mm256_i32gather_ps(normal, normalOffsets, 4);
+    auto ny = _mm256_i32gather_ps(normal + 1, normalOffsets, 4);
+    auto nz = _mm256_i32gather_ps(normal + 2, normalOffsets, 4);
+    auto sum = _mm256_add_ps(_mm256_add_ps(absAvx2(nx), absAvx2(ny)), absAvx2(nz));
+    auto valid = _mm256_cmp_ps(sum, zero, _CMP_GT_OQ);
+
+    auto x = _mm256_div_ps(nx, sum);
+    auto y = _mm256_div_ps(ny, sum);
+    auto signX = _mm256_blendv_ps(minusOne, one, _mm256_cmp_ps(x, zero, _CMP_GE_OQ));
+    auto signY = _mm256_blendv_ps(minusOne, one, _mm256_cmp_ps(y, zero, _CMP_GE_OQ));
+    auto lower = _mm256_cmp_ps(nz, zero, _CMP_LT_OQ);
+    auto foldedX = _mm256_mul_ps(_mm256_sub_ps(one, absAvx2(y)), signX);
+    auto foldedY = _mm256_mul_ps(_mm256_sub_ps(one, absAvx2(x)), signY);
+    x = _mm256_blendv_ps(x, foldedX, lower);
+    y = _mm256_blendv_ps(y, foldedY, lower);
+
+    int32_t encodedX[8];
+    int32_t encodedY[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(encodedX), _mm256_cvttps_epi32(roundAwayAvx2(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(x, minusOne), one), scale))));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(encodedY), _mm256_cvttps_epi32(roundAwayAvx2(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(y, minusOne), one), scale))));
+    auto validLanes = _mm256_movemask_ps(valid);
+
+    uint16_t u[8]{};
+    uint16_t v[8]{};
+    if (texCoords != nullptr) {
+      const auto* texCoord = texCoords + i * 2;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u), _mm256_cvtps_ph(_mm256_i32gather_ps(texCoord, texCoordOffsets, 4), _MM_FROUND_TO_NEAREST_INT));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(v), _mm256_cvtps_ph(_mm256_i32gather_ps(texCoord + 1, texCoordOffsets, 4), _MM_FROUND_TO_NEAREST_INT));
+    }
+
+    for (auto lane = size_t{0}; lane < 8; lane++) {
+      auto& vertex = vertices[i + lane];
+      vertex.position = positions[i + lane];
+      vertex.normal = validLanes & (1 << lane) ? std::array<int16_t, 2>{int16_t(encodedX[lane]), int16_t(encodedY[lane])} : std::array<int16_t, 2>{NO_NORMAL, NO_NORMAL};
+      vertex.texCoord = {u[lane], v[lane]};
+    }
+  }
+  quantizeScalar(positions, normals, texCoords, i, end, vertices);
+}
+
+#endif
+
+}
+
+SimdLevel detectSimdLevel() {
+#if SCENE_CORE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c")) {
+    return SimdLevel::Avx2;
+  }
+  return SimdLevel::Sse;
+#else
+  return SimdLevel::Scalar;
+#endif
+}
+
+const char* simdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::Avx2: return "AVX2";
+    case SimdLevel::Sse: return "SSE";
+    default: return "scalar";
+  }
+}
+
+void TransformArrays::resize(size_t size) {
+  for (auto& coefficients : m) {
+    coefficients.resize(size);
+  }
+}
+
+void TransformArrays::set(size_t index, const Mat4& transform) {
+  for (auto column = size_t{0}; column < 4; column++) {
+    for (auto row = size_t{0}; row < 3; row++) {
+      m[coefficient(row, column)][index] = transform(int(row), int(column));
+    }
+  }
+}
+
+Mat4 TransformArrays::get(size_t index) const {
+  Mat4 transform;
+  for (auto column = size_t{0}; column < 4; column++) {
+    for (auto row = size_t{0}; row < 3; row++) {
+      transform(int(row), int(column)) = m[coefficient(row, column)][index];
+    }
+  }
+  return transform;
+}
+
+void BoundsArrays::resize(size_t size) {
+  for (auto values : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ}) {
+    values->resize(size);
+  }
+}
+
+void BoundsArrays::set(size_t index, const Aabb& bounds) {
+  minX[index] = bounds.min.x;
+  minY[index] = bounds.min.y;
+  minZ[index] = bounds.min.z;
+  maxX[index] = bounds.max.x;
+  maxY[index] = bounds.max.y;
+  maxZ[index] = bounds.max.z;
+}
+
+Aabb BoundsArrays::get(size_t index) const {
+  return {{minX[index], minY[index], minZ[index]}, {maxX[index], maxY[index], maxZ[index]}};
+}
+
+void propagateTransforms(SimdLevel level, const TransformArrays& local, TransformArrays& world, const uint32_t* parents, size_t begin, size_t end) {
+#if SCENE_CORE_X86
+  if (level == SimdLevel::Avx2) {
+    return propagateAvx2(local, world, parents, begin, end);
+  }
+  if (level == SimdLevel::Sse) {
+    return propagateSse(local, world, parents, begin, end);
+  }
+#endif
+  propagateScalar(local, world, parents, begin, end);
+}
+
+void transformBounds(SimdLevel level, const TransformArrays& world, const BoundsArrays& local, BoundsArrays& worldBounds, size_t begin, size_t end) {
+#if SCENE_CORE_X86
+  if (level == SimdLevel::Avx2) {
+    return transformBoundsAvx2(world, local, worldBounds, begin, end);
+  }
+  if (level == SimdLevel::Sse) {
+    return transformBoundsSse(world, local, worldBounds, begin, end);
+  }
+#endif
+  transformBoundsScalar(world, local, worldBounds, begin, end);
+}
+
+Aabb mergeBounds(SimdLevel level, const BoundsArrays& bounds, size_t begin, size_t end) {
+#if SCENE_CORE_X86
+  if (level == SimdLevel::Avx2) {
+    return mergeAvx2(bounds, begin, end);
+  }
+  if (level == SimdLevel::Sse) {
+    return mergeSse(bounds, begin, end);
+  }
+#endif
+  return mergeScalar(bounds, begin, end);
+}
+
+void quantizeVertices(SimdLevel level, const Vec3* positions, const Vec3* normals, const float* texCoords, size_t count, Vertex* vertices) {
+#if SCENE_CORE_X86
+  if (level == SimdLevel::Avx2) {
+    return quantizeAvx2(positions, normals, texCoords, 0, count, vertices);
+  }
+  if (level == SimdLevel::Sse) {
+    return quantizeSse(positions, normals, texCoords, 0, count, vertices);
+  }
+#endif
+  quantizeScalar(positions, normals, texCoords, 0, count, vertices);
+}
+
+SceneCore::SceneCore(SimdLevel level)
+  : level{level} {
+}
+
+uint32_t SceneCore::addNode(uint32_t parent, const Mat4& local, const Aabb& localBounds) {
+  if (parent != NO_PARENT && parent >= slots.size()) {
+    throw std::runtime_error("Parent node does not exist");
+  }
+
+  auto node = uint32_t(slots.size());
+  auto slot = parents.size();
+  parents.push_back(parent == NO_PARENT ? NO_PARENT : slots[parent]);
+  depths.push_back(parent == NO_PARENT ? 0 : depths[slots[parent]] + 1);
+  nodes.push_back(node);
+  slots.push_back(uint32_t(slot));
+  for (auto arrays : {&localTransforms, &worldTransforms}) {
+    arrays->resize(slot + 1);
+  }
+  for (auto arrays : {&localBoxes, &worldBoxes}) {
+    arrays->resize(slot + 1);
+  }
+  localTransforms.set(slot, local);
+  localBoxes.set(slot, localBounds);
+  sorted = false;
+  return node;
+}
+
+void SceneCore::setLocal(uint32_t node, const Mat4& local) {
+  localTransforms.set(slots[node], local);
+}
+
+void SceneCore::update() {
+  if (!sorted) {
+    sortByDepth();
+  }
+  if (parents.empty()) {
+    sceneBounds = {};
+    return;
+  }
+
+  // Roots have no parent to propagate from.
+  for (auto slot = size_t{0}; slot < depthStarts[1]; slot++) {
+    for (auto k = size_t{0}; k < 12; k++) {
+      worldTransforms.m[k][slot] = localTransforms.m[k][slot];
+    }
+  }
+  for (auto depth = size_t{1}; depth + 1 < depthStarts.size(); depth++) {
+    propagateTransforms(level, localTransforms, worldTransforms, parents.data(), depthStarts[depth], depthStarts[depth + 1]);
+  }
+
+  transformBounds(level, worldTransforms, localBoxes, worldBoxes, 0, size());
+  sceneBounds = mergeBounds(level, worldBoxes, 0, size());
+}
+
+// A stable counting sort, so nodes of one depth keep the order they were added in.
+void SceneCore::sortByDepth() {
+  auto depthCount = size_t{*std::max_element(depths.begin(), depths.end())} + 1;
+  depthStarts.assign(depthCount + 1, 0);
+  for (auto depth : depths) {
+    depthStarts[depth + 1]++;
+  }
+  for (auto depth = size_t{1}; depth <= depthCount; depth++) {
+    depthStarts[depth] += depthStarts[depth - 1];
+  }
+
+  std::vector<uint32_t> newSlots(parents.size());
+  auto next = depthStarts;
+  for (auto slot = size_t{0}; slot < parents.size(); slot++) {
+    newSlots[slot] = uint32_t(next[depths[slot]]++);
+  }
+
+  auto permute = [&](auto& values, auto remap) {
+    std::remove_reference_t<decltype(values)> permuted(values.size());
+    for (auto slot = size_t{0}; slot < values.size(); slot++) {
+      permuted[newSlots[slot]] = remap(values[slot]);
+    }
+    values = std::move(permuted);
+  };
+  auto same = [](auto value) { return value; };
+  permute(parents, [&](uint32_t parent) { return parent == NO_PARENT ? NO_PARENT : newSlots[parent]; });
+  permute(depths, same);
+  permute(nodes, same);
+  for (auto arrays : {&localTransforms, &worldTransforms}) {
+    for (auto& coefficients : arrays->m) {
+      permute(coefficients, same);
+    }
+  }
+  for (auto arrays : {&localBoxes, &worldBoxes}) {
+    for (auto values : {&arrays->minX, &arrays->minY, &arrays->minZ, &arrays->maxX, &arrays->maxY, &arrays->maxZ}) {
+      permute(*values, same);
+    }
+  }
+  for (auto slot = size_t{0}; slot < nodes.size(); slot++) {
+    slots[nodes[slot]] = uint32_t(slot);
+  }
+  sorted = true;
+}
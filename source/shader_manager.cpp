@@ -0,0 +1,243 @@
+#include "shader_manager.hpp"
+
+#include "mapped_file.hpp"
+
+#include <shaderc/shaderc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+
+// Bump whenever the compile options below change, so stale cache entries are ignored.
+constexpr auto COMPILE_OPTIONS_VERSION = "vulkan1.2-O-v1";
+
+// Unique per process and call, so compiles of the same shader on several
+// threads or in several viewers never write the same file; the last rename wins.
+std::string temporaryPathFor(const std::string& path) {
+  static std::atomic<uint64_t> counter{0};
+  return path + "." + std::to_string(getpid()) + "." + std::to_string(counter.fetch_add(1)) + ".tmp";
+}
+
+uint64_t fnv1a(const std::string& data, uint64_t hash = 14695981039346656037ull) {
+  for (auto c : data) {
+    hash ^= uint8_t(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+shaderc_shader_kind shaderKind(const std::string& name) {
+  auto extension = std::filesystem::path{name}.extension().string();
+  if (extension == ".vert") return shaderc_glsl_vertex_shader;
+  if (extension == ".frag") return shaderc_glsl_fragment_shader;
+  if (extension == ".comp") return shaderc_glsl_compute_shader;
+  if (extension == ".task") return shaderc_glsl_task_shader;
+  if (extension == ".mesh") return shaderc_glsl_mesh_shader;
+  throw std::runtime_error("Unknown shader stage for " + name);
+}
+
+std::string readFile(const std::string& path) {
+  std::ifstream file{path, std::ios::binary};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open shader " + path);
+  }
+
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+}
+
+ShaderManager::ShaderManager(VkDevice logicalDevice, const std::string& shaderDirectory, const std::string& cacheDirectory)
+  : logicalDevice{logicalDevice}, shaderDirectory{shaderDirectory}, cacheDirectory{cacheDirectory + "/spirv"} {
+  std::filesystem::create_directories(this->cacheDirectory);
+}
+
+ShaderManager::~ShaderManager() {
+  if (watcher.joinable()) {
+    auto value = uint64_t{1};
+    write(stopDescriptor, &value, sizeof(value));
+    watcher.join();
+  }
+
+  if (inotifyDescriptor >= 0) {
+    close(inotifyDescriptor);
+  }
+  if (stopDescriptor >= 0) {
+    close(stopDescriptor);
+  }
+
+  std::lock_guard lock{mutex};
+  for (const auto& reloaded : reloadedPipelines) {
+    vkDestroyPipeline(logicalDevice, reloaded.pipeline, nullptr);
+  }
+}
+
+VkShaderModule ShaderManager::createShaderModule(const std::string& name) {
+  MappedFile spirv{compile(name)};
+  if (spirv.size() == 0 || spirv.size() % sizeof(uint32_t) != 0) {
+    throw std::runtime_error("Invalid SPIR-V for " + name);
+  }
+
+  VkShaderModuleCreateInfo shaderModuleCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+    .codeSize = spirv.size(),
+    .pCode = reinterpret_cast<const uint32_t*>(spirv.data())
+  };
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(logicalDevice, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create shader module");
+  }
+
+  return shaderModule;
+}
+
+std::string ShaderManager::compile(const std::string& name) {
+  auto source = readFile(shaderDirectory + "/" + name);
+
+  std::stringstream cacheName;
+  cacheName << std::hex << std::setw(16) << std::setfill('0') << fnv1a(source, fnv1a(name + COMPILE_OPTIONS_VERSION)) << ".spv";
+  auto cachePath = cacheDirectory + "/" + cacheName.str();
+
+  // A torn or truncated entry is simply compiled again.
+  std::error_code error;
+  auto cachedSize = std::filesystem::file_size(cachePath, error);
+  if (!error && cachedSize > 0 && cachedSize % sizeof(uint32_t) == 0) {
+    return cachePath;
+  }
+
+  auto compileStart = std::chrono::steady_clock::now();
+
+  shaderc::CompileOptions compileOptions;
+  compileOptions.SetOptimizationLevel(shaderc_optimization_level_performance);
+  compileOptions.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+
+  shaderc::Compiler compiler;
+  auto result = compiler.CompileGlslToSpv(source, shaderKind(name), name.c_str(), compileOptions);
+  if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+    throw std::runtime_error(result.GetErrorMessage());
+  }
+
+  std::vector<uint32_t> spirv{result.cbegin(), result.cend()};
+
+  auto temporaryPath = temporaryPathFor(cachePath);
+  {
+    std::ofstream file{temporaryPath, std::ios::binary | std::ios::trunc};
+    file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+    if (!file) {
+      std::filesystem::remove(temporaryPath, error);
+      throw std::runtime_error("Could not write " + temporaryPath);
+    }
+  }
+  std::filesystem::rename(temporaryPath, cachePath);
+
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compileStart).count();
+  std::cout << "Compiled " << name << " in " << elapsed << " ms" << std::endl;
+  return cachePath;
+}
+
+uint32_t ShaderManager::addPipeline(const std::vector<std::string>& shaderNames, PipelineBuilder builder) {
+  std::lock_guard lock{mutex};
+  pipelines.push_back({shaderNames, std::move(builder)});
+  return uint32_t(pipelines.size() - 1);
+}
+
+void ShaderManager::watch() {
+  inotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  stopDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (inotifyDescriptor < 0 || stopDescriptor < 0) {
+    throw std::runtime_error("Could not set up shader file watching");
+  }
+
+  // Editors commonly save by writing a temporary file and renaming it over the original.
+  if (inotify_add_watch(inotifyDescriptor, shaderDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    throw std::runtime_error("Could not watch " + shaderDirectory);
+  }
+
+  watcher = std::thread{&ShaderManager::watchLoop, this};
+}
+
+bool ShaderManager::poll(ReloadedPipeline& reloaded) {
+  std::lock_guard lock{mutex};
+  if (reloadedPipelines.empty()) {
+    return false;
+  }
+
+  reloaded = reloadedPipelines.front();
+  reloadedPipelines.pop_front();
+  return true;
+}
+
+void ShaderManager::watchLoop() {
+  std::vector<char> buffer(4096);
+
+  while (true) {
+    pollfd descriptors[] = {
+      {inotifyDescriptor, POLLIN, 0},
+      {stopDescriptor, POLLIN, 0}
+    };
+    if (::poll(descriptors, 2, -1) < 0 || descriptors[1].revents != 0) {
+      return;
+    }
+
+    // Saving often produces a burst of events, so let it settle before compiling.
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+
+    std::vector<std::string> changed;
+    auto length = ssize_t{0};
+    while ((length = read(inotifyDescriptor, buffer.data(), buffer.size())) > 0) {
+      for (auto offset = ssize_t{0}; offset < length;) {
+        auto event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+        if (event->len > 0) {
+          auto name = std::string{event->name};
+          if (std::find(changed.begin(), changed.end(), name) == changed.end()) {
+            changed.push_back(name);
+          }
+        }
+        offset += sizeof(inotify_event) + event->len;
+      }
+    }
+
+    for (const auto& name : changed) {
+      rebuildPipelinesUsing(name);
+    }
+  }
+}
+
+void ShaderManager::rebuildPipelinesUsing(const std::string& shaderName) {
+  std::vector<std::pair<uint32_t, PipelineBuilder>> affected;
+  {
+    std::lock_guard lock{mutex};
+    for (auto id = uint32_t{0}; id < pipelines.size(); id++) {
+      const auto& names = pipelines[id].shaderNames;
+      if (std::find(names.begin(), names.end(), shaderName) != names.end()) {
+        affected.emplace_back(id, pipelines[id].builder);
+      }
+    }
+  }
+
+  for (const auto& [id, builder] : affected) {
+    try {
+      auto pipeline = builder();
+      std::lock_guard lock{mutex};
+      reloadedPipelines.push_back({id, pipeline});
+    } catch (const std::exception& exception) {
+      std::cerr << "Could not rebuild pipeline after change to " << shaderName << ":\n" << exception.what() << std::endl;
+    }
+  }
+}
@@ -1,10 +1,28 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(location = 0) in vec3 fragColor;
+layout(location = 0) in vec3 fragPosition;
+layout(location = 1) in vec3 fragNormal;
+layout(location = 2) in vec2 fragTexCoord;
+
+// The descriptor heap's textures; meshes without a texture get a white one.
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+// First in the push constants of every vertex and mesh shader.
+layout(push_constant) uniform PushConstants {
+    uint texture;
+} pushConstants;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    // Meshes without normals get flat shading from the screen space derivatives.
+    vec3 normal = dot(fragNormal, fragNormal) > 0.25
+        ? normalize(fragNormal)
+        : normalize(cross(dFdx(fragPosition), dFdy(fragPosition)));
+
+    // A headlight: both normals are in view space.
+    float diffuse = abs(normal.z);
+    outColor = vec4(texture(textures[pushConstants.texture], fragTexCoord).rgb * (0.15 + 0.85 * diffuse), 1.0);
 }
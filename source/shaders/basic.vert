@@ -1,21 +1,60 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
 
-layout(location = 0) out vec3 fragColor;
+// See CameraUniforms in camera.hpp.
+layout(std140, set = 0, binding = 2) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+} cameras[];
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// The descriptor heap's buffers, see InstanceBuffers in instance_buffers.hpp.
+layout(std430, set = 0, binding = 1) readonly buffer Models {
+    mat4 models[];
+} modelBuffers[];
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(std430, set = 0, binding = 1) readonly buffer Instances {
+    uint instances[];
+} instanceBuffers[];
+
+// See DrawPushConstants in viewer.hpp; basic.frag reads the texture.
+layout(push_constant) uniform PushConstants {
+    uint texture;
+    uint camera;
+    uint models;
+    uint instances;
+} pushConstants;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in ivec2 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragPosition;
+layout(location = 1) out vec3 fragNormal;
+layout(location = 2) out vec2 fragTexCoord;
+
+// Reverses encodeNormal() in mesh.cpp; meshes without normals get a zero vector.
+vec3 decodeNormal(ivec2 encoded) {
+    if (encoded.x == -32768) {
+        return vec3(0.0);
+    }
+
+    vec2 folded = vec2(encoded) / 32767.0;
+    vec3 normal = vec3(folded, 1.0 - abs(folded.x) - abs(folded.y));
+    float t = max(-normal.z, 0.0);
+    normal.xy += mix(vec2(t), vec2(-t), greaterThanEqual(normal.xy, vec2(0.0)));
+    return normalize(normal);
+}
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    // gl_InstanceIndex includes the draw's first instance.
+    uint drawItem = instanceBuffers[pushConstants.instances].instances[gl_InstanceIndex];
+    mat4 model = modelBuffers[pushConstants.models].models[drawItem];
+
+    gl_Position = cameras[pushConstants.camera].viewProjection * model * vec4(inPosition, 1.0);
+    fragPosition = gl_Position.xyz / gl_Position.w;
+    // In view space, like the derivative normals of basic.frag, so the light follows the camera.
+    fragNormal = mat3(cameras[pushConstants.camera].view) * mat3(model) * decodeNormal(inNormal);
+    fragTexCoord = inTexCoord;
 }
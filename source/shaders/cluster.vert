@@ -0,0 +1,63 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct Object {
+    mat4 model;
+    vec3 boundsMin;
+    uint mesh;
+    vec3 boundsMax;
+    uint visibleOffset;
+    uint viewMask;
+};
+
+// See CameraUniforms in camera.hpp.
+layout(std140, set = 0, binding = 2) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+} cameras[];
+
+// The descriptor heap's buffers, picked by the indices in the push constants.
+layout(std430, set = 0, binding = 1) readonly buffer Objects {
+    Object objects[];
+} objectBuffers[];
+
+// See ClusterPushConstants in gpu_scene.hpp; only the first three are used here.
+layout(push_constant) uniform PushConstants {
+    uint texture;
+    uint camera;
+    uint objects;
+} pushConstants;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in ivec2 inNormal;
+layout(location = 2) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragPosition;
+layout(location = 1) out vec3 fragNormal;
+layout(location = 2) out vec2 fragTexCoord;
+
+// Reverses encodeNormal() in mesh.cpp; meshes without normals get a zero vector.
+vec3 decodeNormal(ivec2 encoded) {
+    if (encoded.x == -32768) {
+        return vec3(0.0);
+    }
+
+    vec2 folded = vec2(encoded) / 32767.0;
+    vec3 normal = vec3(folded, 1.0 - abs(folded.x) - abs(folded.y));
+    float t = max(-normal.z, 0.0);
+    normal.xy += mix(vec2(t), vec2(-t), greaterThanEqual(normal.xy, vec2(0.0)));
+    return normalize(normal);
+}
+
+void main() {
+    // Every cluster draw is one instance, whose first instance is the object (see cluster_cull.comp).
+    Object object = objectBuffers[pushConstants.objects].objects[gl_InstanceIndex];
+
+    gl_Position = cameras[pushConstants.camera].viewProjection * object.model * vec4(inPosition, 1.0);
+    fragPosition = gl_Position.xyz / gl_Position.w;
+    // In view space, like the derivative normals of basic.frag, so the light follows the camera.
+    fragNormal = mat3(cameras[pushConstants.camera].view) * mat3(object.model) * decodeNormal(inNormal);
+    fragTexCoord = inTexCoord;
+}
@@ -0,0 +1,269 @@
+#include "staging_ring.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+StagingRing::StagingRing(VkDevice logicalDevice, VkQueue queue, uint32_t queueFamilyIndex, VkBuffer buffer, void* mapped, VkDeviceSize size, uint32_t slotCount)
+  : logicalDevice{logicalDevice}, queue{queue}, buffer{buffer}, mapped{static_cast<char*>(mapped)}, slotSize{size / slotCount}, slots(slotCount) {
+  VkCommandPoolCreateInfo commandPoolCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = queueFamilyIndex
+  };
+
+  if (vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create staging command pool");
+  }
+
+  std::vector<VkCommandBuffer> commandBuffers(slotCount);
+  VkCommandBufferAllocateInfo commandBufferAllocateInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = commandPool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = slotCount
+  };
+
+  if (vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, commandBuffers.data()) != VK_SUCCESS) {
+    throw std::runtime_error("Could not allocate staging command buffers");
+  }
+
+  for (auto i = size_t{0}; i < slots.size(); i++) {
+    slots[i].commandBuffer = commandBuffers[i];
+  }
+
+  VkSemaphoreTypeCreateInfo semaphoreTypeCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+    .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+    .initialValue = 0
+  };
+
+  VkSemaphoreCreateInfo semaphoreCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    .pNext = &semaphoreTypeCreateInfo
+  };
+
+  if (vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &timeline) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create staging semaphore");
+  }
+}
+
+StagingRing::~StagingRing() {
+  waitIdle();
+
+  vkDestroySemaphore(logicalDevice, timeline, nullptr);
+  vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+}
+
+void StagingRing::upload(VkBuffer destination, VkDeviceSize destinationOffset, const void* data, VkDeviceSize size) {
+  auto source = static_cast<const char*>(data);
+
+  while (size > 0) {
+    auto& slot = recordingSlot();
+    auto count = std::min(size, slotSize - slot.used);
+    auto stagingOffset = currentSlot * slotSize + slot.used;
+    std::memcpy(mapped + stagingOffset, source, count);
+
+    VkBufferCopy bufferCopy{
+      .srcOffset = stagingOffset,
+      .dstOffset = destinationOffset,
+      .size = count
+    };
+    vkCmdCopyBuffer(slot.commandBuffer, buffer, destination, 1, &bufferCopy);
+
+    slot.used += count;
+    source += count;
+    destinationOffset += count;
+    size -= count;
+
+    if (slot.used == slotSize) {
+      nextSlot();
+    }
+  }
+}
+
+// Barriers order against everything submitted before them on the queue, so
+// the transitions may land in other slots than the copies they guard. The
+// transfer queue cannot name the fragment shader stage; the frames' wait on
+// the semaphore orders their reads after the final transition instead.
+void StagingRing::uploadImage(VkImage destination, uint32_t blockSize, uint32_t blockBytes, const std::vector<ImageLevel>& levels) {
+  VkImageMemoryBarrier imageMemoryBarrier{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = 0,
+    .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = destination,
+    .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, uint32_t(levels.size()), 0, 1}
+  };
+  vkCmdPipelineBarrier(recordingSlot().commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+
+  for (auto mipLevel = uint32_t{0}; mipLevel < levels.size(); mipLevel++) {
+    const auto& level = levels[mipLevel];
+    auto rowBytes = VkDeviceSize{(level.width + blockSize - 1) / blockSize} * blockBytes;
+    auto rowCount = (level.height + blockSize - 1) / blockSize;
+    if (rowBytes > slotSize) {
+      throw std::runtime_error("Image row exceeds the staging slot size");
+    }
+
+    auto source = static_cast<const char*>(level.data);
+    for (auto row = uint32_t{0}; row < rowCount; ) {
+      auto& slot = recordingSlot();
+      // Buffer offsets of block compressed copies must be multiples of the block size.
+      auto offset = std::min((slot.used + 15) / 16 * 16, slotSize);
+      auto rows = uint32_t(std::min<VkDeviceSize>(rowCount - row, (slotSize - offset) / rowBytes));
+      if (rows == 0) {
+        nextSlot();
+        continue;
+      }
+
+      auto stagingOffset = currentSlot * slotSize + offset;
+      std::memcpy(mapped + stagingOffset, source + row * rowBytes, rows * rowBytes);
+
+      VkBufferImageCopy bufferImageCopy{
+        .bufferOffset = stagingOffset,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, mipLevel, 0, 1},
+        .imageOffset = {0, int32_t(row * blockSize), 0},
+        .imageExtent = {level.width, std::min(rows * blockSize, level.height - row * blockSize), 1}
+      };
+      vkCmdCopyBufferToImage(slot.commandBuffer, buffer, destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferImageCopy);
+
+      slot.used = offset + rows * rowBytes;
+      row += rows;
+      if (slot.used == slotSize) {
+        nextSlot();
+      }
+    }
+  }
+
+  imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  imageMemoryBarrier.dstAccessMask = 0;
+  imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  vkCmdPipelineBarrier(recordingSlot().commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+}
+
+uint64_t StagingRing::flush() {
+  if (slots[currentSlot].recording) {
+    nextSlot();
+  }
+  return submittedValue;
+}
+
+void StagingRing::waitIdle() {
+  waitForValue(flush());
+}
+
+uint64_t StagingRing::completedValue() const {
+  auto value = uint64_t{0};
+  vkGetSemaphoreCounterValue(logicalDevice, timeline, &value);
+  return value;
+}
+
+VkDeviceSize StagingRing::freeBytes() const {
+  auto completed = completedValue();
+  auto bytes = VkDeviceSize{0};
+  for (auto i = size_t{0}; i < slots.size(); i++) {
+    const auto& slot = slots[(currentSlot + i) % slots.size()];
+    if (slot.recording) {
+      bytes += slotSize - slot.used;
+    } else if (slot.value <= completed) {
+      bytes += slotSize;
+    } else {
+      break;
+    }
+  }
+  return bytes;
+}
+
+// Waits for the last of the slots, in the order they come up again, that
+// freeBytes() has to count to reach bytes.
+void StagingRing::waitForFreeBytes(VkDeviceSize bytes) {
+  auto value = uint64_t{0};
+  auto available = VkDeviceSize{0};
+  for (auto i = size_t{0}; i < slots.size() && available < bytes; i++) {
+    const auto& slot = slots[(currentSlot + i) % slots.size()];
+    if (slot.recording) {
+      available += slotSize - slot.used;
+    } else {
+      available += slotSize;
+      value = std::max(value, slot.value);
+    }
+  }
+  waitForValue(value);
+}
+
+void StagingRing::waitForValue(uint64_t value) {
+  VkSemaphoreWaitInfo semaphoreWaitInfo{
+    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+    .semaphoreCount = 1,
+    .pSemaphores = &timeline,
+    .pValues = &value
+  };
+  vkWaitSemaphores(logicalDevice, &semaphoreWaitInfo, std::numeric_limits<uint64_t>::max());
+}
+
+StagingRing::Slot& StagingRing::recordingSlot() {
+  auto& slot = slots[currentSlot];
+  if (!slot.recording) {
+    beginSlot(slot);
+  }
+  return slot;
+}
+
+void StagingRing::nextSlot() {
+  submitSlot(slots[currentSlot]);
+  currentSlot = (currentSlot + 1) % slots.size();
+}
+
+void StagingRing::beginSlot(Slot& slot) {
+  waitForValue(slot.value);
+
+  VkCommandBufferBeginInfo commandBufferBeginInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+
+  if (vkBeginCommandBuffer(slot.commandBuffer, &commandBufferBeginInfo) != VK_SUCCESS) {
+    throw std::runtime_error("Could not begin staging command buffer");
+  }
+
+  slot.used = 0;
+  slot.recording = true;
+}
+
+// No barrier is needed: the semaphore signal makes the copies available, and
+// the frames using them wait on it.
+void StagingRing::submitSlot(Slot& slot) {
+  if (vkEndCommandBuffer(slot.commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("Could not record staging command buffer");
+  }
+
+  slot.value = ++submittedValue;
+
+  VkTimelineSemaphoreSubmitInfo timelineSemaphoreSubmitInfo{
+    .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+    .signalSemaphoreValueCount = 1,
+    .pSignalSemaphoreValues = &slot.value
+  };
+
+  VkSubmitInfo submitInfo{
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .pNext = &timelineSemaphoreSubmitInfo,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &slot.commandBuffer,
+    .signalSemaphoreCount = 1,
+    .pSignalSemaphores = &timeline
+  };
+
+  if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("Could not submit staging command buffer");
+  }
+
+  slot.recording = false;
+}
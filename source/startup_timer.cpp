@@ -0,0 +1,35 @@
+#include "startup_timer.hpp"
+
+#include "json.hpp"
+
+#include <iomanip>
+
+StartupTimer::StartupTimer()
+  : start{std::chrono::steady_clock::now()} {
+}
+
+void StartupTimer::mark(const std::string& milestone) {
+  auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  milestones.emplace_back(milestone, elapsed);
+}
+
+void StartupTimer::print(std::ostream& stream) const {
+  stream << "Startup timing:" << std::endl;
+
+  auto previous = 0.0;
+  for (const auto& [milestone, elapsed] : milestones) {
+    stream << "  " << std::left << std::setw(24) << milestone << std::right << std::fixed << std::setprecision(2)
+      << std::setw(10) << elapsed << " ms (+" << elapsed - previous << " ms)" << std::defaultfloat << std::endl;
+    previous = elapsed;
+  }
+}
+
+void StartupTimer::writeJson(std::ostream& stream) const {
+  stream << "{";
+  for (auto i = size_t{0}; i < milestones.size(); i++) {
+    stream << (i > 0 ? ", " : "");
+    writeJsonString(stream, milestones[i].first);
+    stream << ": " << std::fixed << std::setprecision(3) << milestones[i].second << std::defaultfloat;
+  }
+  stream << "}";
+}
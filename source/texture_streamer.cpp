@@ -0,0 +1,408 @@
+#include "texture_streamer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+TextureStreamer::TextureStreamer(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, MemoryAllocator& memoryAllocator, StagingRing& stagingRing,
+    DescriptorHeap& descriptorHeap, const std::vector<uint32_t>& queueFamilyIndices, VkDeviceSize budget, uint32_t framesInFlight)
+  : physicalDevice{physicalDevice}, logicalDevice{logicalDevice}, memoryAllocator{memoryAllocator}, stagingRing{stagingRing},
+    descriptorHeap{descriptorHeap}, queueFamilyIndices{queueFamilyIndices}, budget{budget}, framesInFlight{framesInFlight} {
+  // The views only cover the resident levels, so the sampler needs no LOD clamp of its own.
+  VkSamplerCreateInfo samplerCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_LINEAR,
+    .minFilter = VK_FILTER_LINEAR,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+    .anisotropyEnable = VK_FALSE,
+    .minLod = 0.0f,
+    .maxLod = VK_LOD_CLAMP_NONE
+  };
+
+  if (vkCreateSampler(logicalDevice, &samplerCreateInfo, nullptr, &sampler) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create texture sampler");
+  }
+
+  createDefaultTexture();
+}
+
+TextureStreamer::~TextureStreamer() {
+  for (auto& retired : retiredVersions) {
+    destroyVersion(retired.version);
+  }
+  for (auto& texture : textures) {
+    destroyVersion(texture.pending);
+    destroyVersion(texture.streamed);
+    destroyVersion(texture.tail);
+  }
+
+  vkDestroySampler(logicalDevice, sampler, nullptr);
+}
+
+uint32_t TextureStreamer::textureIndex(uint32_t texture) const {
+  const auto& entry = textures[texture];
+  if (entry.streamed.image != VK_NULL_HANDLE) {
+    return entry.streamed.index;
+  }
+  // Until its tail has arrived, a texture is drawn white.
+  if (entry.tail.image != VK_NULL_HANDLE && entry.tail.uploadValue <= visibleUploadValue) {
+    return entry.tail.index;
+  }
+  return textures[0].tail.index;
+}
+
+uint32_t TextureStreamer::load(const std::string& path) {
+  auto existing = handles.find(path);
+  if (existing != handles.end()) {
+    return existing->second;
+  }
+
+  Texture texture;
+  texture.path = path;
+  try {
+    texture.file = std::make_unique<KtxTexture>(path);
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, texture.file->format(), &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+      throw std::runtime_error("Texture format of " + path + " is not supported by the device");
+    }
+
+    texture.tailLevel = texture.file->levelCount() - 1;
+    while (texture.tailLevel > 0) {
+      const auto& level = texture.file->level(texture.tailLevel - 1);
+      if (std::max(level.width, level.height) > TAIL_SIZE) {
+        break;
+      }
+      texture.tailLevel--;
+    }
+    for (auto level = uint32_t{0}; level <= texture.tailLevel; level++) {
+      texture.versionBytes.push_back(queryVersionBytes(texture, level));
+    }
+  } catch (const std::exception& exception) {
+    std::cerr << "Could not load texture: " << exception.what() << std::endl;
+    handles[path] = 0;
+    return 0;
+  }
+
+  texture.requestedLevel = texture.file->levelCount();
+  textures.push_back(std::move(texture));
+  handles[path] = uint32_t(textures.size() - 1);
+  return uint32_t(textures.size() - 1);
+}
+
+void TextureStreamer::request(uint32_t texture, float pixels) {
+  auto& entry = textures[texture];
+  if (!entry.file || pixels <= 0.0f) {
+    return;
+  }
+
+  // The level whose texels are closest to one per pixel, assuming the texture spans the object once.
+  const auto& top = entry.file->level(0);
+  auto texels = float(std::max(top.width, top.height));
+  auto level = uint32_t(std::clamp(std::floor(std::log2(texels / pixels)), 0.0f, float(entry.file->levelCount() - 1)));
+  entry.requestedLevel = std::min(entry.requestedLevel, level);
+}
+
+void TextureStreamer::update(uint64_t frameNumber, uint64_t visibleUploadValue) {
+  this->frameNumber = frameNumber;
+  this->visibleUploadValue = visibleUploadValue;
+
+  while (!retiredVersions.empty() && retiredVersions.front().retiredAtFrame + framesInFlight <= frameNumber) {
+    retiringBytes -= retiredVersions.front().version.bytes;
+    destroyVersion(retiredVersions.front().version);
+    retiredVersions.pop_front();
+  }
+
+  for (auto& texture : textures) {
+    if (texture.pending.image != VK_NULL_HANDLE && texture.pending.uploadValue <= visibleUploadValue) {
+      retire(texture.streamed);
+      texture.streamed = texture.pending;
+      texture.pending = {};
+    }
+    if (texture.file && texture.requestedLevel < texture.file->levelCount()) {
+      texture.lastUsed = frameNumber;
+    }
+  }
+
+  // Finer levels only once every tail is in, so they do not take the memory
+  // freed for a tail.
+  started = false;
+  if (!createTails()) {
+    for (auto& texture : textures) {
+      texture.requestedLevel = texture.file ? texture.file->levelCount() : 0;
+    }
+    return;
+  }
+
+  std::vector<uint32_t> wanting;
+  for (auto i = uint32_t{1}; i < textures.size(); i++) {
+    const auto& texture = textures[i];
+    if (texture.file && texture.requestedLevel < residentLevel(texture) && texture.pending.image == VK_NULL_HANDLE) {
+      wanting.push_back(i);
+    }
+  }
+
+  // The textures missing the most levels first.
+  std::sort(wanting.begin(), wanting.end(), [this](uint32_t a, uint32_t b) {
+    return residentLevel(textures[a]) - textures[a].requestedLevel > residentLevel(textures[b]) - textures[b].requestedLevel;
+  });
+
+  auto uploaded = VkDeviceSize{0};
+  for (auto i : wanting) {
+    auto& texture = textures[i];
+    if (uploaded >= UPLOAD_BUDGET_PER_FRAME) {
+      break;
+    }
+
+    // The finest level that fits once every texture not drawn this frame has been dropped.
+    auto evictable = VkDeviceSize{0};
+    for (const auto& other : textures) {
+      if (&other != &texture && other.lastUsed < frameNumber && other.pending.image == VK_NULL_HANDLE) {
+        evictable += other.streamed.bytes;
+      }
+    }
+    for (auto level = texture.requestedLevel; level < residentLevel(texture); level++) {
+      auto bytes = levelBytes(texture, level);
+      if (usedBytes - retiringBytes - evictable + bytes > budget) {
+        continue;
+      }
+      // Only uploads that fit the staging slots free right now, so the frame
+      // never waits for earlier copies; levels larger than the ring wait for it to drain.
+      if (std::min(bytes, stagingRing.size()) > stagingRing.freeBytes()) {
+        break;
+      }
+      // Dropped images only free their memory once the frames using them are done.
+      if (evictFor(bytes, texture) && createVersion(texture, level, texture.pending)) {
+        levelsStreamed += residentLevel(texture) - level;
+        uploaded += bytes;
+        started = true;
+      }
+      break;
+    }
+  }
+
+  for (auto& texture : textures) {
+    texture.requestedLevel = texture.file ? texture.file->levelCount() : 0;
+  }
+}
+
+bool TextureStreamer::idle() const {
+  return !started && std::none_of(textures.begin(), textures.end(), [](const Texture& texture) { return texture.pending.image != VK_NULL_HANDLE; });
+}
+
+void TextureStreamer::logStats(std::ostream& stream) const {
+  stream << "Textures: " << textures.size() - 1 << " loaded, " << (usedBytes >> 20) << " of " << (budget >> 20) << " MiB resident, "
+    << levelsStreamed << " levels streamed in, " << evictions << " evictions" << std::endl;
+}
+
+// Creates the tails that fit, evicting streamed levels of any texture to make
+// room. A texture whose tail could never fit next to the others is dropped.
+// True once every tail is in.
+bool TextureStreamer::createTails() {
+  auto tailBytes = VkDeviceSize{0};
+  for (const auto& texture : textures) {
+    tailBytes += texture.tail.bytes;
+  }
+
+  auto complete = true;
+  for (auto i = uint32_t{1}; i < textures.size(); i++) {
+    auto& texture = textures[i];
+    if (!texture.file || texture.tail.image != VK_NULL_HANDLE) {
+      continue;
+    }
+
+    auto bytes = levelBytes(texture, texture.tailLevel);
+    if (tailBytes + bytes > budget) {
+      std::cerr << "Texture budget too small for " << texture.path << ", drawing it white" << std::endl;
+      texture.file.reset();
+      continue;
+    }
+    if (bytes <= stagingRing.freeBytes() && evictFor(bytes, texture, true) && createVersion(texture, texture.tailLevel, texture.tail)) {
+      tailBytes += bytes;
+      started = true;
+    } else {
+      complete = false;
+    }
+  }
+  return complete;
+}
+
+void TextureStreamer::createDefaultTexture() {
+  Texture texture;
+
+  VkImageCreateInfo imageCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = VK_FORMAT_R8G8B8A8_UNORM,
+    .extent = {1, 1, 1},
+    .mipLevels = 1,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = queueFamilyIndices.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+    .queueFamilyIndexCount = uint32_t(queueFamilyIndices.size()),
+    .pQueueFamilyIndices = queueFamilyIndices.data(),
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  memoryAllocator.createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, texture.tail.image, texture.tail.allocation);
+  createView(imageCreateInfo.format, 1, texture.tail);
+
+  // Every frame may use it, so it has to be there before the first one.
+  uint32_t white{0xffffffff};
+  stagingRing.uploadImage(texture.tail.image, 1, sizeof(white), {{1, 1, &white}});
+  stagingRing.waitIdle();
+
+  textures.push_back(std::move(texture));
+}
+
+VkImageCreateInfo TextureStreamer::versionCreateInfo(const Texture& texture, uint32_t baseLevel) const {
+  const auto& file = *texture.file;
+  const auto& base = file.level(baseLevel);
+  return {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = file.format(),
+    .extent = {base.width, base.height, 1},
+    .mipLevels = file.levelCount() - baseLevel,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = queueFamilyIndices.size() > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+    .queueFamilyIndexCount = uint32_t(queueFamilyIndices.size()),
+    .pQueueFamilyIndices = queueFamilyIndices.data(),
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+}
+
+// The budget is charged exactly this, which can be well above the level data
+// for small images.
+VkDeviceSize TextureStreamer::queryVersionBytes(const Texture& texture, uint32_t baseLevel) const {
+  auto imageCreateInfo = versionCreateInfo(texture, baseLevel);
+  VkImage image;
+  if (vkCreateImage(logicalDevice, &imageCreateInfo, nullptr, &image) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create texture image");
+  }
+
+  VkMemoryRequirements memoryRequirements;
+  vkGetImageMemoryRequirements(logicalDevice, image, &memoryRequirements);
+  vkDestroyImage(logicalDevice, image, nullptr);
+  return memoryRequirements.size;
+}
+
+bool TextureStreamer::createVersion(Texture& texture, uint32_t baseLevel, Version& version) {
+  const auto& file = *texture.file;
+  auto imageCreateInfo = versionCreateInfo(texture, baseLevel);
+
+  // Running out of memory or descriptors only keeps the texture at the levels it has.
+  try {
+    memoryAllocator.createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, version.image, version.allocation);
+  } catch (const std::runtime_error& error) {
+    std::cerr << "Could not allocate texture image: " << error.what() << std::endl;
+    return false;
+  }
+  try {
+    createView(file.format(), imageCreateInfo.mipLevels, version);
+  } catch (const std::runtime_error& error) {
+    std::cerr << "Could not create texture view: " << error.what() << std::endl;
+    memoryAllocator.destroyImage(version.image, version.allocation);
+    version = {};
+    return false;
+  }
+
+  std::vector<ImageLevel> levels;
+  for (auto level = baseLevel; level < file.levelCount(); level++) {
+    levels.push_back({file.level(level).width, file.level(level).height, file.level(level).data});
+  }
+  stagingRing.uploadImage(version.image, 4, file.blockBytes(), levels);
+
+  version.baseLevel = baseLevel;
+  version.bytes = levelBytes(texture, baseLevel);
+  version.uploadValue = stagingRing.flush();
+  usedBytes += version.bytes;
+  return true;
+}
+
+void TextureStreamer::createView(VkFormat format, uint32_t levelCount, Version& version) {
+  VkImageViewCreateInfo imageViewCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = version.image,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = format,
+    .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1}
+  };
+
+  if (vkCreateImageView(logicalDevice, &imageViewCreateInfo, nullptr, &version.view) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create texture image view");
+  }
+
+  try {
+    version.index = descriptorHeap.addTexture(version.view, sampler);
+  } catch (...) {
+    vkDestroyImageView(logicalDevice, version.view, nullptr);
+    version.view = VK_NULL_HANDLE;
+    throw;
+  }
+}
+
+void TextureStreamer::destroyVersion(Version& version) {
+  if (version.image == VK_NULL_HANDLE) {
+    return;
+  }
+
+  descriptorHeap.removeTexture(version.index);
+  vkDestroyImageView(logicalDevice, version.view, nullptr);
+  memoryAllocator.destroyImage(version.image, version.allocation);
+  usedBytes -= version.bytes;
+  version = {};
+}
+
+void TextureStreamer::retire(Version& version) {
+  if (version.image == VK_NULL_HANDLE) {
+    return;
+  }
+
+  retiringBytes += version.bytes;
+  retiredVersions.push_back({version, frameNumber});
+  version = {};
+}
+
+// Drops the streamed images of textures not drawn this frame (of any texture
+// with `evictDrawn`), least recently drawn first, until `bytes` more fit once
+// they are destroyed. True if they fit right away.
+bool TextureStreamer::evictFor(VkDeviceSize bytes, const Texture& keep, bool evictDrawn) {
+  if (usedBytes + bytes <= budget) {
+    return true;
+  }
+
+  std::vector<Texture*> candidates;
+  for (auto& texture : textures) {
+    if (&texture != &keep && (evictDrawn || texture.lastUsed < frameNumber) && texture.streamed.image != VK_NULL_HANDLE && texture.pending.image == VK_NULL_HANDLE) {
+      candidates.push_back(&texture);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const Texture* a, const Texture* b) { return a->lastUsed < b->lastUsed; });
+
+  for (auto texture : candidates) {
+    if (usedBytes - retiringBytes + bytes <= budget) {
+      break;
+    }
+    retire(texture->streamed);
+    evictions++;
+  }
+  return false;
+}
+
+uint32_t TextureStreamer::residentLevel(const Texture& texture) const {
+  return texture.streamed.image != VK_NULL_HANDLE ? texture.streamed.baseLevel : texture.tailLevel;
+}
+
+VkDeviceSize TextureStreamer::levelBytes(const Texture& texture, uint32_t baseLevel) const {
+  return texture.versionBytes[baseLevel];
+}
@@ -1,41 +1,159 @@
 #include "viewer.hpp"
 
-#include <iostream>
+#include "json.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <future>
+#include <thread>
 #include <limits>
+#include <numeric>
+
+#include <sys/resource.h>
+
+namespace {
+
+// Null without a monitor, e.g. on a headless X server.
+const GLFWvidmode* primaryVideoMode() {
+  auto monitor = glfwGetPrimaryMonitor();
+  return monitor != nullptr ? glfwGetVideoMode(monitor) : nullptr;
+}
+
+VkShaderStageFlagBits shaderStage(const std::string& name) {
+  auto extension = std::filesystem::path{name}.extension().string();
+  if (extension == ".vert") return VK_SHADER_STAGE_VERTEX_BIT;
+  if (extension == ".task") return VK_SHADER_STAGE_TASK_BIT_EXT;
+  if (extension == ".mesh") return VK_SHADER_STAGE_MESH_BIT_EXT;
+  return VK_SHADER_STAGE_FRAGMENT_BIT;
+}
+
+std::vector<VkSurfaceFormatKHR> surfaceFormats(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
+  auto formatCount = uint32_t{0};
+  vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+  std::vector<VkSurfaceFormatKHR> formats(formatCount);
+  vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, formats.data());
+  return formats;
+}
+
+std::vector<VkPresentModeKHR> presentModes(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
+  auto presentModeCount = uint32_t{0};
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
+  std::vector<VkPresentModeKHR> modes(presentModeCount);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, modes.data());
+  return modes;
+}
+
+}
+
+Viewer::Viewer(const Options& options)
+  : options{options}, framesInFlight{options.framesInFlight} {
+  // Offscreen frames are read back as RGBA, which the image writer takes as is.
+  if (options.headless) {
+    surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
+  }
+}
 
 Viewer::~Viewer() {
-  for (auto i = size_t{0}; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(logicalDevice, renderFinishedSemaphores[i], nullptr);
-    vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i], nullptr);
-    vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
+  meshLoader.reset();
+  lodBuilder.reset();
+  meshletBuilder.reset();
+  jobSystem.reset();
+  stagingRing.reset();
+  if (textureStreamer) {
+    textureStreamer->logStats(std::cout);
+  }
+  textureStreamer.reset();
+
+  destroyRetiredMeshBuffers(true);
+  for (auto& mesh : meshes) {
+    destroyMesh(mesh);
+  }
+  memoryAllocator->destroyBuffer(stagingBuffer, stagingAllocation);
+  for (auto& view : views) {
+    for (auto& cameraBuffer : view.cameraBuffers) {
+      memoryAllocator->destroyBuffer(cameraBuffer.buffer, cameraBuffer.allocation);
+    }
+  }
+  destroyOffscreenTargets();
+  if (!options.headless) {
+    cleanupSwapChains();
+  }
+  gpuScene.reset();
+  instanceBuffers.reset();
+  descriptorHeap.reset();
+
+  memoryAllocator->logStats(std::cout);
+  memoryAllocator.reset();
+
+  for (auto fence : inFlightFences) {
+    vkDestroyFence(logicalDevice, fence, nullptr);
   }
 
+  commandRecorder.reset();
+  profiler.reset();
   vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 
-  cleanupSwapChain();
+  shaderManager.reset();
+  destroyRetiredPipelines(true);
+  vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
+  vkDestroyPipeline(logicalDevice, indirectPipeline, nullptr);
+  vkDestroyPipeline(logicalDevice, cullPipeline, nullptr);
+  vkDestroyPipeline(logicalDevice, clusterCullPipeline, nullptr);
+  vkDestroyPipeline(logicalDevice, clusterPipeline, nullptr);
+  vkDestroyPipeline(logicalDevice, depthPyramidPipeline, nullptr);
+  vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+  vkDestroyRenderPass(logicalDevice, occlusionRenderPass, nullptr);
+  vkDestroyRenderPass(logicalDevice, nextViewRenderPass, nullptr);
+  vkDestroyRenderPass(logicalDevice, nextViewOcclusionRenderPass, nullptr);
+  vkDestroySampler(logicalDevice, depthSampler, nullptr);
+  pipelineCache.reset();
 
   vkDestroyDevice(logicalDevice, nullptr);
-  vkDestroySurfaceKHR(vkInstance, surface, nullptr);
+  for (const auto& window : windows) {
+    vkDestroySurfaceKHR(vkInstance, window.surface, nullptr);
+  }
   vkDestroyInstance(vkInstance, nullptr);
 
-  glfwTerminate();
-  glfwDestroyWindow(window);
+  if (!options.headless) {
+    for (const auto& window : windows) {
+      glfwDestroyWindow(window.handle);
+    }
+    glfwTerminate();
+  }
 }
 
 void Viewer::run() {
-  glfwInit();
-  glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  if (!options.cameraPath.empty()) {
+    cameraPath = std::make_unique<CameraPath>(options.cameraPath);
+  }
 
-  auto glfwVideoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-  width = 0.8 * glfwVideoMode->width;
-  height = 0.8 * glfwVideoMode->height;
+  if (!options.headless) {
+    glfwInit();
+    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
-  window = glfwCreateWindow(width, height, "3D Viewer", nullptr, nullptr);
+    // Keeps the default size without a monitor to measure.
+    if (auto videoMode = primaryVideoMode()) {
+      width = 0.8 * videoMode->width;
+      height = 0.8 * videoMode->height;
+    }
 
-  glfwSetWindowUserPointer(window, this);
-  glfwSetKeyCallback(window, key_callback);
-  glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    windows.resize(options.windows);
+    cursors.resize(options.windows);
+    for (auto i = uint32_t{0}; i < options.windows; i++) {
+      createWindow(i);
+    }
+    publishInput();
+    startupTimer.mark("window");
+  } else {
+    windows.resize(1);
+  }
 
   VkApplicationInfo applicationInfo{
     .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -43,11 +161,11 @@ void Viewer::run() {
     .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
     .pEngineName = "3D Viewer",
     .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-    .apiVersion = VK_API_VERSION_1_1
+    .apiVersion = VK_API_VERSION_1_2
   };
 
   auto glfwExtensionCount = uint32_t{0};
-  auto glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  auto glfwExtensions = options.headless ? nullptr : glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
   VkInstanceCreateInfo instanceCreateInfo{
     .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
@@ -60,30 +178,156 @@ void Viewer::run() {
     throw std::runtime_error("Could not create vulkan instance");
   }
 
-  if (glfwCreateWindowSurface(vkInstance, window, nullptr, &surface) != VK_SUCCESS) {
-    throw std::runtime_error("Could not create window surface");
+  startupTimer.mark("instance");
+
+  for (auto& window : windows) {
+    if (window.handle != nullptr && glfwCreateWindowSurface(vkInstance, window.handle, nullptr, &window.surface) != VK_SUCCESS) {
+      throw std::runtime_error("Could not create window surface");
+    }
   }
 
   auto pyhsicalDeviceCount = uint32_t{0};
   vkEnumeratePhysicalDevices(vkInstance, &pyhsicalDeviceCount, nullptr);
   std::vector<VkPhysicalDevice> physicalDevices(pyhsicalDeviceCount);
   vkEnumeratePhysicalDevices(vkInstance, &pyhsicalDeviceCount, physicalDevices.data());
-  physicalDevice = physicalDevices[0];
 
-  auto queuePriority = float{1.0f};
-  VkDeviceQueueCreateInfo logicalDeviceQueueCreateInfo{
+  // The first device that can draw (and present to every window) wins.
+  physicalDevice = VK_NULL_HANDLE;
+  for (auto candidate : physicalDevices) {
+    try {
+      // Its features are queried through the Vulkan 1.2 structures below.
+      VkPhysicalDeviceProperties candidateProperties;
+      vkGetPhysicalDeviceProperties(candidate, &candidateProperties);
+      if (candidateProperties.apiVersion < VK_API_VERSION_1_2) {
+        throw std::runtime_error("Device does not support Vulkan 1.2");
+      }
+
+      queueFamilies = findQueueFamilies(candidate, windows.front().surface);
+      for (const auto& window : windows) {
+        auto presentSupported = VkBool32{VK_FALSE};
+        if (window.surface != VK_NULL_HANDLE) {
+          vkGetPhysicalDeviceSurfaceSupportKHR(candidate, queueFamilies.present, window.surface, &presentSupported);
+          if (!presentSupported) {
+            throw std::runtime_error("Device cannot present to every window");
+          }
+        }
+      }
+
+      VkPhysicalDeviceVulkan12Features supportedVulkan12Features{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+      };
+      VkPhysicalDeviceFeatures2 supportedFeatures{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &supportedVulkan12Features
+      };
+      vkGetPhysicalDeviceFeatures2(candidate, &supportedFeatures);
+      if (!supportedVulkan12Features.timelineSemaphore) {
+        throw std::runtime_error("Device does not support timeline semaphores");
+      }
+      DescriptorHeap::requireFeatures(supportedFeatures.features, supportedVulkan12Features);
+
+      physicalDevice = candidate;
+      break;
+    } catch (const std::runtime_error& error) {
+      VkPhysicalDeviceProperties physicalDeviceProperties;
+      vkGetPhysicalDeviceProperties(candidate, &physicalDeviceProperties);
+      std::cerr << "Skipping " << physicalDeviceProperties.deviceName << ": " << error.what() << std::endl;
+    }
+  }
+  if (physicalDevice == VK_NULL_HANDLE) {
+    throw std::runtime_error("No suitable GPU found");
+  }
+
+  float queuePriorities[]{1.0f, 1.0f};
+  std::vector<VkDeviceQueueCreateInfo> logicalDeviceQueueCreateInfos{{
     .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-    .queueFamilyIndex = 0,
-    .queueCount = 1,
-    .pQueuePriorities = &queuePriority
+    .queueFamilyIndex = queueFamilies.graphics,
+    .queueCount = queueFamilies.transferQueueIndex + 1,
+    .pQueuePriorities = queuePriorities
+  }};
+  if (queueFamilies.transfer != queueFamilies.graphics) {
+    logicalDeviceQueueCreateInfos.push_back({
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = queueFamilies.transfer,
+      .queueCount = 1,
+      .pQueuePriorities = queuePriorities
+    });
+  }
+  if (queueFamilies.present != queueFamilies.graphics && queueFamilies.present != queueFamilies.transfer) {
+    logicalDeviceQueueCreateInfos.push_back({
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = queueFamilies.present,
+      .queueCount = 1,
+      .pQueuePriorities = queuePriorities
+    });
+  }
+
+  auto deviceExtensionCount = uint32_t{0};
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &deviceExtensionCount, nullptr);
+  std::vector<VkExtensionProperties> deviceExtensions(deviceExtensionCount);
+  vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &deviceExtensionCount, deviceExtensions.data());
+  auto hasMeshShaderExtension = std::any_of(deviceExtensions.begin(), deviceExtensions.end(), [](const VkExtensionProperties& extension) {
+    return std::strcmp(extension.extensionName, VK_EXT_MESH_SHADER_EXTENSION_NAME) == 0;
+  });
+
+  VkPhysicalDeviceMeshShaderFeaturesEXT supportedMeshShaderFeatures{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT
+  };
+  VkPhysicalDeviceVulkan12Features supportedVulkan12Features{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    .pNext = hasMeshShaderExtension ? &supportedMeshShaderFeatures : nullptr
+  };
+  VkPhysicalDeviceFeatures2 supportedFeatures{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+    .pNext = &supportedVulkan12Features
   };
+  vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+
+  // Cluster draws take their count from a buffer and their object from
+  // firstInstance. Mesh shaders cull and draw the clusters without the
+  // compute pass where the device has them; lavapipe only takes the compute path.
+  clusters = options.clusters && options.gpuDriven && supportedVulkan12Features.drawIndirectCount && supportedFeatures.features.drawIndirectFirstInstance;
+  meshShaders = clusters && options.meshShaders && hasMeshShaderExtension && supportedMeshShaderFeatures.taskShader && supportedMeshShaderFeatures.meshShader;
+  if (options.clusters && options.gpuDriven && !clusters) {
+    std::cerr << "Indirect count draws are not supported, culling whole objects only" << std::endl;
+  }
+  // Also needs a depth format that can be sampled, see chooseDepthFormat().
+  occlusionCulling = options.occlusionCulling && options.gpuDriven;
+
+  // Uploads signal a timeline semaphore that the frames wait on; the
+  // descriptor heap adds the descriptor indexing features.
+  VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+    .taskShader = VK_TRUE,
+    .meshShader = VK_TRUE
+  };
+  VkPhysicalDeviceVulkan12Features vulkan12Features{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+    .pNext = meshShaders ? &meshShaderFeatures : nullptr,
+    .drawIndirectCount = clusters,
+    .timelineSemaphore = VK_TRUE
+  };
+
+  // Textures are only loaded in BC formats, which desktop GPUs support.
+  VkPhysicalDeviceFeatures logicalDeviceFeatures{
+    .drawIndirectFirstInstance = clusters,
+    .textureCompressionBC = supportedFeatures.features.textureCompressionBC
+  };
+  DescriptorHeap::enableFeatures(logicalDeviceFeatures, vulkan12Features);
+
+  if (options.headless) {
+    logicalDeviceExtensions.clear();
+  }
+  if (meshShaders) {
+    logicalDeviceExtensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+  }
 
-  VkPhysicalDeviceFeatures logicalDeviceFeatures{};
   VkDeviceCreateInfo logicalDeviceCreateInfo{
     .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-    .queueCreateInfoCount = 1,
-    .pQueueCreateInfos = &logicalDeviceQueueCreateInfo,
-    .enabledExtensionCount = 1,
+    .pNext = &vulkan12Features,
+    .queueCreateInfoCount = uint32_t(logicalDeviceQueueCreateInfos.size()),
+    .pQueueCreateInfos = logicalDeviceQueueCreateInfos.data(),
+    .enabledExtensionCount = uint32_t(logicalDeviceExtensions.size()),
     .ppEnabledExtensionNames = logicalDeviceExtensions.data(),
     .pEnabledFeatures = &logicalDeviceFeatures
   };
@@ -91,11 +335,115 @@ void Viewer::run() {
   if (vkCreateDevice(physicalDevice, &logicalDeviceCreateInfo, nullptr, &logicalDevice) != VK_SUCCESS) {
     throw std::runtime_error("Could not create logical device");
   }
+  if (meshShaders) {
+    drawMeshTasksIndirect = reinterpret_cast<PFN_vkCmdDrawMeshTasksIndirectEXT>(vkGetDeviceProcAddr(logicalDevice, "vkCmdDrawMeshTasksIndirectEXT"));
+  }
+
+  startupTimer.mark("device");
+
+  chooseSampleCount();
+  chooseDepthFormat();
+
+  if (!options.headless) {
+    chooseSurfaceFormat();
+    choosePresentMode();
+  }
+
+  std::vector<uint32_t> bufferQueueFamilies{queueFamilies.graphics};
+  if (queueFamilies.transfer != queueFamilies.graphics) {
+    bufferQueueFamilies.push_back(queueFamilies.transfer);
+  }
+  memoryAllocator = std::make_unique<MemoryAllocator>(physicalDevice, logicalDevice, bufferQueueFamilies);
+
+  vkGetDeviceQueue(logicalDevice, queueFamilies.graphics, 0, &graphicsQueue);
+  vkGetDeviceQueue(logicalDevice, queueFamilies.present, 0, &presentationQueue);
+  vkGetDeviceQueue(logicalDevice, queueFamilies.transfer, queueFamilies.transferQueueIndex, &transferQueue);
+
+  pipelineCache = std::make_unique<PipelineCache>(physicalDevice, logicalDevice, options.cacheDirectory + "/pipeline_cache.bin");
+  startupTimer.mark(pipelineCache->loadedBytes() > 0 ? "pipeline cache (warm)" : "pipeline cache (cold)");
+
+  memoryAllocator->createBuffer(STAGING_BUFFER_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingAllocation);
+  stagingRing = std::make_unique<StagingRing>(logicalDevice, transferQueue, queueFamilies.transfer, stagingBuffer, stagingAllocation.mapped, STAGING_BUFFER_SIZE, STAGING_SLOT_COUNT);
+  // A camera uniform buffer per view and frame in flight, see createViews().
+  static_assert(MAX_WINDOWS * MAX_VIEWS_PER_WINDOW * MAX_FRAMES_IN_FLIGHT <= DescriptorHeap::MAX_UNIFORM_BUFFERS, "Every option combination needs its camera buffers");
+  auto cameraBufferCount = uint32_t(std::max<size_t>(windows.size(), 1)) * options.views * uint32_t(framesInFlight);
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+  const auto& limits = physicalDeviceProperties.limits;
+  if (cameraBufferCount > std::min(limits.maxPerStageDescriptorUniformBuffers, limits.maxDescriptorSetUniformBuffers)) {
+    throw std::runtime_error("The device supports at most " + std::to_string(std::min(limits.maxPerStageDescriptorUniformBuffers, limits.maxDescriptorSetUniformBuffers))
+      + " camera buffers, " + std::to_string(cameraBufferCount) + " needed; use fewer windows, views or frames in flight");
+  }
+  descriptorHeap = std::make_unique<DescriptorHeap>(logicalDevice, uint32_t(framesInFlight), cameraBufferCount, meshShaders);
+  createViews();
+  if (occlusionCulling) {
+    // The depth pyramid reads single texels, so the sampler never filters.
+    VkSamplerCreateInfo samplerCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = VK_FILTER_NEAREST,
+      .minFilter = VK_FILTER_NEAREST,
+      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+      .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+    };
+    if (vkCreateSampler(logicalDevice, &samplerCreateInfo, nullptr, &depthSampler) != VK_SUCCESS) {
+      throw std::runtime_error("Could not create depth sampler");
+    }
+  }
+  textureStreamer = std::make_unique<TextureStreamer>(physicalDevice, logicalDevice, *memoryAllocator, *stagingRing, *descriptorHeap, bufferQueueFamilies,
+    VkDeviceSize{options.textureBudget} << 20, uint32_t(framesInFlight));
+
+  shaderManager = std::make_unique<ShaderManager>(logicalDevice, options.shaderDirectory, options.cacheDirectory);
+  if (options.gpuDriven) {
+    gpuScene = std::make_unique<GpuScene>(logicalDevice, *memoryAllocator, *descriptorHeap, uint32_t(framesInFlight), uint32_t(views.size()),
+      clusters, drawMeshTasksIndirect, occlusionCulling);
+  }
+  instanceBuffers = std::make_unique<InstanceBuffers>(*memoryAllocator, *descriptorHeap, uint32_t(framesInFlight), uint32_t(views.size()));
+
+  // Shader and pipeline compilation are the slowest part of startup, so they
+  // overlap with the swap chain and resource setup below.
+  createRenderPass();
+  auto pipelinesCreated = std::async(options.asyncPipelineCompilation ? std::launch::async : std::launch::deferred, [this] {
+    createPipelines();
+  });
+
+  createCommandBuffers();
+  // Every view of a frame records into command buffers of its own.
+  commandRecorder = std::make_unique<CommandRecorder>(logicalDevice, queueFamilies.graphics, options.recordThreads, uint32_t(framesInFlight * views.size()));
+  profiler = std::make_unique<Profiler>(physicalDevice, logicalDevice, queueFamilies.graphics, framesInFlight, options.frameStats || !options.statsFile.empty(), !options.traceFile.empty());
+  if (options.framePacing && !options.headless) {
+    // FramePacer assumes 60 Hz for an unknown rate.
+    auto videoMode = primaryVideoMode();
+    framePacer = std::make_unique<FramePacer>(videoMode != nullptr ? videoMode->refreshRate : 0.0);
+  }
+  if (options.headless) {
+    createOffscreenTargets();
+  } else {
+    for (auto i = uint32_t{0}; i < windows.size(); i++) {
+      windows[i].handledResizes = input.windows[i].resizes;
+      createSwapChain(i, input.windows[i].framebufferExtent);
+    }
+    startupTimer.mark("swap chain");
+  }
 
-  vkGetDeviceQueue(logicalDevice, 0, 0, &graphicsQueue);
-  vkGetDeviceQueue(logicalDevice, 0, 0, &presentationQueue);
+  jobSystem = std::make_unique<JobSystem>(options.importThreads);
+  if (options.lod) {
+    lodBuilder = std::make_unique<LodBuilder>(*jobSystem);
+  }
+  if (clusters) {
+    meshletBuilder = std::make_unique<MeshletBuilder>(*jobSystem);
+  }
+  loadMeshes(options.meshFiles);
 
-  createSwapChain();  
+  pipelinesCreated.get();
+  startupTimer.mark("pipelines");
+  if (pipelineCache->loadedBytes() == 0) {
+    pipelineCache->save();
+  }
+  if (options.shaderHotReload && !options.headless) {
+    shaderManager->watch();
+  }
 
   VkSemaphoreCreateInfo semaphoreCreateInfo{
     .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
@@ -106,129 +454,555 @@ void Viewer::run() {
     .flags = VK_FENCE_CREATE_SIGNALED_BIT
   };
 
-  imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+  inFlightFences.resize(framesInFlight);
+  for (auto& fence : inFlightFences) {
+    if (vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &fence) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record command buffer!");
+    }
+  }
+
+  for (auto& window : windows) {
+    if (window.surface == VK_NULL_HANDLE) {
+      continue;
+    }
+    window.imageAvailableSemaphores.resize(framesInFlight);
+    window.renderFinishedSemaphores.resize(framesInFlight);
+    for (auto i = size_t{0}; i < framesInFlight; i++) {
+      if (vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &window.imageAvailableSemaphores[i]) != VK_SUCCESS
+          || vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &window.renderFinishedSemaphores[i]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+      }
+    }
+  }
+
+  if (options.resizeBenchmarkIterations > 0 && !options.headless) {
+    runResizeBenchmark();
+  }
+  if (options.recordBenchmarkFrames > 0) {
+    runRecordBenchmark();
+  }
+
+  if (options.headless) {
+    renderOffscreen();
+  } else if (options.renderThread) {
+    // Input is handled here as soon as it arrives, however long the frames
+    // take; the render thread picks up the latest state before recording.
+    renderThreadRunning = true;
+    std::thread renderThread{[this] {
+      renderLoop();
+    }};
+    while (!windowClosed() && !closeRequested) {
+      glfwWaitEvents();
+      publishInput();
+    }
+    closeRequested = true;
+    renderThread.join();
+    renderThreadRunning = false;
+    if (renderError) {
+      vkDeviceWaitIdle(logicalDevice);
+      std::rethrow_exception(renderError);
+    }
+  } else {
+    while (!windowClosed() && !closeRequested) {
+      // With frame pacing, drawFrame() polls input itself right before recording.
+      if (!framePacer) {
+        pollInput();
+      }
+      drawFrame();
+    }
+  }
+
+  vkDeviceWaitIdle(logicalDevice);
+
+  if (options.frameStats) {
+    profiler->report(std::cout);
+  }
+  if (!options.traceFile.empty()) {
+    profiler->writeChromeTrace(options.traceFile);
+  }
+  if (!options.statsFile.empty()) {
+    writeStats(options.statsFile);
+  }
+}
+
+void Viewer::createWindow(uint32_t index) {
+  auto title = index == 0 ? std::string{"3D Viewer"} : "3D Viewer " + std::to_string(index + 1);
+  auto handle = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
+  windows[index].handle = handle;
+
+  glfwSetWindowUserPointer(handle, this);
+  glfwSetKeyCallback(handle, key_callback);
+  glfwSetCursorPosCallback(handle, cursorPositionCallback);
+  glfwSetScrollCallback(handle, scrollCallback);
+  glfwSetFramebufferSizeCallback(handle, framebufferResizeCallback);
+  glfwSetDropCallback(handle, dropCallback);
+
+  auto frameWidth = int{0};
+  auto frameHeight = int{0};
+  glfwGetFramebufferSize(handle, &frameWidth, &frameHeight);
+  input.windows[index].framebufferExtent = {uint32_t(frameWidth), uint32_t(frameHeight)};
+  glfwGetCursorPos(handle, &cursors[index].x, &cursors[index].y);
+  cursors[index].view = index * options.views;
+}
+
+uint32_t Viewer::windowIndex(GLFWwindow* handle) const {
+  for (auto i = uint32_t{0}; i < windows.size(); i++) {
+    if (windows[i].handle == handle) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Closing any window closes the viewer.
+bool Viewer::windowClosed() const {
+  return std::any_of(windows.begin(), windows.end(), [](const Window& window) { return glfwWindowShouldClose(window.handle); });
+}
+
+void Viewer::waitForMeshes() {
+  while (meshLoader && (options.headless || !windowClosed())) {
+    if (options.headless) {
+      // Events are left queued while the staging ring is full; sleep on its
+      // copies instead of spinning next to them.
+      meshLoader->wait();
+      if (!meshLoader->finished() && stagingRing->freeBytes() < MeshLoader::MAX_EVENT_BYTES) {
+        stagingRing->waitForFreeBytes(MeshLoader::MAX_EVENT_BYTES);
+      }
+      processMeshEvents();
+    } else {
+      pollInput();
+      drawFrame();
+    }
+  }
+
+  // Benchmarks and rendered images should not depend on how far the LODs
+  // and meshlets got.
+  if (lodBuilder) {
+    lodBuilder->waitIdle();
+    processLodResults();
+  }
+  if (meshletBuilder) {
+    meshletBuilder->waitIdle();
+    processMeshletResults();
+  }
+  stagingRing->waitIdle();
+  completeUploads();
+}
 
-  for (auto i = size_t{0}; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    if (vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS
-        || vkCreateSemaphore(logicalDevice, &semaphoreCreateInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS
-        || vkCreateFence(logicalDevice, &fenceCreateInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
-          throw std::runtime_error("failed to record command buffer!");
+// Resizes the first window only.
+void Viewer::runResizeBenchmark() {
+  auto window = windows.front().handle;
+  auto frameWidth = int{0};
+  auto frameHeight = int{0};
+  glfwGetFramebufferSize(window, &frameWidth, &frameHeight);
+
+  resizeTimings.clear();
+  for (auto i = uint32_t{0}; i < options.resizeBenchmarkIterations && !windowClosed(); i++) {
+    auto scale = i % 2 == 0 ? 0.75 : 1.0;
+    glfwSetWindowSize(window, int(frameWidth * scale), int(frameHeight * scale));
+
+    auto resizesBefore = resizeTimings.size();
+    while (resizeTimings.size() == resizesBefore && !windowClosed()) {
+      pollInput();
+      drawFrame();
     }
   }
 
-  while (!glfwWindowShouldClose(window)) {
-    glfwPollEvents();
-    drawFrame();
+  if (resizeTimings.empty()) {
+    return;
   }
 
+  auto timings = resizeTimings;
+  std::sort(timings.begin(), timings.end());
+  auto total = std::accumulate(timings.begin(), timings.end(), 0.0);
+  std::cout << "Swap chain recreation over " << timings.size() << " resizes: mean " << total / timings.size()
+    << " ms, p50 " << timings[timings.size() / 2] << " ms, p99 " << timings[timings.size() * 99 / 100]
+    << " ms, max " << timings.back() << " ms" << std::endl;
+}
+
+void Viewer::runRecordBenchmark() {
+  waitForMeshes();
+
+  updateCamera();
+  auto viewProjection = sceneTransform(views.front());
+  auto camera = views.front().cameraBuffers[0].index;
+  // The recorded draws use the first frame's instance buffers.
   vkDeviceWaitIdle(logicalDevice);
+  instanceBuffers->update(0, drawItems, sceneVersion);
+  VkCommandBufferInheritanceInfo inheritanceInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+    .renderPass = renderPass,
+    .subpass = 0
+  };
+  auto recordFunction = [&](VkCommandBuffer commandBuffer, size_t first, size_t count) {
+    recordDrawItems(commandBuffer, viewProjection, camera, 0, 0, first, count);
+  };
+
+  // The recorded command buffers are never submitted, so a single frame's pools suffice.
+  for (auto threadCount = uint32_t{1}; ; threadCount = std::min(threadCount * 2, options.recordThreads)) {
+    CommandRecorder recorder{logicalDevice, queueFamilies.graphics, threadCount, 1};
+
+    std::vector<double> timings;
+    for (auto i = uint32_t{0}; i < options.recordBenchmarkFrames; i++) {
+      auto recordStart = std::chrono::steady_clock::now();
+      recorder.record(0, inheritanceInfo, drawItems.size(), recordFunction);
+      timings.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count());
+    }
+
+    std::sort(timings.begin(), timings.end());
+    auto total = std::accumulate(timings.begin(), timings.end(), 0.0);
+    std::cout << "Recording " << drawItems.size() << " draws with " << threadCount << " threads: mean " << total / timings.size()
+      << " ms, p50 " << timings[timings.size() / 2] << " ms, max " << timings.back() << " ms" << std::endl;
+
+    if (threadCount == options.recordThreads) {
+      break;
+    }
+  }
 }
 
 void Viewer::drawFrame() {
-  vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+  {
+    auto scope = profiler->scope("mesh uploads");
+    if (!meshLoader) {
+      std::lock_guard<std::mutex> lock{droppedFilesMutex};
+      if (!droppedFiles.empty()) {
+        loadMeshes(droppedFiles);
+        droppedFiles.clear();
+      }
+    }
+    processMeshEvents();
+    processLodResults();
+    processMeshletResults();
+    completeUploads();
+  }
+
+  {
+    auto scope = profiler->scope("wait for fence");
+    vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+  }
+  profiler->collect(uint32_t(currentFrame));
+  destroyRetiredSwapChains(false);
+  destroyRetiredPipelines(false);
+  destroyRetiredMeshBuffers(false);
+  descriptorHeap->collect(frameNumber);
+  swapReloadedPipelines();
+  {
+    auto scope = profiler->scope("texture streaming");
+    updateTextures();
+  }
 
-  auto imageIndex = uint32_t{0};
-  auto acquireNextImageResult = vkAcquireNextImageKHR(logicalDevice, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+  // Every window that is not minimized gets an image; the frame is drawn into
+  // all of them at once.
+  auto latest = inputSnapshots.latest();
+  auto anyVisible = false;
+  std::vector<VkFramebuffer> framebuffers(windows.size(), VK_NULL_HANDLE);
+  for (auto i = uint32_t{0}; i < windows.size(); i++) {
+    auto& window = windows[i];
+    window.acquired = false;
+    if (latest.windows[i].framebufferExtent.width == 0 || latest.windows[i].framebufferExtent.height == 0) {
+      continue;
+    }
+    anyVisible = true;
+    if (latest.windows[i].resizes != window.handledResizes) {
+      recreateSwapChain(i);
+    }
 
-  if (acquireNextImageResult == VK_ERROR_OUT_OF_DATE_KHR) {
-      recreateSwapChain();
-      return;
-  } else if (acquireNextImageResult != VK_SUCCESS && acquireNextImageResult != VK_SUBOPTIMAL_KHR) {
+    auto acquireNextImageResult = VK_SUCCESS;
+    {
+      auto scope = profiler->scope("acquire");
+      acquireNextImageResult = vkAcquireNextImageKHR(logicalDevice, window.swapChain, std::numeric_limits<uint64_t>::max(),
+        window.imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &window.imageIndex);
+    }
+
+    if (acquireNextImageResult == VK_ERROR_OUT_OF_DATE_KHR) {
+      recreateSwapChain(i);
+      continue;
+    } else if (acquireNextImageResult != VK_SUCCESS && acquireNextImageResult != VK_SUBOPTIMAL_KHR) {
       throw std::runtime_error("failed to acquire swap chain image!");
+    }
+    window.acquired = true;
+    framebuffers[i] = window.framebuffers[window.imageIndex];
+  }
+
+  if (std::none_of(windows.begin(), windows.end(), [](const Window& window) { return window.acquired; })) {
+    // Minimized windows have nothing to present to until they are restored.
+    if (!anyVisible) {
+      if (renderThreadRunning) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      } else {
+        glfwWaitEvents();
+        publishInput();
+      }
+    }
+    return;
+  }
+
+  if (framePacer) {
+    {
+      auto scope = profiler->scope("frame pacing");
+      framePacer->waitForNextFrame();
+    }
+    if (!renderThreadRunning) {
+      pollInput();
+    }
+  }
+  updateCamera();
+
+  vkResetFences(logicalDevice, 1, &inFlightFences[currentFrame]);
+  {
+    auto scope = profiler->scope("record");
+    auto commandBuffer = commandBuffers[currentFrame];
+    beginCommandBuffer(commandBuffer);
+    profiler->resetQueries(commandBuffer, uint32_t(currentFrame));
+    recordViews(commandBuffer, framebuffers);
+    endCommandBuffer(commandBuffer);
+  }
+
+  // The upload wait has already completed (see completeUploads), it only
+  // makes the copies visible to this frame. The binary semaphores ignore their value.
+  std::vector<VkSemaphore> waitSemaphores{stagingRing->semaphore()};
+  std::vector<VkPipelineStageFlags> waitStages{uploadWaitStages()};
+  std::vector<uint64_t> waitValues{visibleUploadValue};
+  std::vector<VkSemaphore> signalSemaphores;
+  std::vector<VkSwapchainKHR> presentSwapChains;
+  std::vector<uint32_t> imageIndices;
+  for (const auto& window : windows) {
+    if (window.acquired) {
+      waitSemaphores.push_back(window.imageAvailableSemaphores[currentFrame]);
+      waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+      waitValues.push_back(0);
+      signalSemaphores.push_back(window.renderFinishedSemaphores[currentFrame]);
+      presentSwapChains.push_back(window.swapChain);
+      imageIndices.push_back(window.imageIndex);
+    }
   }
 
-  std::vector<VkSemaphore> waitSemaphores{imageAvailableSemaphores[currentFrame]};
-  std::vector<VkPipelineStageFlags> waitStages{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  std::vector<VkSemaphore> signalSemaphores{renderFinishedSemaphores[currentFrame]};
+  VkTimelineSemaphoreSubmitInfo timelineSemaphoreSubmitInfo{
+    .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+    .waitSemaphoreValueCount = uint32_t(waitValues.size()),
+    .pWaitSemaphoreValues = waitValues.data()
+  };
 
   VkSubmitInfo submitInfo{
     .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-    .waitSemaphoreCount = 1,
+    .pNext = &timelineSemaphoreSubmitInfo,
+    .waitSemaphoreCount = uint32_t(waitSemaphores.size()),
     .pWaitSemaphores = waitSemaphores.data(),
     .pWaitDstStageMask = waitStages.data(),
     .commandBufferCount = 1,
-    .pCommandBuffers = &commandBuffers[imageIndex],
-    .signalSemaphoreCount = 1,
+    .pCommandBuffers = &commandBuffers[currentFrame],
+    .signalSemaphoreCount = uint32_t(signalSemaphores.size()),
     .pSignalSemaphores = signalSemaphores.data()
   };
 
-  vkResetFences(logicalDevice, 1, &inFlightFences[currentFrame]);
-
-  if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to submit draw command buffer!");
+  {
+    auto scope = profiler->scope("submit");
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit draw command buffer!");
+    }
+  }
+  profiler->submitted(uint32_t(currentFrame));
+  if (framePacer) {
+    framePacer->frameSubmitted();
   }
 
-  VkSwapchainKHR swapChains[] = {swapChain};
+  std::vector<VkResult> presentResults(presentSwapChains.size(), VK_SUCCESS);
   VkPresentInfoKHR presentInfo = {
     .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-    .waitSemaphoreCount = 1,
+    .waitSemaphoreCount = uint32_t(signalSemaphores.size()),
     .pWaitSemaphores = signalSemaphores.data(),
-    .swapchainCount = 1,
-    .pSwapchains = swapChains,
-    .pImageIndices = &imageIndex,
+    .swapchainCount = uint32_t(presentSwapChains.size()),
+    .pSwapchains = presentSwapChains.data(),
+    .pImageIndices = imageIndices.data(),
+    .pResults = presentResults.data()
   };
 
-  auto queuePresentResult = vkQueuePresentKHR(presentationQueue, &presentInfo);
+  {
+    auto scope = profiler->scope("present");
+    vkQueuePresentKHR(presentationQueue, &presentInfo);
+  }
 
-  if (queuePresentResult == VK_ERROR_OUT_OF_DATE_KHR || queuePresentResult == VK_SUBOPTIMAL_KHR || resizeHappended) {
-    resizeHappended = false;
-    recreateSwapChain();
-  } else if (queuePresentResult != VK_SUCCESS) {
+  auto presented = size_t{0};
+  for (auto i = uint32_t{0}; i < windows.size(); i++) {
+    if (!windows[i].acquired) {
+      continue;
+    }
+    auto queuePresentResult = presentResults[presented++];
+    if (queuePresentResult == VK_ERROR_OUT_OF_DATE_KHR || queuePresentResult == VK_SUBOPTIMAL_KHR) {
+      recreateSwapChain(i);
+    } else if (queuePresentResult != VK_SUCCESS) {
       throw std::runtime_error("failed to present swap chain image!");
+    }
+  }
+
+  if (frameNumber == 0) {
+    startupTimer.mark("first frame");
+  }
+  // The first frame that has every mesh in it ends startup, whether the meshes
+  // came from their source files or from the mesh cache.
+  if (!startupComplete && !meshLoader && std::none_of(meshes.begin(), meshes.end(), [](const Mesh& mesh) { return mesh.uploading; })) {
+    startupComplete = true;
+    startupTimer.mark("first complete frame");
+    if (options.startupTiming) {
+      startupTimer.print(std::cout);
+      requestClose();
+    }
   }
 
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  profiler->endFrame();
+  currentFrame = (currentFrame + 1) % framesInFlight;
+  frameNumber++;
 }
 
-void Viewer::recreateSwapChain() {
-  vkDeviceWaitIdle(logicalDevice);
+// A minimized window keeps its swap chain until it is restored; drawFrame
+// skips it meanwhile.
+void Viewer::recreateSwapChain(uint32_t index) {
+  auto recreateStart = std::chrono::steady_clock::now();
+
+  auto latest = inputSnapshots.latest().windows[index];
+  if (latest.framebufferExtent.width == 0 || latest.framebufferExtent.height == 0) {
+    return;
+  }
+  auto& window = windows[index];
+  window.handledResizes = latest.resizes;
+
+  // Frames in flight may still render into the old images, so they are only
+  // destroyed once those frames have finished (see destroyRetiredSwapChains).
+  retiredSwapChains.push_back({window.swapChain, window.imageViews, window.framebuffers, window.colorAttachment, window.depthAttachment, frameNumber});
+  createSwapChain(index, latest.framebufferExtent);
+
+  resizeTimings.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recreateStart).count());
+}
+
+void Viewer::destroyRetiredSwapChains(bool all) {
+  while (!retiredSwapChains.empty() && (all || retiredSwapChains.front().retiredAtFrame + framesInFlight <= frameNumber)) {
+    auto& retired = retiredSwapChains.front();
+    for (auto framebuffer : retired.framebuffers) {
+      vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+    }
+    for (auto imageView : retired.imageViews) {
+      vkDestroyImageView(logicalDevice, imageView, nullptr);
+    }
+    destroyTransientAttachment(retired.colorAttachment);
+    destroyTransientAttachment(retired.depthAttachment);
+    vkDestroySwapchainKHR(logicalDevice, retired.swapChain, nullptr);
+    retiredSwapChains.pop_front();
+  }
+}
+
+// All windows share the render passes and pipelines, so they need a format
+// every one of them supports.
+void Viewer::chooseSurfaceFormat() {
+  auto formats = surfaceFormats(physicalDevice, windows.front().surface);
+  if (formats.empty()) {
+    throw std::runtime_error("Surface reports no formats");
+  }
+  for (auto i = size_t{1}; i < windows.size(); i++) {
+    auto supported = surfaceFormats(physicalDevice, windows[i].surface);
+    formats.erase(std::remove_if(formats.begin(), formats.end(), [&](const VkSurfaceFormatKHR& format) {
+      return std::none_of(supported.begin(), supported.end(), [&](const VkSurfaceFormatKHR& other) {
+        return other.format == format.format && other.colorSpace == format.colorSpace;
+      });
+    }), formats.end());
+  }
+  if (formats.empty()) {
+    throw std::runtime_error("The windows have no surface format in common");
+  }
 
-  cleanupSwapChain();
-  createSwapChain();
+  for (auto format : {VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM}) {
+    for (const auto& available : formats) {
+      if (available.format == format && available.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+        surfaceFormat = available;
+        return;
+      }
+    }
+  }
+  surfaceFormat = formats[0];
 }
 
-void Viewer::createSwapChain() {
-  VkSurfaceFormatKHR surfaceFormat{VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
-  VkPresentModeKHR presentationMode{VK_PRESENT_MODE_FIFO_KHR};
+void Viewer::choosePresentMode() {
+  std::vector<std::vector<VkPresentModeKHR>> supportedModes;
+  for (const auto& window : windows) {
+    supportedModes.push_back(presentModes(physicalDevice, window.surface));
+  }
+
+  // Every mode falls back to the closest one in latency, FIFO is always supported.
+  std::vector<VkPresentModeKHR> candidates;
+  if (options.presentMode == "mailbox") {
+    candidates = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+  } else if (options.presentMode == "immediate") {
+    candidates = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
+  } else if (options.presentMode == "fifo-relaxed") {
+    candidates = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+  }
+
+  presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  for (auto candidate : candidates) {
+    if (std::all_of(supportedModes.begin(), supportedModes.end(), [&](const std::vector<VkPresentModeKHR>& modes) {
+          return std::find(modes.begin(), modes.end(), candidate) != modes.end();
+        })) {
+      presentMode = candidate;
+      break;
+    }
+  }
+
+  if (options.presentMode != "fifo" && presentMode == VK_PRESENT_MODE_FIFO_KHR) {
+    std::cerr << "Present mode " << options.presentMode << " is not supported, using fifo" << std::endl;
+  }
+}
 
-  auto newWidth = int{0};
-  auto newHeight = int{0};
-  glfwGetFramebufferSize(window, &newWidth, &newHeight);
-  VkExtent2D swapExtent{uint32_t(newWidth), uint32_t(newHeight)};
+void Viewer::createSwapChain(uint32_t index, VkExtent2D swapExtent) {
+  auto& window = windows[index];
+  window.extent = swapExtent;
 
   VkSurfaceCapabilitiesKHR surfaceCapabilities;
-  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, window.surface, &surfaceCapabilities);
+
+  // One image above the minimum gives MAILBOX a spare to replace; more only adds FIFO latency.
+  auto imageCount = options.swapChainImageCount > 0 ? options.swapChainImageCount : surfaceCapabilities.minImageCount + 1;
+  imageCount = std::max(imageCount, surfaceCapabilities.minImageCount);
+  if (surfaceCapabilities.maxImageCount > 0) {
+    imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+  }
 
   VkSwapchainCreateInfoKHR swapChainCreateInfo{
     .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-    .surface = surface,
-    .minImageCount = surfaceCapabilities.minImageCount + 1,
+    .surface = window.surface,
+    .minImageCount = imageCount,
     .imageFormat = surfaceFormat.format,
     .imageColorSpace = surfaceFormat.colorSpace,
     .imageExtent = swapExtent,
     .imageArrayLayers = 1,
     .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
     .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .queueFamilyIndexCount = 0,
+    .pQueueFamilyIndices = nullptr,
     .preTransform = surfaceCapabilities.currentTransform,
     .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-    .presentMode = presentationMode,
+    .presentMode = presentMode,
     .clipped = VK_TRUE,
-    .oldSwapchain = VK_NULL_HANDLE
+    .oldSwapchain = window.swapChain
   };
 
-  if (vkCreateSwapchainKHR(logicalDevice, &swapChainCreateInfo, nullptr, &swapChain) != VK_SUCCESS) {
+  // Rendered on the graphics queue, presented on another: share the images instead of transferring ownership every frame.
+  uint32_t sharingQueueFamilies[]{queueFamilies.graphics, queueFamilies.present};
+  if (queueFamilies.present != queueFamilies.graphics) {
+    swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+    swapChainCreateInfo.queueFamilyIndexCount = 2;
+    swapChainCreateInfo.pQueueFamilyIndices = sharingQueueFamilies;
+  }
+
+  if (vkCreateSwapchainKHR(logicalDevice, &swapChainCreateInfo, nullptr, &window.swapChain) != VK_SUCCESS) {
     throw std::runtime_error("Could not create swap chain");
   }
 
   auto swapChainImageCount = uint32_t{0};
-  vkGetSwapchainImagesKHR(logicalDevice, swapChain, &swapChainImageCount, nullptr);
-  swapChainImages.resize(swapChainImageCount);
-  vkGetSwapchainImagesKHR(logicalDevice, swapChain, &swapChainImageCount, swapChainImages.data());
+  vkGetSwapchainImagesKHR(logicalDevice, window.swapChain, &swapChainImageCount, nullptr);
+  window.images.resize(swapChainImageCount);
+  vkGetSwapchainImagesKHR(logicalDevice, window.swapChain, &swapChainImageCount, window.images.data());
 
-  swapChainImageViews.resize(swapChainImages.size());
-  for (auto i = size_t{0}; i < swapChainImages.size(); i++) {
+  window.imageViews.resize(window.images.size());
+  for (auto i = size_t{0}; i < window.images.size(); i++) {
     VkComponentMapping componentMapping{
       .r = VK_COMPONENT_SWIZZLE_IDENTITY,
       .g = VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -246,89 +1020,306 @@ void Viewer::createSwapChain() {
 
     VkImageViewCreateInfo imageViewCreateInfo{
       .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-      .image = swapChainImages[i],
+      .image = window.images[i],
       .viewType = VK_IMAGE_VIEW_TYPE_2D,
       .format = surfaceFormat.format,
       .components = componentMapping,
       .subresourceRange = imageSubResourceRange      
     };
 
-    if (vkCreateImageView(logicalDevice, &imageViewCreateInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
+    if (vkCreateImageView(logicalDevice, &imageViewCreateInfo, nullptr, &window.imageViews[i]) != VK_SUCCESS) {
       throw std::runtime_error("Could not create image view");
     }
   }
 
-  VkAttachmentDescription attachmentDescription{
-    .format = surfaceFormat.format,
-    .samples = VK_SAMPLE_COUNT_1_BIT,
-    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-    .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+  createTransientAttachments(window);
+
+  window.framebuffers.resize(window.imageViews.size());
+  for (auto i = size_t{0}; i < window.imageViews.size(); i++) {
+    auto attachments = framebufferAttachments(window, window.imageViews[i]);
+
+    VkFramebufferCreateInfo frameBufferCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+      .renderPass = renderPass,
+      .attachmentCount = uint32_t(attachments.size()),
+      .pAttachments = attachments.data(),
+      .width = swapExtent.width,
+      .height = swapExtent.height,
+      .layers = 1
+    };
+
+    if (vkCreateFramebuffer(logicalDevice, &frameBufferCreateInfo, nullptr, &window.framebuffers[i]) != VK_SUCCESS) {
+      throw std::runtime_error("Could not create frame buffer");
+    }
+  }
+
+  layoutViews(index);
+}
+
+// Every view has a camera of its own, options.views of them side by side in
+// every window.
+void Viewer::createViews() {
+  views.resize(windows.size() * options.views);
+  for (auto i = uint32_t{0}; i < views.size(); i++) {
+    auto& view = views[i];
+    view.window = i / options.views;
+    view.cameraBuffers.resize(framesInFlight);
+    for (auto& cameraBuffer : view.cameraBuffers) {
+      memoryAllocator->createBuffer(sizeof(CameraUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        cameraBuffer.buffer, cameraBuffer.allocation);
+      cameraBuffer.index = descriptorHeap->addUniformBuffer(cameraBuffer.buffer);
+    }
+  }
+}
+
+// Splits the window into equal columns, one per view.
+void Viewer::layoutViews(uint32_t window) {
+  auto extent = windows[window].extent;
+  for (auto i = uint32_t{0}; i < options.views; i++) {
+    auto left = extent.width * i / options.views;
+    auto right = extent.width * (i + 1) / options.views;
+    views[window * options.views + i].rectangle = {{int32_t(left), 0}, {right - left, extent.height}};
+  }
+}
+
+void Viewer::chooseSampleCount() {
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+  auto supported = physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+
+  sampleCount = VK_SAMPLE_COUNT_1_BIT;
+  for (auto candidate : {VK_SAMPLE_COUNT_8_BIT, VK_SAMPLE_COUNT_4_BIT, VK_SAMPLE_COUNT_2_BIT}) {
+    if (uint32_t(candidate) <= options.samples && (supported & candidate)) {
+      sampleCount = candidate;
+      break;
+    }
+  }
+
+  if (uint32_t(sampleCount) != options.samples) {
+    std::cerr << options.samples << "x MSAA is not supported, using " << uint32_t(sampleCount) << "x" << std::endl;
+  }
+}
+
+// Occlusion culling samples the depth attachment, at the chosen sample count.
+void Viewer::chooseDepthFormat() {
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+  if (occlusionCulling && !(physicalDeviceProperties.limits.sampledImageDepthSampleCounts & sampleCount)) {
+    std::cerr << "Multisampled depth cannot be sampled, culling without occlusion" << std::endl;
+    occlusionCulling = false;
+  }
+
+  auto features = VkFormatFeatureFlags{VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT};
+  if (occlusionCulling) {
+    features |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  }
+  for (auto format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D16_UNORM}) {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+    if ((formatProperties.optimalTilingFeatures & features) == features) {
+      depthFormat = format;
+      return;
+    }
+  }
+
+  if (occlusionCulling) {
+    std::cerr << "No depth format can be sampled, culling without occlusion" << std::endl;
+    occlusionCulling = false;
+    chooseDepthFormat();
+    return;
+  }
+  throw std::runtime_error("No supported depth format");
+}
+
+void Viewer::createRenderPass() {
+  renderPass = buildRenderPass(true, !occlusionCulling, false);
+  if (occlusionCulling) {
+    occlusionRenderPass = buildRenderPass(false, true, false);
+  }
+  if (options.views > 1) {
+    nextViewRenderPass = buildRenderPass(true, !occlusionCulling, true);
+    if (occlusionCulling) {
+      nextViewOcclusionRenderPass = buildRenderPass(false, true, true);
+    }
+  }
+}
+
+// Only the single sampled color image is ever stored. With MSAA the samples
+// are resolved into it at the end of the subpass, so neither they nor the
+// depth values leave tile memory on tilers. Between the two render passes of
+// occlusion culling, color and depth are stored and the depth is left ready
+// to be sampled. Every view after the first of a window keeps what the views
+// before it drew into the target, outside of its render area.
+VkRenderPass Viewer::buildRenderPass(bool first, bool last, bool keepTarget) {
+  auto multisampled = sampleCount != VK_SAMPLE_COUNT_1_BIT;
+  auto targetLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  std::vector<VkAttachmentDescription> attachmentDescriptions{
+    {
+      .format = surfaceFormat.format,
+      .samples = sampleCount,
+      .loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD,
+      .storeOp = multisampled && last ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = !first ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : keepTarget && !multisampled ? targetLayout : VK_IMAGE_LAYOUT_UNDEFINED,
+      .finalLayout = multisampled || !last ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : targetLayout
+    },
+    {
+      .format = depthFormat,
+      .samples = sampleCount,
+      .loadOp = first ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD,
+      .storeOp = last ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = first ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      .finalLayout = last ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    }
   };
+  if (multisampled) {
+    attachmentDescriptions.push_back({
+      .format = surfaceFormat.format,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .storeOp = last ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = !keepTarget ? VK_IMAGE_LAYOUT_UNDEFINED : first ? targetLayout : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .finalLayout = last ? targetLayout : VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    });
+  }
 
   VkAttachmentReference attachmentReference{
     .attachment = 0,
     .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
   };
 
+  VkAttachmentReference depthAttachmentReference{
+    .attachment = 1,
+    .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+  };
+
+  VkAttachmentReference resolveAttachmentReference{
+    .attachment = 2,
+    .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+  };
+
   VkSubpassDescription subpassDescription{
     .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
     .colorAttachmentCount = 1,
-    .pColorAttachments = &attachmentReference
+    .pColorAttachments = &attachmentReference,
+    .pResolveAttachments = multisampled ? &resolveAttachmentReference : nullptr,
+    .pDepthStencilAttachment = &depthAttachmentReference
   };
 
-  VkSubpassDependency subpassDependency{
+  // The transient attachments are shared by all frames in flight, so the
+  // previous frame's writes to them have to finish first. The second pass
+  // also waits for the depth pyramid to have read the depth, and the first
+  // makes its depth visible to it.
+  std::vector<VkSubpassDependency> subpassDependencies{{
     .srcSubpass = VK_SUBPASS_EXTERNAL,
     .dstSubpass = 0,
-    .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-    .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-    .srcAccessMask = 0,
-    .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
-  };
+    .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+    .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+      | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+  }};
+  if (!first) {
+    subpassDependencies.front().srcStageMask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  }
+  if (!last) {
+    subpassDependencies.push_back({
+      .srcSubpass = 0,
+      .dstSubpass = VK_SUBPASS_EXTERNAL,
+      .srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+    });
+  }
 
   VkRenderPassCreateInfo renderPassCreateInfo{
     .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-    .attachmentCount = 1,
-    .pAttachments = &attachmentDescription,
+    .attachmentCount = uint32_t(attachmentDescriptions.size()),
+    .pAttachments = attachmentDescriptions.data(),
     .subpassCount = 1,
     .pSubpasses = &subpassDescription,
-    .dependencyCount = 1,
-    .pDependencies = &subpassDependency
+    .dependencyCount = uint32_t(subpassDependencies.size()),
+    .pDependencies = subpassDependencies.data()
   };
 
-  if (vkCreateRenderPass(logicalDevice, &renderPassCreateInfo, nullptr, &renderPass) != VK_SUCCESS) {
+  VkRenderPass builtRenderPass;
+  if (vkCreateRenderPass(logicalDevice, &renderPassCreateInfo, nullptr, &builtRenderPass) != VK_SUCCESS) {
     throw std::runtime_error("Could not create render pass");   
   }
+  return builtRenderPass;
+}
 
-  VkShaderModule vertexShaderModule, fragmentShaderModule;
-  createShaderModuleFromBinary("../source/shaders/vert.spv", vertexShaderModule);
-  createShaderModuleFromBinary("../source/shaders/frag.spv", fragmentShaderModule);
+void Viewer::createPipelines() {
+  registerPipeline(graphicsPipeline, {"basic.vert", "basic.frag"}, [this] {
+    return buildGraphicsPipeline({"basic.vert", "basic.frag"});
+  });
+
+  if (gpuScene) {
+    registerPipeline(indirectPipeline, {"indirect.vert", "basic.frag"}, [this] {
+      return buildGraphicsPipeline({"indirect.vert", "basic.frag"});
+    });
+    registerPipeline(cullPipeline, {"cull.comp"}, [this] {
+      return buildComputePipeline("cull.comp");
+    });
+  }
+  if (occlusionCulling) {
+    registerPipeline(depthPyramidPipeline, {"depth_pyramid.comp"}, [this] {
+      return buildComputePipeline("depth_pyramid.comp");
+    });
+  }
 
-  VkPipelineShaderStageCreateInfo vertexShaderStageCreateInfo{
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-    .stage = VK_SHADER_STAGE_VERTEX_BIT,
-    .module = vertexShaderModule,
-    .pName = "main"
-  };
+  if (meshShaders) {
+    registerPipeline(clusterPipeline, {"cluster.task", "cluster.mesh", "basic.frag"}, [this] {
+      return buildGraphicsPipeline({"cluster.task", "cluster.mesh", "basic.frag"});
+    });
+  } else if (clusters) {
+    registerPipeline(clusterCullPipeline, {"cluster_cull.comp"}, [this] {
+      return buildComputePipeline("cluster_cull.comp");
+    });
+    registerPipeline(clusterPipeline, {"cluster.vert", "basic.frag"}, [this] {
+      return buildGraphicsPipeline({"cluster.vert", "basic.frag"});
+    });
+  }
+}
 
-  VkPipelineShaderStageCreateInfo fragmentShaderStageCreateInfo{
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-    .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-    .module = fragmentShaderModule,
-    .pName = "main"
-  };
+void Viewer::registerPipeline(VkPipeline& pipeline, const std::vector<std::string>& shaderNames, std::function<VkPipeline()> build) {
+  pipeline = build();
+  auto id = shaderManager->addPipeline(shaderNames, std::move(build));
+  reloadablePipelines.resize(std::max<size_t>(reloadablePipelines.size(), id + 1));
+  reloadablePipelines[id] = &pipeline;
+}
 
-  auto shaderStages = std::vector<VkPipelineShaderStageCreateInfo>{
-    vertexShaderStageCreateInfo,
-    fragmentShaderStageCreateInfo
-  };
+// Called on the shader watcher thread as well, so it must only touch state
+// that stays fixed for the lifetime of the pipeline. The stages follow from
+// the file extensions; mesh shader pipelines have no vertex input.
+VkPipeline Viewer::buildGraphicsPipeline(const std::vector<std::string>& shaderNames) {
+  std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
+  for (const auto& shaderName : shaderNames) {
+    shaderStages.push_back({
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = shaderStage(shaderName),
+      .module = shaderManager->createShaderModule(shaderName),
+      .pName = "main"
+    });
+  }
+  auto meshPipeline = shaderStages.front().stage != VK_SHADER_STAGE_VERTEX_BIT;
+
+  auto vertexBindingDescription = Vertex::bindingDescription();
+  auto vertexAttributeDescriptions = Vertex::attributeDescriptions();
 
   VkPipelineVertexInputStateCreateInfo pipelineVertexInputStateCreateInfo{
     .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-    .vertexBindingDescriptionCount = 0
+    .vertexBindingDescriptionCount = 1,
+    .pVertexBindingDescriptions = &vertexBindingDescription,
+    .vertexAttributeDescriptionCount = uint32_t(vertexAttributeDescriptions.size()),
+    .pVertexAttributeDescriptions = vertexAttributeDescriptions.data()
   };
 
   VkPipelineInputAssemblyStateCreateInfo pipelineInputAssemblyStateCreateInfo{
@@ -337,26 +1328,10 @@ void Viewer::createSwapChain() {
     .primitiveRestartEnable = VK_FALSE
   };
 
-  VkViewport viewport{
-    .x = 0.0f,
-    .y = 0.0f,
-    .width = float(swapExtent.width),
-    .height = float(swapExtent.height),
-    .minDepth = 0.0f,
-    .maxDepth = 1.0f
-  };
-
-  VkRect2D scissor{
-    .offset = {0, 0},
-    .extent = swapExtent
-  };
-
   VkPipelineViewportStateCreateInfo pipelineViewportStateCreateInfo{
     .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
     .viewportCount = 1,
-    .pViewports = &viewport,
-    .scissorCount = 1,
-    .pScissors = &scissor
+    .scissorCount = 1
   };
 
   VkPipelineRasterizationStateCreateInfo pipelineRasterizationStateCreateInfo{
@@ -365,18 +1340,29 @@ void Viewer::createSwapChain() {
     .rasterizerDiscardEnable = VK_FALSE,
     .polygonMode = VK_POLYGON_MODE_FILL,
     .cullMode = VK_CULL_MODE_BACK_BIT,
-    .frontFace = VK_FRONT_FACE_CLOCKWISE,
+    .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
     .depthBiasEnable = VK_FALSE,
     .lineWidth = 1.0f
   };
 
   VkPipelineMultisampleStateCreateInfo pipelineMultisampleStateCreateInfo{
     .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    .rasterizationSamples = sampleCount,
     .sampleShadingEnable = VK_FALSE,
     .minSampleShading = 1.0f
   };
 
+  VkPipelineDepthStencilStateCreateInfo pipelineDepthStencilStateCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+    .depthTestEnable = VK_TRUE,
+    .depthWriteEnable = VK_TRUE,
+    .depthCompareOp = VK_COMPARE_OP_LESS,
+    .depthBoundsTestEnable = VK_FALSE,
+    .stencilTestEnable = VK_FALSE,
+    .minDepthBounds = 0.0f,
+    .maxDepthBounds = 1.0f
+  };
+
   VkPipelineColorBlendAttachmentState pipelineColorBlendAttachmentState{
     .blendEnable = VK_FALSE,
     .colorWriteMask =
@@ -393,65 +1379,102 @@ void Viewer::createSwapChain() {
     .pAttachments = &pipelineColorBlendAttachmentState
   };
 
-  VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo{
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+  auto dynamicStates = std::vector<VkDynamicState>{
+    VK_DYNAMIC_STATE_VIEWPORT,
+    VK_DYNAMIC_STATE_SCISSOR
   };
 
-  if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-    throw std::runtime_error("Could not create pipeline layout");
-  }
+  VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+    .dynamicStateCount = uint32_t(dynamicStates.size()),
+    .pDynamicStates = dynamicStates.data()
+  };
 
   VkGraphicsPipelineCreateInfo pipelineCreateInfo{
     .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-    .stageCount = 2,
+    .stageCount = uint32_t(shaderStages.size()),
     .pStages = shaderStages.data(),
-    .pVertexInputState = &pipelineVertexInputStateCreateInfo,
-    .pInputAssemblyState = &pipelineInputAssemblyStateCreateInfo,
+    .pVertexInputState = meshPipeline ? nullptr : &pipelineVertexInputStateCreateInfo,
+    .pInputAssemblyState = meshPipeline ? nullptr : &pipelineInputAssemblyStateCreateInfo,
     .pViewportState = &pipelineViewportStateCreateInfo,
     .pRasterizationState = &pipelineRasterizationStateCreateInfo,
     .pMultisampleState = &pipelineMultisampleStateCreateInfo,
+    .pDepthStencilState = &pipelineDepthStencilStateCreateInfo,
     .pColorBlendState = &pipelineColorBlendStateCreateInfo,
-    .layout = pipelineLayout,
+    .pDynamicState = &pipelineDynamicStateCreateInfo,
+    .layout = descriptorHeap->pipelineLayout(),
     .renderPass = renderPass,
     .subpass = 0
   };
 
-  if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+  VkPipeline pipeline;
+  auto result = vkCreateGraphicsPipelines(logicalDevice, pipelineCache->handle(), 1, &pipelineCreateInfo, nullptr, &pipeline);
+
+  for (const auto& shaderStage : shaderStages) {
+    vkDestroyShaderModule(logicalDevice, shaderStage.module, nullptr);
+  }
+
+  if (result != VK_SUCCESS) {
     throw std::runtime_error("Could not create graphics pipeline");
   }
 
-  vkDestroyShaderModule(logicalDevice, fragmentShaderModule, nullptr);
-  vkDestroyShaderModule(logicalDevice, vertexShaderModule, nullptr);
+  return pipeline;
+}
 
-  swapChainFramebuffers.resize(swapChainImageViews.size());
-  for (auto i = size_t{0}; i < swapChainImageViews.size(); i++) {
-    auto attachments = std::vector<VkImageView>{swapChainImageViews[i]};
+VkPipeline Viewer::buildComputePipeline(const std::string& shaderName) {
+  auto computeShaderModule = shaderManager->createShaderModule(shaderName);
+
+  VkComputePipelineCreateInfo pipelineCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = computeShaderModule,
+      .pName = "main"
+    },
+    .layout = descriptorHeap->pipelineLayout()
+  };
 
-    VkFramebufferCreateInfo frameBufferCreateInfo{
-      .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-      .renderPass = renderPass,
-      .attachmentCount = 1,
-      .pAttachments = attachments.data(),
-      .width = swapExtent.width,
-      .height = swapExtent.height,
-      .layers = 1
-    };
+  VkPipeline pipeline;
+  auto result = vkCreateComputePipelines(logicalDevice, pipelineCache->handle(), 1, &pipelineCreateInfo, nullptr, &pipeline);
 
-    if (vkCreateFramebuffer(logicalDevice, &frameBufferCreateInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-      throw std::runtime_error("Could not create frame buffer");
-    }
+  vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Could not create compute pipeline for " + shaderName);
   }
 
+  return pipeline;
+}
+
+void Viewer::swapReloadedPipelines() {
+  ReloadedPipeline reloaded;
+  while (shaderManager->poll(reloaded)) {
+    auto& pipeline = *reloadablePipelines[reloaded.id];
+    retiredPipelines.push_back({pipeline, frameNumber});
+    pipeline = reloaded.pipeline;
+  }
+}
+
+void Viewer::destroyRetiredPipelines(bool all) {
+  while (!retiredPipelines.empty() && (all || retiredPipelines.front().retiredAtFrame + framesInFlight <= frameNumber)) {
+    vkDestroyPipeline(logicalDevice, retiredPipelines.front().pipeline, nullptr);
+    retiredPipelines.pop_front();
+  }
+}
+
+void Viewer::createCommandBuffers() {
   VkCommandPoolCreateInfo commandPoolCreateInfo{
     .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-    .queueFamilyIndex = 0
+    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = queueFamilies.graphics
   };
 
   if (vkCreateCommandPool(logicalDevice, &commandPoolCreateInfo, nullptr, &commandPool) != VK_SUCCESS) {
     throw std::runtime_error("failed to create command pool!");
   }
 
-  commandBuffers.resize(swapChainFramebuffers.size());
+  commandBuffers.resize(framesInFlight);
 
   VkCommandBufferAllocateInfo commandBufferAllocateInfo{
     .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -463,95 +1486,1173 @@ void Viewer::createSwapChain() {
   if (vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, commandBuffers.data()) != VK_SUCCESS) {
     throw std::runtime_error("failed to allocate command buffers!");
   }
+}
+
+void Viewer::beginCommandBuffer(VkCommandBuffer commandBuffer) {
+  VkCommandBufferBeginInfo commandBufferBeginInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+
+  if (vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo) != VK_SUCCESS) {
+      throw std::runtime_error("failed to begin recording command buffer!");
+  }
+}
+
+void Viewer::endCommandBuffer(VkCommandBuffer commandBuffer) {
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer!");
+  }
+}
+
+// Views draw one after another, each culled for its own camera and drawn in
+// its own render passes limited to its rectangle of the window; the culling
+// of a view reuses the buffers the previous one has drawn from.
+void Viewer::recordViews(VkCommandBuffer commandBuffer, const std::vector<VkFramebuffer>& framebuffers) {
+  // Each mesh with objects costs a draw per level of detail, however many
+  // objects share it; the draw items are sorted by mesh.
+  auto drawnMeshes = uint64_t{0};
+  for (auto i = size_t{0}; i < drawItems.size(); i++) {
+    drawnMeshes += i == 0 || drawItems[i].mesh != drawItems[i - 1].mesh;
+  }
+  profiler->addCount("meshes drawn", drawnMeshes);
+
+  if (gpuScene) {
+    GpuCullStats cullStats;
+    if (gpuScene->readStats(uint32_t(currentFrame), cullStats)) {
+      profiler->addCount("objects drawn", cullStats.drawnLastVisible + cullStats.drawnNewlyVisible);
+      profiler->addCount("objects frustum culled", cullStats.frustumCulled);
+      if (occlusionCulling) {
+        profiler->addCount("objects newly visible", cullStats.drawnNewlyVisible);
+        profiler->addCount("objects occlusion culled", cullStats.occlusionCulled);
+      }
+    }
+    std::vector<VkExtent2D> viewports;
+    for (const auto& view : views) {
+      viewports.push_back(view.rectangle.extent);
+    }
+    gpuScene->update(uint32_t(currentFrame), meshes, drawItems, sceneVersion, viewports);
+    gpuScene->recordUploads(commandBuffer, uint32_t(currentFrame));
+  } else {
+    instanceBuffers->update(uint32_t(currentFrame), drawItems, sceneVersion);
+  }
+
+  auto gpuScope = profiler->beginGpuScope(commandBuffer, uint32_t(currentFrame), "render pass");
+  auto previousWindow = uint32_t(windows.size());
+  for (auto i = uint32_t{0}; i < views.size(); i++) {
+    const auto& view = views[i];
+    auto framebuffer = framebuffers[view.window];
+    if (framebuffer == VK_NULL_HANDLE || view.rectangle.extent.width == 0 || view.rectangle.extent.height == 0) {
+      continue;
+    }
+    recordView(commandBuffer, i, framebuffer, view.window != previousWindow);
+    previousWindow = view.window;
+  }
+  profiler->endGpuScope(commandBuffer, uint32_t(currentFrame), gpuScope);
+
+  if (gpuScene) {
+    gpuScene->recordStatsReadback(commandBuffer, uint32_t(currentFrame));
+  }
+}
+
+void Viewer::recordView(VkCommandBuffer commandBuffer, uint32_t viewIndex, VkFramebuffer framebuffer, bool firstInWindow) {
+  const auto& view = views[viewIndex];
+  const auto& window = windows[view.window];
+  auto aspect = float(view.rectangle.extent.width) / float(std::max(view.rectangle.extent.height, 1u));
+  CameraUniforms cameraUniforms{view.camera.view(), view.camera.projection(aspect), sceneTransform(view)};
+  const auto& cameraBuffer = view.cameraBuffers[currentFrame];
+  std::memcpy(cameraBuffer.allocation.mapped, &cameraUniforms, sizeof(cameraUniforms));
+  auto viewProjection = cameraUniforms.viewProjection;
+
+  if (gpuScene) {
+    auto cullingScope = profiler->beginGpuScope(commandBuffer, uint32_t(currentFrame), "culling");
+    gpuScene->recordCulling(commandBuffer, uint32_t(currentFrame), viewIndex, cullPipeline, clusterCullPipeline, meshes, cameraBuffer.index,
+      view.rectangle.extent, options.lodPixelError);
+    profiler->endGpuScope(commandBuffer, uint32_t(currentFrame), cullingScope);
+  }
 
-  for (auto i = size_t{0}; i < commandBuffers.size(); i++) {
-    VkCommandBufferBeginInfo commandBufferBeginInfo{
-      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT
+  // The resolve attachment is not cleared, so it needs no clear value.
+  VkClearValue clearValues[2];
+  clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  clearValues[1].depthStencil = {1.0f, 0};
+
+  auto firstPass = firstInWindow ? renderPass : nextViewRenderPass;
+  VkRenderPassBeginInfo renderPassBeginInfo{
+    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+    .renderPass = firstPass,
+    .framebuffer = framebuffer,
+    .renderArea = view.rectangle,
+    .clearValueCount = 2,
+    .pClearValues = clearValues
+  };
+
+  if (gpuScene) {
+    auto drawScene = [&](VkRenderPass pass) {
+      renderPassBeginInfo.renderPass = pass;
+      vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+      setViewportAndScissor(commandBuffer, view.rectangle);
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectPipeline);
+      descriptorHeap->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+      gpuScene->recordDraws(commandBuffer, cameraBuffer.index, meshes, *textureStreamer, clusterPipeline);
+      vkCmdEndRenderPass(commandBuffer);
     };
 
-    if (vkBeginCommandBuffer(commandBuffers[i], &commandBufferBeginInfo) != VK_SUCCESS) {
-        throw std::runtime_error("failed to begin recording command buffer!");
+    drawScene(firstPass);
+    if (occlusionCulling) {
+      auto occlusionScope = profiler->beginGpuScope(commandBuffer, uint32_t(currentFrame), "occlusion culling");
+      gpuScene->recordOcclusionCulling(commandBuffer, uint32_t(currentFrame), viewIndex, cullPipeline, clusterCullPipeline, depthPyramidPipeline, meshes, cameraBuffer.index,
+        view.rectangle, options.lodPixelError, window.depthAttachment.texture, uint32_t(sampleCount));
+      profiler->endGpuScope(commandBuffer, uint32_t(currentFrame), occlusionScope);
+      drawScene(firstInWindow ? occlusionRenderPass : nextViewOcclusionRenderPass);
+    }
+    return;
+  }
+
+  VkCommandBufferInheritanceInfo inheritanceInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+    .renderPass = firstPass,
+    .subpass = 0,
+    .framebuffer = framebuffer
+  };
+
+  auto slot = uint32_t(currentFrame * views.size() + viewIndex);
+  const auto& secondaryCommandBuffers = commandRecorder->record(slot, inheritanceInfo, drawItems.size(), [&](VkCommandBuffer secondaryCommandBuffer, size_t first, size_t count) {
+    recordDrawItems(secondaryCommandBuffer, viewProjection, cameraBuffer.index, uint32_t(currentFrame), viewIndex, first, count);
+  });
+
+  vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+  vkCmdExecuteCommands(commandBuffer, uint32_t(secondaryCommandBuffers.size()), secondaryCommandBuffers.data());
+  vkCmdEndRenderPass(commandBuffer);
+}
+
+void Viewer::setViewportAndScissor(VkCommandBuffer commandBuffer, const VkRect2D& rectangle) {
+  VkViewport viewport{
+    .x = float(rectangle.offset.x),
+    .y = float(rectangle.offset.y),
+    .width = float(rectangle.extent.width),
+    .height = float(rectangle.extent.height),
+    .minDepth = 0.0f,
+    .maxDepth = 1.0f
+  };
+
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &rectangle);
+}
+
+// Runs on the recording threads; only reads the scene and writes the
+// instances of its own range. Draw items are sorted by mesh, so the range
+// holds runs of objects sharing a mesh, and each run is drawn with one
+// instanced draw per level of detail. Every view has a list of instances of
+// its own, without the objects it does not show.
+void Viewer::recordDrawItems(VkCommandBuffer commandBuffer, const Mat4& viewProjection, uint32_t camera, uint32_t frame, uint32_t viewIndex, size_t first, size_t count) {
+  auto scope = profiler->scope("record draw items");
+  const auto& rectangle = views[viewIndex].rectangle;
+
+  // Dynamic state is not inherited from the primary command buffer.
+  setViewportAndScissor(commandBuffer, rectangle);
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+  descriptorHeap->bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+
+  auto instances = instanceBuffers->instanceData(frame);
+  auto firstInstance = uint32_t(viewIndex * drawItems.size() + first);
+  auto boundIndexBuffer = VkBuffer{VK_NULL_HANDLE};
+  std::array<std::vector<uint32_t>, MAX_LOD_LEVELS> levelItems;
+  for (auto i = first; i < first + count; ) {
+    auto meshIndex = drawItems[i].mesh;
+    const auto& mesh = meshes[meshIndex];
+    for (auto& items : levelItems) {
+      items.clear();
+    }
+    for (; i < first + count && drawItems[i].mesh == meshIndex; i++) {
+      if ((drawItems[i].viewMask & (1u << viewIndex)) == 0) {
+        continue;
+      }
+      levelItems[selectLod(mesh, drawItems[i].bounds, viewProjection, rectangle.extent, options.lodPixelError)].push_back(uint32_t(i));
     }
 
-    VkRect2D renderArea{
-      .offset = {0, 0},
-      .extent = swapExtent
+    auto offset = VkDeviceSize{0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &mesh.vertexBuffer, &offset);
+    descriptorHeap->pushConstants(commandBuffer, DrawPushConstants{textureStreamer->textureIndex(mesh.texture), camera, instanceBuffers->models(frame), instanceBuffers->instances(frame)});
+
+    for (auto level = uint32_t{0}; level < MAX_LOD_LEVELS; level++) {
+      const auto& items = levelItems[level];
+      if (items.empty()) {
+        continue;
+      }
+      std::copy(items.begin(), items.end(), instances + firstInstance);
+
+      auto indexBuffer = level == 0 ? mesh.indexBuffer : mesh.lodIndexBuffer;
+      if (indexBuffer != boundIndexBuffer) {
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        boundIndexBuffer = indexBuffer;
+      }
+
+      if (level == 0) {
+        vkCmdDrawIndexed(commandBuffer, mesh.indexCount, uint32_t(items.size()), 0, 0, firstInstance);
+      } else {
+        const auto& lod = mesh.lods[level - 1];
+        vkCmdDrawIndexed(commandBuffer, lod.indexCount, uint32_t(items.size()), lod.firstIndex, 0, firstInstance);
+      }
+      firstInstance += uint32_t(items.size());
+    }
+  }
+}
+
+void Viewer::cleanupSwapChains() {
+  destroyRetiredSwapChains(true);
+
+  for (auto& window : windows) {
+    for (auto framebuffer : window.framebuffers) {
+        vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+    }
+
+    for (auto imageView : window.imageViews) {
+      vkDestroyImageView(logicalDevice, imageView, nullptr);
+    }
+
+    destroyTransientAttachment(window.colorAttachment);
+    destroyTransientAttachment(window.depthAttachment);
+
+    vkDestroySwapchainKHR(logicalDevice, window.swapChain, nullptr);
+    for (auto semaphore : window.imageAvailableSemaphores) {
+      vkDestroySemaphore(logicalDevice, semaphore, nullptr);
+    }
+    for (auto semaphore : window.renderFinishedSemaphores) {
+      vkDestroySemaphore(logicalDevice, semaphore, nullptr);
+    }
+  }
+}
+
+void Viewer::createTransientAttachments(Window& window) {
+  auto extent = window.extent;
+  if (sampleCount != VK_SAMPLE_COUNT_1_BIT) {
+    window.colorAttachment = createTransientAttachment(surfaceFormat.format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, VK_IMAGE_ASPECT_COLOR_BIT, extent);
+  }
+  if (!occlusionCulling) {
+    window.depthAttachment = createTransientAttachment(depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, extent);
+    return;
+  }
+  window.depthAttachment = createTransientAttachment(depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, extent);
+  window.depthAttachment.texture = descriptorHeap->addTexture(window.depthAttachment.view, depthSampler);
+}
+
+Viewer::TransientAttachment Viewer::createTransientAttachment(VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect, VkExtent2D extent) {
+  TransientAttachment attachment;
+
+  VkImageCreateInfo imageCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = format,
+    .extent = {extent.width, extent.height, 1},
+    .mipLevels = 1,
+    .arrayLayers = 1,
+    .samples = sampleCount,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = usage | (occlusionCulling ? 0 : VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT),
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+
+  // Tilers back lazily allocated memory only if the attachment ever has to
+  // leave tile memory, which with DONT_CARE stores it never does. Desktop
+  // GPUs have no such memory type.
+  // Occlusion culling stores them, so they are ordinary images then.
+  if (!occlusionCulling) {
+    try {
+      memoryAllocator->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, attachment.image, attachment.allocation);
+    } catch (const std::runtime_error&) {
+    }
+  }
+  if (attachment.image == VK_NULL_HANDLE) {
+    memoryAllocator->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, attachment.image, attachment.allocation);
+  }
+
+  VkImageViewCreateInfo imageViewCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = attachment.image,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = format,
+    .subresourceRange = {aspect, 0, 1, 0, 1}
+  };
+
+  if (vkCreateImageView(logicalDevice, &imageViewCreateInfo, nullptr, &attachment.view) != VK_SUCCESS) {
+    throw std::runtime_error("Could not create image view");
+  }
+
+  return attachment;
+}
+
+void Viewer::destroyTransientAttachment(TransientAttachment& attachment) {
+  if (attachment.image == VK_NULL_HANDLE) {
+    return;
+  }
+  if (attachment.texture != NO_TEXTURE) {
+    descriptorHeap->removeTexture(attachment.texture);
+  }
+  vkDestroyImageView(logicalDevice, attachment.view, nullptr);
+  memoryAllocator->destroyImage(attachment.image, attachment.allocation);
+  attachment = {};
+}
+
+// In the order of the render pass attachments: color, depth, resolve.
+std::vector<VkImageView> Viewer::framebufferAttachments(const Window& window, VkImageView target) const {
+  if (sampleCount == VK_SAMPLE_COUNT_1_BIT) {
+    return {target, window.depthAttachment.view};
+  }
+  return {window.colorAttachment.view, window.depthAttachment.view, target};
+}
+
+// Headless, the views are laid out in the offscreen images as in one window.
+void Viewer::createOffscreenTargets() {
+  auto& window = windows.front();
+  window.extent = {options.width, options.height};
+  imageWriter = std::make_unique<ImageWriter>(MAX_QUEUED_IMAGES);
+  createTransientAttachments(window);
+  layoutViews(0);
+
+  offscreenTargets.resize(framesInFlight);
+  for (auto& target : offscreenTargets) {
+    VkImageCreateInfo imageCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = surfaceFormat.format,
+      .extent = {options.width, options.height, 1},
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    memoryAllocator->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target.image, target.imageAllocation);
+
+    VkImageViewCreateInfo imageViewCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = target.image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = surfaceFormat.format,
+      .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}
     };
 
-    VkClearValue clearValue = {0.0f, 0.0f, 0.0f, 1.0f};
+    if (vkCreateImageView(logicalDevice, &imageViewCreateInfo, nullptr, &target.imageView) != VK_SUCCESS) {
+      throw std::runtime_error("Could not create image view");
+    }
+
+    auto attachments = framebufferAttachments(window, target.imageView);
 
-    VkRenderPassBeginInfo renderPassBeginInfo{
-      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+    VkFramebufferCreateInfo frameBufferCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
       .renderPass = renderPass,
-      .framebuffer = swapChainFramebuffers[i],
-      .renderArea = renderArea,
-      .clearValueCount = 1,
-      .pClearValues = &clearValue
+      .attachmentCount = uint32_t(attachments.size()),
+      .pAttachments = attachments.data(),
+      .width = options.width,
+      .height = options.height,
+      .layers = 1
     };
 
-    vkCmdBeginRenderPass(commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-    vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-    vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
-    vkCmdEndRenderPass(commandBuffers[i]);
+    if (vkCreateFramebuffer(logicalDevice, &frameBufferCreateInfo, nullptr, &target.framebuffer) != VK_SUCCESS) {
+      throw std::runtime_error("Could not create frame buffer");
+    }
 
-    if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to record command buffer!");
+    // The CPU reads every byte of the readback buffer, so prefer cached memory
+    // over the write-combined kind.
+    auto readbackSize = VkDeviceSize{options.width} * options.height * 4;
+    try {
+      memoryAllocator->createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, target.readbackBuffer, target.readbackAllocation);
+    } catch (const std::runtime_error&) {
+      memoryAllocator->createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, target.readbackBuffer, target.readbackAllocation);
     }
   }
 }
 
-void Viewer::cleanupSwapChain() {
-  for (auto framebuffer : swapChainFramebuffers) {
-      vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
+void Viewer::destroyOffscreenTargets() {
+  imageWriter.reset();
+
+  for (auto& target : offscreenTargets) {
+    memoryAllocator->destroyBuffer(target.readbackBuffer, target.readbackAllocation);
+    vkDestroyFramebuffer(logicalDevice, target.framebuffer, nullptr);
+    vkDestroyImageView(logicalDevice, target.imageView, nullptr);
+    memoryAllocator->destroyImage(target.image, target.imageAllocation);
+  }
+  if (!offscreenTargets.empty()) {
+    destroyTransientAttachment(windows.front().colorAttachment);
+    destroyTransientAttachment(windows.front().depthAttachment);
   }
+  offscreenTargets.clear();
+}
 
-  vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-  vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
-  vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+void Viewer::renderOffscreen() {
+  waitForMeshes();
+
+  // Rendered images should not depend on how far streaming got either.
+  updateCamera();
+  do {
+    updateTextures();
+    stagingRing->waitIdle();
+    visibleUploadValue = stagingRing->completedValue();
+  } while (!textureStreamer->idle());
+
+  if (options.imageFormat != "none") {
+    std::filesystem::create_directories(options.outputDirectory);
+  }
+
+  auto renderStart = std::chrono::steady_clock::now();
+  for (auto i = uint32_t{0}; i < options.frameCount; i++) {
+    drawOffscreenFrame();
+  }
+
+  // Collect the frames still in flight, oldest first.
+  for (auto i = size_t{0}; i < framesInFlight; i++) {
+    auto frame = (currentFrame + i) % framesInFlight;
+    vkWaitForFences(logicalDevice, 1, &inFlightFences[frame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+    writeReadback(offscreenTargets[frame]);
+  }
+  imageWriter->finish();
+
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+  std::cout << "Rendered " << options.frameCount << " frames of " << options.width << "x" << options.height << " in " << elapsed * 1000.0
+    << " ms (" << options.frameCount / elapsed << " frames/s)" << std::endl;
+}
+
+// Each frame copies its image into the readback buffer of its target. That
+// buffer is only read once the target comes around again, by which time the
+// following frames are already queued, so the GPU never waits for the CPU.
+void Viewer::drawOffscreenFrame() {
+  auto& target = offscreenTargets[currentFrame];
+
+  {
+    auto scope = profiler->scope("wait for fence");
+    vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+  }
+  profiler->collect(uint32_t(currentFrame));
+  destroyRetiredPipelines(false);
+  destroyRetiredMeshBuffers(false);
+  descriptorHeap->collect(frameNumber);
+  updateTextures();
+  updateCamera();
+  {
+    auto scope = profiler->scope("readback");
+    writeReadback(target);
+  }
+
+  auto scope = profiler->scope("record and submit");
+  auto commandBuffer = commandBuffers[currentFrame];
+  vkResetFences(logicalDevice, 1, &inFlightFences[currentFrame]);
+  beginCommandBuffer(commandBuffer);
+  profiler->resetQueries(commandBuffer, uint32_t(currentFrame));
+  recordViews(commandBuffer, {target.framebuffer});
+
+  // The render pass leaves the image in TRANSFER_SRC_OPTIMAL.
+  VkMemoryBarrier renderedBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &renderedBarrier, 0, nullptr, 0, nullptr);
+
+  VkBufferImageCopy bufferImageCopy{
+    .bufferOffset = 0,
+    .bufferRowLength = 0,
+    .bufferImageHeight = 0,
+    .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+    .imageOffset = {0, 0, 0},
+    .imageExtent = {options.width, options.height, 1}
+  };
+  auto copyScope = profiler->beginGpuScope(commandBuffer, uint32_t(currentFrame), "readback copy");
+  vkCmdCopyImageToBuffer(commandBuffer, target.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.readbackBuffer, 1, &bufferImageCopy);
+  profiler->endGpuScope(commandBuffer, uint32_t(currentFrame), copyScope);
+
+  VkMemoryBarrier copiedBarrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_HOST_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &copiedBarrier, 0, nullptr, 0, nullptr);
+  endCommandBuffer(commandBuffer);
 
+  auto uploadSemaphore = stagingRing->semaphore();
+  auto uploadWaitStage = uploadWaitStages();
 
-  for (auto swapChainImageView : swapChainImageViews) {
-    vkDestroyImageView(logicalDevice, swapChainImageView, nullptr);
+  VkTimelineSemaphoreSubmitInfo timelineSemaphoreSubmitInfo{
+    .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+    .waitSemaphoreValueCount = 1,
+    .pWaitSemaphoreValues = &visibleUploadValue
+  };
+
+  VkSubmitInfo submitInfo{
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .pNext = &timelineSemaphoreSubmitInfo,
+    .waitSemaphoreCount = 1,
+    .pWaitSemaphores = &uploadSemaphore,
+    .pWaitDstStageMask = &uploadWaitStage,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &commandBuffer
+  };
+
+  if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit draw command buffer!");
+  }
+  profiler->submitted(uint32_t(currentFrame));
+  target.pendingFrame = int64_t(frameNumber);
+  if (frameNumber == 0) {
+    startupTimer.mark("first frame");
   }
 
-  vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
+  profiler->endFrame();
+  currentFrame = (currentFrame + 1) % framesInFlight;
+  frameNumber++;
+}
+
+// With --image-format none the frames are still copied back, just not written.
+void Viewer::writeReadback(OffscreenTarget& target) {
+  if (target.pendingFrame < 0 || options.imageFormat == "none") {
+    target.pendingFrame = -1;
+    return;
+  }
+
+  std::vector<uint8_t> rgba(size_t{options.width} * options.height * 4);
+  std::memcpy(rgba.data(), target.readbackAllocation.mapped, rgba.size());
+
+  std::stringstream path;
+  path << options.outputDirectory << "/frame_" << std::setw(5) << std::setfill('0') << target.pendingFrame << "." << options.imageFormat;
+  imageWriter->write(path.str(), options.width, options.height, std::move(rgba));
+  target.pendingFrame = -1;
 }
 
+// Everything a benchmark run is judged by, as JSON: the device, the startup
+// milestones, the frame timings and the memory high-water marks.
+void Viewer::writeStats(const std::string& path) const {
+  std::ofstream file{path, std::ios::trunc};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open " + path);
+  }
+
+  VkPhysicalDeviceProperties physicalDeviceProperties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+  auto memoryStats = memoryAllocator->stats();
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  file << "{\n  \"device\": ";
+  writeJsonString(file, physicalDeviceProperties.deviceName);
+  file << ",\n  \"startup_ms\": ";
+  startupTimer.writeJson(file);
+  file << ",\n  \"timings_ms\": ";
+  profiler->writeJson(file);
+  file << ",\n  \"memory_bytes\": {\"device_peak_reserved\": " << memoryStats.peakReservedBytes << ", \"device_peak_used\": " << memoryStats.peakUsedBytes
+    << ", \"host_peak_rss\": " << uint64_t(usage.ru_maxrss) * 1024 << "}\n}\n";
+}
+
+// Main thread only, like the callbacks it runs.
+void Viewer::pollInput() {
+  glfwPollEvents();
+  publishInput();
+}
+
+void Viewer::publishInput() {
+  inputSnapshots.back() = input;
+  inputSnapshots.publish();
+}
+
+void Viewer::requestClose() {
+  closeRequested = true;
+  glfwPostEmptyEvent();
+}
+
+void Viewer::renderLoop() {
+  try {
+    while (!closeRequested) {
+      drawFrame();
+    }
+  } catch (...) {
+    renderError = std::current_exception();
+  }
+  requestClose();
+}
+
+// Advances the camera by the input published since the last frame.
+void Viewer::updateCamera() {
+  auto latest = options.headless ? InputState{} : inputSnapshots.latest();
+  if (cameraPath) {
+    latest.cameras.fill(cameraPath->at(frameNumber));
+  }
+  auto now = std::chrono::steady_clock::now();
+  auto seconds = lastCameraUpdate.time_since_epoch().count() == 0 ? 0.0f : std::chrono::duration<float>(now - lastCameraUpdate).count();
+  lastCameraUpdate = now;
+
+  // Long stalls should not fling the camera across the scene.
+  for (auto i = size_t{0}; i < views.size(); i++) {
+    views[i].camera.update(latest.cameras[i], lastInput.cameras[i], std::min(seconds, MAX_CAMERA_STEP), sceneBounds);
+  }
+  lastInput = latest;
+}
+
+// Keys and the scroll wheel move the camera of the view last under the cursor.
 void Viewer::key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+  auto app = reinterpret_cast<Viewer*>(glfwGetWindowUserPointer(window));
+  auto& camera = app->input.cameras[app->cursors[app->windowIndex(window)].view];
+
+  // Held keys add their direction on press and take it away on release.
+  auto held = action == GLFW_PRESS ? 1.0f : action == GLFW_RELEASE ? -1.0f : 0.0f;
   switch (key) {
     case GLFW_KEY_ESCAPE:
       glfwSetWindowShouldClose(window, GLFW_TRUE);
       break;
+    case GLFW_KEY_W:
+      camera.move.z -= held;
+      break;
+    case GLFW_KEY_S:
+      camera.move.z += held;
+      break;
+    case GLFW_KEY_A:
+      camera.move.x -= held;
+      break;
+    case GLFW_KEY_D:
+      camera.move.x += held;
+      break;
+    case GLFW_KEY_Q:
+      camera.move.y -= held;
+      break;
+    case GLFW_KEY_E:
+      camera.move.y += held;
+      break;
+    case GLFW_KEY_LEFT_SHIFT:
+    case GLFW_KEY_RIGHT_SHIFT:
+      camera.fast = action != GLFW_RELEASE;
+      break;
+    case GLFW_KEY_TAB:
+      if (action == GLFW_PRESS) {
+        camera.modeToggles++;
+      }
+      break;
+    case GLFW_KEY_F:
+      if (action == GLFW_PRESS) {
+        camera.resets++;
+      }
+      break;
   }
 }
 
+void Viewer::cursorPositionCallback(GLFWwindow* window, double x, double y) {
+  auto app = reinterpret_cast<Viewer*>(glfwGetWindowUserPointer(window));
+  auto index = app->windowIndex(window);
+  auto& cursor = app->cursors[index];
+
+  auto dx = x - cursor.x;
+  auto dy = y - cursor.y;
+  cursor.x = x;
+  cursor.y = y;
+
+  // A drag keeps moving the view it started in.
+  auto dragging = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS || glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS
+    || glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS;
+  if (!dragging) {
+    auto width = int{0};
+    auto height = int{0};
+    glfwGetWindowSize(window, &width, &height);
+    auto column = width > 0 ? uint32_t(std::clamp(x / width, 0.0, 1.0) * app->options.views) : 0;
+    cursor.view = index * app->options.views + std::min(column, app->options.views - 1);
+  }
+  auto& camera = app->input.cameras[cursor.view];
+
+  if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+    camera.rotateX += dx;
+    camera.rotateY += dy;
+  } else if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS || glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS) {
+    camera.panX += dx;
+    camera.panY += dy;
+  }
+}
+
+void Viewer::scrollCallback(GLFWwindow* window, double x, double y) {
+  auto app = reinterpret_cast<Viewer*>(glfwGetWindowUserPointer(window));
+  app->input.cameras[app->cursors[app->windowIndex(window)].view].scroll += y;
+}
+
 void Viewer::framebufferResizeCallback(GLFWwindow* window, int width, int height) {
   auto app = reinterpret_cast<Viewer*>(glfwGetWindowUserPointer(window));
-  app->resizeHappended = true;
+  auto& windowInput = app->input.windows[app->windowIndex(window)];
+  windowInput.framebufferExtent = {uint32_t(width), uint32_t(height)};
+  windowInput.resizes++;
+}
+
+void Viewer::dropCallback(GLFWwindow* window, int count, const char** paths) {
+  auto app = reinterpret_cast<Viewer*>(glfwGetWindowUserPointer(window));
+  std::lock_guard<std::mutex> lock{app->droppedFilesMutex};
+  app->droppedFiles.insert(app->droppedFiles.end(), paths, paths + count);
+}
+
+void Viewer::processMeshEvents() {
+  if (!meshLoader) {
+    return;
+  }
+
+  // Never waits for earlier copies to make room in the staging ring: what
+  // does not fit is left for the next frame.
+  auto uploaded = VkDeviceSize{0};
+  MeshLoadEvent event;
+  while (uploaded < UPLOAD_BUDGET_PER_FRAME && stagingRing->freeBytes() >= MeshLoader::MAX_EVENT_BYTES && meshLoader->poll(event)) {
+    event.mesh += meshBase;
+    auto& mesh = meshes[event.mesh];
+
+    switch (event.type) {
+      case MeshLoadEvent::Type::Begin:
+        mesh.vertexCount = event.vertexCount;
+        mesh.indexCount = event.indexCount;
+        mesh.cached = event.cached;
+        // Cached meshes are compared by the loader before their Begin, so
+        // their duplicates never allocate or upload anything. Repeats of a
+        // file share whatever its first load uses.
+        mesh.contentHash = event.contentHash;
+        if (event.repeatOf != NO_MESH) {
+          const auto& firstLoad = meshes[event.repeatOf + meshBase];
+          mesh.duplicateOf = firstLoad.duplicateOf != NO_MESH ? firstLoad.duplicateOf : originalOf(event.repeatOf + meshBase);
+        } else {
+          mesh.duplicateOf = originalOf(event.duplicateOf);
+        }
+        if (mesh.duplicateOf == NO_MESH && mesh.vertexCount > 0 && mesh.indexCount > 0) {
+          memoryAllocator->createBuffer(mesh.vertexCount * sizeof(Vertex), VERTEX_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.vertexBuffer, mesh.vertexAllocation);
+          memoryAllocator->createBuffer(mesh.indexCount * sizeof(uint32_t), MESH_BUFFER_USAGE | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.indexBuffer, mesh.indexAllocation);
+          if (lodBuilder) {
+            lodBuilder->begin(event.mesh, mesh.path, mesh.vertexCount, mesh.indexCount);
+          }
+          if (meshletBuilder) {
+            meshletBuilder->begin(event.mesh, mesh.path, mesh.vertexCount, mesh.indexCount);
+          }
+        }
+        break;
+
+      case MeshLoadEvent::Type::Data:
+        if (mesh.vertexBuffer == VK_NULL_HANDLE) {
+          break;
+        }
+        stagingRing->upload(mesh.vertexBuffer, event.firstVertex * sizeof(Vertex), event.vertexData(), event.vertexDataCount() * sizeof(Vertex));
+        stagingRing->upload(mesh.indexBuffer, event.firstIndex * sizeof(uint32_t), event.indexData(), event.indexDataCount() * sizeof(uint32_t));
+        uploaded += event.vertexDataCount() * sizeof(Vertex) + event.indexDataCount() * sizeof(uint32_t);
+        if (lodBuilder) {
+          lodBuilder->addData(event.mesh, event.firstVertex, event.vertexData(), event.vertexDataCount(), event.firstIndex, event.indexData(), event.indexDataCount());
+        }
+        if (meshletBuilder) {
+          meshletBuilder->addData(event.mesh, event.firstVertex, event.vertexData(), event.vertexDataCount(), event.firstIndex, event.indexData(), event.indexDataCount());
+        }
+        break;
+
+      case MeshLoadEvent::Type::End: {
+        // Drawn once its copies have completed, see completeUploads().
+        mesh.bounds = event.bounds;
+        mesh.texturePath = event.texturePath;
+        mesh.contentHash = event.contentHash;
+        if (mesh.duplicateOf == NO_MESH) {
+          mesh.duplicateOf = originalOf(event.duplicateOf);
+        }
+        mesh.uploadValue = stagingRing->flush();
+        if (mesh.duplicateOf != NO_MESH) {
+          // Parsed duplicates are only recognized now; their copies are
+          // dropped once the uploads into them have completed.
+          mesh.uploading = true;
+          if (lodBuilder) {
+            lodBuilder->cancel(event.mesh);
+          }
+          if (meshletBuilder) {
+            meshletBuilder->cancel(event.mesh);
+          }
+        } else {
+          if (!mesh.texturePath.empty()) {
+            mesh.texture = textureStreamer->load(mesh.texturePath);
+          }
+          mesh.uploading = mesh.vertexBuffer != VK_NULL_HANDLE;
+          if (mesh.uploading) {
+            meshesByContent.emplace(mesh.contentHash, event.mesh);
+          }
+          if (lodBuilder && mesh.uploading) {
+            lodBuilder->end(event.mesh);
+          } else if (lodBuilder) {
+            lodBuilder->cancel(event.mesh);
+          }
+          if (meshletBuilder && mesh.uploading) {
+            meshletBuilder->end(event.mesh);
+          } else if (meshletBuilder) {
+            meshletBuilder->cancel(event.mesh);
+          }
+        }
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+        std::cout << "Loaded " << mesh.path << (mesh.cached ? " from cache" : "") << ": " << mesh.vertexCount << " vertices, " << mesh.indexCount / 3 << " triangles"
+          << (mesh.duplicateOf != NO_MESH ? ", same as " + meshes[mesh.duplicateOf].path : "") << " after " << elapsed << " ms (peak RSS " << usage.ru_maxrss / 1024 << " MiB)" << std::endl;
+        memoryAllocator->logStats(std::cout);
+        break;
+      }
+
+      case MeshLoadEvent::Type::Failed:
+        stagingRing->waitIdle();
+        destroyMesh(mesh);
+        if (lodBuilder) {
+          lodBuilder->cancel(event.mesh);
+        }
+        if (meshletBuilder) {
+          meshletBuilder->cancel(event.mesh);
+        }
+        std::cerr << "Could not load " << mesh.path << ": " << event.error << std::endl;
+        defragmentMeshMemory();
+        break;
+    }
+  }
+
+  if (meshLoader->finished()) {
+    stagingRing->flush();
+    meshLoader.reset();
+    startupTimer.mark("meshes loaded");
+  }
+}
+
+void Viewer::processLodResults() {
+  if (!lodBuilder) {
+    return;
+  }
+
+  // Like the mesh batches, left for a later frame while the ring is busy.
+  LodResult result;
+  while (stagingRing->freeBytes() >= stagingRing->size() / 2 && lodBuilder->poll(result)) {
+    auto& mesh = meshes[result.mesh];
+    if (!mesh.ready && !mesh.uploading) {
+      continue;
+    }
+
+    mesh.lodIndexCount = uint32_t(result.indices.size());
+    memoryAllocator->createBuffer(mesh.lodIndexCount * sizeof(uint32_t), MESH_BUFFER_USAGE | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.lodIndexBuffer, mesh.lodIndexAllocation);
+    stagingRing->upload(mesh.lodIndexBuffer, 0, result.indices.data(), result.indices.size() * sizeof(uint32_t));
+    mesh.uploadValue = stagingRing->flush();
+    mesh.pendingLods = std::move(result.levels);
+  }
+}
+
+// The meshlet buffer holds the meshlets, followed by their triangles as
+// indices for the indexed cluster draws or, for mesh shaders, by their vertex
+// lists and packed triangles. See MeshletLayout.
+void Viewer::processMeshletResults() {
+  if (!meshletBuilder) {
+    return;
+  }
+
+  MeshletResult result;
+  while (stagingRing->freeBytes() >= stagingRing->size() / 2 && meshletBuilder->poll(result)) {
+    auto& mesh = meshes[result.mesh];
+    if ((!mesh.ready && !mesh.uploading) || result.meshlets.empty()) {
+      continue;
+    }
+
+    MeshletLayout layout;
+    layout.meshletCount = uint32_t(result.meshlets.size());
+    layout.indexOffset = result.meshlets.size() * sizeof(Meshlet);
+    auto size = layout.indexOffset;
+    if (meshShaders) {
+      layout.vertexOffset = uint32_t(size / sizeof(uint32_t));
+      size += result.vertices.size() * sizeof(uint32_t);
+      layout.triangleOffset = uint32_t(size / sizeof(uint32_t));
+      size += result.triangles.size() * sizeof(uint32_t);
+    } else {
+      size += result.indices.size() * sizeof(uint32_t);
+    }
+
+    mesh.meshletBufferSize = size;
+    memoryAllocator->createBuffer(size, MESHLET_BUFFER_USAGE, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mesh.meshletBuffer, mesh.meshletAllocation);
+    stagingRing->upload(mesh.meshletBuffer, 0, result.meshlets.data(), result.meshlets.size() * sizeof(Meshlet));
+    if (meshShaders) {
+      stagingRing->upload(mesh.meshletBuffer, layout.vertexOffset * sizeof(uint32_t), result.vertices.data(), result.vertices.size() * sizeof(uint32_t));
+      stagingRing->upload(mesh.meshletBuffer, layout.triangleOffset * sizeof(uint32_t), result.triangles.data(), result.triangles.size() * sizeof(uint32_t));
+    } else {
+      stagingRing->upload(mesh.meshletBuffer, layout.indexOffset, result.indices.data(), result.indices.size() * sizeof(uint32_t));
+    }
+    mesh.uploadValue = stagingRing->flush();
+    mesh.pendingMeshletLayout = layout;
+  }
 }
 
-void Viewer::createShaderModuleFromBinary(const std::string& filename, VkShaderModule& shaderModule) {
-  std::ifstream shader{filename, std::ios::ate | std::ios::binary};
+// Every stage of a frame that reads uploaded data: the culling and meshlet
+// compute passes, the indirect commands they write from it, vertex fetch,
+// the vertex or task and mesh shaders pulling vertices and meshlets, and the
+// fragment shader sampling streamed texture levels.
+VkPipelineStageFlags Viewer::uploadWaitStages() const {
+  VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+    | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  if (meshShaders) {
+    stages |= VK_PIPELINE_STAGE_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_MESH_SHADER_BIT_EXT;
+  }
+  return stages;
+}
+
+// Uploads run on the transfer queue while frames keep rendering, so a mesh
+// (or its LODs) only becomes visible to the frames once its copies are done
+// and no frame ever waits for an upload in progress.
+void Viewer::completeUploads() {
+  visibleUploadValue = stagingRing->completedValue();
+
+  for (auto i = uint32_t{0}; i < meshes.size(); i++) {
+    auto& mesh = meshes[i];
+    if (mesh.uploadValue > visibleUploadValue) {
+      continue;
+    }
 
-  if (!shader.is_open()) {
-    throw std::runtime_error("failed to open shader file!");
+    // Duplicates are placed with the original's buffers once it is ready. It
+    // was announced first but may come later in this loop or still be
+    // uploading, in which case the duplicate waits for a later frame.
+    if (mesh.uploading && mesh.duplicateOf != NO_MESH) {
+      if (meshes[mesh.duplicateOf].ready) {
+        destroyMesh(mesh);
+        addDrawItems(i);
+        defragmentMeshMemory();
+      }
+      continue;
+    }
+
+    if (mesh.uploading) {
+      mesh.uploading = false;
+      mesh.ready = true;
+      addDrawItems(i);
+    }
+
+    if (!mesh.pendingLods.empty()) {
+      mesh.lods = std::move(mesh.pendingLods);
+      mesh.pendingLods.clear();
+
+      std::cout << "LODs of " << mesh.path << ":";
+      for (const auto& lod : mesh.lods) {
+        std::cout << " " << lod.indexCount / 3;
+      }
+      std::cout << " triangles" << std::endl;
+    }
+
+    // The GPU scene lays out the cluster draws along with the objects.
+    if (mesh.pendingMeshletLayout.meshletCount > 0) {
+      mesh.meshletLayout = mesh.pendingMeshletLayout;
+      mesh.pendingMeshletLayout = {};
+      mesh.meshletBufferIndex = descriptorHeap->addBuffer(mesh.meshletBuffer);
+      if (meshShaders) {
+        mesh.vertexBufferIndex = descriptorHeap->addBuffer(mesh.vertexBuffer);
+      }
+      sceneVersion++;
+      std::cout << "Meshlets of " << mesh.path << ": " << mesh.meshletLayout.meshletCount << std::endl;
+    }
   }
 
-  auto fileSize = size_t{shader.tellg()};
-  std::vector<char> buffer(fileSize);
+  updateSceneCore();
+}
 
-  shader.seekg(0);
-  shader.read(buffer.data(), fileSize);
-  shader.close();
+// Every visible object asks for the levels its size on screen needs.
+// Vulkan has no sampler feedback, so this stands in for the levels the
+// fragment shader actually sampled.
+// Every texture gets the finest level any view needs.
+void Viewer::updateTextures() {
+  for (auto i = uint32_t{0}; i < views.size(); i++) {
+    const auto& view = views[i];
+    auto viewProjection = sceneTransform(view);
+    for (const auto& drawItem : drawItems) {
+      const auto& mesh = meshes[drawItem.mesh];
+      if (mesh.texture != 0 && mesh.ready && (drawItem.viewMask & (1u << i)) != 0) {
+        textureStreamer->request(mesh.texture, projectedPixels(drawItem.bounds, viewProjection, view.rectangle.extent));
+      }
+    }
+  }
+  textureStreamer->update(frameNumber, visibleUploadValue);
+}
+
+// With --repeat, every file is loaded as several parts, each with grid cells
+// of its own. With --view-files, the files take turns over the views, so
+// revisions of a model given one after another are compared side by side.
+void Viewer::loadMeshes(const std::vector<std::string>& paths) {
+  std::vector<std::string> parts;
+  for (const auto& path : paths) {
+    parts.insert(parts.end(), options.repeat, path);
+  }
+
+  meshBase = uint32_t(meshes.size());
+  meshes.resize(meshes.size() + parts.size());
+  for (auto i = size_t{0}; i < parts.size(); i++) {
+    meshes[meshBase + i].path = parts[i];
+    meshes[meshBase + i].firstCell = uint32_t(i % options.repeat) * options.copies;
+    if (options.viewFiles) {
+      meshes[meshBase + i].viewMask = 1u << (i / options.repeat % views.size());
+    }
+  }
+  loadStart = std::chrono::steady_clock::now();
+  std::unordered_map<uint64_t, OriginalMesh> originals;
+  for (const auto& [contentHash, mesh] : meshesByContent) {
+    originals.emplace(contentHash, OriginalMesh{mesh, meshes[mesh].path});
+  }
+  meshLoader = std::make_unique<MeshLoader>(*jobSystem, parts, options.meshCache ? options.cacheDirectory : "", options.dedup, meshBase, std::move(originals));
+}
+
+void Viewer::destroyMesh(Mesh& mesh) {
+  if (mesh.meshletLayout.meshletCount > 0) {
+    descriptorHeap->removeBuffer(mesh.meshletBufferIndex);
+    if (meshShaders) {
+      descriptorHeap->removeBuffer(mesh.vertexBufferIndex);
+    }
+  }
+  memoryAllocator->destroyBuffer(mesh.vertexBuffer, mesh.vertexAllocation);
+  memoryAllocator->destroyBuffer(mesh.indexBuffer, mesh.indexAllocation);
+  memoryAllocator->destroyBuffer(mesh.lodIndexBuffer, mesh.lodIndexAllocation);
+  memoryAllocator->destroyBuffer(mesh.meshletBuffer, mesh.meshletAllocation);
+  mesh.lods.clear();
+  mesh.pendingLods.clear();
+  mesh.meshletLayout = {};
+  mesh.pendingMeshletLayout = {};
+  mesh.ready = false;
+  mesh.uploading = false;
+}
+
+// Called whenever mesh memory has been freed. Only buffers whose uploads
+// have completed are moved. The copies are submitted ahead of the next frame
+// on the graphics queue, which orders them after the frames still reading
+// the old buffers; those are destroyed once these frames have finished.
+void Viewer::defragmentMeshMemory() {
+  if (memoryAllocator->stats().fragmentation <= MAX_FRAGMENTATION) {
+    return;
+  }
 
-  VkShaderModuleCreateInfo shaderModuleCreateInfo{
-    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-    .codeSize = buffer.size(),
-    .pCode = reinterpret_cast<const uint32_t*>(buffer.data())
+  std::vector<DefragmentableBuffer> buffers;
+  for (auto& mesh : meshes) {
+    if (!mesh.ready || mesh.uploadValue > visibleUploadValue) {
+      continue;
+    }
+    buffers.push_back({&mesh.vertexBuffer, &mesh.vertexAllocation, mesh.vertexCount * sizeof(Vertex), VERTEX_BUFFER_USAGE});
+    buffers.push_back({&mesh.indexBuffer, &mesh.indexAllocation, mesh.indexCount * sizeof(uint32_t), MESH_BUFFER_USAGE | VK_BUFFER_USAGE_INDEX_BUFFER_BIT});
+    if (mesh.lodIndexBuffer != VK_NULL_HANDLE) {
+      buffers.push_back({&mesh.lodIndexBuffer, &mesh.lodIndexAllocation, mesh.lodIndexCount * sizeof(uint32_t), MESH_BUFFER_USAGE | VK_BUFFER_USAGE_INDEX_BUFFER_BIT});
+    }
+    if (mesh.meshletBuffer != VK_NULL_HANDLE) {
+      buffers.push_back({&mesh.meshletBuffer, &mesh.meshletAllocation, mesh.meshletBufferSize, MESHLET_BUFFER_USAGE});
+    }
+  }
+  if (buffers.empty()) {
+    return;
+  }
+
+  VkCommandBufferAllocateInfo commandBufferAllocateInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = commandPool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1
+  };
+
+  VkCommandBuffer commandBuffer;
+  if (vkAllocateCommandBuffers(logicalDevice, &commandBufferAllocateInfo, &commandBuffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate command buffers!");
+  }
+
+  VkCommandBufferBeginInfo commandBufferBeginInfo{
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
   };
 
-  if (vkCreateShaderModule(logicalDevice, &shaderModuleCreateInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-    throw std::runtime_error("Could not create shader module");
+  std::vector<VkBuffer> meshletBuffers(meshes.size()), vertexBuffers(meshes.size());
+  for (auto i = size_t{0}; i < meshes.size(); i++) {
+    meshletBuffers[i] = meshes[i].meshletBuffer;
+    vertexBuffers[i] = meshes[i].vertexBuffer;
+  }
+
+  vkBeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
+  auto movedBuffers = memoryAllocator->defragment(commandBuffer, buffers);
+  vkEndCommandBuffer(commandBuffer);
+  if (movedBuffers.empty()) {
+    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+    return;
+  }
+
+  VkSubmitInfo submitInfo{
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &commandBuffer
+  };
+
+  if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit defragmentation command buffer!");
+  }
+  retiredMeshBuffers.push_back({commandBuffer, std::move(movedBuffers), frameNumber});
+  memoryAllocator->logStats(std::cout);
+
+  // Frames in flight still read the old buffers through their heap slots, so
+  // moved buffers get new slots; the old ones are reused once those frames
+  // have finished.
+  for (auto i = size_t{0}; i < meshes.size(); i++) {
+    auto& mesh = meshes[i];
+    if (mesh.meshletLayout.meshletCount == 0) {
+      continue;
+    }
+    if (mesh.meshletBuffer != meshletBuffers[i]) {
+      descriptorHeap->removeBuffer(mesh.meshletBufferIndex);
+      mesh.meshletBufferIndex = descriptorHeap->addBuffer(mesh.meshletBuffer);
+    }
+    if (meshShaders && mesh.vertexBuffer != vertexBuffers[i]) {
+      descriptorHeap->removeBuffer(mesh.vertexBufferIndex);
+      mesh.vertexBufferIndex = descriptorHeap->addBuffer(mesh.vertexBuffer);
+    }
+  }
+}
+
+void Viewer::destroyRetiredMeshBuffers(bool all) {
+  while (!retiredMeshBuffers.empty() && (all || retiredMeshBuffers.front().retiredAtFrame + framesInFlight <= frameNumber)) {
+    auto& retired = retiredMeshBuffers.front();
+    vkFreeCommandBuffers(logicalDevice, commandPool, 1, &retired.commandBuffer);
+    memoryAllocator->release(retired.buffers);
+    retiredMeshBuffers.pop_front();
+  }
+}
+
+// Places the copies of a part in its cells of a grid, drawn with the
+// original mesh if the part is a duplicate. Inserted after the mesh's other
+// objects, keeping the draw items sorted by mesh. Their world transforms and
+// bounds are filled in by updateSceneCore().
+void Viewer::addDrawItems(uint32_t part) {
+  auto mesh = meshes[part].duplicateOf != NO_MESH ? meshes[part].duplicateOf : part;
+  const auto& bounds = meshes[mesh].bounds;
+  auto columns = uint32_t(std::ceil(std::sqrt(float(options.copies * options.repeat))));
+  auto size = bounds.extent() * 2.5f;
+
+  std::vector<DrawItem> copies;
+  for (auto i = uint32_t{0}; i < options.copies; i++) {
+    auto cell = meshes[part].firstCell + i;
+    auto offset = Vec3{float(cell % columns) * size.x, float(cell / columns) * size.y, 0.0f};
+    auto node = sceneCore.addNode(SceneCore::NO_PARENT, translation(offset), bounds);
+    copies.push_back({mesh, Mat4{}, bounds, meshes[part].viewMask, node});
+  }
+  sceneCoreChanged = true;
+  auto position = std::upper_bound(drawItems.begin(), drawItems.end(), mesh, [](uint32_t mesh, const DrawItem& drawItem) { return mesh < drawItem.mesh; });
+  drawItems.insert(position, copies.begin(), copies.end());
+  sceneVersion++;
+}
+
+// Once per batch of added objects rather than per part, as update() runs over
+// the whole scene.
+void Viewer::updateSceneCore() {
+  if (!sceneCoreChanged) {
+    return;
+  }
+
+  sceneCore.update();
+  for (auto& drawItem : drawItems) {
+    drawItem.model = sceneCore.world(drawItem.node);
+    drawItem.bounds = sceneCore.worldBounds(drawItem.node);
+  }
+  sceneBounds = sceneCore.bounds();
+  sceneCoreChanged = false;
+}
+
+// The original the loader announced, or NO_MESH. The loader has compared
+// the bytes; this only checks that the original got buffers, which empty or
+// failed meshes do not.
+uint32_t Viewer::originalOf(uint32_t original) const {
+  return original != NO_MESH && meshes[original].vertexBuffer != VK_NULL_HANDLE ? original : NO_MESH;
+}
+
+Mat4 Viewer::sceneTransform(const View& view) const {
+  if (!sceneBounds.valid()) {
+    return Mat4{};
   }
+
+  auto aspect = float(view.rectangle.extent.width) / float(std::max(view.rectangle.extent.height, 1u));
+  return view.camera.projection(aspect) * view.camera.view();
 }
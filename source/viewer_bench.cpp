@@ -0,0 +1,656 @@
+#include "json.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Renders a generated scene headless along scripted camera paths, each in a
+// fresh viewer process, and prints the startup time, frame time percentiles
+// and memory high-water marks of every path as JSON. Given a baseline (an
+// earlier output), fails if a metric got worse by more than its threshold.
+//
+// The scene has N objects, each a distinct displaced sphere of M / N
+// triangles with its translation baked in, so none are deduplicated, and K
+// BC1 textures shared round robin. With --shapes S, object i is instead a
+// copy of the file of object i % S, the way an assembly repeats its parts;
+// copies coincide in space, and compared with a run passing --no-dedup to
+// the viewer they show what deduplication saves in draws and memory. A
+// warm-up run fills the shader, pipeline and mesh caches first, so every
+// measured run starts warm.
+//
+// Given mesh files instead, measures loading them: every run renders a
+// single frame, once parsing the files ("parse") and once from the mesh
+// cache the warm-up run wrote ("cached"), and the time until every mesh is
+// uploaded is reported along with the memory high-water marks.
+namespace {
+
+struct Options {
+  std::string viewer{VIEWER_EXECUTABLE};
+  std::string workDirectory;
+  std::string output;
+  std::string baseline;
+  std::string icd;
+  uint32_t objects{1000};
+  uint32_t shapes{0};
+  uint32_t triangles{1000000};
+  uint32_t textures{16};
+  uint32_t frames{200};
+  uint32_t runs{3};
+  std::string size{"1024x1024"};
+  double timeThreshold{10.0};
+  double memoryThreshold{5.0};
+  std::vector<std::string> viewerArguments;
+  std::vector<std::string> meshes;
+};
+
+constexpr const char* USAGE{"Usage: viewer_bench [--objects N] [--shapes S] [--triangles M] [--textures K] [--frames N] [--runs N] [--size WxH]"
+  " [--work-dir DIR] [--output FILE] [--baseline FILE] [--time-threshold PERCENT] [--memory-threshold PERCENT]"
+  " [--icd FILE] [--viewer PATH] [mesh files...] [-- viewer options...]"};
+
+Options parseOptions(int argc, char** argv) {
+  Options options;
+  options.workDirectory = (std::filesystem::temp_directory_path() / "viewer_bench").string();
+  for (auto i = 1; i < argc; i++) {
+    auto arg = std::string{argv[i]};
+    auto value = [&] {
+      if (i + 1 >= argc) {
+        throw std::runtime_error("Missing value for " + arg);
+      }
+      return std::string{argv[++i]};
+    };
+    if (arg == "--objects") {
+      options.objects = std::max(uint32_t(std::stoul(value())), 1u);
+    } else if (arg == "--shapes") {
+      options.shapes = uint32_t(std::stoul(value()));
+    } else if (arg == "--triangles") {
+      options.triangles = uint32_t(std::stoul(value()));
+    } else if (arg == "--textures") {
+      options.textures = uint32_t(std::stoul(value()));
+    } else if (arg == "--frames") {
+      options.frames = std::max(uint32_t(std::stoul(value())), 1u);
+    } else if (arg == "--runs") {
+      options.runs = std::max(uint32_t(std::stoul(value())), 1u);
+    } else if (arg == "--size") {
+      options.size = value();
+    } else if (arg == "--work-dir") {
+      options.workDirectory = value();
+    } else if (arg == "--output") {
+      options.output = value();
+    } else if (arg == "--baseline") {
+      options.baseline = value();
+    } else if (arg == "--time-threshold") {
+      options.timeThreshold = std::stod(value());
+    } else if (arg == "--memory-threshold") {
+      options.memoryThreshold = std::stod(value());
+    } else if (arg == "--icd") {
+      options.icd = value();
+    } else if (arg == "--viewer") {
+      options.viewer = value();
+    } else if (arg == "--") {
+      options.viewerArguments.assign(argv + i + 1, argv + argc);
+      break;
+    } else if (arg.rfind("--", 0) == 0) {
+      throw std::runtime_error(USAGE);
+    } else {
+      options.meshes.push_back(arg);
+    }
+  }
+  return options;
+}
+
+// Numbers and strings of a JSON document by their dotted path, e.g.
+// "timings_ms.frame.p99". Enough for the viewer's stats and our own output.
+struct FlatJson {
+  std::map<std::string, double> numbers;
+  std::map<std::string, std::string> strings;
+};
+
+class JsonParser {
+public:
+  explicit JsonParser(const std::string& text) : text{text} {}
+
+  FlatJson parse() {
+    FlatJson json;
+    value("", json);
+    return json;
+  }
+
+private:
+  const std::string& text;
+  size_t position{0};
+
+  char peek() {
+    while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+      position++;
+    }
+    if (position >= text.size()) {
+      throw std::runtime_error("Unexpected end of JSON");
+    }
+    return text[position];
+  }
+
+  void expect(char c) {
+    if (peek() != c) {
+      throw std::runtime_error(std::string{"Expected '"} + c + "' in JSON at offset " + std::to_string(position));
+    }
+    position++;
+  }
+
+  std::string string() {
+    expect('"');
+    std::string result;
+    while (position < text.size() && text[position] != '"') {
+      if (text[position] == '\\' && position + 1 < text.size()) {
+        position++;
+        // Only control characters are written as \u00XX, see writeJsonString().
+        if (text[position] == 'u' && position + 4 < text.size()) {
+          result += char(std::stoi(text.substr(position + 1, 4), nullptr, 16));
+          position += 5;
+          continue;
+        }
+      }
+      result += text[position++];
+    }
+    expect('"');
+    return result;
+  }
+
+  void value(const std::string& path, FlatJson& json) {
+    auto prefix = path.empty() ? path : path + ".";
+    auto c = peek();
+    if (c == '{') {
+      position++;
+      if (peek() == '}') {
+        position++;
+        return;
+      }
+      while (true) {
+        auto name = string();
+        expect(':');
+        value(prefix + name, json);
+        if (peek() != ',') {
+          break;
+        }
+        position++;
+      }
+      expect('}');
+    } else if (c == '[') {
+      position++;
+      if (peek() == ']') {
+        position++;
+        return;
+      }
+      for (auto index = 0; ; index++) {
+        value(prefix + std::to_string(index), json);
+        if (peek() != ',') {
+          break;
+        }
+        position++;
+      }
+      expect(']');
+    } else if (c == '"') {
+      json.strings[path] = string();
+    } else if (text.compare(position, 4, "true") == 0 || text.compare(position, 4, "null") == 0) {
+      position += 4;
+    } else if (text.compare(position, 5, "false") == 0) {
+      position += 5;
+    } else {
+      char* end = nullptr;
+      json.numbers[path] = std::strtod(text.c_str() + position, &end);
+      if (end == text.c_str() + position) {
+        throw std::runtime_error("Invalid JSON value at offset " + std::to_string(position));
+      }
+      position = size_t(end - text.c_str());
+    }
+  }
+};
+
+FlatJson readJson(const std::string& path) {
+  std::ifstream file{path};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open " + path);
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+  return JsonParser{text.str()}.parse();
+}
+
+struct Color {
+  float r, g, b;
+};
+
+uint16_t rgb565(Color color) {
+  auto channel = [](float value, int bits) { return uint16_t(std::clamp(value, 0.0f, 1.0f) * float((1 << bits) - 1) + 0.5f); };
+  return uint16_t(channel(color.r, 5) << 11 | channel(color.g, 6) << 5 | channel(color.b, 5));
+}
+
+// A checkerboard of two colors in solid BC1 blocks, 8 blocks per square on
+// the top level, with the full mip chain.
+void writeTexture(const std::filesystem::path& path, uint32_t index, uint32_t textureSize) {
+  auto hue = float(index) * 2.39996f;
+  Color light{0.6f + 0.4f * std::cos(hue), 0.6f + 0.4f * std::cos(hue + 2.094f), 0.6f + 0.4f * std::cos(hue + 4.189f)};
+  Color dark{light.r * 0.3f, light.g * 0.3f, light.b * 0.3f};
+  uint16_t colors[2]{rgb565(light), rgb565(dark)};
+
+  auto levelCount = uint32_t(std::log2(textureSize)) + 1;
+  std::vector<std::vector<uint8_t>> levels;
+  for (auto level = uint32_t{0}; level < levelCount; level++) {
+    auto blocks = std::max((textureSize >> level) / 4, 1u);
+    auto square = std::max(8u >> level, 1u);
+    std::vector<uint8_t> data(size_t{blocks} * blocks * 8);
+    for (auto y = uint32_t{0}; y < blocks; y++) {
+      for (auto x = uint32_t{0}; x < blocks; x++) {
+        // Both endpoints the same color and every index 0: a solid block.
+        auto color = colors[(x / square + y / square) % 2];
+        auto block = &data[(size_t{y} * blocks + x) * 8];
+        std::memcpy(block, &color, 2);
+        std::memcpy(block + 2, &color, 2);
+      }
+    }
+    levels.push_back(std::move(data));
+  }
+
+  std::ofstream file{path, std::ios::binary | std::ios::trunc};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not write " + path.string());
+  }
+  const uint8_t identifier[12]{0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+  file.write(reinterpret_cast<const char*>(identifier), sizeof(identifier));
+  uint32_t header[9]{VK_FORMAT_BC1_RGB_UNORM_BLOCK, 1, textureSize, textureSize, 0, 0, 1, levelCount, 0};
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+  uint32_t dataFormatDescriptor[4]{0, 0, 0, 0};
+  file.write(reinterpret_cast<const char*>(dataFormatDescriptor), sizeof(dataFormatDescriptor));
+  uint64_t supercompression[2]{0, 0};
+  file.write(reinterpret_cast<const char*>(supercompression), sizeof(supercompression));
+
+  auto offset = uint64_t{80 + 24 * levelCount};
+  for (const auto& level : levels) {
+    uint64_t index[3]{offset, level.size(), level.size()};
+    file.write(reinterpret_cast<const char*>(index), sizeof(index));
+    offset += level.size();
+  }
+  for (const auto& level : levels) {
+    file.write(reinterpret_cast<const char*>(level.data()), std::streamsize(level.size()));
+  }
+}
+
+// A sphere with `rings` latitude bands and `segments` longitude bands,
+// displaced by a few random waves, scaled and moved to `center`. Returns the
+// number of triangles written.
+uint64_t writeObject(const std::filesystem::path& path, const std::string& texture, uint32_t triangles, float center[3], std::mt19937& random) {
+  auto rings = std::max(uint32_t(std::lround(std::sqrt(triangles / 4.0))), 2u);
+  auto segments = std::max(uint32_t(std::lround(triangles / (2.0 * (rings - 1)))), 3u);
+
+  std::uniform_real_distribution<float> unit{0.0f, 1.0f};
+  auto waveA = 2.0f + std::floor(unit(random) * 6.0f);
+  auto waveB = 2.0f + std::floor(unit(random) * 6.0f);
+  auto phase = unit(random) * 6.2831853f;
+  auto amplitude = 0.05f + unit(random) * 0.15f;
+  auto scale = 0.5f + unit(random);
+
+  struct PlyVertex {
+    float position[3];
+    float normal[3];
+    float texCoord[2];
+  };
+  std::vector<PlyVertex> vertices;
+  vertices.reserve(size_t{rings + 1} * (segments + 1));
+  for (auto ring = uint32_t{0}; ring <= rings; ring++) {
+    auto theta = 3.14159265f * float(ring) / float(rings);
+    for (auto segment = uint32_t{0}; segment <= segments; segment++) {
+      auto phi = 6.2831853f * float(segment) / float(segments);
+      float direction[3]{std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+      auto radius = scale * (1.0f + amplitude * std::sin(waveA * theta + phase) * std::cos(waveB * phi));
+      PlyVertex vertex{};
+      for (auto k = 0; k < 3; k++) {
+        vertex.position[k] = center[k] + direction[k] * radius;
+        vertex.normal[k] = direction[k];
+      }
+      vertex.texCoord[0] = float(segment) / float(segments);
+      vertex.texCoord[1] = 1.0f - float(ring) / float(rings);
+      vertices.push_back(vertex);
+    }
+  }
+
+  // The first and last band are fans around the poles.
+  std::vector<uint32_t> indices;
+  auto vertexIndex = [segments](uint32_t ring, uint32_t segment) { return ring * (segments + 1) + segment; };
+  for (auto ring = uint32_t{0}; ring < rings; ring++) {
+    for (auto segment = uint32_t{0}; segment < segments; segment++) {
+      auto a = vertexIndex(ring, segment);
+      auto b = vertexIndex(ring, segment + 1);
+      auto c = vertexIndex(ring + 1, segment);
+      auto d = vertexIndex(ring + 1, segment + 1);
+      if (ring > 0) {
+        indices.insert(indices.end(), {a, b, d});
+      }
+      if (ring + 1 < rings) {
+        indices.insert(indices.end(), {a, d, c});
+      }
+    }
+  }
+
+  std::ofstream file{path, std::ios::binary | std::ios::trunc};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not write " + path.string());
+  }
+  file << "ply\nformat binary_little_endian 1.0\n";
+  if (!texture.empty()) {
+    file << "comment TextureFile " << texture << "\n";
+  }
+  file << "element vertex " << vertices.size() << "\n"
+       << "property float x\nproperty float y\nproperty float z\n"
+       << "property float nx\nproperty float ny\nproperty float nz\n"
+       << "property float u\nproperty float v\n"
+       << "element face " << indices.size() / 3 << "\n"
+       << "property list uchar int vertex_indices\n"
+       << "end_header\n";
+  file.write(reinterpret_cast<const char*>(vertices.data()), std::streamsize(vertices.size() * sizeof(PlyVertex)));
+  for (auto i = size_t{0}; i < indices.size(); i += 3) {
+    uint8_t corners = 3;
+    file.write(reinterpret_cast<const char*>(&corners), 1);
+    file.write(reinterpret_cast<const char*>(&indices[i]), 3 * sizeof(uint32_t));
+  }
+  return indices.size() / 3;
+}
+
+struct Scene {
+  std::vector<std::string> files;
+  uint64_t triangles{0};
+};
+
+// Objects fill a cube of grid cells, so most of them hide others from most
+// directions.
+Scene generateScene(const Options& options, const std::filesystem::path& directory) {
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+
+  for (auto i = uint32_t{0}; i < options.textures; i++) {
+    writeTexture(directory / ("texture_" + std::to_string(i) + ".ktx2"), i, 256);
+  }
+
+  Scene scene;
+  std::mt19937 random{1};
+  auto columns = uint32_t(std::ceil(std::cbrt(double(options.objects))));
+  auto trianglesPerObject = std::max(options.triangles / options.objects, 8u);
+  std::vector<uint64_t> shapeTriangles;
+  for (auto i = uint32_t{0}; i < options.objects; i++) {
+    float center[3]{float(i % columns) * 3.0f, float(i / columns % columns) * 3.0f, float(i / (columns * columns)) * 3.0f};
+    auto texture = options.textures > 0 ? "texture_" + std::to_string(i % options.textures) + ".ktx2" : std::string{};
+    auto path = directory / ("object_" + std::to_string(i) + ".ply");
+    if (options.shapes > 0 && i >= options.shapes) {
+      std::filesystem::copy_file(scene.files[i % options.shapes], path);
+      scene.triangles += shapeTriangles[i % options.shapes];
+    } else {
+      shapeTriangles.push_back(writeObject(path, texture, trianglesPerObject, center, random));
+      scene.triangles += shapeTriangles.back();
+    }
+    scene.files.push_back(path.string());
+  }
+  return scene;
+}
+
+// Keyframes of CameraPath: frame, rotateX, rotateY, panX, panY, scroll. The
+// camera starts out framing the whole scene.
+struct CameraPathScript {
+  const char* name;
+  const char* keyframes;
+  bool meshCache{true};
+};
+
+const CameraPathScript CAMERA_PATHS[]{
+  {"static", "0 0 0 0 0 0\n"},
+  // One turn around the scene (0.005 radians per pixel), tilting down a little.
+  {"orbit", "0 0 0 0 0 0\n1.0 1257 120 0 0 0\n"},
+  // Into the middle of the scene and back out, where occlusion culls the most.
+  {"zoom", "0 0 0 0 0 0\n0.5 0 0 0 0 20\n1.0 0 0 0 0 0\n"},
+};
+
+// Keyframes are given at fractions of the run and scaled to `frames`, so
+// keyframes that would land on the same frame are dropped.
+void writeCameraPath(const std::filesystem::path& path, const char* keyframes, uint32_t frames) {
+  std::ofstream file{path, std::ios::trunc};
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not write " + path.string());
+  }
+  std::istringstream lines{keyframes};
+  std::string line;
+  auto previousFrame = uint64_t{0};
+  auto first = true;
+  while (std::getline(lines, line)) {
+    std::istringstream values{line};
+    auto fraction = 0.0;
+    std::string input;
+    values >> fraction;
+    std::getline(values, input);
+    auto frame = uint64_t(fraction * (frames - 1));
+    if (first || frame > previousFrame) {
+      file << frame << input << "\n";
+    }
+    previousFrame = frame;
+    first = false;
+  }
+}
+
+// Runs the viewer with its output going to `log`, throwing if it fails.
+void runViewer(const Options& options, const std::vector<std::string>& arguments, const std::filesystem::path& log) {
+  std::vector<char*> argv{const_cast<char*>(options.viewer.c_str())};
+  for (const auto& argument : arguments) {
+    argv.push_back(const_cast<char*>(argument.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  auto pid = fork();
+  if (pid < 0) {
+    throw std::runtime_error("Could not start " + options.viewer);
+  }
+  if (pid == 0) {
+    auto output = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output >= 0) {
+      dup2(output, STDOUT_FILENO);
+      dup2(output, STDERR_FILENO);
+      close(output);
+    }
+    if (!options.icd.empty()) {
+      // Older loaders only know the first, newer ones prefer the second.
+      setenv("VK_ICD_FILENAMES", options.icd.c_str(), 1);
+      setenv("VK_DRIVER_FILES", options.icd.c_str(), 1);
+    }
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+
+  auto status = 0;
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    throw std::runtime_error(options.viewer + " failed, see " + log.string());
+  }
+}
+
+// The metrics of a path and where they are in the viewer's --stats-json output.
+const std::pair<const char*, const char*> METRICS[]{
+  {"startup_ms", "startup_ms.first frame"},
+  {"load_ms", "startup_ms.meshes loaded"},
+  {"frame_p50_ms", "timings_ms.frame.p50"},
+  {"frame_p90_ms", "timings_ms.frame.p90"},
+  {"frame_p99_ms", "timings_ms.frame.p99"},
+  {"gpu_render_pass_p50_ms", "timings_ms.gpu.render pass.p50"},
+  {"meshes_drawn", "timings_ms.counts.meshes drawn.p50"},
+  {"device_peak_reserved_bytes", "memory_bytes.device_peak_reserved"},
+  {"device_peak_used_bytes", "memory_bytes.device_peak_used"},
+  {"host_peak_rss_bytes", "memory_bytes.host_peak_rss"},
+};
+
+bool isMemoryMetric(const std::string& name) {
+  return name.size() > 6 && name.compare(name.size() - 6, 6, "_bytes") == 0;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+using Results = std::map<std::string, std::map<std::string, double>>;
+
+void writeResults(std::ostream& stream, const Options& options, const Scene& scene, const std::string& device, const Results& results) {
+  stream << "{\n  \"device\": ";
+  writeJsonString(stream, device);
+  stream << ",\n  \"scene\": {";
+  if (options.meshes.empty()) {
+    stream << "\"objects\": " << options.objects << ", \"shapes\": " << options.shapes << ", \"triangles\": " << scene.triangles << ", \"textures\": " << options.textures;
+  } else {
+    stream << "\"files\": " << options.meshes.size();
+  }
+  stream << ", \"size\": ";
+  writeJsonString(stream, options.size);
+  stream << ", \"frames\": " << options.frames << ", \"runs\": " << options.runs << "},\n"
+         << "  \"paths\": {";
+  auto firstPath = true;
+  for (const auto& [path, metrics] : results) {
+    stream << (firstPath ? "\n" : ",\n") << "    ";
+    writeJsonString(stream, path);
+    stream << ": {";
+    auto firstMetric = true;
+    for (const auto& [name, value] : metrics) {
+      stream << (firstMetric ? "" : ", ");
+      writeJsonString(stream, name);
+      stream << ": ";
+      if (isMemoryMetric(name)) {
+        stream << uint64_t(value);
+      } else {
+        stream << std::fixed << std::setprecision(3) << value << std::defaultfloat;
+      }
+      firstMetric = false;
+    }
+    stream << "}";
+    firstPath = false;
+  }
+  stream << "\n  }\n}\n";
+}
+
+// Only increases count: a metric that got better never fails, and one missing
+// from either side is skipped.
+bool compareWithBaseline(const Options& options, const std::string& device, const Results& results) {
+  auto baseline = readJson(options.baseline);
+  if (baseline.strings["device"] != device) {
+    std::cerr << "Warning: the baseline was measured on " << baseline.strings["device"] << ", not " << device << std::endl;
+  }
+
+  auto passed = true;
+  for (const auto& [path, metrics] : results) {
+    for (const auto& [name, value] : metrics) {
+      auto entry = baseline.numbers.find("paths." + path + "." + name);
+      if (entry == baseline.numbers.end() || entry->second <= 0.0) {
+        continue;
+      }
+      auto change = (value - entry->second) / entry->second * 100.0;
+      auto threshold = isMemoryMetric(name) ? options.memoryThreshold : options.timeThreshold;
+      auto regressed = change > threshold;
+      passed = passed && !regressed;
+      std::cerr << (regressed ? "REGRESSED " : "ok        ") << std::left << std::setw(36) << path + "." + name << std::right
+                << std::fixed << std::setprecision(2) << std::setw(14) << entry->second << " -> " << std::setw(14) << value
+                << std::showpos << std::setw(9) << change << "%" << std::noshowpos << std::defaultfloat << std::endl;
+    }
+  }
+  return passed;
+}
+
+}
+
+int main(int argc, char** argv) {
+  try {
+    auto options = parseOptions(argc, argv);
+    auto workDirectory = std::filesystem::path{options.workDirectory};
+    std::filesystem::create_directories(workDirectory);
+
+    Scene scene;
+    std::vector<CameraPathScript> scripts{std::begin(CAMERA_PATHS), std::end(CAMERA_PATHS)};
+    if (options.meshes.empty()) {
+      std::cerr << "Generating " << options.objects << " objects (" << (options.shapes > 0 ? std::to_string(options.shapes) : "all") << " distinct), " << options.triangles << " triangles, " << options.textures << " textures" << std::endl;
+      scene = generateScene(options, workDirectory / "scene");
+    } else {
+      scene.files = options.meshes;
+      scripts = {{"parse", CAMERA_PATHS[0].keyframes, false}, {"cached", CAMERA_PATHS[0].keyframes, true}};
+      options.frames = 1;
+    }
+
+    auto run = [&](const std::string& name, const std::filesystem::path& cameraPath, uint32_t frames, bool meshCache) {
+      auto stats = workDirectory / (name + ".json");
+      std::vector<std::string> arguments{"--headless", "--frames", std::to_string(frames), "--size", options.size, "--image-format", "none",
+        "--no-hot-reload", "--cache-dir", (workDirectory / "cache").string(), "--camera-path", cameraPath.string(), "--stats-json", stats.string()};
+      if (!meshCache) {
+        arguments.push_back("--no-mesh-cache");
+      }
+      arguments.insert(arguments.end(), options.viewerArguments.begin(), options.viewerArguments.end());
+      arguments.insert(arguments.end(), scene.files.begin(), scene.files.end());
+      runViewer(options, arguments, workDirectory / (name + ".log"));
+      return readJson(stats.string());
+    };
+
+    // Fills the caches, so the measured runs neither compile shaders nor parse meshes.
+    std::filesystem::remove_all(workDirectory / "cache");
+    auto staticPath = workDirectory / "static.path";
+    writeCameraPath(staticPath, CAMERA_PATHS[0].keyframes, 1);
+    std::cerr << "Warming up the caches" << std::endl;
+    auto device = run("warmup", staticPath, 1, true).strings["device"];
+
+    Results results;
+    for (const auto& script : scripts) {
+      auto cameraPath = workDirectory / (std::string{script.name} + ".path");
+      writeCameraPath(cameraPath, script.keyframes, options.frames);
+
+      std::map<std::string, std::vector<double>> samples;
+      for (auto i = uint32_t{0}; i < options.runs; i++) {
+        std::cerr << "Rendering " << script.name << " (run " << i + 1 << " of " << options.runs << ")" << std::endl;
+        auto stats = run(std::string{script.name} + "_" + std::to_string(i), cameraPath, options.frames, script.meshCache);
+        for (const auto& [metric, key] : METRICS) {
+          auto value = stats.numbers.find(key);
+          if (value != stats.numbers.end()) {
+            samples[metric].push_back(value->second);
+          }
+        }
+      }
+      for (const auto& [metric, values] : samples) {
+        results[script.name][metric] = median(values);
+      }
+    }
+
+    if (options.output.empty()) {
+      writeResults(std::cout, options, scene, device, results);
+    } else {
+      std::ofstream file{options.output, std::ios::trunc};
+      if (!file.is_open()) {
+        throw std::runtime_error("Could not open " + options.output);
+      }
+      writeResults(file, options, scene, device, results);
+    }
+
+    if (!options.baseline.empty() && !compareWithBaseline(options, device, results)) {
+      std::cerr << "Performance regressed beyond the thresholds" << std::endl;
+      return EXIT_FAILURE;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}